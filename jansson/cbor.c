@@ -0,0 +1,900 @@
+/*
+ * Copyright (c) 2009-2016 Petri Lehtinen <petri@digip.org>
+ *
+ * Jansson is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+/* CBOR (RFC 8949) encoding and decoding, a binary form of the same
+   values for hops where neither end needs text. Numbers are copied as
+   they are: integers in the fewest bytes that hold them, reals always
+   as float64, so nothing is formatted or parsed and a round trip gives
+   back the exact bits. Strings are length prefixed, they are copied
+   with one memcpy, long ones are passed to the callback as they are and
+   decoded in place with JSON_INSITU. */
+
+#include "jansson_private.h"
+
+#include <math.h>
+#include <string.h>
+
+#include "jansson.h"
+#include "strbuffer.h"
+#include "utf.h"
+
+#define CBOR_UNSIGNED 0
+#define CBOR_NEGATIVE 1
+#define CBOR_BYTES    2
+#define CBOR_TEXT     3
+#define CBOR_ARRAY    4
+#define CBOR_MAP      5
+#define CBOR_TAG      6
+#define CBOR_SIMPLE   7
+
+#define CBOR_FALSE      0xf4
+#define CBOR_TRUE       0xf5
+#define CBOR_NULL       0xf6
+#define CBOR_UNDEFINED  0xf7
+#define CBOR_FLOAT64    0xfb
+#define CBOR_INDEFINITE 31
+
+/* output is collected in a buffer of this size, input read in pieces of it */
+#define CBOR_CHUNK 4096
+
+/* containers of a definite size don't reserve more than this up front
+   when reading from a callback, where the input size is unknown */
+#define CBOR_RESERVE_MAX 1024
+
+/*** encoder ***/
+
+typedef struct {
+    json_dump_callback_t dump;
+    void *data;
+    size_t used;
+    char buffer[CBOR_CHUNK];
+} cbor_out_t;
+
+static int out_flush(cbor_out_t *out) {
+    if (out->used && out->dump(out->buffer, out->used, out->data))
+        return -1;
+    out->used = 0;
+    return 0;
+}
+
+static int out_bytes(cbor_out_t *out, const void *bytes, size_t size) {
+    if (size > sizeof(out->buffer) - out->used) {
+        if (out_flush(out))
+            return -1;
+        /* too long to be worth copying, e.g. a long string */
+        if (size >= sizeof(out->buffer))
+            return out->dump(bytes, size, out->data);
+    }
+    memcpy(out->buffer + out->used, bytes, size);
+    out->used += size;
+    return 0;
+}
+
+/* The initial byte and the argument in big endian, as short as it fits */
+static int out_head(cbor_out_t *out, int major, uint64_t arg) {
+    unsigned char head[9];
+    size_t size, i;
+
+    if (arg < 24) {
+        head[0] = (unsigned char)(major << 5 | (int)arg);
+        size = 1;
+    } else {
+        int info = arg <= 0xff ? 24 : arg <= 0xffff ? 25 : arg <= 0xffffffff ? 26 : 27;
+        size = (size_t)1 << (info - 24);
+        head[0] = (unsigned char)(major << 5 | info);
+        for (i = size; i > 0; i--) {
+            head[i] = (unsigned char)arg;
+            arg >>= 8;
+        }
+        size++;
+    }
+    return out_bytes(out, head, size);
+}
+
+static int out_real(cbor_out_t *out, double value) {
+    unsigned char head[9];
+    uint64_t bits;
+    int i;
+
+    memcpy(&bits, &value, sizeof(bits));
+    head[0] = CBOR_FLOAT64;
+    for (i = 8; i > 0; i--) {
+        head[i] = (unsigned char)bits;
+        bits >>= 8;
+    }
+    return out_bytes(out, head, sizeof(head));
+}
+
+static int out_text(cbor_out_t *out, const char *value, size_t len) {
+    if (out_head(out, CBOR_TEXT, len))
+        return -1;
+    return out_bytes(out, value, len);
+}
+
+static int cbor_dump(const json_t *json, loop_set_t *parents, cbor_out_t *out) {
+    unsigned char simple;
+
+    if (!json)
+        return -1;
+
+    switch (json_typeof(json)) {
+        case JSON_NULL:
+            simple = CBOR_NULL;
+            return out_bytes(out, &simple, 1);
+
+        case JSON_TRUE:
+            simple = CBOR_TRUE;
+            return out_bytes(out, &simple, 1);
+
+        case JSON_FALSE:
+            simple = CBOR_FALSE;
+            return out_bytes(out, &simple, 1);
+
+        case JSON_INTEGER: {
+            json_int_t value = json_integer_value(json);
+
+            /* a negative n is written as -1 - n, which can't overflow */
+            if (value < 0)
+                return out_head(out, CBOR_NEGATIVE, (uint64_t)(-1 - value));
+            return out_head(out, CBOR_UNSIGNED, (uint64_t)value);
+        }
+
+        case JSON_REAL:
+            return out_real(out, json_real_value(json));
+
+        case JSON_STRING:
+            return out_text(out, json_string_value(json), json_string_length(json));
+
+        case JSON_ARRAY: {
+            size_t n = json_array_size(json);
+            size_t i;
+
+            /* detect circular references */
+            if (jsonp_loop_enter(parents, json))
+                return -1;
+
+            if (out_head(out, CBOR_ARRAY, n))
+                return -1;
+
+            for (i = 0; i < n; i++) {
+                /* packed elements are encoded without creating their nodes */
+                jsonp_shadow_t shadow;
+
+                if (cbor_dump(jsonp_array_peek(json, i, &shadow), parents, out))
+                    return -1;
+            }
+
+            jsonp_loop_leave(parents, json);
+            return 0;
+        }
+
+        case JSON_OBJECT: {
+            void *iter;
+
+            /* detect circular references */
+            if (jsonp_loop_enter(parents, json))
+                return -1;
+
+            if (out_head(out, CBOR_MAP, json_object_size(json)))
+                return -1;
+
+            for (iter = json_object_iter((json_t *)json); iter;
+                 iter = json_object_iter_next((json_t *)json, iter)) {
+                if (out_text(out, json_object_iter_key(iter), json_object_iter_key_len(iter)) ||
+                    cbor_dump(json_object_iter_value(iter), parents, out))
+                    return -1;
+            }
+
+            jsonp_loop_leave(parents, json);
+            return 0;
+        }
+
+        default:
+            /* not reached */
+            return -1;
+    }
+}
+
+int json_cbor_dump_callback(const json_t *json, json_dump_callback_t callback, void *data,
+                            size_t flags) {
+    cbor_out_t *out;
+    loop_set_t parents_set;
+    int res;
+
+    if (!callback)
+        return -1;
+
+    if (!(flags & JSON_ENCODE_ANY)) {
+        if (!json_is_array(json) && !json_is_object(json))
+            return -1;
+    }
+
+    out = jsonp_malloc(sizeof(cbor_out_t));
+    if (!out)
+        return -1;
+    out->dump = callback;
+    out->data = data;
+    out->used = 0;
+
+    jsonp_loop_init(&parents_set);
+    res = cbor_dump(json, (flags & JSON_ACYCLIC) ? NULL : &parents_set, out);
+    jsonp_loop_close(&parents_set);
+
+    if (!res)
+        res = out_flush(out);
+
+    jsonp_free(out);
+    return res;
+}
+
+struct cbor_buffer {
+    const size_t size;
+    size_t used;
+    char *data;
+};
+
+static int dump_to_buffer(const char *buffer, size_t size, void *data) {
+    struct cbor_buffer *buf = (struct cbor_buffer *)data;
+
+    if (buf->used + size <= buf->size)
+        memcpy(&buf->data[buf->used], buffer, size);
+
+    buf->used += size;
+    return 0;
+}
+
+size_t json_cbor_dumpb(const json_t *json, char *buffer, size_t size, size_t flags) {
+    struct cbor_buffer buf = {size, 0, buffer};
+
+    if (json_cbor_dump_callback(json, dump_to_buffer, (void *)&buf, flags))
+        return 0;
+
+    return buf.used;
+}
+
+/*** decoder ***/
+
+typedef struct {
+    const unsigned char *pos;   /* next byte to read */
+    const unsigned char *end;   /* end of what has been read */
+    const unsigned char *start; /* start of the window pos is in */
+    size_t offset;              /* input before start */
+    json_load_callback_t callback; /* NULL when decoding a buffer */
+    void *arg;
+    unsigned char *chunk;       /* room for the callback's output */
+    int insitu;                 /* JSON_INSITU: the buffer is writable */
+    size_t flags;
+    size_t depth;
+    unsigned int domain;        /* hash domain of the document */
+    json_arena_t *arena;
+    json_error_t *error;
+    strbuffer_t text;           /* strings split across reads, or in chunks */
+} cbor_in_t;
+
+static void cbor_error(cbor_in_t *in, enum json_error_code code, const char *msg) {
+    jsonp_error_set(in->error, -1, -1, in->offset + (size_t)(in->pos - in->start), code,
+                    "%s", msg);
+}
+
+static int cbor_premature(cbor_in_t *in) {
+    cbor_error(in, json_error_premature_end_of_input, "unexpected end of input");
+    return -1;
+}
+
+/* Only called once everything read is consumed */
+static int cbor_fill(cbor_in_t *in) {
+    size_t len;
+
+    if (!in->callback)
+        return -1;
+
+    in->offset += (size_t)(in->end - in->start);
+    in->start = in->pos = in->end = in->chunk;
+
+    len = in->callback(in->chunk, CBOR_CHUNK, in->arg);
+    if (len == 0 || len == (size_t)-1)
+        return -1;
+
+    in->end = in->chunk + len;
+    return 0;
+}
+
+static int cbor_read(cbor_in_t *in, void *buffer, size_t size) {
+    unsigned char *p = buffer;
+
+    while (size) {
+        size_t avail;
+
+        if (in->pos == in->end && cbor_fill(in))
+            return cbor_premature(in);
+
+        avail = (size_t)(in->end - in->pos);
+        if (avail > size)
+            avail = size;
+        memcpy(p, in->pos, avail);
+        in->pos += avail;
+        p += avail;
+        size -= avail;
+    }
+    return 0;
+}
+
+/* Appends size bytes of the input to in->text */
+static int cbor_append(cbor_in_t *in, uint64_t size) {
+    while (size) {
+        size_t avail;
+
+        if (in->pos == in->end && cbor_fill(in))
+            return cbor_premature(in);
+
+        avail = (size_t)(in->end - in->pos);
+        if (avail > size)
+            avail = (size_t)size;
+        if (strbuffer_append_bytes(&in->text, (const char *)in->pos, avail)) {
+            cbor_error(in, json_error_out_of_memory, "out of memory");
+            return -1;
+        }
+        in->pos += avail;
+        size -= avail;
+    }
+    return 0;
+}
+
+static uint64_t load_be(const unsigned char *p, size_t size) {
+    uint64_t value = 0;
+    size_t i;
+
+    for (i = 0; i < size; i++)
+        value = value << 8 | p[i];
+    return value;
+}
+
+/* Reads the initial byte of an item and its argument. CBOR_INDEFINITE
+   is left in *info, with *arg 0, for the caller to check. */
+static int cbor_head(cbor_in_t *in, int *major, int *info, uint64_t *arg) {
+    unsigned char head[9];
+    size_t size;
+
+    if (in->end - in->pos >= 9) {
+        /* enough input for any head, read it in place */
+        const unsigned char *p = in->pos;
+
+        *major = p[0] >> 5;
+        *info = p[0] & 0x1f;
+        if (*info < 24) {
+            *arg = (uint64_t)*info;
+            in->pos++;
+            return 0;
+        }
+        if (*info <= 27) {
+            size = (size_t)1 << (*info - 24);
+            *arg = load_be(p + 1, size);
+            in->pos += size + 1;
+            return 0;
+        }
+    } else {
+        if (cbor_read(in, head, 1))
+            return -1;
+
+        *major = head[0] >> 5;
+        *info = head[0] & 0x1f;
+        if (*info < 24) {
+            *arg = (uint64_t)*info;
+            return 0;
+        }
+        if (*info <= 27) {
+            size = (size_t)1 << (*info - 24);
+            if (cbor_read(in, head + 1, size))
+                return -1;
+            *arg = load_be(head + 1, size);
+            return 0;
+        }
+        in->pos--; /* not consumed, for the error position */
+    }
+
+    if (*info == CBOR_INDEFINITE && *major != CBOR_UNSIGNED && *major != CBOR_NEGATIVE &&
+        *major != CBOR_TAG) {
+        in->pos++;
+        *arg = 0;
+        return 0;
+    }
+
+    cbor_error(in, json_error_invalid_syntax, "invalid additional information");
+    return -1;
+}
+
+/* The value of a text string whose head has been read: *value points
+   into the input when the string is there in one piece, into in->text
+   otherwise. *stable is set if *value stays valid after reading more. */
+static int cbor_text(cbor_in_t *in, int info, uint64_t len, const char **value,
+                     size_t *out_len, int *stable) {
+    if (info != CBOR_INDEFINITE && len <= (uint64_t)(in->end - in->pos)) {
+        *value = (const char *)in->pos;
+        *out_len = (size_t)len;
+        *stable = !in->callback;
+        in->pos += len;
+    } else {
+        strbuffer_clear(&in->text);
+
+        if (info != CBOR_INDEFINITE) {
+            if (!in->callback)
+                return cbor_premature(in);
+            if (cbor_append(in, len))
+                return -1;
+        } else {
+            /* definite length chunks up to a break */
+            while (1) {
+                int major, chunk_info;
+                uint64_t chunk_len;
+
+                if (cbor_head(in, &major, &chunk_info, &chunk_len))
+                    return -1;
+                if (major == CBOR_SIMPLE && chunk_info == CBOR_INDEFINITE)
+                    break;
+                if (major != CBOR_TEXT || chunk_info == CBOR_INDEFINITE) {
+                    cbor_error(in, json_error_invalid_syntax, "invalid text string chunk");
+                    return -1;
+                }
+                if (cbor_append(in, chunk_len))
+                    return -1;
+            }
+        }
+
+        *value = in->text.value;
+        *out_len = in->text.length;
+        *stable = 0;
+    }
+
+    if (!utf8_check_string(*value, *out_len)) {
+        cbor_error(in, json_error_invalid_utf8, "invalid UTF-8 string");
+        return -1;
+    }
+    return 0;
+}
+
+static json_t *cbor_string(cbor_in_t *in, int info, uint64_t len) {
+    const char *value;
+    size_t length;
+    int stable;
+    json_t *json;
+
+    if (cbor_text(in, info, len, &value, &length, &stable))
+        return NULL;
+
+    if (!(in->flags & JSON_ALLOW_NUL) && memchr(value, '\0', length)) {
+        cbor_error(in, json_error_null_character,
+                   "NUL byte is not allowed without JSON_ALLOW_NUL");
+        return NULL;
+    }
+
+    json = (in->flags & JSON_DECODE_SHARED) ? jsonp_shared_string(value, length) : NULL;
+    if (json)
+        return json;
+
+    if (in->insitu && stable && length > JSON_STRING_INLINE) {
+        /* Move the string over its head, which is at least one byte long,
+           to make room for the terminating NUL */
+        size_t head = 1 + (info < 24 ? 0 : (size_t)1 << (info - 24));
+        char *target = (char *)value - head;
+
+        memmove(target, value, length);
+        target[length] = '\0';
+        return jsonp_stringn_nocheck_borrow_arena(in->arena, target, length);
+    }
+
+    return jsonp_stringn_nocheck_arena(in->arena, value, length);
+}
+
+/* Decodes the number a head starts, if it does: 1 with *type set to
+   JSON_INTEGER or JSON_REAL, 0 for anything else, -1 on error. */
+static int cbor_number(cbor_in_t *in, int major, int info, uint64_t arg, int *type,
+                       json_int_t *integer, double *real) {
+    if (major == CBOR_UNSIGNED || major == CBOR_NEGATIVE) {
+        if (arg > (uint64_t)INT64_MAX) {
+            cbor_error(in, json_error_numeric_overflow, "too big integer");
+            return -1;
+        }
+        *integer = major == CBOR_UNSIGNED ? (json_int_t)arg : -1 - (json_int_t)arg;
+        *type = JSON_INTEGER;
+
+        if (in->flags & JSON_DECODE_INT_AS_REAL) {
+            *real = (double)*integer;
+            *type = JSON_REAL;
+        }
+        return 1;
+    }
+
+    if (major != CBOR_SIMPLE || info < 25 || info > 27)
+        return 0;
+
+    if (info == 27) {
+        memcpy(real, &arg, sizeof(*real));
+    } else if (info == 26) {
+        uint32_t bits = (uint32_t)arg;
+        float value;
+
+        memcpy(&value, &bits, sizeof(value));
+        *real = value;
+    } else {
+        /* half precision */
+        int exponent = (int)(arg >> 10) & 0x1f;
+        int mantissa = (int)arg & 0x3ff;
+
+        if (exponent == 0)
+            *real = ldexp(mantissa, -24);
+        else if (exponent != 31)
+            *real = ldexp(mantissa + 1024, exponent - 25);
+        else
+            *real = mantissa ? NAN : INFINITY;
+        if (arg & 0x8000)
+            *real = -*real;
+    }
+
+    if (isnan(*real) || isinf(*real)) {
+        cbor_error(in, json_error_invalid_format, "NaN or infinite real not supported");
+        return -1;
+    }
+    *type = JSON_REAL;
+    return 1;
+}
+
+static void cbor_confine(cbor_in_t *in, json_t *json) {
+    /* immortal values are never counted */
+    if ((in->flags & JSON_DECODE_CONFINED) && json->refcount != (size_t)-1)
+        json->flags |= JSON_NODE_LOCAL;
+}
+
+static json_t *cbor_value(cbor_in_t *in, int major, int info, uint64_t arg);
+
+static json_t *cbor_next(cbor_in_t *in) {
+    int major, info;
+    uint64_t arg;
+
+    if (cbor_head(in, &major, &info, &arg))
+        return NULL;
+
+    if (major == CBOR_SIMPLE && info == CBOR_INDEFINITE) {
+        cbor_error(in, json_error_invalid_syntax, "unexpected break");
+        return NULL;
+    }
+    return cbor_value(in, major, info, arg);
+}
+
+static size_t cbor_reserve_size(const cbor_in_t *in, uint64_t count) {
+    /* every item takes at least a byte, so a buffer bounds the count */
+    uint64_t limit = in->callback ? CBOR_RESERVE_MAX : (uint64_t)(in->end - in->pos);
+    return (size_t)(count < limit ? count : limit);
+}
+
+static json_t *cbor_array(cbor_in_t *in, int info, uint64_t count) {
+    int indefinite = info == CBOR_INDEFINITE;
+    json_t *array = jsonp_array_arena(in->arena);
+    uint64_t i;
+
+    if (!array)
+        return NULL;
+    /* already now, so that unpacking confines the elements it creates */
+    cbor_confine(in, array);
+    jsonp_set_domain(array, in->domain);
+
+    if (!indefinite && count && json_array_reserve(array, cbor_reserve_size(in, count)))
+        goto error;
+
+    for (i = 0; indefinite || i < count; i++) {
+        json_array_t *packed = json_to_array(array);
+        int major, elem_info, type, number = 0;
+        uint64_t arg;
+        json_int_t integer;
+        double real;
+        json_t *elem;
+
+        if (cbor_head(in, &major, &elem_info, &arg))
+            goto error;
+
+        if (major == CBOR_SIMPLE && elem_info == CBOR_INDEFINITE) {
+            if (indefinite)
+                break;
+            cbor_error(in, json_error_invalid_syntax, "unexpected break");
+            goto error;
+        }
+
+        if ((in->flags & JSON_DECODE_PACKED) && in->depth < JSON_PARSER_MAX_DEPTH) {
+            number = cbor_number(in, major, elem_info, arg, &type, &integer, &real);
+            if (number < 0)
+                goto error;
+        }
+
+        /* stays packed while every element is a number of the same kind */
+        if (number && (packed->packed == type || (!packed->packed && !packed->entries))) {
+            if (type == JSON_REAL ? jsonp_array_pack_real(array, real)
+                                  : jsonp_array_pack_integer(array, integer))
+                goto error;
+            continue;
+        }
+
+        elem = cbor_value(in, major, elem_info, arg);
+        if (!elem || json_array_append_new(array, elem))
+            goto error;
+    }
+
+    return array;
+
+error:
+    json_decref(array);
+    return NULL;
+}
+
+static json_t *cbor_object(cbor_in_t *in, int info, uint64_t count) {
+    int indefinite = info == CBOR_INDEFINITE;
+    json_t *object = jsonp_object_arena(in->arena);
+    uint64_t i;
+
+    if (!object)
+        return NULL;
+
+    for (i = 0; indefinite || i < count; i++) {
+        int major, key_info, stable;
+        uint64_t len;
+        const char *key;
+        char *key_copy = NULL;
+        char small_key[64];
+        size_t key_len;
+        const json_key_t *interned = NULL;
+        json_t *value;
+
+        if (cbor_head(in, &major, &key_info, &len))
+            goto error;
+
+        if (indefinite && major == CBOR_SIMPLE && key_info == CBOR_INDEFINITE)
+            break;
+        if (major != CBOR_TEXT) {
+            cbor_error(in, json_error_invalid_syntax, "object key must be a text string");
+            goto error;
+        }
+        if (cbor_text(in, key_info, len, &key, &key_len, &stable))
+            goto error;
+
+        if (memchr(key, '\0', key_len)) {
+            cbor_error(in, json_error_null_byte_in_key,
+                       "NUL byte in object key not supported");
+            goto error;
+        }
+
+        if (in->flags & JSON_INTERN_KEYS) {
+            /* falls back to a copied key if it is too long or the table is full */
+            interned = hashtable_intern(key, key_len);
+        }
+
+        if (!interned && !stable) {
+            /* reading the value reuses the memory the key is in */
+            if (key_len < sizeof(small_key)) {
+                memcpy(small_key, key, key_len);
+                key = small_key;
+            } else {
+                key = key_copy = jsonp_strndup(key, key_len);
+                if (!key_copy) {
+                    cbor_error(in, json_error_out_of_memory, "out of memory");
+                    goto error;
+                }
+            }
+        }
+
+        if (in->flags & JSON_REJECT_DUPLICATES) {
+            if (interned ? json_object_get_key(object, interned)
+                         : json_object_getn(object, key, key_len)) {
+                jsonp_free(key_copy);
+                cbor_error(in, json_error_duplicate_key, "duplicate object key");
+                goto error;
+            }
+        }
+
+        value = cbor_next(in);
+        if (!value) {
+            jsonp_free(key_copy);
+            goto error;
+        }
+
+        if (interned ? json_object_set_key_new(object, interned, value)
+                     : json_object_setn_new_nocheck(object, key, key_len, value)) {
+            jsonp_free(key_copy);
+            goto error;
+        }
+        jsonp_free(key_copy);
+    }
+
+    return object;
+
+error:
+    json_decref(object);
+    return NULL;
+}
+
+static json_t *cbor_value(cbor_in_t *in, int major, int info, uint64_t arg) {
+    json_t *json = NULL;
+    json_int_t integer;
+    double real;
+    int type, number;
+
+    /* tags add nothing JSON can hold, the tagged item stands for itself */
+    while (major == CBOR_TAG) {
+        if (cbor_head(in, &major, &info, &arg))
+            return NULL;
+    }
+
+    in->depth++;
+    if (in->depth > JSON_PARSER_MAX_DEPTH) {
+        cbor_error(in, json_error_stack_overflow, "maximum parsing depth reached");
+        return NULL;
+    }
+
+    number = cbor_number(in, major, info, arg, &type, &integer, &real);
+    if (number < 0)
+        return NULL;
+
+    if (number && type == JSON_INTEGER) {
+        json = (in->flags & JSON_DECODE_SHARED) ? jsonp_shared_integer(integer) : NULL;
+        if (!json)
+            json = jsonp_integer_arena(in->arena, integer);
+    } else if (number) {
+        json = jsonp_real_arena(in->arena, real);
+    } else {
+        switch (major) {
+            case CBOR_TEXT:
+                json = cbor_string(in, info, arg);
+                break;
+
+            case CBOR_ARRAY:
+                json = cbor_array(in, info, arg);
+                break;
+
+            case CBOR_MAP:
+                json = cbor_object(in, info, arg);
+                break;
+
+            case CBOR_BYTES:
+                cbor_error(in, json_error_invalid_format, "byte strings not supported");
+                return NULL;
+
+            default: /* CBOR_SIMPLE */
+                if (info == (CBOR_TRUE & 0x1f))
+                    json = json_true();
+                else if (info == (CBOR_FALSE & 0x1f))
+                    json = json_false();
+                else if (info == (CBOR_NULL & 0x1f) || info == (CBOR_UNDEFINED & 0x1f))
+                    json = json_null();
+                else if (info == CBOR_INDEFINITE) {
+                    cbor_error(in, json_error_invalid_syntax, "unexpected break");
+                    return NULL;
+                } else {
+                    cbor_error(in, json_error_invalid_format, "unsupported simple value");
+                    return NULL;
+                }
+                break;
+        }
+    }
+
+    if (!json) {
+        cbor_error(in, json_error_out_of_memory, "out of memory");
+        return NULL;
+    }
+
+    cbor_confine(in, json);
+    jsonp_set_domain(json, in->domain);
+
+    in->depth--;
+    return json;
+}
+
+static json_t *cbor_load(cbor_in_t *in) {
+    json_t *result;
+    int major, info;
+    uint64_t arg;
+
+    in->depth = 0;
+    in->domain = jsonp_hash_domain();
+
+    if (cbor_head(in, &major, &info, &arg))
+        return NULL;
+    while (major == CBOR_TAG) {
+        if (cbor_head(in, &major, &info, &arg))
+            return NULL;
+    }
+
+    if (!(in->flags & JSON_DECODE_ANY)) {
+        if (major != CBOR_ARRAY && major != CBOR_MAP) {
+            cbor_error(in, json_error_invalid_syntax, "array or map expected");
+            return NULL;
+        }
+    }
+
+    result = cbor_value(in, major, info, arg);
+    if (!result)
+        return NULL;
+
+    if (!(in->flags & JSON_DISABLE_EOF_CHECK)) {
+        if (in->pos < in->end || !cbor_fill(in)) {
+            cbor_error(in, json_error_end_of_input_expected, "end of input expected");
+            json_decref(result);
+            return NULL;
+        }
+    }
+
+    if (in->error) {
+        /* Save the position even though there was no error */
+        in->error->position = (int)(in->offset + (size_t)(in->pos - in->start));
+    }
+
+    return result;
+}
+
+static int cbor_init(cbor_in_t *in, size_t flags, json_arena_t *arena,
+                     json_error_t *error) {
+    memset(in, 0, sizeof(*in));
+    in->flags = flags;
+    in->arena = arena;
+    in->error = error;
+    return strbuffer_init(&in->text);
+}
+
+json_t *json_cbor_loadb(const char *buffer, size_t buflen, size_t flags,
+                        json_error_t *error) {
+    return json_cbor_loadb_arena(buffer, buflen, flags, NULL, error);
+}
+
+json_t *json_cbor_loadb_arena(const char *buffer, size_t buflen, size_t flags,
+                              json_arena_t *arena, json_error_t *error) {
+    cbor_in_t in;
+    json_t *result;
+
+    jsonp_error_init(error, "<buffer>");
+
+    if (buffer == NULL) {
+        jsonp_error_set(error, -1, -1, 0, json_error_invalid_argument, "wrong arguments");
+        return NULL;
+    }
+
+    if (cbor_init(&in, flags, arena, error))
+        return NULL;
+    in.start = in.pos = (const unsigned char *)buffer;
+    in.end = in.pos + buflen;
+    in.insitu = (flags & JSON_INSITU) != 0;
+
+    result = cbor_load(&in);
+
+    strbuffer_close(&in.text);
+    return result;
+}
+
+json_t *json_cbor_load_callback(json_load_callback_t callback, void *data, size_t flags,
+                                json_error_t *error) {
+    cbor_in_t in;
+    json_t *result;
+
+    jsonp_error_init(error, "<callback>");
+
+    if (callback == NULL) {
+        jsonp_error_set(error, -1, -1, 0, json_error_invalid_argument, "wrong arguments");
+        return NULL;
+    }
+
+    if (cbor_init(&in, flags, NULL, error))
+        return NULL;
+    in.callback = callback;
+    in.arg = data;
+    in.chunk = jsonp_malloc(CBOR_CHUNK);
+    if (!in.chunk) {
+        strbuffer_close(&in.text);
+        return NULL;
+    }
+    in.start = in.pos = in.end = in.chunk;
+
+    result = cbor_load(&in);
+
+    jsonp_free(in.chunk);
+    strbuffer_close(&in.text);
+    return result;
+}
@@ -12,6 +12,8 @@
 #include "jansson_private.h"
 
 #include <assert.h>
+#include <errno.h>
+#include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -56,13 +58,53 @@ static int dump_to_file(const char *buffer, size_t size, void *data) {
     return 0;
 }
 
-static int dump_to_fd(const char *buffer, size_t size, void *data) {
+/* json_dumpfd() collects the output and writes it in large pieces,
+   rather than making a system call for every token */
+#define FD_BUFFER_SIZE 65536
+
+struct fd_buffer {
+    int fd;
+    size_t used;
+    char data[FD_BUFFER_SIZE];
+};
+
+static int write_fd(int fd, const char *buffer, size_t size) {
 #ifdef HAVE_UNISTD_H
-    int *dest = (int *)data;
-    if (write(*dest, buffer, size) == (ssize_t)size)
-        return 0;
+    while (size > 0) {
+        ssize_t written = write(fd, buffer, size);
+        if (written < 0 && errno == EINTR)
+            continue;
+        if (written <= 0)
+            return -1;
+        buffer += written;
+        size -= (size_t)written;
+    }
+    return 0;
+#else
+    (void)fd;
+    (void)buffer;
+    return size ? -1 : 0;
 #endif
-    return -1;
+}
+
+static int fd_buffer_flush(struct fd_buffer *buf) {
+    size_t used = buf->used;
+
+    buf->used = 0;
+    return write_fd(buf->fd, buf->data, used);
+}
+
+static int dump_to_fd(const char *buffer, size_t size, void *data) {
+    struct fd_buffer *buf = (struct fd_buffer *)data;
+
+    if (buf->used + size > FD_BUFFER_SIZE && fd_buffer_flush(buf))
+        return -1;
+    if (size >= FD_BUFFER_SIZE)
+        return write_fd(buf->fd, buffer, size);
+
+    memcpy(buf->data + buf->used, buffer, size);
+    buf->used += size;
+    return 0;
 }
 
 /* 32 spaces (the maximum indentation size) */
@@ -107,6 +149,11 @@ static int dump_string(const char *str, size_t len, json_dump_callback_t dump, v
         int length;
 
         while (end < lim) {
+            /* skip a run of bytes that need no escaping in bulk */
+            pos = end = pos + utf8_span_plain(pos, lim - pos, flags & JSON_ESCAPE_SLASH);
+            if (end == lim)
+                break;
+
             end = utf8_iterate(pos, lim - pos, &codepoint);
             if (!end)
                 return -1;
@@ -198,6 +245,7 @@ static int dump_string(const char *str, size_t len, json_dump_callback_t dump, v
 struct key_len {
     const char *key;
     int len;
+    const json_t *value;
 };
 
 static int compare_keys(const void *key1, const void *key2) {
@@ -212,15 +260,73 @@ static int compare_keys(const void *key1, const void *key2) {
     return k1->len - k2->len;
 }
 
-static int do_dump(const json_t *json, size_t flags, int depth, hashtable_t *parents,
-                   json_dump_callback_t dump, void *data) {
-    int embed = flags & JSON_EMBED;
+/* The size members of an object in the order of JSON_SORT_KEYS */
+static struct key_len *sort_keys(const json_t *json, size_t size) {
+    struct key_len *keys;
+    void *iter;
+    size_t i = 0;
 
-    flags &= ~JSON_EMBED;
+    keys = jsonp_malloc(size * sizeof(struct key_len));
+    if (!keys)
+        return NULL;
 
-    if (!json)
-        return -1;
+    for (iter = json_object_iter((json_t *)json); iter;
+         iter = json_object_iter_next((json_t *)json, iter)) {
+        keys[i].key = json_object_iter_key(iter);
+        keys[i].len = json_object_iter_key_len(iter);
+        keys[i].value = json_object_iter_value(iter);
+        i++;
+    }
+    assert(i == size);
 
+    qsort(keys, size, sizeof(struct key_len), compare_keys);
+    return keys;
+}
+
+/* A container being written by do_dump() */
+typedef struct {
+    const json_t *json;
+    void *iter;           /* next member of an object, unless keys is set */
+    struct key_len *keys; /* members of an object with JSON_SORT_KEYS */
+    size_t index;         /* children written so far */
+    size_t size;
+    int embed;
+} dump_frame_t;
+
+/* The open containers, in place of recursion. One stack serves all the
+   do_dump() calls of an encoding. */
+typedef struct {
+    dump_frame_t *frames;
+    size_t size;
+    dump_frame_t small[16];
+} dump_stack_t;
+
+static void dump_stack_init(dump_stack_t *stack) {
+    stack->frames = stack->small;
+    stack->size = sizeof(stack->small) / sizeof(stack->small[0]);
+}
+
+static void dump_stack_close(dump_stack_t *stack) {
+    if (stack->frames != stack->small)
+        jsonp_free(stack->frames);
+}
+
+static dump_frame_t *dump_push(dump_stack_t *stack, size_t top) {
+    if (top == stack->size) {
+        dump_frame_t *frames = jsonp_malloc(2 * stack->size * sizeof(dump_frame_t));
+
+        if (!frames)
+            return NULL;
+        memcpy(frames, stack->frames, top * sizeof(dump_frame_t));
+        dump_stack_close(stack);
+        stack->frames = frames;
+        stack->size *= 2;
+    }
+    return &stack->frames[top];
+}
+
+static int dump_scalar(const json_t *json, size_t flags, json_dump_callback_t dump,
+                       void *data) {
     switch (json_typeof(json)) {
         case JSON_NULL:
             return dump("null", 4, data);
@@ -235,10 +341,7 @@ static int do_dump(const json_t *json, size_t flags, int depth, hashtable_t *par
             char buffer[MAX_INTEGER_STR_LENGTH];
             int size;
 
-            size = snprintf(buffer, MAX_INTEGER_STR_LENGTH, "%" JSON_INTEGER_FORMAT,
-                            json_integer_value(json));
-            if (size < 0 || size >= MAX_INTEGER_STR_LENGTH)
-                return -1;
+            size = jsonp_itostr(buffer, json_integer_value(json));
 
             return dump(buffer, size, data);
         }
@@ -260,167 +363,224 @@ static int do_dump(const json_t *json, size_t flags, int depth, hashtable_t *par
             return dump_string(json_string_value(json), json_string_length(json), dump,
                                data, flags);
 
-        case JSON_ARRAY: {
-            size_t n;
-            size_t i;
-            /* Space for "0x", double the sizeof a pointer for the hex and a
-             * terminator. */
-            char key[2 + (sizeof(json) * 2) + 1];
-            size_t key_len;
+        default:
+            /* not reached */
+            return -1;
+    }
+}
 
-            /* detect circular references */
-            if (jsonp_loop_check(parents, json, key, sizeof(key), &key_len))
-                return -1;
+static int do_dump(const json_t *json, size_t flags, int depth, loop_set_t *parents,
+                   dump_stack_t *stack, json_dump_callback_t dump, void *data) {
+    int embed = flags & JSON_EMBED;
+    const char *separator = (flags & JSON_COMPACT) ? ":" : ": ";
+    int separator_length = (flags & JSON_COMPACT) ? 1 : 2;
+    jsonp_shadow_t shadow; /* a packed element, dumped right away */
+    size_t top = 0;        /* open containers */
+    int res = -1;
 
-            n = json_array_size(json);
+    flags &= ~JSON_EMBED;
 
-            if (!embed && dump("[", 1, data))
-                return -1;
-            if (n == 0) {
-                hashtable_del(parents, key, key_len);
-                return embed ? 0 : dump("]", 1, data);
-            }
-            if (dump_indent(flags, depth + 1, 0, dump, data))
-                return -1;
+    while (1) {
+        /* json is the next value, at depth + top */
+        if (!json)
+            goto out;
 
-            for (i = 0; i < n; ++i) {
-                if (do_dump(json_array_get(json, i), flags, depth + 1, parents, dump,
-                            data))
-                    return -1;
+        if (json_is_array(json) || json_is_object(json)) {
+            int is_array = json_is_array(json);
+            size_t size = is_array ? json_array_size(json) : json_object_size(json);
+            dump_frame_t *frame;
 
-                if (i < n - 1) {
-                    if (dump(",", 1, data) ||
-                        dump_indent(flags, depth + 1, 1, dump, data))
-                        return -1;
-                } else {
-                    if (dump_indent(flags, depth, 0, dump, data))
-                        return -1;
+            /* detect circular references */
+            if (jsonp_loop_enter(parents, json))
+                goto out;
+
+            if (!embed && dump(is_array ? "[" : "{", 1, data))
+                goto out;
+            if (size == 0) {
+                jsonp_loop_leave(parents, json);
+                if (!embed && dump(is_array ? "]" : "}", 1, data))
+                    goto out;
+            } else {
+                if (dump_indent(flags, depth + (int)top + 1, 0, dump, data))
+                    goto out;
+
+                frame = dump_push(stack, top);
+                if (!frame)
+                    goto out;
+                frame->json = json;
+                frame->iter = NULL;
+                frame->keys = NULL;
+                frame->index = 0;
+                frame->size = size;
+                frame->embed = embed;
+                top++;
+
+                if (!is_array && (flags & JSON_SORT_KEYS)) {
+                    frame->keys = sort_keys(json, size);
+                    if (!frame->keys)
+                        goto out;
+                } else if (!is_array) {
+                    frame->iter = json_object_iter((json_t *)json);
                 }
             }
-
-            hashtable_del(parents, key, key_len);
-            return embed ? 0 : dump("]", 1, data);
+        } else if (dump_scalar(json, flags, dump, data)) {
+            goto out;
         }
+        embed = 0;
+
+        /* the next child to write, closing the containers that are done */
+        json = NULL;
+        while (top > 0) {
+            dump_frame_t *frame = &stack->frames[top - 1];
+            int child_depth = depth + (int)top;
+
+            if (frame->index < frame->size) {
+                if (frame->index > 0 &&
+                    (dump(",", 1, data) || dump_indent(flags, child_depth, 1, dump, data)))
+                    goto out;
+
+                if (json_is_array(frame->json)) {
+                    /* packed elements are dumped without creating their nodes */
+                    json = jsonp_array_peek(frame->json, frame->index, &shadow);
+                } else {
+                    const char *key;
+                    size_t key_len;
 
-        case JSON_OBJECT: {
-            void *iter;
-            const char *separator;
-            int separator_length;
-            char loop_key[LOOP_KEY_LEN];
-            size_t loop_key_len;
+                    if (frame->keys) {
+                        key = frame->keys[frame->index].key;
+                        key_len = frame->keys[frame->index].len;
+                        json = frame->keys[frame->index].value;
+                    } else {
+                        key = json_object_iter_key(frame->iter);
+                        key_len = json_object_iter_key_len(frame->iter);
+                        json = json_object_iter_value(frame->iter);
+                        frame->iter = json_object_iter_next((json_t *)frame->json, frame->iter);
+                    }
 
-            if (flags & JSON_COMPACT) {
-                separator = ":";
-                separator_length = 1;
-            } else {
-                separator = ": ";
-                separator_length = 2;
+                    if (dump_string(key, key_len, dump, data, flags) ||
+                        dump(separator, separator_length, data))
+                        goto out;
+                }
+                frame->index++;
+                break;
             }
 
-            /* detect circular references */
-            if (jsonp_loop_check(parents, json, loop_key, sizeof(loop_key),
-                                 &loop_key_len))
-                return -1;
-
-            iter = json_object_iter((json_t *)json);
-
-            if (!embed && dump("{", 1, data))
-                return -1;
-            if (!iter) {
-                hashtable_del(parents, loop_key, loop_key_len);
-                return embed ? 0 : dump("}", 1, data);
-            }
-            if (dump_indent(flags, depth + 1, 0, dump, data))
-                return -1;
+            if (dump_indent(flags, child_depth - 1, 0, dump, data))
+                goto out;
+            jsonp_loop_leave(parents, frame->json);
+            jsonp_free(frame->keys);
+            frame->keys = NULL;
+            top--;
+            if (!frame->embed && dump(json_is_array(frame->json) ? "]" : "}", 1, data))
+                goto out;
+        }
 
-            if (flags & JSON_SORT_KEYS) {
-                struct key_len *keys;
-                size_t size, i;
+        if (!json) {
+            res = 0;
+            goto out;
+        }
+    }
 
-                size = json_object_size(json);
-                keys = jsonp_malloc(size * sizeof(struct key_len));
-                if (!keys)
-                    return -1;
+out:
+    while (top > 0)
+        jsonp_free(stack->frames[--top].keys);
+    return res;
+}
 
-                i = 0;
-                while (iter) {
-                    struct key_len *keylen = &keys[i];
+/* One child of a top-level container, with the separator that comes
+   before it. Children are at depth 1, their container at depth 0. */
+static int dump_range_child(const json_t *json, const char *key, size_t key_len,
+                            size_t index, size_t flags, loop_set_t *parents,
+                            dump_stack_t *stack, json_dump_callback_t dump, void *data) {
+    if (index > 0) {
+        if (dump(",", 1, data) || dump_indent(flags, 1, 1, dump, data))
+            return -1;
+    }
 
-                    keylen->key = json_object_iter_key(iter);
-                    keylen->len = json_object_iter_key_len(iter);
+    if (key) {
+        int compact = flags & JSON_COMPACT;
 
-                    iter = json_object_iter_next((json_t *)json, iter);
-                    i++;
-                }
-                assert(i == size);
+        if (dump_string(key, key_len, dump, data, flags) ||
+            dump(compact ? ":" : ": ", compact ? 1 : 2, data))
+            return -1;
+    }
 
-                qsort(keys, size, sizeof(struct key_len), compare_keys);
+    return do_dump(json, flags, 1, parents, stack, dump, data);
+}
 
-                for (i = 0; i < size; i++) {
-                    const struct key_len *key;
-                    json_t *value;
+static int dump_range(const json_t *json, size_t index, size_t count, size_t flags,
+                      loop_set_t *parents, dump_stack_t *stack, json_dump_callback_t dump,
+                      void *data) {
+    int embed = flags & JSON_EMBED;
+    int is_object = json_is_object(json);
+    size_t size, end, i;
+    void *iter = NULL;
 
-                    key = &keys[i];
-                    value = json_object_getn(json, key->key, key->len);
-                    assert(value);
+    flags &= ~JSON_EMBED;
 
-                    dump_string(key->key, key->len, dump, data, flags);
-                    if (dump(separator, separator_length, data) ||
-                        do_dump(value, flags, depth + 1, parents, dump, data)) {
-                        jsonp_free(keys);
-                        return -1;
-                    }
+    size = is_object ? json_object_size(json) : json_array_size(json);
+    if (index > size || count > size - index)
+        return -1;
+    end = index + count;
 
-                    if (i < size - 1) {
-                        if (dump(",", 1, data) ||
-                            dump_indent(flags, depth + 1, 1, dump, data)) {
-                            jsonp_free(keys);
-                            return -1;
-                        }
-                    } else {
-                        if (dump_indent(flags, depth, 0, dump, data)) {
-                            jsonp_free(keys);
-                            return -1;
-                        }
-                    }
-                }
+    if (index == 0) {
+        if (!embed && dump(is_object ? "{" : "[", 1, data))
+            return -1;
+        if (size > 0 && dump_indent(flags, 1, 0, dump, data))
+            return -1;
+    }
 
-                jsonp_free(keys);
-            } else {
-                /* Don't sort keys */
-
-                while (iter) {
-                    void *next = json_object_iter_next((json_t *)json, iter);
-                    const char *key = json_object_iter_key(iter);
-                    const size_t key_len = json_object_iter_key_len(iter);
-
-                    dump_string(key, key_len, dump, data, flags);
-                    if (dump(separator, separator_length, data) ||
-                        do_dump(json_object_iter_value(iter), flags, depth + 1, parents,
-                                dump, data))
-                        return -1;
-
-                    if (next) {
-                        if (dump(",", 1, data) ||
-                            dump_indent(flags, depth + 1, 1, dump, data))
-                            return -1;
-                    } else {
-                        if (dump_indent(flags, depth, 0, dump, data))
-                            return -1;
-                    }
+    if (is_object && count > 0)
+        iter = hashtable_iter_nth(&json_to_object(json)->hashtable, index);
 
-                    iter = next;
-                }
-            }
+    for (i = index; i < end; i++) {
+        jsonp_shadow_t shadow;
 
-            hashtable_del(parents, loop_key, loop_key_len);
-            return embed ? 0 : dump("}", 1, data);
+        if (is_object) {
+            if (dump_range_child(json_object_iter_value(iter), json_object_iter_key(iter),
+                                 json_object_iter_key_len(iter), i, flags, parents, stack,
+                                 dump, data))
+                return -1;
+            iter = json_object_iter_next((json_t *)json, iter);
+        } else if (dump_range_child(jsonp_array_peek(json, i, &shadow), NULL, 0, i, flags,
+                                    parents, stack, dump, data)) {
+            return -1;
         }
+    }
 
-        default:
-            /* not reached */
+    if (end == size) {
+        if (size > 0 && dump_indent(flags, 0, 0, dump, data))
+            return -1;
+        if (!embed && dump(is_object ? "}" : "]", 1, data))
             return -1;
     }
+    return 0;
+}
+
+int json_dump_range(const json_t *json, size_t index, size_t count,
+                    json_dump_callback_t callback, void *data, size_t flags) {
+    int res;
+    loop_set_t parents_set;
+    loop_set_t *parents = (flags & JSON_ACYCLIC) ? NULL : &parents_set;
+    dump_stack_t stack;
+
+    if (!json_is_array(json) && !json_is_object(json))
+        return -1;
+    if (json_is_object(json) && (flags & JSON_SORT_KEYS))
+        return -1;
+
+    jsonp_loop_init(&parents_set);
+    dump_stack_init(&stack);
+
+    /* the container is a parent of every child, as in do_dump() */
+    if (jsonp_loop_enter(parents, json))
+        res = -1;
+    else
+        res = dump_range(json, index, count, flags, parents, &stack, callback, data);
+
+    dump_stack_close(&stack);
+    jsonp_loop_close(&parents_set);
+    return res;
 }
 
 char *json_dumps(const json_t *json, size_t flags) {
@@ -430,11 +590,13 @@ char *json_dumps(const json_t *json, size_t flags) {
     if (strbuffer_init(&strbuff))
         return NULL;
 
-    if (json_dump_callback(json, dump_to_strbuffer, (void *)&strbuff, flags))
-        result = NULL;
-    else
-        result = jsonp_strdup(strbuffer_value(&strbuff));
+    if (json_dump_callback(json, dump_to_strbuffer, (void *)&strbuff, flags)) {
+        strbuffer_close(&strbuff);
+        return NULL;
+    }
 
+    /* hand out the buffer itself rather than a copy of it */
+    result = strbuffer_steal_value(&strbuff);
     strbuffer_close(&strbuff);
     return result;
 }
@@ -453,7 +615,23 @@ int json_dumpf(const json_t *json, FILE *output, size_t flags) {
 }
 
 int json_dumpfd(const json_t *json, int output, size_t flags) {
-    return json_dump_callback(json, dump_to_fd, (void *)&output, flags);
+    struct fd_buffer *buf;
+    int res;
+
+    buf = jsonp_malloc(sizeof(struct fd_buffer));
+    if (!buf)
+        return -1;
+    buf->fd = output;
+    buf->used = 0;
+
+    /* what was encoded before an error is still written, as it was
+       without the buffer */
+    res = json_dump_callback(json, dump_to_fd, (void *)buf, flags);
+    if (fd_buffer_flush(buf))
+        res = -1;
+
+    jsonp_free(buf);
+    return res;
 }
 
 int json_dump_file(const json_t *json, const char *path, size_t flags) {
@@ -474,17 +652,50 @@ int json_dump_file(const json_t *json, const char *path, size_t flags) {
 int json_dump_callback(const json_t *json, json_dump_callback_t callback, void *data,
                        size_t flags) {
     int res;
-    hashtable_t parents_set;
+    loop_set_t parents_set;
+    dump_stack_t stack;
 
     if (!(flags & JSON_ENCODE_ANY)) {
         if (!json_is_array(json) && !json_is_object(json))
             return -1;
     }
 
-    if (hashtable_init(&parents_set))
-        return -1;
-    res = do_dump(json, flags, 0, &parents_set, callback, data);
-    hashtable_close(&parents_set);
+    jsonp_loop_init(&parents_set);
+    dump_stack_init(&stack);
+    res = do_dump(json, flags, 0, (flags & JSON_ACYCLIC) ? NULL : &parents_set, &stack,
+                  callback, data);
+    dump_stack_close(&stack);
+    jsonp_loop_close(&parents_set);
 
     return res;
 }
+
+/* Scalars encoded on their own, for writing JSON without building it */
+
+int json_dump_string(const char *value, size_t len, json_dump_callback_t callback,
+                     void *data, size_t flags) {
+    if (!value || !callback)
+        return -1;
+    return dump_string(value, len, callback, data, flags);
+}
+
+int json_dump_integer(json_int_t value, json_dump_callback_t callback, void *data) {
+    char buffer[MAX_INTEGER_STR_LENGTH];
+
+    if (!callback)
+        return -1;
+    return callback(buffer, jsonp_itostr(buffer, value), data);
+}
+
+int json_dump_real(double value, json_dump_callback_t callback, void *data, size_t flags) {
+    char buffer[MAX_REAL_STR_LENGTH];
+    int size;
+
+    if (!callback || isnan(value) || isinf(value))
+        return -1;
+
+    size = jsonp_dtostr(buffer, MAX_REAL_STR_LENGTH, value, FLAGS_TO_PRECISION(flags));
+    if (size < 0)
+        return -1;
+    return callback(buffer, size, data);
+}
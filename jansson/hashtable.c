@@ -16,6 +16,10 @@
 #include <stdint.h>
 #endif
 
+#ifdef HAVE_SCHED_H
+#include <sched.h>
+#endif
+
 #include "hashtable.h"
 #include "jansson_private.h" /* for container_of() */
 #include <jansson_config.h>  /* for JSON_INLINE */
@@ -24,178 +28,184 @@
 #define INITIAL_HASHTABLE_ORDER 3
 #endif
 
-typedef struct hashtable_list list_t;
 typedef struct hashtable_pair pair_t;
-typedef struct hashtable_bucket bucket_t;
+typedef struct hashtable_entry entry_t;
 
 extern volatile uint32_t hashtable_seed;
 
 /* Implementation of the hash function */
 #include "lookup3.h"
 
-#define list_to_pair(list_)         container_of(list_, pair_t, list)
-#define ordered_list_to_pair(list_) container_of(list_, pair_t, ordered_list)
-#define hash_str(key, len)          ((size_t)hashlittle((key), len, hashtable_seed))
+#define hash_str(key, len) ((size_t)hashlittle((key), len, hashtable_seed))
 
-static JSON_INLINE void list_init(list_t *list) {
-    list->next = list;
-    list->prev = list;
-}
+/* Tables with up to this many entries have no index and are searched
+   linearly, comparing a cheap tag of the key first instead of hashing
+   it. This is the common case for JSON objects. */
+#define SMALL_CAPACITY hashsize(INITIAL_HASHTABLE_ORDER)
 
-static JSON_INLINE void list_insert(list_t *list, list_t *node) {
-    node->next = list;
-    node->prev = list->prev;
-    list->prev->next = node;
-    list->prev = node;
+static JSON_INLINE size_t small_tag(const char *key, size_t key_len) {
+    if (key_len == 0)
+        return 0;
+    return key_len ^ ((size_t)(unsigned char)key[0] << 8) ^
+           ((size_t)(unsigned char)key[key_len - 1] << 16);
 }
 
-static JSON_INLINE void list_remove(list_t *list) {
-    list->prev->next = list->next;
-    list->next->prev = list->prev;
+/* the tag or hash of key entries of this table have */
+static JSON_INLINE size_t key_hash(const hashtable_t *hashtable, const char *key,
+                                   size_t key_len, const json_key_t *interned) {
+    if (!hashtable->index)
+        return small_tag(key, key_len);
+    return interned ? interned->hash : hash_str(key, key_len);
 }
 
-static JSON_INLINE int bucket_is_empty(hashtable_t *hashtable, bucket_t *bucket) {
-    return bucket->first == &hashtable->list && bucket->first == bucket->last;
-}
+static JSON_INLINE int entry_matches(const entry_t *entry, const char *key,
+                                     size_t key_len, size_t hash,
+                                     const json_key_t *interned) {
+    const pair_t *pair = entry->pair;
 
-static void insert_to_bucket(hashtable_t *hashtable, bucket_t *bucket, list_t *list) {
-    if (bucket_is_empty(hashtable, bucket)) {
-        list_insert(&hashtable->list, list);
-        bucket->first = bucket->last = list;
-    } else {
-        list_insert(bucket->first, list);
-        bucket->first = list;
-    }
+    if (!pair)
+        return 0;
+    if (interned && pair->interned == interned)
+        return 1;
+    return entry->hash == hash && pair->key_len == key_len &&
+           memcmp(pair->key, key, key_len) == 0;
 }
 
-static pair_t *hashtable_find_pair(hashtable_t *hashtable, bucket_t *bucket,
-                                   const char *key, size_t key_len, size_t hash) {
-    list_t *list;
-    pair_t *pair;
-
-    if (bucket_is_empty(hashtable, bucket))
-        return NULL;
-
-    list = bucket->first;
-    while (1) {
-        pair = list_to_pair(list);
-        if (pair->hash == hash && pair->key_len == key_len &&
-            memcmp(pair->key, key, key_len) == 0)
-            return pair;
+static entry_t *hashtable_find_entry(hashtable_t *hashtable, const char *key,
+                                     size_t key_len, size_t hash,
+                                     const json_key_t *interned) {
+    entry_t *entry;
 
-        if (list == bucket->last)
-            break;
+    if (!hashtable->index) {
+        entry_t *end = hashtable->entries + hashtable->used;
 
-        list = list->next;
+        for (entry = hashtable->entries; entry < end; entry++) {
+            if (entry_matches(entry, key, key_len, hash, interned))
+                return entry;
+        }
+    } else {
+        size_t mask = hashmask(hashtable->order);
+        size_t slot = hash & mask;
+        uint32_t number;
+
+        /* linear probing; holes keep their slot so probing goes on past
+           them until the index is rebuilt */
+        while ((number = hashtable->index[slot]) != 0) {
+            entry = &hashtable->entries[number - 1];
+            if (entry_matches(entry, key, key_len, hash, interned))
+                return entry;
+            slot = (slot + 1) & mask;
+        }
     }
 
     return NULL;
 }
 
-/* returns 0 on success, -1 if key was not found */
-static int hashtable_do_del(hashtable_t *hashtable, const char *key, size_t key_len,
-                            size_t hash) {
-    pair_t *pair;
-    bucket_t *bucket;
-    size_t index;
-
-    index = hash & hashmask(hashtable->order);
-    bucket = &hashtable->buckets[index];
-
-    pair = hashtable_find_pair(hashtable, bucket, key, key_len, hash);
-    if (!pair)
-        return -1;
-
-    if (&pair->list == bucket->first && &pair->list == bucket->last)
-        bucket->first = bucket->last = &hashtable->list;
-
-    else if (&pair->list == bucket->first)
-        bucket->first = pair->list.next;
-
-    else if (&pair->list == bucket->last)
-        bucket->last = pair->list.prev;
-
-    list_remove(&pair->list);
-    list_remove(&pair->ordered_list);
-    json_decref(pair->value);
-
-    jsonp_free(pair);
-    hashtable->size--;
-
-    return 0;
-}
-
-static void hashtable_do_clear(hashtable_t *hashtable) {
-    list_t *list, *next;
-    pair_t *pair;
+static void index_insert(hashtable_t *hashtable, size_t hash, size_t i) {
+    size_t mask = hashmask(hashtable->order);
+    size_t slot = hash & mask;
 
-    for (list = hashtable->list.next; list != &hashtable->list; list = next) {
-        next = list->next;
-        pair = list_to_pair(list);
-        json_decref(pair->value);
-        jsonp_free(pair);
-    }
+    while (hashtable->index[slot])
+        slot = (slot + 1) & mask;
+    hashtable->index[slot] = (uint32_t)(i + 1);
 }
 
+/* Make room for one more entry: drop the holes if they make up half
+   of the entries, otherwise double the capacity. The entries and the
+   index share one allocation. The pairs themselves don't move. */
 static int hashtable_do_rehash(hashtable_t *hashtable) {
-    list_t *list, *next;
-    pair_t *pair;
-    size_t i, index, new_size, new_order;
-    struct hashtable_bucket *new_buckets;
+    size_t i, used = 0, capacity, order = 0, block_size;
+    entry_t *entries;
+    char *block;
+
+    if (hashtable->capacity && hashtable->size <= hashtable->capacity / 2)
+        capacity = hashtable->capacity;
+    else if (hashtable->capacity)
+        capacity = hashtable->capacity * 2;
+    else
+        capacity = SMALL_CAPACITY;
+
+    /* entry numbers have to fit the index */
+    if (capacity >= UINT32_MAX)
+        return -1;
 
-    new_order = hashtable->order + 1;
-    new_size = hashsize(new_order);
+    block_size = capacity * sizeof(entry_t);
+    if (capacity > SMALL_CAPACITY) {
+        /* twice as many slots as entries keeps probe sequences short */
+        while (hashsize(order) < 2 * capacity)
+            order++;
+        block_size += hashsize(order) * sizeof(uint32_t);
+    }
 
-    new_buckets = jsonp_malloc(new_size * sizeof(bucket_t));
-    if (!new_buckets)
+    block = jsonp_arena_malloc(hashtable->arena, block_size);
+    if (!block)
         return -1;
 
-    jsonp_free(hashtable->buckets);
-    hashtable->buckets = new_buckets;
-    hashtable->order = new_order;
-
-    for (i = 0; i < hashsize(hashtable->order); i++) {
-        hashtable->buckets[i].first = hashtable->buckets[i].last = &hashtable->list;
+    entries = (entry_t *)block;
+    for (i = 0; i < hashtable->used; i++) {
+        pair_t *pair = hashtable->entries[i].pair;
+        if (!pair)
+            continue;
+
+        entries[used].pair = pair;
+        entries[used].hash = hashtable->entries[i].hash;
+        if (order && !hashtable->index) {
+            /* leaving the small mode, replace the tags by hashes */
+            entries[used].hash = pair->interned ? pair->interned->hash
+                                                : hash_str(pair->key, pair->key_len);
+        }
+        pair->index = used++;
     }
 
-    list = hashtable->list.next;
-    list_init(&hashtable->list);
-
-    for (; list != &hashtable->list; list = next) {
-        next = list->next;
-        pair = list_to_pair(list);
-        index = pair->hash % new_size;
-        insert_to_bucket(hashtable, &hashtable->buckets[index], &pair->list);
+    jsonp_arena_free(hashtable->arena, hashtable->entries);
+    hashtable->entries = entries;
+    hashtable->capacity = capacity;
+    hashtable->used = used;
+
+    if (order) {
+        hashtable->index = (uint32_t *)(entries + capacity);
+        hashtable->order = order;
+        memset(hashtable->index, 0, hashsize(order) * sizeof(uint32_t));
+        for (i = 0; i < used; i++)
+            index_insert(hashtable, entries[i].hash, i);
     }
 
     return 0;
 }
 
-int hashtable_init(hashtable_t *hashtable) {
+static void hashtable_do_clear(hashtable_t *hashtable) {
     size_t i;
 
-    hashtable->size = 0;
-    hashtable->order = INITIAL_HASHTABLE_ORDER;
-    hashtable->buckets = jsonp_malloc(hashsize(hashtable->order) * sizeof(bucket_t));
-    if (!hashtable->buckets)
-        return -1;
-
-    list_init(&hashtable->list);
-    list_init(&hashtable->ordered_list);
-
-    for (i = 0; i < hashsize(hashtable->order); i++) {
-        hashtable->buckets[i].first = hashtable->buckets[i].last = &hashtable->list;
+    for (i = 0; i < hashtable->used; i++) {
+        pair_t *pair = hashtable->entries[i].pair;
+        if (pair) {
+            json_decref(pair->value);
+            jsonp_arena_free(hashtable->arena, pair);
+        }
     }
+}
+
+int hashtable_init(hashtable_t *hashtable) { return hashtable_init_arena(hashtable, NULL); }
 
+int hashtable_init_arena(hashtable_t *hashtable, json_arena_t *arena) {
+    /* nothing is allocated until the first key is added */
+    hashtable->size = 0;
+    hashtable->used = 0;
+    hashtable->capacity = 0;
+    hashtable->entries = NULL;
+    hashtable->index = NULL;
+    hashtable->order = 0;
+    hashtable->arena = arena;
     return 0;
 }
 
 void hashtable_close(hashtable_t *hashtable) {
     hashtable_do_clear(hashtable);
-    jsonp_free(hashtable->buckets);
+    jsonp_arena_free(hashtable->arena, hashtable->entries);
 }
 
-static pair_t *init_pair(json_t *value, const char *key, size_t key_len, size_t hash) {
+static pair_t *init_pair(hashtable_t *hashtable, json_t *value, const char *key,
+                         size_t key_len, const json_key_t *interned) {
     pair_t *pair;
 
     /* offsetof(...) returns the size of pair_t without the last,
@@ -207,134 +217,366 @@ static pair_t *init_pair(json_t *value, const char *key, size_t key_len, size_t
         return NULL;
     }
 
-    pair = jsonp_malloc(offsetof(pair_t, key) + key_len + 1);
+    pair = jsonp_arena_malloc(hashtable->arena, offsetof(pair_t, key) + key_len + 1);
 
     if (!pair)
         return NULL;
 
-    pair->hash = hash;
     memcpy(pair->key, key, key_len);
     pair->key[key_len] = '\0';
     pair->key_len = key_len;
+    pair->interned = interned;
     pair->value = value;
 
-    list_init(&pair->list);
-    list_init(&pair->ordered_list);
-
     return pair;
 }
 
-int hashtable_set(hashtable_t *hashtable, const char *key, size_t key_len,
-                  json_t *value) {
+/* known is hashtable_hash() of key if the caller has it, or NULL */
+static int hashtable_do_set(hashtable_t *hashtable, const char *key, size_t key_len,
+                            const json_key_t *interned, const size_t *known,
+                            json_t *value) {
     pair_t *pair;
-    bucket_t *bucket;
-    size_t hash, index;
+    entry_t *entry;
+    size_t hash = (known && hashtable->index) ? *known
+                                              : key_hash(hashtable, key, key_len, interned);
+
+    entry = hashtable_find_entry(hashtable, key, key_len, hash, interned);
+    if (entry) {
+        json_decref(entry->pair->value);
+        entry->pair->value = value;
+        return 0;
+    }
 
-    /* rehash if the load ratio exceeds 1 */
-    if (hashtable->size >= hashsize(hashtable->order))
+    if (hashtable->used == hashtable->capacity) {
         if (hashtable_do_rehash(hashtable))
             return -1;
+        hash = (known && hashtable->index) ? *known
+                                           : key_hash(hashtable, key, key_len, interned);
+    }
 
-    hash = hash_str(key, key_len);
-    index = hash & hashmask(hashtable->order);
-    bucket = &hashtable->buckets[index];
-    pair = hashtable_find_pair(hashtable, bucket, key, key_len, hash);
+    pair = init_pair(hashtable, value, key, key_len, interned);
+    if (!pair)
+        return -1;
 
-    if (pair) {
-        json_decref(pair->value);
-        pair->value = value;
-    } else {
-        pair = init_pair(value, key, key_len, hash);
+    pair->index = hashtable->used;
+    entry = &hashtable->entries[hashtable->used++];
+    entry->hash = hash;
+    entry->pair = pair;
+    if (hashtable->index)
+        index_insert(hashtable, hash, pair->index);
 
-        if (!pair)
-            return -1;
+    hashtable->size++;
+    return 0;
+}
+
+int hashtable_set(hashtable_t *hashtable, const char *key, size_t key_len,
+                  json_t *value) {
+    return hashtable_do_set(hashtable, key, key_len, NULL, NULL, value);
+}
 
-        insert_to_bucket(hashtable, bucket, &pair->list);
-        list_insert(&hashtable->ordered_list, &pair->ordered_list);
+int hashtable_set_key(hashtable_t *hashtable, const json_key_t *key, json_t *value) {
+    return hashtable_do_set(hashtable, key->key, key->key_len, key, NULL, value);
+}
 
-        hashtable->size++;
-    }
-    return 0;
+int hashtable_set_hashed(hashtable_t *hashtable, const char *key, size_t key_len,
+                         size_t hash, json_t *value) {
+    return hashtable_do_set(hashtable, key, key_len, NULL, &hash, value);
 }
 
 void *hashtable_get(hashtable_t *hashtable, const char *key, size_t key_len) {
-    pair_t *pair;
-    size_t hash;
-    bucket_t *bucket;
+    entry_t *entry = hashtable_find_entry(hashtable, key, key_len,
+                                          key_hash(hashtable, key, key_len, NULL), NULL);
+    if (!entry)
+        return NULL;
 
-    hash = hash_str(key, key_len);
-    bucket = &hashtable->buckets[hash & hashmask(hashtable->order)];
+    return entry->pair->value;
+}
 
-    pair = hashtable_find_pair(hashtable, bucket, key, key_len, hash);
-    if (!pair)
+void *hashtable_get_key(hashtable_t *hashtable, const json_key_t *key) {
+    entry_t *entry =
+        hashtable_find_entry(hashtable, key->key, key->key_len,
+                             key_hash(hashtable, key->key, key->key_len, key), key);
+    if (!entry)
         return NULL;
 
-    return pair->value;
+    return entry->pair->value;
 }
 
-int hashtable_del(hashtable_t *hashtable, const char *key, size_t key_len) {
-    size_t hash = hash_str(key, key_len);
-    return hashtable_do_del(hashtable, key, key_len, hash);
+void *hashtable_get_hashed(hashtable_t *hashtable, const char *key, size_t key_len,
+                           size_t hash) {
+    entry_t *entry;
+
+    if (!hashtable->index)
+        hash = small_tag(key, key_len);
+
+    entry = hashtable_find_entry(hashtable, key, key_len, hash, NULL);
+    if (!entry)
+        return NULL;
+
+    return entry->pair->value;
 }
 
-void hashtable_clear(hashtable_t *hashtable) {
-    size_t i;
+size_t hashtable_hash(const char *key, size_t key_len) {
+    if (!hashtable_seed)
+        json_object_seed(0);
+    return hash_str(key, key_len);
+}
 
-    hashtable_do_clear(hashtable);
+int hashtable_del(hashtable_t *hashtable, const char *key, size_t key_len) {
+    pair_t *pair;
+    entry_t *entry = hashtable_find_entry(hashtable, key, key_len,
+                                          key_hash(hashtable, key, key_len, NULL), NULL);
+    if (!entry)
+        return -1;
 
-    for (i = 0; i < hashsize(hashtable->order); i++) {
-        hashtable->buckets[i].first = hashtable->buckets[i].last = &hashtable->list;
+    pair = entry->pair;
+    entry->pair = NULL;
+    if (!hashtable->index && entry == &hashtable->entries[hashtable->used - 1]) {
+        /* no index refers to the last entry, reuse it */
+        hashtable->used--;
     }
 
-    list_init(&hashtable->list);
-    list_init(&hashtable->ordered_list);
+    json_decref(pair->value);
+    jsonp_arena_free(hashtable->arena, pair);
+    hashtable->size--;
+
+    return 0;
+}
+
+void hashtable_clear(hashtable_t *hashtable) {
+    hashtable_do_clear(hashtable);
+
+    if (hashtable->index)
+        memset(hashtable->index, 0, hashsize(hashtable->order) * sizeof(uint32_t));
+    hashtable->used = 0;
     hashtable->size = 0;
 }
 
-void *hashtable_iter(hashtable_t *hashtable) {
-    return hashtable_iter_next(hashtable, &hashtable->ordered_list);
+static void *iter_from(hashtable_t *hashtable, size_t i) {
+    for (; i < hashtable->used; i++) {
+        if (hashtable->entries[i].pair)
+            return hashtable->entries[i].pair;
+    }
+    return NULL;
 }
 
+void *hashtable_iter(hashtable_t *hashtable) { return iter_from(hashtable, 0); }
+
 void *hashtable_iter_at(hashtable_t *hashtable, const char *key, size_t key_len) {
-    pair_t *pair;
-    size_t hash;
-    bucket_t *bucket;
+    entry_t *entry = hashtable_find_entry(hashtable, key, key_len,
+                                          key_hash(hashtable, key, key_len, NULL), NULL);
+    if (!entry)
+        return NULL;
+
+    return entry->pair;
+}
 
-    hash = hash_str(key, key_len);
-    bucket = &hashtable->buckets[hash & hashmask(hashtable->order)];
+void *hashtable_iter_nth(hashtable_t *hashtable, size_t n) {
+    size_t i;
 
-    pair = hashtable_find_pair(hashtable, bucket, key, key_len, hash);
-    if (!pair)
+    if (n >= hashtable->size)
         return NULL;
+    if (hashtable->used == hashtable->size)
+        return hashtable->entries[n].pair;
 
-    return &pair->ordered_list;
+    /* skip the holes */
+    for (i = 0; i < hashtable->used; i++) {
+        if (hashtable->entries[i].pair && n-- == 0)
+            return hashtable->entries[i].pair;
+    }
+    return NULL;
 }
 
 void *hashtable_iter_next(hashtable_t *hashtable, void *iter) {
-    list_t *list = (list_t *)iter;
-    if (list->next == &hashtable->ordered_list)
-        return NULL;
-    return list->next;
+    pair_t *pair = (pair_t *)iter;
+    return iter_from(hashtable, pair->index + 1);
 }
 
 void *hashtable_iter_key(void *iter) {
-    pair_t *pair = ordered_list_to_pair((list_t *)iter);
+    pair_t *pair = (pair_t *)iter;
     return pair->key;
 }
 
 size_t hashtable_iter_key_len(void *iter) {
-    pair_t *pair = ordered_list_to_pair((list_t *)iter);
+    pair_t *pair = (pair_t *)iter;
     return pair->key_len;
 }
 
 void *hashtable_iter_value(void *iter) {
-    pair_t *pair = ordered_list_to_pair((list_t *)iter);
+    pair_t *pair = (pair_t *)iter;
     return pair->value;
 }
 
 void hashtable_iter_set(void *iter, json_t *value) {
-    pair_t *pair = ordered_list_to_pair((list_t *)iter);
+    pair_t *pair = (pair_t *)iter;
 
     json_decref(pair->value);
     pair->value = value;
 }
+
+/* The intern table: an open-addressed set of the interned keys. Within
+   a table, slots only ever go from free to taken. Growing publishes a
+   new table and leaves the old one alone for lookups still running in
+   it, so with atomic builtins lookups don't take the lock. Interned keys
+   are never freed, so keys from untrusted input can't grow the table
+   past INTERN_MAX_KEYS keys or INTERN_MAX_BYTES bytes of them, and keys
+   longer than INTERN_MAX_KEY_LEN are not interned. */
+
+#define INTERN_MAX_KEYS     65536
+#define INTERN_MAX_KEY_LEN  256
+#define INTERN_MAX_BYTES    (4 * 1024 * 1024)
+#define INTERN_INITIAL_SIZE 256
+
+struct intern_table {
+    size_t mask;
+    size_t count;
+    struct intern_table *previous; /* kept for lookups still using it */
+    const json_key_t *slots[1];
+};
+
+static struct intern_table *intern_current = NULL;
+static size_t intern_bytes = 0; /* of the keys interned so far */
+static char intern_full = 0;    /* set once a limit is reached, never cleared */
+
+#ifdef HAVE_SCHED_YIELD
+#define intern_yield() sched_yield()
+#else
+#define intern_yield() ((void)0)
+#endif
+
+#if defined(HAVE_ATOMIC_BUILTINS)
+static char intern_locked = 0;
+#define INTERN_LOAD(ptr)       __atomic_load_n(ptr, __ATOMIC_ACQUIRE)
+#define INTERN_STORE(ptr, val) __atomic_store_n(ptr, val, __ATOMIC_RELEASE)
+#define INTERN_LOCK()                                                                    \
+    while (__atomic_test_and_set(&intern_locked, __ATOMIC_ACQUIRE))                    \
+    intern_yield()
+#define INTERN_UNLOCK()      __atomic_clear(&intern_locked, __ATOMIC_RELEASE)
+#define INTERN_READ_LOCK()   ((void)0)
+#define INTERN_READ_UNLOCK() ((void)0)
+#elif defined(HAVE_SYNC_BUILTINS)
+/* no load-acquire with the __sync builtins, lookups take the lock too */
+static volatile char intern_locked = 0;
+#define INTERN_LOAD(ptr)       (*(ptr))
+#define INTERN_STORE(ptr, val) (*(ptr) = (val))
+#define INTERN_LOCK()                                                                    \
+    while (__sync_lock_test_and_set(&intern_locked, 1))                                 \
+    intern_yield()
+#define INTERN_UNLOCK()      __sync_lock_release(&intern_locked)
+#define INTERN_READ_LOCK()   INTERN_LOCK()
+#define INTERN_READ_UNLOCK() INTERN_UNLOCK()
+#else
+/* Fall back to a thread-unsafe version */
+#define INTERN_LOAD(ptr)       (*(ptr))
+#define INTERN_STORE(ptr, val) (*(ptr) = (val))
+#define INTERN_LOCK()          ((void)0)
+#define INTERN_UNLOCK()        ((void)0)
+#define INTERN_READ_LOCK()     ((void)0)
+#define INTERN_READ_UNLOCK()   ((void)0)
+#endif
+
+/* Look key up in table. If it's not there, *slot is set to the free
+   slot it would go to. */
+static const json_key_t *intern_find(struct intern_table *table, const char *key,
+                                     size_t key_len, size_t hash, size_t *slot) {
+    const json_key_t *interned;
+    size_t i = hash & table->mask;
+
+    while ((interned = INTERN_LOAD(&table->slots[i])) != NULL) {
+        if (interned->hash == hash && interned->key_len == key_len &&
+            memcmp(interned->key, key, key_len) == 0)
+            return interned;
+        i = (i + 1) & table->mask;
+    }
+
+    *slot = i;
+    return NULL;
+}
+
+/* Make sure that table has room for one more key, switching to a new
+   one twice as large if not. Called with the lock held. */
+static struct intern_table *intern_reserve(struct intern_table *table) {
+    struct intern_table *grown;
+    size_t i, size, slot;
+
+    if (table && (table->count + 1) * 2 <= table->mask + 1)
+        return table;
+    if (table && table->count >= INTERN_MAX_KEYS) {
+        INTERN_STORE(&intern_full, 1);
+        return NULL;
+    }
+
+    size = table ? (table->mask + 1) * 2 : INTERN_INITIAL_SIZE;
+    grown = jsonp_malloc(offsetof(struct intern_table, slots) + size * sizeof(json_key_t *));
+    if (!grown)
+        return NULL;
+
+    grown->mask = size - 1;
+    grown->count = 0;
+    grown->previous = table;
+    memset(grown->slots, 0, size * sizeof(json_key_t *));
+
+    if (table) {
+        for (i = 0; i <= table->mask; i++) {
+            const json_key_t *interned = table->slots[i];
+            if (!interned)
+                continue;
+
+            intern_find(grown, interned->key, interned->key_len, interned->hash, &slot);
+            grown->slots[slot] = interned;
+            grown->count++;
+        }
+    }
+
+    INTERN_STORE(&intern_current, grown);
+    return grown;
+}
+
+const json_key_t *hashtable_intern(const char *key, size_t key_len) {
+    struct intern_table *table;
+    const json_key_t *found = NULL;
+    json_key_t *interned;
+    size_t hash, slot;
+
+    if (key_len > INTERN_MAX_KEY_LEN)
+        return NULL;
+
+    hash = hashtable_hash(key, key_len);
+
+    INTERN_READ_LOCK();
+    table = INTERN_LOAD(&intern_current);
+    if (table)
+        found = intern_find(table, key, key_len, hash, &slot);
+    INTERN_READ_UNLOCK();
+    /* once full, misses don't need the lock to fail */
+    if (found || INTERN_LOAD(&intern_full))
+        return found;
+
+    INTERN_LOCK();
+
+    /* another thread may have added key since */
+    table = intern_current;
+    if (table)
+        found = intern_find(table, key, key_len, hash, &slot);
+
+    if (!found && intern_bytes + key_len + 1 > INTERN_MAX_BYTES) {
+        INTERN_STORE(&intern_full, 1);
+    } else if (!found && (table = intern_reserve(table)) != NULL) {
+        interned = jsonp_malloc(offsetof(json_key_t, key) + key_len + 1);
+        if (interned) {
+            interned->hash = hash;
+            interned->key_len = key_len;
+            memcpy(interned->key, key, key_len);
+            interned->key[key_len] = '\0';
+
+            intern_find(table, key, key_len, hash, &slot);
+            INTERN_STORE(&table->slots[slot], (const json_key_t *)interned);
+            table->count++;
+            intern_bytes += key_len + 1;
+            found = interned;
+        }
+    }
+
+    INTERN_UNLOCK();
+    return found;
+}
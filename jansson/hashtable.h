@@ -8,41 +8,60 @@
 #ifndef HASHTABLE_H
 #define HASHTABLE_H
 
+#ifdef HAVE_CONFIG_H
+#include <jansson_private_config.h>
+#endif
+
 #include "jansson.h"
 #include <stdlib.h>
 
-struct hashtable_list {
-    struct hashtable_list *prev;
-    struct hashtable_list *next;
-};
+#ifdef HAVE_STDINT_H
+#include <stdint.h>
+#endif
 
 /* "pair" may be a bit confusing a name, but think of it as a
    key-value pair. In this case, it just encodes some extra data,
-   too */
+   too. Pairs are allocated one by one so that they, and iterators
+   pointing to them, stay put while the table changes. */
 struct hashtable_pair {
-    struct hashtable_list list;
-    struct hashtable_list ordered_list;
-    size_t hash;
+    size_t index; /* position in hashtable->entries */
     json_t *value;
+    const json_key_t *interned; /* the key's interned twin, or NULL */
+    size_t key_len;
+    char key[1];
+};
+
+/* An interned key: allocated once per distinct key for the lifetime
+   of the process, so that its address identifies it. hash is the
+   hashtable hash of the key. Pairs still keep their own copy of the
+   key, json_object_key_to_iter() relies on it. */
+struct json_key_t {
+    size_t hash;
     size_t key_len;
     char key[1];
 };
 
-struct hashtable_bucket {
-    struct hashtable_list *first;
-    struct hashtable_list *last;
+/* Entries are kept in insertion order. Deleting a pair leaves a hole
+   (pair == NULL) that is squeezed out the next time the array is full.
+   In a small table hash is only a cheap tag of the key, see
+   hashtable.c. */
+struct hashtable_entry {
+    size_t hash;
+    struct hashtable_pair *pair;
 };
 
 typedef struct hashtable {
-    size_t size;
-    struct hashtable_bucket *buckets;
-    size_t order; /* hashtable has pow(2, order) buckets */
-    struct hashtable_list list;
-    struct hashtable_list ordered_list;
+    size_t size;     /* number of pairs */
+    size_t used;     /* number of entries, holes included */
+    size_t capacity; /* room in entries */
+    struct hashtable_entry *entries;
+    uint32_t *index; /* open-addressed slots of entry number + 1, 0 for
+                        a free slot; NULL while the table is small */
+    size_t order;    /* the index has pow(2, order) slots */
+    json_arena_t *arena; /* where entries and pairs live, NULL for the heap */
 } hashtable_t;
 
-#define hashtable_key_to_iter(key_)                                                      \
-    (&(container_of(key_, struct hashtable_pair, key)->ordered_list))
+#define hashtable_key_to_iter(key_) (container_of(key_, struct hashtable_pair, key))
 
 /**
  * hashtable_init - Initialize a hashtable object
@@ -56,6 +75,20 @@ typedef struct hashtable {
  */
 int hashtable_init(hashtable_t *hashtable) JANSSON_ATTRS((warn_unused_result));
 
+/**
+ * hashtable_init_arena - Initialize a hashtable object backed by an arena
+ *
+ * @hashtable: The (statically allocated) hashtable object
+ * @arena: The arena to allocate entries and pairs from, or NULL
+ *
+ * Like hashtable_init(), but all memory of the hashtable is taken from
+ * arena and only released together with it.
+ *
+ * Returns 0 on success, -1 on error (out of memory).
+ */
+int hashtable_init_arena(hashtable_t *hashtable, json_arena_t *arena)
+    JANSSON_ATTRS((warn_unused_result));
+
 /**
  * hashtable_close - Release all resources used by a hashtable object
  *
@@ -83,6 +116,36 @@ void hashtable_close(hashtable_t *hashtable);
  */
 int hashtable_set(hashtable_t *hashtable, const char *key, size_t key_len, json_t *value);
 
+/**
+ * hashtable_set_key - Add/modify value in hashtable by an interned key
+ *
+ * @hashtable: The hashtable object
+ * @key: The interned key
+ * @value: The value
+ *
+ * Like hashtable_set(), but neither hashes key nor compares its bytes
+ * when the pair was also set by an interned key.
+ *
+ * Returns 0 on success, -1 on failure (out of memory).
+ */
+int hashtable_set_key(hashtable_t *hashtable, const json_key_t *key, json_t *value);
+
+/**
+ * hashtable_set_hashed - Add/modify value in hashtable by a key of known hash
+ *
+ * @hashtable: The hashtable object
+ * @key: The key
+ * @key_len: The length of key
+ * @hash: hashtable_hash() of key
+ * @value: The value
+ *
+ * Like hashtable_set(), but doesn't hash key again.
+ *
+ * Returns 0 on success, -1 on failure (out of memory).
+ */
+int hashtable_set_hashed(hashtable_t *hashtable, const char *key, size_t key_len,
+                         size_t hash, json_t *value);
+
 /**
  * hashtable_get - Get a value associated with a key
  *
@@ -94,6 +157,42 @@ int hashtable_set(hashtable_t *hashtable, const char *key, size_t key_len, json_
  */
 void *hashtable_get(hashtable_t *hashtable, const char *key, size_t key_len);
 
+/**
+ * hashtable_get_key - Get a value associated with an interned key
+ *
+ * @hashtable: The hashtable object
+ * @key: The interned key
+ *
+ * Returns value if it is found, or NULL otherwise.
+ */
+void *hashtable_get_key(hashtable_t *hashtable, const json_key_t *key);
+
+/**
+ * hashtable_get_hashed - Get a value associated with a key of known hash
+ *
+ * @hashtable: The hashtable object
+ * @key: The key
+ * @key_len: The length of key
+ * @hash: hashtable_hash() of key
+ *
+ * Like hashtable_get(), but doesn't hash key again.
+ *
+ * Returns value if it is found, or NULL otherwise.
+ */
+void *hashtable_get_hashed(hashtable_t *hashtable, const char *key, size_t key_len,
+                           size_t hash);
+
+/**
+ * hashtable_hash - Hash a key
+ *
+ * @key: The key
+ * @key_len: The length of key
+ *
+ * Returns the hash hashtables use for key. The hash function is seeded
+ * first if it isn't yet, so the seed can't change afterwards.
+ */
+size_t hashtable_hash(const char *key, size_t key_len);
+
 /**
  * hashtable_del - Remove a value from the hashtable
  *
@@ -105,6 +204,19 @@ void *hashtable_get(hashtable_t *hashtable, const char *key, size_t key_len);
  */
 int hashtable_del(hashtable_t *hashtable, const char *key, size_t key_len);
 
+/**
+ * hashtable_intern - Intern a key
+ *
+ * @key: The key
+ * @key_len: The length of key
+ *
+ * Returns the process wide interned instance of key, adding it if
+ * needed, or NULL if key is too long, the intern table is full or out
+ * of memory.
+ * Interned keys are never freed. Safe to call from several threads.
+ */
+const json_key_t *hashtable_intern(const char *key, size_t key_len);
+
 /**
  * hashtable_clear - Clear hashtable
  *
@@ -121,7 +233,7 @@ void hashtable_clear(hashtable_t *hashtable);
  *
  * Returns an opaque iterator to the first element in the hashtable.
  * The iterator should be passed to hashtable_iter_* functions.
- * The hashtable items are not iterated over in any particular order.
+ * The hashtable items are iterated over in insertion order.
  *
  * There's no need to free the iterator in any way. The iterator is
  * valid as long as the item that is referenced by the iterator is not
@@ -143,6 +255,18 @@ void *hashtable_iter(hashtable_t *hashtable);
  */
 void *hashtable_iter_at(hashtable_t *hashtable, const char *key, size_t key_len);
 
+/**
+ * hashtable_iter_nth - Return an iterator at a position
+ *
+ * @hashtable: The hashtable object
+ * @n: The position of the pair in insertion order
+ *
+ * Like hashtable_iter() but returns an iterator pointing to the nth
+ * pair, or NULL if there are no more than n pairs. Constant time
+ * unless pairs were deleted since the entries were last compacted.
+ */
+void *hashtable_iter_nth(hashtable_t *hashtable, size_t n);
+
 /**
  * hashtable_iter_next - Advance an iterator
  *
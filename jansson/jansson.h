@@ -58,11 +58,20 @@ typedef enum {
     JSON_NULL
 } json_type;
 
+/* flags takes the padding after type where size_t is 64 bits, so nodes
+   keep their size there. This is not binary compatible with upstream
+   jansson 2.14: where size_t is 32 bits refcount moves, and everywhere a
+   static json_t initializer needs all three members, {type, 0, refcount}.
+   Code built against other jansson headers must be rebuilt. */
 typedef struct json_t {
     json_type type;
+    unsigned int flags; /* internal storage flags, see jansson_private.h */
     volatile size_t refcount;
 } json_t;
 
+typedef struct json_arena_t json_arena_t;
+typedef struct json_key_t json_key_t;
+
 #ifndef JANSSON_USING_CMAKE /* disabled if using cmake */
 #if JSON_INTEGER_IS_LONG_LONG
 #ifdef _WIN32
@@ -105,6 +114,10 @@ json_t *json_false(void);
 #define json_boolean(val) ((val) ? json_true() : json_false())
 json_t *json_null(void);
 
+/* json_t flag of confined values, counted without atomic operations (see
+   json_confine()); the other flags are private */
+#define JSON_NODE_LOCAL 0x10
+
 /* do not call JSON_INTERNAL_INCREF or JSON_INTERNAL_DECREF directly */
 #if JSON_HAVE_ATOMIC_BUILTINS
 #define JSON_INTERNAL_INCREF(json)                                                       \
@@ -120,8 +133,12 @@ json_t *json_null(void);
 #endif
 
 static JSON_INLINE json_t *json_incref(json_t *json) {
-    if (json && json->refcount != (size_t)-1)
-        JSON_INTERNAL_INCREF(json);
+    if (json && json->refcount != (size_t)-1) {
+        if (json->flags & JSON_NODE_LOCAL)
+            ++json->refcount;
+        else
+            JSON_INTERNAL_INCREF(json);
+    }
     return json;
 }
 
@@ -129,10 +146,27 @@ static JSON_INLINE json_t *json_incref(json_t *json) {
 void json_delete(json_t *json);
 
 static JSON_INLINE void json_decref(json_t *json) {
-    if (json && json->refcount != (size_t)-1 && JSON_INTERNAL_DECREF(json) == 0)
+    if (json && json->refcount != (size_t)-1 &&
+        ((json->flags & JSON_NODE_LOCAL) ? --json->refcount : JSON_INTERNAL_DECREF(json)) ==
+            0)
         json_delete(json);
 }
 
+/* thread confinement
+
+   json_confine() switches a value and everything it contains to plain,
+   non-atomic reference counting, for documents that only one thread
+   references at a time. It stops at values referenced more than once,
+   which keep atomic counting along with everything in them. json_publish()
+   switches back before the value is shared between threads; it must
+   happen before whatever hands the value over. Immortal values (arena,
+   shared, true, false, null) are never confined. Both return -1 if a
+   container contains itself or on allocation failure, leaving what they
+   reached until then switched, and a value that failed to be published
+   must not be shared. */
+int json_confine(json_t *json);
+int json_publish(json_t *json);
+
 #if defined(__GNUC__) || defined(__clang__)
 static JSON_INLINE void json_decrefp(json_t **json) {
     if (json) {
@@ -190,11 +224,16 @@ json_t *json_object_get(const json_t *object, const char *key)
     JANSSON_ATTRS((warn_unused_result));
 json_t *json_object_getn(const json_t *object, const char *key, size_t key_len)
     JANSSON_ATTRS((warn_unused_result));
+json_t *json_object_getn_hashed(const json_t *object, const char *key, size_t key_len,
+                                size_t hash) JANSSON_ATTRS((warn_unused_result));
+size_t json_object_key_hash(const char *key, size_t key_len);
 int json_object_set_new(json_t *object, const char *key, json_t *value);
 int json_object_setn_new(json_t *object, const char *key, size_t key_len, json_t *value);
 int json_object_set_new_nocheck(json_t *object, const char *key, json_t *value);
 int json_object_setn_new_nocheck(json_t *object, const char *key, size_t key_len,
                                  json_t *value);
+int json_object_setn_new_hashed(json_t *object, const char *key, size_t key_len,
+                                size_t hash, json_t *value);
 int json_object_del(json_t *object, const char *key);
 int json_object_deln(json_t *object, const char *key, size_t key_len);
 int json_object_clear(json_t *object);
@@ -211,6 +250,37 @@ size_t json_object_iter_key_len(void *iter);
 json_t *json_object_iter_value(void *iter);
 int json_object_iter_set_new(json_t *object, void *iter, json_t *value);
 
+/* Copies up to count members, in insertion order, into items and returns
+   how many were copied, 0 once there are no more. *position starts at 0
+   and is advanced past the copied members for the next call. Cheaper
+   than an iterator call per key and value; the object must not change
+   while it is read this way. */
+typedef struct json_object_item_t {
+    const char *key;
+    size_t key_len;
+    json_t *value;
+} json_object_item_t;
+
+size_t json_object_get_items(const json_t *object, size_t *position,
+                             json_object_item_t *items, size_t count);
+
+/* interned keys
+
+   An interned key is a process wide, never freed instance of a key
+   with its hash precomputed. Looking it up in an object that got the
+   key from an interned key, or from decoding with JSON_INTERN_KEYS,
+   compares pointers only. json_key_intern() returns NULL on invalid
+   UTF-8, for keys longer than 256 bytes and once the intern table is
+   full; decoding then keeps such keys as plain ones. */
+
+const json_key_t *json_key_intern(const char *key);
+const json_key_t *json_key_internn(const char *key, size_t key_len);
+const char *json_key_value(const json_key_t *key);
+size_t json_key_length(const json_key_t *key);
+json_t *json_object_get_key(const json_t *object, const json_key_t *key)
+    JANSSON_ATTRS((warn_unused_result));
+int json_object_set_key_new(json_t *object, const json_key_t *key, json_t *value);
+
 #define json_object_foreach(object, key, value)                                          \
     for (key = json_object_iter_key(json_object_iter(object));                           \
          key && (value = json_object_iter_value(json_object_key_to_iter(key)));          \
@@ -264,6 +334,11 @@ static JSON_INLINE int json_object_setn_nocheck(json_t *object, const char *key,
     return json_object_setn_new_nocheck(object, key, key_len, json_incref(value));
 }
 
+static JSON_INLINE int json_object_set_key(json_t *object, const json_key_t *key,
+                                           json_t *value) {
+    return json_object_set_key_new(object, key, json_incref(value));
+}
+
 static JSON_INLINE int json_object_iter_set(json_t *object, void *iter, json_t *value) {
     return json_object_iter_set_new(object, iter, json_incref(value));
 }
@@ -295,6 +370,25 @@ int json_array_insert_new(json_t *array, size_t index, json_t *value);
 int json_array_remove(json_t *array, size_t index);
 int json_array_clear(json_t *array);
 int json_array_extend(json_t *array, json_t *other);
+int json_array_reserve(json_t *array, size_t size);
+
+/* Bulk construction and extraction: json_array_of_*() build a packed
+   array (see JSON_DECODE_PACKED) holding a copy of values, the node of
+   an element is only made when it is asked for. json_array_get_*() copy
+   the values of count elements starting at index and return how many
+   were copied, stopping early at the end of the array or at an element
+   of another type; reals accept integers too. json_array_get_values()
+   copies the elements themselves, as borrowed references. */
+json_t *json_array_of_reals(const double *values, size_t count)
+    JANSSON_ATTRS((warn_unused_result));
+json_t *json_array_of_integers(const json_int_t *values, size_t count)
+    JANSSON_ATTRS((warn_unused_result));
+size_t json_array_get_reals(const json_t *array, size_t index, double *values,
+                            size_t count);
+size_t json_array_get_integers(const json_t *array, size_t index, json_int_t *values,
+                               size_t count);
+size_t json_array_get_values(const json_t *array, size_t index, json_t **values,
+                             size_t count);
 
 static JSON_INLINE int json_array_set(json_t *array, size_t ind, json_t *value) {
     return json_array_set_new(array, ind, json_incref(value));
@@ -337,6 +431,44 @@ int json_unpack_ex(json_t *root, json_error_t *error, size_t flags, const char *
 int json_vunpack_ex(json_t *root, json_error_t *error, size_t flags, const char *fmt,
                     va_list ap);
 
+/* A format scanned once by json_template_compile(), then packed or
+   unpacked any number of times, also from several threads. Errors are
+   those of json_pack_ex() and json_unpack_ex(); flags apply to unpacking. */
+typedef struct json_template_t json_template_t;
+
+json_template_t *json_template_compile(const char *fmt, size_t flags, json_error_t *error)
+    JANSSON_ATTRS((warn_unused_result));
+void json_template_free(json_template_t *tmpl);
+json_t *json_template_pack(const json_template_t *tmpl, json_error_t *error, ...)
+    JANSSON_ATTRS((warn_unused_result));
+json_t *json_template_vpack(const json_template_t *tmpl, json_error_t *error, va_list ap)
+    JANSSON_ATTRS((warn_unused_result));
+int json_template_unpack(const json_template_t *tmpl, json_t *root, json_error_t *error,
+                         ...);
+int json_template_vunpack(const json_template_t *tmpl, json_t *root, json_error_t *error,
+                          va_list ap);
+
+/* paths */
+
+/* A JSON Pointer ("/a/b/0", RFC 6901) or, if it starts with '$', a subset
+   of JSONPath: .key, ['key'], [index] (negative counts from the end), .*,
+   [*] and filters [?(@.key)] or [?(@.key <op> value)] with op one of
+   == != < <= > >=. Keys are unescaped and hashed once, when compiling. */
+typedef struct json_path_t json_path_t;
+typedef int (*json_path_callback_t)(size_t index, json_t *value, void *data);
+
+json_path_t *json_path_compile(const char *path, json_error_t *error)
+    JANSSON_ATTRS((warn_unused_result));
+void json_path_free(json_path_t *path);
+json_t *json_path_get(const json_t *root, const json_path_t *path)
+    JANSSON_ATTRS((warn_unused_result));
+int json_path_query(const json_t *root, const json_path_t *path,
+                    json_path_callback_t callback, void *data);
+int json_path_query_batch(const json_t *root, const json_path_t *const *paths,
+                          size_t count, json_path_callback_t callback, void *data);
+json_t *json_pointer_get(const json_t *root, const char *pointer)
+    JANSSON_ATTRS((warn_unused_result));
+
 /* sprintf */
 
 json_t *json_sprintf(const char *fmt, ...)
@@ -348,11 +480,68 @@ json_t *json_vsprintf(const char *fmt, va_list ap)
 
 int json_equal(const json_t *value1, const json_t *value2);
 
+/* hashing */
+
+size_t json_hash(const json_t *value) JANSSON_ATTRS((warn_unused_result));
+
 /* copying */
 
 json_t *json_copy(json_t *value) JANSSON_ATTRS((warn_unused_result));
 json_t *json_deep_copy(const json_t *value) JANSSON_ATTRS((warn_unused_result));
 
+/* walking
+
+   json_visit() calls callback for value and everything in it, parents
+   before their children and in document order, keeping its own stack
+   instead of recursing, so any depth can be walked. key and key_len name
+   the member of an object, key is NULL otherwise; index is the position
+   in the parent and depth is 0 for value itself. The callback returns 0
+   to go on, JSON_VISIT_SKIP not to enter the object or array it was
+   passed, anything else to stop. It must not add or remove members of
+   the containers being walked. Returns 0 on success, -1 if stopped, on
+   a circular reference (not checked with JSON_ACYCLIC) or out of memory. */
+
+#define JSON_VISIT_SKIP 1
+
+typedef int (*json_visit_callback_t)(const char *key, size_t key_len, size_t index,
+                                     json_t *value, size_t depth, void *data);
+
+int json_visit(json_t *value, json_visit_callback_t callback, void *data, size_t flags);
+
+/* copy-on-write
+
+   json_copy() shares the members or elements of value with the copy. A
+   *_get_mutable() function returns a child that can be changed in place,
+   first replacing it by a json_copy() of its own if anything else
+   references it. Getting to a value that way only duplicates the
+   containers along the path, leaving the rest shared. A borrowed
+   reference is returned, NULL if there is no such child or on failure. */
+
+json_t *json_object_get_mutable(json_t *object, const char *key)
+    JANSSON_ATTRS((warn_unused_result));
+json_t *json_object_getn_mutable(json_t *object, const char *key, size_t key_len)
+    JANSSON_ATTRS((warn_unused_result));
+json_t *json_array_get_mutable(json_t *array, size_t index)
+    JANSSON_ATTRS((warn_unused_result));
+json_t *json_path_get_mutable(json_t *root, const json_path_t *path)
+    JANSSON_ATTRS((warn_unused_result));
+json_t *json_pointer_get_mutable(json_t *root, const char *pointer)
+    JANSSON_ATTRS((warn_unused_result));
+
+/* patches
+
+   json_merge_patch() applies an RFC 7386 merge patch, json_patch_apply()
+   an RFC 6902 JSON Patch, both in place and sharing the values of the
+   patch. json_merge_diff() and json_patch_diff() compute the patch from
+   one document to another, which shares the values of to. */
+
+int json_merge_patch(json_t *target, const json_t *patch);
+json_t *json_merge_diff(const json_t *from, const json_t *to)
+    JANSSON_ATTRS((warn_unused_result));
+int json_patch_apply(json_t *root, const json_t *patch, json_error_t *error);
+json_t *json_patch_diff(const json_t *from, const json_t *to)
+    JANSSON_ATTRS((warn_unused_result));
+
 /* decoding */
 
 #define JSON_REJECT_DUPLICATES  0x1
@@ -360,6 +549,25 @@ json_t *json_deep_copy(const json_t *value) JANSSON_ATTRS((warn_unused_result));
 #define JSON_DECODE_ANY         0x4
 #define JSON_DECODE_INT_AS_REAL 0x8
 #define JSON_ALLOW_NUL          0x10
+#define JSON_INSITU             0x20 /* json_loads/json_loadb: decode strings in place,
+                                        the input must stay writable and alive */
+#define JSON_INTERN_KEYS        0x40 /* intern object keys, see json_key_intern() */
+#define JSON_DECODE_PACKED      0x80 /* keep arrays of numbers of one kind as plain
+                                        values, the node of an element is made
+                                        when it is first asked for; threads may
+                                        do so reading at the same time, but an
+                                        arena must not be written to meanwhile */
+#define JSON_DECODE_SHARED      0x100 /* small integers and one byte strings are shared
+                                         immortal values that can't be set */
+#define JSON_DECODE_CONFINED    0x200 /* decoded values start out confined, see
+                                         json_confine() */
+#define JSON_DECODE_LINES       0x400 /* json_reader_document(): a document ends on
+                                         its line, a newline inside it is an error */
+#define JSON_DISABLE_MMAP       0x800 /* json_load_file(): read the file with stdio
+                                         instead of mapping it */
+/* decode as if inside n containers, so the depth limit covers the whole
+   document when a part of it is parsed on its own */
+#define JSON_DECODE_NESTED(n) (((size_t)(n)&0xFFF) << 16)
 
 typedef size_t (*json_load_callback_t)(void *buffer, size_t buflen, void *data);
 
@@ -371,11 +579,107 @@ json_t *json_loadf(FILE *input, size_t flags, json_error_t *error)
     JANSSON_ATTRS((warn_unused_result));
 json_t *json_loadfd(int input, size_t flags, json_error_t *error)
     JANSSON_ATTRS((warn_unused_result));
+/* json_load_file() maps regular files into memory where it can. If
+   another process truncates the file while it is being parsed, touching
+   the lost pages raises SIGBUS on POSIX systems (Windows refuses to
+   truncate a mapped file). Pass JSON_DISABLE_MMAP for files that may be
+   truncated while they are read. */
 json_t *json_load_file(const char *path, size_t flags, json_error_t *error)
     JANSSON_ATTRS((warn_unused_result));
 json_t *json_load_callback(json_load_callback_t callback, void *data, size_t flags,
                            json_error_t *error) JANSSON_ATTRS((warn_unused_result));
 
+/* maps a regular file read-only, NULL if it can't be mapped (read it
+   with stdio then). Unmap it with json_unmap_file() and its size. */
+const char *json_map_file(const char *path, size_t *size);
+void json_unmap_file(const char *data, size_t size);
+json_t *json_loads_arena(const char *input, size_t flags, json_arena_t *arena,
+                         json_error_t *error) JANSSON_ATTRS((warn_unused_result));
+json_t *json_loadb_arena(const char *buffer, size_t buflen, size_t flags,
+                         json_arena_t *arena, json_error_t *error)
+    JANSSON_ATTRS((warn_unused_result));
+
+/* pull parsing
+
+   A reader returns the document as a sequence of events without
+   building it, so memory use doesn't depend on the size of the input.
+   json_reader_value() turns the value an event started (a scalar, or
+   the whole object or array) into a json_t. Strings returned by
+   json_reader_string() are valid until the next call on the reader.
+   error, if not NULL, is written to for the lifetime of the reader. */
+
+typedef struct json_reader_t json_reader_t;
+
+typedef enum {
+    JSON_EVENT_ERROR = -1,
+    JSON_EVENT_END = 0,
+    JSON_EVENT_NONE,
+    JSON_EVENT_OBJECT_START,
+    JSON_EVENT_OBJECT_END,
+    JSON_EVENT_ARRAY_START,
+    JSON_EVENT_ARRAY_END,
+    JSON_EVENT_KEY,
+    JSON_EVENT_STRING,
+    JSON_EVENT_INTEGER,
+    JSON_EVENT_REAL,
+    JSON_EVENT_TRUE,
+    JSON_EVENT_FALSE,
+    JSON_EVENT_NULL
+} json_event;
+
+json_reader_t *json_reader_buffer(const char *buffer, size_t buflen, size_t flags,
+                                  json_error_t *error) JANSSON_ATTRS((warn_unused_result));
+json_reader_t *json_reader_file(const char *path, size_t flags, json_error_t *error)
+    JANSSON_ATTRS((warn_unused_result));
+json_reader_t *json_reader_callback(json_load_callback_t callback, void *data,
+                                    size_t flags, json_error_t *error)
+    JANSSON_ATTRS((warn_unused_result));
+json_reader_t *json_reader_stream(FILE *input, size_t flags, json_error_t *error)
+    JANSSON_ATTRS((warn_unused_result));
+json_reader_t *json_reader_fd(int input, size_t flags, json_error_t *error)
+    JANSSON_ATTRS((warn_unused_result));
+void json_reader_close(json_reader_t *reader);
+int json_reader_next(json_reader_t *reader);
+const char *json_reader_string(const json_reader_t *reader, size_t *length);
+json_int_t json_reader_integer(const json_reader_t *reader);
+double json_reader_real(const json_reader_t *reader);
+size_t json_reader_depth(const json_reader_t *reader);
+json_t *json_reader_value(json_reader_t *reader) JANSSON_ATTRS((warn_unused_result));
+int json_reader_skip(json_reader_t *reader);
+int json_reader_event(const json_reader_t *reader);
+
+/* Sequences of documents, e.g. newline delimited JSON: json_reader_document()
+   reads the next whole document, NULL at the end of the input
+   (JSON_EVENT_END) or on an error (JSON_EVENT_ERROR), after which
+   json_reader_skip_line() resumes at the next line. With
+   JSON_DECODE_LINES a document that is cut short fails at the end of its
+   line, so skipping it doesn't drop the document on the next one. */
+json_t *json_reader_document(json_reader_t *reader) JANSSON_ATTRS((warn_unused_result));
+int json_reader_skip_line(json_reader_t *reader);
+
+/* splitting
+
+   Finds the elements of a top-level array, or the documents of a
+   whitespace separated sequence, by tracking strings and brackets only:
+   callback gets the offset and length of each piece, which can then be
+   decoded on its own with json_loadb() and JSON_DECODE_ANY, e.g. on
+   several threads. The pieces are not validated. */
+
+typedef int (*json_split_callback_t)(size_t offset, size_t length, void *data);
+
+int json_split_array(const char *buffer, size_t buflen, json_split_callback_t callback,
+                     void *data);
+int json_split_documents(const char *buffer, size_t buflen, json_split_callback_t callback,
+                         void *data);
+
+/* The members of a top-level object: key_offset and key_length give the
+   key between its quotes, still escaped. */
+typedef int (*json_split_member_callback_t)(size_t key_offset, size_t key_length,
+                                            size_t offset, size_t length, void *data);
+
+int json_split_object(const char *buffer, size_t buflen,
+                      json_split_member_callback_t callback, void *data);
+
 /* encoding */
 
 #define JSON_MAX_INDENT        0x1F
@@ -388,6 +692,8 @@ json_t *json_load_callback(json_load_callback_t callback, void *data, size_t fla
 #define JSON_ESCAPE_SLASH      0x400
 #define JSON_REAL_PRECISION(n) (((n)&0x1F) << 11)
 #define JSON_EMBED             0x10000
+#define JSON_ACYCLIC           0x20000 /* skip the circular reference check, for
+                                          values known to have none */
 
 typedef int (*json_dump_callback_t)(const char *buffer, size_t size, void *data);
 
@@ -399,6 +705,46 @@ int json_dump_file(const json_t *json, const char *path, size_t flags);
 int json_dump_callback(const json_t *json, json_dump_callback_t callback, void *data,
                        size_t flags);
 
+/* Encodes one scalar as json_dump_callback() does inside a value, for
+   writing JSON without building it. json_dump_real() fails for NaN and
+   infinities. */
+int json_dump_string(const char *value, size_t len, json_dump_callback_t callback,
+                     void *data, size_t flags);
+int json_dump_integer(json_int_t value, json_dump_callback_t callback, void *data);
+int json_dump_real(double value, json_dump_callback_t callback, void *data, size_t flags);
+
+/* Encodes the children index .. index + count - 1 of an array or object
+   as json_dump_callback() does inside the container: each child with
+   the separator before it, the opening bracket with index 0 and the
+   closing one with the last child. Consecutive ranges concatenate to
+   the whole encoding, so they can be encoded separately, e.g. on
+   several threads. Objects are taken in insertion order, JSON_SORT_KEYS
+   is not supported for them. */
+int json_dump_range(const json_t *json, size_t index, size_t count,
+                    json_dump_callback_t callback, void *data, size_t flags);
+
+/* CBOR (RFC 8949)
+
+   The same values in binary, for hops between programs that both use
+   it: integers and reals are copied bit-exact (reals as float64) and
+   strings are length prefixed, so neither side formats or parses
+   numbers or escapes strings. Encoding takes JSON_ENCODE_ANY and
+   JSON_ACYCLIC and keeps the order of object keys. Decoding takes the
+   decoding flags; with JSON_INSITU long strings are decoded in place,
+   moved over the bytes before them. Byte strings are rejected, tags
+   are ignored and undefined decodes to null. */
+
+int json_cbor_dump_callback(const json_t *json, json_dump_callback_t callback, void *data,
+                            size_t flags);
+size_t json_cbor_dumpb(const json_t *json, char *buffer, size_t size, size_t flags);
+json_t *json_cbor_loadb(const char *buffer, size_t buflen, size_t flags,
+                        json_error_t *error) JANSSON_ATTRS((warn_unused_result));
+json_t *json_cbor_loadb_arena(const char *buffer, size_t buflen, size_t flags,
+                              json_arena_t *arena, json_error_t *error)
+    JANSSON_ATTRS((warn_unused_result));
+json_t *json_cbor_load_callback(json_load_callback_t callback, void *data, size_t flags,
+                                json_error_t *error) JANSSON_ATTRS((warn_unused_result));
+
 /* custom memory allocation */
 
 typedef void *(*json_malloc_t)(size_t);
@@ -407,6 +753,20 @@ typedef void (*json_free_t)(void *);
 void json_set_alloc_funcs(json_malloc_t malloc_fn, json_free_t free_fn);
 void json_get_alloc_funcs(json_malloc_t *malloc_fn, json_free_t *free_fn);
 
+/* arena allocation
+
+   Values loaded into an arena are owned by it: reference counting is a
+   no-op for them and they are all released at once by json_arena_reset()
+   or json_arena_destroy(). Values stored into an arena container are
+   copied into its arena unless they already live there, and arena values
+   stored into a heap container are copied to the heap, so a container
+   never refers to memory that a reset releases. */
+
+json_arena_t *json_arena_create(size_t block_size) JANSSON_ATTRS((warn_unused_result));
+void json_arena_reset(json_arena_t *arena);
+void json_arena_destroy(json_arena_t *arena);
+size_t json_arena_used(const json_arena_t *arena);
+
 /* runtime version checking */
 
 const char *jansson_version_str(void);
@@ -32,9 +32,38 @@
 #endif
 #endif
 
+/* json_t flags */
+#define JSON_NODE_ARENA    0x1 /* allocated from a json_arena_t, never deleted */
+#define JSON_NODE_BORROWED 0x2 /* string value points into a caller's buffer */
+#define JSON_NODE_INLINE   0x4 /* string value is stored right after the node */
+#define JSON_NODE_SHARED   0x8 /* immortal cached value (JSON_DECODE_SHARED), read only */
+/* 0x10 is JSON_NODE_LOCAL, public for json_incref() and json_decref() */
+
+/* Bits 8 to 13 of flags: the hash domain of a value, see json_hash().
+   Decoded documents and copies get a domain of their own, values made
+   one by one are in domain 0. */
+#define JSON_HASH_DOMAINS      64
+#define JSON_NODE_DOMAIN_SHIFT 8
+#define JSON_NODE_DOMAIN       ((JSON_HASH_DOMAINS - 1) << JSON_NODE_DOMAIN_SHIFT)
+#define json_domain(json_)     (((json_)->flags & JSON_NODE_DOMAIN) >> JSON_NODE_DOMAIN_SHIFT)
+
+unsigned int jsonp_hash_domain(void);
+
+static JSON_INLINE void jsonp_set_domain(json_t *json, unsigned int domain) {
+    /* true, false, null and shared values never change */
+    if (json->refcount != (size_t)-1 || (json->flags & JSON_NODE_ARENA))
+        json->flags = (json->flags & ~JSON_NODE_DOMAIN) | (domain << JSON_NODE_DOMAIN_SHIFT);
+}
+
+/* Strings up to this length are allocated together with their node */
+#define JSON_STRING_INLINE 15
+
 typedef struct {
     json_t json;
     hashtable_t hashtable;
+    size_t hash;           /* cached by json_hash(), valid while the epochs */
+    size_t hash_epochs;    /* of the domains of everything in the object */
+    uint64_t hash_domains; /* still add up to this; 0 if nothing is cached */
 } json_object_t;
 
 typedef struct {
@@ -42,6 +71,13 @@ typedef struct {
     size_t size;
     size_t entries;
     json_t **table;
+    json_arena_t *arena;
+    int packed;   /* JSON_REAL or JSON_INTEGER if the elements are kept in values */
+    void *values; /* double[] or json_int_t[] of size entries; table is then NULL
+                     or holds the nodes made of them so far, see array_node() */
+    size_t hash; /* as for objects */
+    size_t hash_epochs;
+    uint64_t hash_domains;
 } json_array_t;
 
 typedef struct {
@@ -60,6 +96,12 @@ typedef struct {
     json_int_t value;
 } json_integer_t;
 
+/* Room for an element of a packed array seen as a node */
+typedef union {
+    json_real_t real;
+    json_integer_t integer;
+} jsonp_shadow_t;
+
 #define json_to_object(json_)  container_of(json_, json_object_t, json)
 #define json_to_array(json_)   container_of(json_, json_array_t, json)
 #define json_to_string(json_)  container_of(json_, json_string_t, json)
@@ -69,6 +111,56 @@ typedef struct {
 /* Create a string by taking ownership of an existing buffer */
 json_t *jsonp_stringn_nocheck_own(const char *value, size_t len);
 
+/* Constructors allocating from an arena, or from the heap if arena is NULL.
+   A string buffer passed to jsonp_stringn_nocheck_own_arena() must come
+   from the same arena, jsonp_stringn_nocheck_borrow_arena() keeps
+   pointing to value without ever freeing it. */
+json_t *jsonp_object_arena(json_arena_t *arena);
+json_t *jsonp_array_arena(json_arena_t *arena);
+json_t *jsonp_stringn_nocheck_own_arena(json_arena_t *arena, const char *value,
+                                        size_t len);
+json_t *jsonp_stringn_nocheck_borrow_arena(json_arena_t *arena, const char *value,
+                                           size_t len);
+json_t *jsonp_stringn_nocheck_arena(json_arena_t *arena, const char *value, size_t len);
+json_t *jsonp_integer_arena(json_arena_t *arena, json_int_t value);
+json_t *jsonp_real_arena(json_arena_t *arena, double value);
+
+/* Immortal values shared by every document decoded with JSON_DECODE_SHARED:
+   integers from -128 to 1023, the empty string and one byte ASCII strings.
+   NULL if value has no shared node. */
+json_t *jsonp_shared_integer(json_int_t value);
+json_t *jsonp_shared_string(const char *value, size_t len);
+
+/* Packed arrays (JSON_DECODE_PACKED): numbers of one kind appended to an
+   empty or packed array are stored as plain values, the node of an element
+   is only created when something asks for that one. jsonp_array_peek()
+   returns the element at index without creating it, an element without a
+   node is written to *shadow and is valid for as long as shadow is. */
+int jsonp_array_pack_real(json_t *json, double value);
+int jsonp_array_pack_integer(json_t *json, json_int_t value);
+const json_t *jsonp_array_peek(const json_t *json, size_t index, jsonp_shadow_t *shadow);
+
+/* Atomic access to what threads that only read a value still write: the
+   nodes made for a packed array, digests cached by json_hash() and the
+   epochs of hash domains. Without atomic builtins these are plain
+   accesses, and reading a value from several threads is not safe. */
+#if defined(HAVE_ATOMIC_BUILTINS)
+#define JSONP_LOAD(ptr)            __atomic_load_n(ptr, __ATOMIC_ACQUIRE)
+#define JSONP_STORE(ptr, val)      __atomic_store_n(ptr, val, __ATOMIC_RELEASE)
+#define JSONP_CAS(ptr, old, value) __sync_bool_compare_and_swap(ptr, old, value)
+#define JSONP_INC(ptr)             __sync_add_and_fetch(ptr, 1)
+#elif defined(HAVE_SYNC_BUILTINS)
+#define JSONP_LOAD(ptr)            __sync_fetch_and_add(ptr, 0)
+#define JSONP_STORE(ptr, val)      (__sync_synchronize(), *(ptr) = (val))
+#define JSONP_CAS(ptr, old, value) __sync_bool_compare_and_swap(ptr, old, value)
+#define JSONP_INC(ptr)             __sync_add_and_fetch(ptr, 1)
+#else
+#define JSONP_LOAD(ptr)            (*(ptr))
+#define JSONP_STORE(ptr, val)      (*(ptr) = (val))
+#define JSONP_CAS(ptr, old, value) (*(ptr) == (old) ? (*(ptr) = (value), 1) : 0)
+#define JSONP_INC(ptr)             (++*(ptr))
+#endif
+
 /* Error message formatting */
 void jsonp_error_init(json_error_t *error, const char *source);
 void jsonp_error_set_source(json_error_t *error, const char *source);
@@ -78,8 +170,10 @@ void jsonp_error_vset(json_error_t *error, int line, int column, size_t position
                       enum json_error_code code, const char *msg, va_list ap);
 
 /* Locale independent string<->double conversions */
-int jsonp_strtod(strbuffer_t *strbuffer, double *out);
+int jsonp_strtod(const char *str, size_t length, double *out);
 int jsonp_dtostr(char *buffer, size_t size, double value, int prec);
+int jsonp_itostr(char *buffer, json_int_t value);
+int jsonp_dtoa_shortest(double value, uint64_t *digits, int *exponent);
 
 /* Wrappers for custom memory functions */
 void *jsonp_malloc(size_t size) JANSSON_ATTRS((warn_unused_result));
@@ -88,11 +182,37 @@ char *jsonp_strndup(const char *str, size_t length) JANSSON_ATTRS((warn_unused_r
 char *jsonp_strdup(const char *str) JANSSON_ATTRS((warn_unused_result));
 char *jsonp_strndup(const char *str, size_t len) JANSSON_ATTRS((warn_unused_result));
 
-/* Circular reference check*/
-/* Space for "0x", double the sizeof a pointer for the hex and a terminator. */
-#define LOOP_KEY_LEN (2 + (sizeof(json_t *) * 2) + 1)
-int jsonp_loop_check(hashtable_t *parents, const json_t *json, char *key, size_t key_size,
-                     size_t *key_len_out);
+/* Arena aware wrappers: allocate from arena if it's not NULL, and
+   only forward to jsonp_free() for heap memory */
+void *jsonp_arena_malloc(json_arena_t *arena, size_t size)
+    JANSSON_ATTRS((warn_unused_result));
+char *jsonp_arena_strndup(json_arena_t *arena, const char *str, size_t len)
+    JANSSON_ATTRS((warn_unused_result));
+void jsonp_arena_free(json_arena_t *arena, void *ptr);
+int jsonp_arena_owns(const json_arena_t *arena, const void *ptr);
+/* Held around allocations made while only reading arena values, which
+   other threads may be doing at the same time */
+void jsonp_arena_lock(json_arena_t *arena);
+void jsonp_arena_unlock(json_arena_t *arena);
+
+/* Circular reference check: the containers a recursive walk is inside
+   of, kept in an open-addressed set of pointers. The set starts out in
+   the inline slots, on the caller's stack, and only moves to the heap
+   for deep nesting. A NULL set checks nothing. */
+#define LOOP_SET_INLINE 64
+
+typedef struct {
+    const json_t **slots;
+    size_t mask;
+    size_t count;
+    const json_t *inline_slots[LOOP_SET_INLINE];
+} loop_set_t;
+
+void jsonp_loop_init(loop_set_t *set);
+void jsonp_loop_close(loop_set_t *set);
+/* -1 if json is already being visited, or on allocation failure */
+int jsonp_loop_enter(loop_set_t *set, const json_t *json);
+void jsonp_loop_leave(loop_set_t *set, const json_t *json);
 
 /* Windows compatibility */
 #if defined(_WIN32) || defined(WIN32)
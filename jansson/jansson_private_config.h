@@ -3,6 +3,7 @@
 #define HAVE_SCHED_H 1
 #define HAVE_UNISTD_H 1
 #define HAVE_SYS_PARAM_H 1
+#define HAVE_SYS_MMAN_H 1
 #define HAVE_SYS_STAT_H 1
 #define HAVE_SYS_TIME_H 1
 #define HAVE_SYS_TYPES_H 1
@@ -11,6 +12,7 @@
 #define HAVE_CLOSE 1
 #define HAVE_GETPID 1
 #define HAVE_GETTIMEOFDAY 1
+#define HAVE_MMAP 1
 #define HAVE_OPEN 1
 #define HAVE_READ 1
 #define HAVE_SCHED_YIELD 1
@@ -20,6 +20,20 @@
 #ifdef HAVE_UNISTD_H
 #include <unistd.h>
 #endif
+#ifdef HAVE_FCNTL_H
+#include <fcntl.h>
+#endif
+#ifdef HAVE_SYS_STAT_H
+#include <sys/stat.h>
+#endif
+#if defined(HAVE_MMAP) && defined(HAVE_SYS_MMAN_H)
+#include <sys/mman.h>
+#define JSON_LOAD_MMAP 1
+#endif
+#if defined(_WIN32)
+#include <windows.h>
+#define JSON_LOAD_MMAP 1
+#endif
 
 #include "jansson.h"
 #include "strbuffer.h"
@@ -65,13 +79,24 @@ typedef struct {
 typedef struct {
     stream_t stream;
     strbuffer_t saved_text;
+    json_arena_t *arena;
+    const char *window;     /* contiguous input of json_loads/json_loadb, or NULL */
+    const char *window_end;
+    size_t *window_pos;     /* read offset of the stream into window */
+    int insitu;             /* JSON_INSITU: window is writable */
     size_t flags;
     size_t depth;
+    int single_line;        /* JSON_DECODE_LINES, inside a document: stop at '\n' */
+    json_t **stack;         /* open containers of parse_value(), kept for */
+    size_t stack_size;      /* the next value a json_reader_t reads */
+    json_t *small_stack[32];
     int token;
     union {
         struct {
             char *val;
             size_t len;
+            int borrowed; /* val points into the input buffer, or to small */
+            char small[JSON_STRING_INLINE + 1]; /* short strings, saves an allocation */
         } string;
         json_int_t integer;
         double real;
@@ -264,10 +289,49 @@ static void lex_save_cached(lex_t *lex) {
     }
 }
 
+/* The contiguous input can be scanned directly only when the stream
+   holds no cached bytes, i.e. its read offset is the next byte. */
+static int lex_window_ready(const lex_t *lex) {
+    return lex->window && lex->stream.state == STREAM_STATE_OK &&
+           lex->stream.buffer[lex->stream.buffer_pos] == '\0';
+}
+
+/* consume len bytes (on a single line) of the window */
+static void lex_window_advance(lex_t *lex, size_t len, size_t columns) {
+    *lex->window_pos += len;
+    lex->stream.position += len;
+    lex->stream.column += columns;
+}
+
+static void lex_skip_space_window(lex_t *lex) {
+    stream_t *stream = &lex->stream;
+    const char *start = lex->window + *lex->window_pos;
+    const char *p = start, *end = lex->window_end;
+
+    while (p < end) {
+        if (*p == '\n') {
+            if (lex->single_line)
+                break;
+            stream->line++;
+            stream->last_column = stream->column;
+            stream->column = 0;
+        } else if (*p == ' ' || *p == '\t' || *p == '\r')
+            stream->column++;
+        else
+            break;
+        p++;
+    }
+
+    *lex->window_pos += p - start;
+    stream->position += p - start;
+}
+
 static void lex_free_string(lex_t *lex) {
-    jsonp_free(lex->value.string.val);
+    if (!lex->value.string.borrowed)
+        jsonp_arena_free(lex->arena, lex->value.string.val);
     lex->value.string.val = NULL;
     lex->value.string.len = 0;
+    lex->value.string.borrowed = 0;
 }
 
 /* assumes that str points to 'u' plus at least 4 valid hex digits */
@@ -293,78 +357,11 @@ static int32_t decode_unicode_escape(const char *str) {
     return value;
 }
 
-static void lex_scan_string(lex_t *lex, json_error_t *error) {
-    int c;
-    const char *p;
-    char *t;
-    int i;
-
-    lex->value.string.val = NULL;
-    lex->token = TOKEN_INVALID;
-
-    c = lex_get_save(lex, error);
-
-    while (c != '"') {
-        if (c == STREAM_STATE_ERROR)
-            goto out;
-
-        else if (c == STREAM_STATE_EOF) {
-            error_set(error, lex, json_error_premature_end_of_input,
-                      "premature end of input");
-            goto out;
-        }
-
-        else if (0 <= c && c <= 0x1F) {
-            /* control character */
-            lex_unget_unsave(lex, c);
-            if (c == '\n')
-                error_set(error, lex, json_error_invalid_syntax, "unexpected newline");
-            else
-                error_set(error, lex, json_error_invalid_syntax, "control character 0x%x",
-                          c);
-            goto out;
-        }
-
-        else if (c == '\\') {
-            c = lex_get_save(lex, error);
-            if (c == 'u') {
-                c = lex_get_save(lex, error);
-                for (i = 0; i < 4; i++) {
-                    if (!l_isxdigit(c)) {
-                        error_set(error, lex, json_error_invalid_syntax,
-                                  "invalid escape");
-                        goto out;
-                    }
-                    c = lex_get_save(lex, error);
-                }
-            } else if (c == '"' || c == '\\' || c == '/' || c == 'b' || c == 'f' ||
-                       c == 'n' || c == 'r' || c == 't')
-                c = lex_get_save(lex, error);
-            else {
-                error_set(error, lex, json_error_invalid_syntax, "invalid escape");
-                goto out;
-            }
-        } else
-            c = lex_get_save(lex, error);
-    }
-
-    /* the actual value is at most of the same length as the source
-       string, because:
-         - shortcut escapes (e.g. "\t") (length 2) are converted to 1 byte
-         - a single \uXXXX escape (length 6) is converted to at most 3 bytes
-         - two \uXXXX escapes (length 12) forming an UTF-16 surrogate pair
-           are converted to 4 bytes
-    */
-    t = jsonp_malloc(lex->saved_text.length + 1);
-    if (!t) {
-        /* this is not very nice, since TOKEN_INVALID is returned */
-        goto out;
-    }
-    lex->value.string.val = t;
-
-    /* + 1 to skip the " */
-    p = strbuffer_value(&lex->saved_text) + 1;
-
+/* Decode the string body starting at p up to the closing '"' into t,
+   which may be p itself. end bounds the raw text. Returns the end of the
+   decoded value or NULL on an invalid Unicode escape. */
+static char *lex_unescape(lex_t *lex, const char *p, const char *end, char *t,
+                          json_error_t *error) {
     while (*p != '"') {
         if (*p == '\\') {
             p++;
@@ -376,7 +373,7 @@ static void lex_scan_string(lex_t *lex, json_error_t *error) {
                 if (value < 0) {
                     error_set(error, lex, json_error_invalid_syntax,
                               "invalid Unicode escape '%.6s'", p - 1);
-                    goto out;
+                    return NULL;
                 }
                 p += 5;
 
@@ -387,7 +384,7 @@ static void lex_scan_string(lex_t *lex, json_error_t *error) {
                         if (value2 < 0) {
                             error_set(error, lex, json_error_invalid_syntax,
                                       "invalid Unicode escape '%.6s'", p - 1);
-                            goto out;
+                            return NULL;
                         }
                         p += 5;
 
@@ -399,18 +396,18 @@ static void lex_scan_string(lex_t *lex, json_error_t *error) {
                             /* invalid second surrogate */
                             error_set(error, lex, json_error_invalid_syntax,
                                       "invalid Unicode '\\u%04X\\u%04X'", value, value2);
-                            goto out;
+                            return NULL;
                         }
                     } else {
                         /* no second surrogate */
                         error_set(error, lex, json_error_invalid_syntax,
                                   "invalid Unicode '\\u%04X'", value);
-                        goto out;
+                        return NULL;
                     }
                 } else if (0xDC00 <= value && value <= 0xDFFF) {
                     error_set(error, lex, json_error_invalid_syntax,
                               "invalid Unicode '\\u%04X'", value);
-                    goto out;
+                    return NULL;
                 }
 
                 if (utf8_encode(value, t, &length))
@@ -444,136 +441,439 @@ static void lex_scan_string(lex_t *lex, json_error_t *error) {
                 t++;
                 p++;
             }
-        } else
-            *(t++) = *(p++);
+        } else {
+            /* copy up to the next escape in one go */
+            size_t length = utf8_span_plain(p, end - p, 0);
+            if (length == 0)
+                length = 1;
+            memmove(t, p, length);
+            t += length;
+            p += length;
+        }
     }
     *t = '\0';
-    lex->value.string.len = t - lex->value.string.val;
-    lex->token = TOKEN_STRING;
-    return;
-
-out:
-    lex_free_string(lex);
+    return t;
 }
 
-#ifndef JANSSON_USING_CMAKE /* disabled if using cmake */
-#if JSON_INTEGER_IS_LONG_LONG
-#ifdef _MSC_VER /* Microsoft Visual Studio */
-#define json_strtoint _strtoi64
-#else
-#define json_strtoint strtoll
-#endif
-#else
-#define json_strtoint strtol
-#endif
-#endif
+/* Scan the string body straight from the window. The body is validated
+   before anything is consumed or decoded, so on failure lex_scan_string()
+   can take over from the same position and report the error. With
+   JSON_INSITU the body is decoded in place and the value points into the
+   input buffer. Returns 0 on success. */
+static int lex_scan_string_window(lex_t *lex) {
+    const char *start = lex->window + *lex->window_pos;
+    const char *end = lex->window_end;
+    const char *p = start;
+    char *val, *t;
+    size_t columns = 0, raw_len;
+    int escapes = 0, i;
+
+    if (!lex_window_ready(lex))
+        return -1;
 
-static int lex_scan_number(lex_t *lex, int c, json_error_t *error) {
-    const char *saved_text;
-    char *end;
-    double doubleval;
+    while (1) {
+        unsigned char u;
+        size_t plain = utf8_span_plain(p, end - p, 0);
 
-    lex->token = TOKEN_INVALID;
+        p += plain;
+        columns += plain;
+        if (p >= end)
+            return -1;
 
-    if (c == '-')
-        c = lex_get_save(lex, error);
+        u = (unsigned char)*p;
+        columns++;
 
-    if (c == '0') {
-        c = lex_get_save(lex, error);
-        if (l_isdigit(c)) {
-            lex_unget_unsave(lex, c);
-            goto out;
-        }
-    } else if (l_isdigit(c)) {
-        do
-            c = lex_get_save(lex, error);
-        while (l_isdigit(c));
-    } else {
-        lex_unget_unsave(lex, c);
-        goto out;
-    }
+        if (u == '"')
+            break;
 
-    if (!(lex->flags & JSON_DECODE_INT_AS_REAL) && c != '.' && c != 'E' && c != 'e') {
-        json_int_t intval;
+        if (u <= 0x1F)
+            return -1;
 
-        lex_unget_unsave(lex, c);
+        if (u == '\\') {
+            escapes = 1;
+            if (end - p < 2)
+                return -1;
+
+            if (p[1] != 'u') {
+                if (!p[1] || !strchr("\"\\/bfnrt", p[1]))
+                    return -1;
+                p += 2;
+                columns++;
+                continue;
+            }
 
-        saved_text = strbuffer_value(&lex->saved_text);
+            /* also reject bad surrogates here, they are reported only
+               while decoding */
+            for (i = 0; i < 2; i++) {
+                int32_t value;
+                int k;
 
-        errno = 0;
-        intval = json_strtoint(saved_text, &end, 10);
-        if (errno == ERANGE) {
-            if (intval < 0)
-                error_set(error, lex, json_error_numeric_overflow,
-                          "too big negative integer");
-            else
-                error_set(error, lex, json_error_numeric_overflow, "too big integer");
-            goto out;
+                if (end - p < 6)
+                    return -1;
+                for (k = 2; k < 6; k++) {
+                    if (!l_isxdigit(p[k]))
+                        return -1;
+                }
+
+                value = decode_unicode_escape(p + 1);
+                p += 6;
+                columns += 5 + (i ? 1 : 0);
+
+                if (i == 0) {
+                    if (0xDC00 <= value && value <= 0xDFFF)
+                        return -1;
+                    if (value < 0xD800 || value > 0xDBFF)
+                        break;
+                    if (end - p < 2 || p[0] != '\\' || p[1] != 'u')
+                        return -1;
+                } else if (value < 0xDC00 || value > 0xDFFF)
+                    return -1;
+            }
+            continue;
         }
 
-        assert(end == saved_text + lex->saved_text.length);
+        if (u >= 0x80) {
+            size_t count = utf8_check_first(*p);
+            if (!count || count > (size_t)(end - p) || !utf8_check_full(p, count, NULL))
+                return -1;
+            p += count;
+        } else
+            p++;
+    }
 
-        lex->token = TOKEN_INTEGER;
-        lex->value.integer = intval;
-        return 0;
+    if (lex->insitu)
+        val = (char *)start;
+    else if (p - start <= JSON_STRING_INLINE)
+        val = lex->value.string.small;
+    else {
+        val = jsonp_arena_malloc(lex->arena, p - start + 1);
+        if (!val)
+            return -1;
     }
 
-    if (c == '.') {
-        c = lex_get(lex, error);
-        if (!l_isdigit(c)) {
-            lex_unget(lex, c);
-            goto out;
-        }
-        lex_save(lex, c);
+    /* keep the head of the raw token for error messages, see error_set() */
+    raw_len = p + 1 - start;
+    strbuffer_append_bytes(&lex->saved_text, start, raw_len < 20 ? raw_len : 20);
 
-        do
-            c = lex_get_save(lex, error);
-        while (l_isdigit(c));
+    if (escapes)
+        t = lex_unescape(lex, start, p, val, NULL);
+    else {
+        if (val != start)
+            memcpy(val, start, p - start);
+        t = val + (p - start);
+        *t = '\0';
     }
 
-    if (c == 'E' || c == 'e') {
-        c = lex_get_save(lex, error);
-        if (c == '+' || c == '-')
-            c = lex_get_save(lex, error);
+    lex_window_advance(lex, raw_len, columns);
 
-        if (!l_isdigit(c)) {
+    lex->value.string.val = val;
+    lex->value.string.len = t - val;
+    lex->value.string.borrowed = lex->insitu || val == lex->value.string.small;
+    lex->token = TOKEN_STRING;
+    return 0;
+}
+
+static void lex_scan_string(lex_t *lex, json_error_t *error) {
+    int c;
+    const char *p;
+    char *t;
+    int i;
+
+    lex->value.string.val = NULL;
+    lex->value.string.borrowed = 0;
+    lex->token = TOKEN_INVALID;
+
+    c = lex_get_save(lex, error);
+
+    while (c != '"') {
+        if (c == STREAM_STATE_ERROR)
+            goto out;
+
+        else if (c == STREAM_STATE_EOF) {
+            error_set(error, lex, json_error_premature_end_of_input,
+                      "premature end of input");
+            goto out;
+        }
+
+        else if (0 <= c && c <= 0x1F) {
+            /* control character */
             lex_unget_unsave(lex, c);
+            if (c == '\n')
+                error_set(error, lex, json_error_invalid_syntax, "unexpected newline");
+            else
+                error_set(error, lex, json_error_invalid_syntax, "control character 0x%x",
+                          c);
             goto out;
         }
 
-        do
+        else if (c == '\\') {
+            c = lex_get_save(lex, error);
+            if (c == 'u') {
+                c = lex_get_save(lex, error);
+                for (i = 0; i < 4; i++) {
+                    if (!l_isxdigit(c)) {
+                        error_set(error, lex, json_error_invalid_syntax,
+                                  "invalid escape");
+                        goto out;
+                    }
+                    c = lex_get_save(lex, error);
+                }
+            } else if (c == '"' || c == '\\' || c == '/' || c == 'b' || c == 'f' ||
+                       c == 'n' || c == 'r' || c == 't')
+                c = lex_get_save(lex, error);
+            else {
+                error_set(error, lex, json_error_invalid_syntax, "invalid escape");
+                goto out;
+            }
+        } else
             c = lex_get_save(lex, error);
-        while (l_isdigit(c));
     }
 
-    lex_unget_unsave(lex, c);
+    /* the actual value is at most of the same length as the source
+       string, because:
+         - shortcut escapes (e.g. "\t") (length 2) are converted to 1 byte
+         - a single \uXXXX escape (length 6) is converted to at most 3 bytes
+         - two \uXXXX escapes (length 12) forming an UTF-16 surrogate pair
+           are converted to 4 bytes
+    */
+    if (lex->saved_text.length + 1 <= sizeof(lex->value.string.small)) {
+        t = lex->value.string.small;
+        lex->value.string.borrowed = 1;
+    } else {
+        t = jsonp_arena_malloc(lex->arena, lex->saved_text.length + 1);
+        if (!t) {
+            /* this is not very nice, since TOKEN_INVALID is returned */
+            goto out;
+        }
+    }
+    lex->value.string.val = t;
 
-    if (jsonp_strtod(&lex->saved_text, &doubleval)) {
-        error_set(error, lex, json_error_numeric_overflow, "real number overflow");
+    /* + 1 to skip the " */
+    p = strbuffer_value(&lex->saved_text) + 1;
+
+    t = lex_unescape(lex, p, p + lex->saved_text.length - 1, t, error);
+    if (!t)
         goto out;
-    }
 
-    lex->token = TOKEN_REAL;
-    lex->value.real = doubleval;
-    return 0;
+    lex->value.string.len = t - lex->value.string.val;
+    lex->token = TOKEN_STRING;
+    return;
 
 out:
-    return -1;
+    lex_free_string(lex);
 }
 
-static int lex_scan(lex_t *lex, json_error_t *error) {
-    int c;
+#if JSON_INTEGER_IS_LONG_LONG
+#define JSON_INTEGER_MAX LLONG_MAX
+#else
+#define JSON_INTEGER_MAX LONG_MAX
+#endif
 
-    strbuffer_clear(&lex->saved_text);
+/* Find the end of a well-formed number in [p, end) whose first character
+   c has already been read, accumulating the digits of an integer into
+   *integer on the way (modulo 2^64, *digits counts them). Returns NULL if
+   the number is malformed, so that lex_scan_number() can report the
+   error. */
+static const char *scan_number(const char *p, const char *end, int c, int *real,
+                               uint64_t *integer, int *digits) {
+    uint64_t value;
+    const char *first;
 
-    if (lex->token == TOKEN_STRING)
-        lex_free_string(lex);
+    *real = 0;
 
-    do
-        c = lex_get(lex, error);
-    while (c == ' ' || c == '\t' || c == '\n' || c == '\r');
+    if (c == '-') {
+        if (p == end)
+            return NULL;
+        c = *p++;
+    }
 
-    if (c == STREAM_STATE_EOF) {
+    value = (uint64_t)(c - '0');
+    first = p;
+    if (c == '0') {
+        if (p < end && l_isdigit(*p))
+            return NULL;
+    } else if (l_isdigit(c)) {
+        while (p < end && l_isdigit(*p)) {
+            value = 10 * value + (uint64_t)(*p - '0');
+            p++;
+        }
+    } else
+        return NULL;
+
+    *integer = value;
+    *digits = (int)(p - first) + 1;
+
+    if (p < end && *p == '.') {
+        if (end - p < 2 || !l_isdigit(p[1]))
+            return NULL;
+        p += 2;
+        while (p < end && l_isdigit(*p))
+            p++;
+        *real = 1;
+    }
+
+    if (p < end && (*p == 'E' || *p == 'e')) {
+        p++;
+        if (p < end && (*p == '+' || *p == '-'))
+            p++;
+        if (p == end || !l_isdigit(*p))
+            return NULL;
+        while (p < end && l_isdigit(*p))
+            p++;
+        *real = 1;
+    }
+
+    return p;
+}
+
+/* convert the number in saved_text to TOKEN_INTEGER or TOKEN_REAL, from
+   the digits accumulated by scan_number() for an integer */
+static int lex_convert_number(lex_t *lex, int real, uint64_t integer, int digits,
+                              json_error_t *error) {
+    const char *saved_text = strbuffer_value(&lex->saved_text);
+    double doubleval;
+
+    if (!real && !(lex->flags & JSON_DECODE_INT_AS_REAL)) {
+        int negative = saved_text[0] == '-';
+        uint64_t limit = (uint64_t)JSON_INTEGER_MAX + negative;
+
+        /* 19 digits never wrap around 2^64 */
+        if (digits > 19 || integer > limit) {
+            if (negative)
+                error_set(error, lex, json_error_numeric_overflow,
+                          "too big negative integer");
+            else
+                error_set(error, lex, json_error_numeric_overflow, "too big integer");
+            return -1;
+        }
+
+        lex->token = TOKEN_INTEGER;
+        lex->value.integer =
+            negative ? (json_int_t)(0 - integer) : (json_int_t)integer;
+        return 0;
+    }
+
+    if (jsonp_strtod(saved_text, lex->saved_text.length, &doubleval)) {
+        error_set(error, lex, json_error_numeric_overflow, "real number overflow");
+        return -1;
+    }
+
+    lex->token = TOKEN_REAL;
+    lex->value.real = doubleval;
+    return 0;
+}
+
+/* convert a number read through the stream, whose text is in saved_text */
+static int lex_convert_saved_number(lex_t *lex, json_error_t *error) {
+    const char *saved_text = strbuffer_value(&lex->saved_text);
+    uint64_t integer = 0;
+    int real, digits = 0;
+
+    scan_number(saved_text + 1, saved_text + lex->saved_text.length, saved_text[0], &real,
+                &integer, &digits);
+    return lex_convert_number(lex, real, integer, digits, error);
+}
+
+static int lex_scan_number(lex_t *lex, int c, json_error_t *error) {
+    lex->token = TOKEN_INVALID;
+
+    if (lex_window_ready(lex)) {
+        const char *start = lex->window + *lex->window_pos;
+        const char *p;
+        uint64_t integer;
+        int real, digits;
+
+        p = scan_number(start, lex->window_end, c, &real, &integer, &digits);
+        if (p) {
+            strbuffer_append_bytes(&lex->saved_text, start, p - start);
+            lex_window_advance(lex, p - start, p - start);
+            return lex_convert_number(lex, real, integer, digits, error);
+        }
+    }
+
+    if (c == '-')
+        c = lex_get_save(lex, error);
+
+    if (c == '0') {
+        c = lex_get_save(lex, error);
+        if (l_isdigit(c)) {
+            lex_unget_unsave(lex, c);
+            goto out;
+        }
+    } else if (l_isdigit(c)) {
+        do
+            c = lex_get_save(lex, error);
+        while (l_isdigit(c));
+    } else {
+        lex_unget_unsave(lex, c);
+        goto out;
+    }
+
+    if (!(lex->flags & JSON_DECODE_INT_AS_REAL) && c != '.' && c != 'E' && c != 'e') {
+        lex_unget_unsave(lex, c);
+        return lex_convert_saved_number(lex, error);
+    }
+
+    if (c == '.') {
+        c = lex_get(lex, error);
+        if (!l_isdigit(c)) {
+            lex_unget(lex, c);
+            goto out;
+        }
+        lex_save(lex, c);
+
+        do
+            c = lex_get_save(lex, error);
+        while (l_isdigit(c));
+    }
+
+    if (c == 'E' || c == 'e') {
+        c = lex_get_save(lex, error);
+        if (c == '+' || c == '-')
+            c = lex_get_save(lex, error);
+
+        if (!l_isdigit(c)) {
+            lex_unget_unsave(lex, c);
+            goto out;
+        }
+
+        do
+            c = lex_get_save(lex, error);
+        while (l_isdigit(c));
+    }
+
+    lex_unget_unsave(lex, c);
+    return lex_convert_saved_number(lex, error);
+
+out:
+    return -1;
+}
+
+static int lex_scan(lex_t *lex, json_error_t *error) {
+    int c;
+
+    strbuffer_clear(&lex->saved_text);
+
+    if (lex->token == TOKEN_STRING)
+        lex_free_string(lex);
+
+    if (lex_window_ready(lex))
+        lex_skip_space_window(lex);
+
+    do
+        c = lex_get(lex, error);
+    while (c == ' ' || c == '\t' || c == '\r' || (c == '\n' && !lex->single_line));
+
+    if (c == '\n') {
+        /* an invalid token, left for json_reader_skip_line() so that it
+           drops no more than the line of the broken document */
+        lex_unget(lex, c);
+        strbuffer_append_bytes(&lex->saved_text, "\\n", 2);
+        lex->token = TOKEN_INVALID;
+        goto out;
+    }
+
+    if (c == STREAM_STATE_EOF) {
         lex->token = TOKEN_EOF;
         goto out;
     }
@@ -588,8 +888,10 @@ static int lex_scan(lex_t *lex, json_error_t *error) {
     if (c == '{' || c == '}' || c == '[' || c == ']' || c == ':' || c == ',')
         lex->token = c;
 
-    else if (c == '"')
-        lex_scan_string(lex, error);
+    else if (c == '"') {
+        if (!lex->window || lex_scan_string_window(lex))
+            lex_scan_string(lex, error);
+    }
 
     else if (l_isdigit(c) || c == '-') {
         if (lex_scan_number(lex, c, error))
@@ -600,10 +902,20 @@ static int lex_scan(lex_t *lex, json_error_t *error) {
         /* eat up the whole identifier for clearer error messages */
         const char *saved_text;
 
-        do
-            c = lex_get_save(lex, error);
-        while (l_isalpha(c));
-        lex_unget_unsave(lex, c);
+        if (lex_window_ready(lex)) {
+            const char *start = lex->window + *lex->window_pos;
+            const char *p = start;
+
+            while (p < lex->window_end && l_isalpha(*p))
+                p++;
+            strbuffer_append_bytes(&lex->saved_text, start, p - start);
+            lex_window_advance(lex, p - start, p - start);
+        } else {
+            do
+                c = lex_get_save(lex, error);
+            while (l_isalpha(c));
+            lex_unget_unsave(lex, c);
+        }
 
         saved_text = strbuffer_value(&lex->saved_text);
 
@@ -635,16 +947,29 @@ static char *lex_steal_string(lex_t *lex, size_t *out_len) {
         *out_len = lex->value.string.len;
         lex->value.string.val = NULL;
         lex->value.string.len = 0;
+        lex->value.string.borrowed = 0;
     }
     return result;
 }
 
+static void lex_free_key(lex_t *lex, char *key, int borrowed) {
+    if (!borrowed)
+        jsonp_arena_free(lex->arena, key);
+}
+
 static int lex_init(lex_t *lex, get_func get, size_t flags, void *data) {
+    lex->stack = lex->small_stack;
+    lex->stack_size = sizeof(lex->small_stack) / sizeof(lex->small_stack[0]);
     stream_init(&lex->stream, get, data);
     if (strbuffer_init(&lex->saved_text))
         return -1;
 
+    lex->arena = NULL;
+    lex->window = NULL;
+    lex->insitu = 0;
+    lex->value.string.borrowed = 0;
     lex->flags = flags;
+    lex->single_line = 0;
     lex->token = TOKEN_INVALID;
     return 0;
 }
@@ -653,135 +978,22 @@ static void lex_close(lex_t *lex) {
     if (lex->token == TOKEN_STRING)
         lex_free_string(lex);
     strbuffer_close(&lex->saved_text);
+    if (lex->stack != lex->small_stack)
+        jsonp_free(lex->stack);
 }
 
 /*** parser ***/
 
-static json_t *parse_value(lex_t *lex, size_t flags, json_error_t *error);
-
-static json_t *parse_object(lex_t *lex, size_t flags, json_error_t *error) {
-    json_t *object = json_object();
-    if (!object)
-        return NULL;
-
-    lex_scan(lex, error);
-    if (lex->token == '}')
-        return object;
-
-    while (1) {
-        char *key;
-        size_t len;
-        json_t *value;
-
-        if (lex->token != TOKEN_STRING) {
-            error_set(error, lex, json_error_invalid_syntax, "string or '}' expected");
-            goto error;
-        }
-
-        key = lex_steal_string(lex, &len);
-        if (!key)
-            return NULL;
-        if (memchr(key, '\0', len)) {
-            jsonp_free(key);
-            error_set(error, lex, json_error_null_byte_in_key,
-                      "NUL byte in object key not supported");
-            goto error;
-        }
-
-        if (flags & JSON_REJECT_DUPLICATES) {
-            if (json_object_getn(object, key, len)) {
-                jsonp_free(key);
-                error_set(error, lex, json_error_duplicate_key, "duplicate object key");
-                goto error;
-            }
-        }
-
-        lex_scan(lex, error);
-        if (lex->token != ':') {
-            jsonp_free(key);
-            error_set(error, lex, json_error_invalid_syntax, "':' expected");
-            goto error;
-        }
-
-        lex_scan(lex, error);
-        value = parse_value(lex, flags, error);
-        if (!value) {
-            jsonp_free(key);
-            goto error;
-        }
-
-        if (json_object_setn_new_nocheck(object, key, len, value)) {
-            jsonp_free(key);
-            goto error;
-        }
-
-        jsonp_free(key);
-
-        lex_scan(lex, error);
-        if (lex->token != ',')
-            break;
-
-        lex_scan(lex, error);
-    }
-
-    if (lex->token != '}') {
-        error_set(error, lex, json_error_invalid_syntax, "'}' expected");
-        goto error;
-    }
-
-    return object;
-
-error:
-    json_decref(object);
-    return NULL;
-}
-
-static json_t *parse_array(lex_t *lex, size_t flags, json_error_t *error) {
-    json_t *array = json_array();
-    if (!array)
-        return NULL;
-
-    lex_scan(lex, error);
-    if (lex->token == ']')
-        return array;
-
-    while (lex->token) {
-        json_t *elem = parse_value(lex, flags, error);
-        if (!elem)
-            goto error;
-
-        if (json_array_append_new(array, elem)) {
-            goto error;
-        }
-
-        lex_scan(lex, error);
-        if (lex->token != ',')
-            break;
-
-        lex_scan(lex, error);
-    }
-
-    if (lex->token != ']') {
-        error_set(error, lex, json_error_invalid_syntax, "']' expected");
-        goto error;
-    }
-
-    return array;
-
-error:
-    json_decref(array);
-    return NULL;
+static void parse_confine(json_t *json, size_t flags) {
+    /* immortal values are never counted */
+    if ((flags & JSON_DECODE_CONFINED) && json->refcount != (size_t)-1)
+        json->flags |= JSON_NODE_LOCAL;
 }
 
-static json_t *parse_value(lex_t *lex, size_t flags, json_error_t *error) {
+/* The value of a token other than '{' and '[' */
+static JSON_INLINE json_t *parse_scalar(lex_t *lex, size_t flags, json_error_t *error) {
     json_t *json;
 
-    lex->depth++;
-    if (lex->depth > JSON_PARSER_MAX_DEPTH) {
-        error_set(error, lex, json_error_stack_overflow, "maximum parsing depth reached");
-        return NULL;
-    }
-
     switch (lex->token) {
         case TOKEN_STRING: {
             const char *value = lex->value.string.val;
@@ -795,19 +1007,34 @@ static json_t *parse_value(lex_t *lex, size_t flags, json_error_t *error) {
                 }
             }
 
-            json = jsonp_stringn_nocheck_own(value, len);
+            json = (flags & JSON_DECODE_SHARED) ? jsonp_shared_string(value, len) : NULL;
+            if (json || value == lex->value.string.small) {
+                if (!json)
+                    json = jsonp_stringn_nocheck_arena(lex->arena, value, len);
+                lex_free_string(lex);
+                break;
+            }
+
+            if (lex->value.string.borrowed)
+                json = jsonp_stringn_nocheck_borrow_arena(lex->arena, value, len);
+            else
+                json = jsonp_stringn_nocheck_own_arena(lex->arena, value, len);
             lex->value.string.val = NULL;
             lex->value.string.len = 0;
+            lex->value.string.borrowed = 0;
             break;
         }
 
         case TOKEN_INTEGER: {
-            json = json_integer(lex->value.integer);
+            json = (flags & JSON_DECODE_SHARED) ? jsonp_shared_integer(lex->value.integer)
+                                                : NULL;
+            if (!json)
+                json = jsonp_integer_arena(lex->arena, lex->value.integer);
             break;
         }
 
         case TOKEN_REAL: {
-            json = json_real(lex->value.real);
+            json = jsonp_real_arena(lex->arena, lex->value.real);
             break;
         }
 
@@ -823,14 +1050,6 @@ static json_t *parse_value(lex_t *lex, size_t flags, json_error_t *error) {
             json = json_null();
             break;
 
-        case '{':
-            json = parse_object(lex, flags, error);
-            break;
-
-        case '[':
-            json = parse_array(lex, flags, error);
-            break;
-
         case TOKEN_INVALID:
             error_set(error, lex, json_error_invalid_syntax, "invalid token");
             return NULL;
@@ -840,17 +1059,223 @@ static json_t *parse_value(lex_t *lex, size_t flags, json_error_t *error) {
             return NULL;
     }
 
-    if (!json)
-        return NULL;
-
-    lex->depth--;
-    return json;
+    return json;
+}
+
+/* An object key, from parse_key() until its value is stored */
+typedef struct {
+    char *key; /* NULL if there is none */
+    size_t len;
+    int borrowed;
+    const json_key_t *interned;
+    char small[JSON_STRING_INLINE + 1];
+} parse_key_t;
+
+/* Reads a key and the ':' after it, leaving the first token of the value. */
+static int parse_key(lex_t *lex, json_t *object, size_t flags, parse_key_t *key,
+                     json_error_t *error) {
+    if (lex->token != TOKEN_STRING) {
+        error_set(error, lex, json_error_invalid_syntax, "string or '}' expected");
+        return -1;
+    }
+
+    key->borrowed = lex->value.string.borrowed;
+    key->interned = NULL;
+    key->key = lex_steal_string(lex, &key->len);
+    if (!key->key)
+        return -1;
+    if (key->key == lex->value.string.small) {
+        /* scanning the value reuses the lexer's buffer */
+        memcpy(key->small, key->key, key->len + 1);
+        key->key = key->small;
+    }
+    if (memchr(key->key, '\0', key->len)) {
+        error_set(error, lex, json_error_null_byte_in_key,
+                  "NUL byte in object key not supported");
+        goto error;
+    }
+
+    if (flags & JSON_INTERN_KEYS) {
+        /* falls back to a copied key if it is too long or the table is full */
+        key->interned = hashtable_intern(key->key, key->len);
+    }
+
+    if (flags & JSON_REJECT_DUPLICATES) {
+        if (key->interned ? json_object_get_key(object, key->interned)
+                          : json_object_getn(object, key->key, key->len)) {
+            error_set(error, lex, json_error_duplicate_key, "duplicate object key");
+            goto error;
+        }
+    }
+
+    lex_scan(lex, error);
+    if (lex->token != ':') {
+        error_set(error, lex, json_error_invalid_syntax, "':' expected");
+        goto error;
+    }
+
+    lex_scan(lex, error);
+    return 0;
+
+error:
+    lex_free_key(lex, key->key, key->borrowed);
+    key->key = NULL;
+    return -1;
+}
+
+/* Adds value to container, under key if it's an object. value is
+   released on failure. */
+static JSON_INLINE int parse_store(lex_t *lex, json_t *container, parse_key_t *key,
+                                   json_t *value) {
+    int res;
+
+    if (json_is_array(container))
+        return json_array_append_new(container, value);
+
+    res = key->interned ? json_object_set_key_new(container, key->interned, value)
+                        : json_object_setn_new_nocheck(container, key->key, key->len, value);
+    lex_free_key(lex, key->key, key->borrowed);
+    key->key = NULL;
+    return res;
+}
+
+static int parse_push(lex_t *lex, size_t top, json_t *container) {
+    if (top == lex->stack_size) {
+        json_t **stack = jsonp_malloc(2 * lex->stack_size * sizeof(json_t *));
+
+        if (!stack)
+            return -1;
+        memcpy(stack, lex->stack, top * sizeof(json_t *));
+        if (lex->stack != lex->small_stack)
+            jsonp_free(lex->stack);
+        lex->stack = stack;
+        lex->stack_size *= 2;
+    }
+    lex->stack[top] = container;
+    return 0;
+}
+
+/* Parses the value that starts with the current token. Containers are
+   added to their parent as soon as they open and kept on a stack while
+   they are filled, so nesting costs no recursion. lex->depth is the
+   nesting the value is at and stays unchanged. */
+static json_t *parse_value(lex_t *lex, size_t flags, json_error_t *error) {
+    json_t *root = NULL, *parent = NULL, *json;
+    size_t top = 0; /* open containers, parent is the innermost */
+    unsigned int domain = jsonp_hash_domain(); /* see json_hash() */
+    parse_key_t key;
+
+    key.key = NULL;
+
+    while (1) {
+        /* the current token starts the root, or the next child of parent */
+        int type = 0;
+
+        json = NULL;
+        if (parent && json_is_array(parent)) {
+            json_array_t *array = json_to_array(parent);
+
+            if (lex->token == TOKEN_EOF) {
+                error_set(error, lex, json_error_invalid_syntax, "']' expected");
+                goto error;
+            }
+
+            /* stays packed while every element is a number of the same kind */
+            if ((flags & JSON_DECODE_PACKED) &&
+                lex->depth + top < JSON_PARSER_MAX_DEPTH &&
+                (lex->token == TOKEN_REAL || lex->token == TOKEN_INTEGER)) {
+                type = lex->token == TOKEN_REAL ? JSON_REAL : JSON_INTEGER;
+                if (array->packed != type && (array->packed || array->entries))
+                    type = 0;
+            }
+        }
+
+        if (type) {
+            if (type == JSON_REAL ? jsonp_array_pack_real(parent, lex->value.real)
+                                  : jsonp_array_pack_integer(parent, lex->value.integer))
+                goto error;
+        } else {
+            if (lex->depth + top + 1 > JSON_PARSER_MAX_DEPTH) {
+                error_set(error, lex, json_error_stack_overflow,
+                          "maximum parsing depth reached");
+                goto error;
+            }
+
+            if (lex->token == '{')
+                json = jsonp_object_arena(lex->arena);
+            else if (lex->token == '[')
+                json = jsonp_array_arena(lex->arena);
+            else
+                json = parse_scalar(lex, flags, error);
+            if (!json)
+                goto error;
+            /* already now, so that unpacking an array confines the
+               elements it creates */
+            parse_confine(json, flags);
+            jsonp_set_domain(json, domain);
+
+            if (!parent)
+                root = json;
+            else if (parse_store(lex, parent, &key, json))
+                goto error;
+        }
+
+        if (json && (json_is_object(json) || json_is_array(json))) {
+            if (parse_push(lex, top, json))
+                goto error;
+            top++;
+            parent = json;
+
+            lex_scan(lex, error);
+            if (lex->token != (json_is_object(json) ? '}' : ']')) {
+                if (json_is_object(json) && parse_key(lex, json, flags, &key, error))
+                    goto error;
+                continue;
+            }
+            /* empty, the current token closes it */
+        } else {
+            if (!parent)
+                return root;
+            lex_scan(lex, error);
+        }
+
+        /* after a child of parent: the next one, or the end of parent and
+           maybe of the containers around it */
+        while (1) {
+            if (lex->token == ',') {
+                lex_scan(lex, error);
+                if (json_is_object(parent) && parse_key(lex, parent, flags, &key, error))
+                    goto error;
+                break;
+            }
+
+            if (json_is_object(parent) && lex->token != '}') {
+                error_set(error, lex, json_error_invalid_syntax, "'}' expected");
+                goto error;
+            }
+            if (json_is_array(parent) && lex->token != ']') {
+                error_set(error, lex, json_error_invalid_syntax, "']' expected");
+                goto error;
+            }
+
+            if (--top == 0)
+                return root;
+            parent = lex->stack[top - 1];
+            lex_scan(lex, error);
+        }
+    }
+
+error:
+    if (key.key)
+        lex_free_key(lex, key.key, key.borrowed);
+    json_decref(root);
+    return NULL;
 }
 
 static json_t *parse_json(lex_t *lex, size_t flags, json_error_t *error) {
     json_t *result;
 
-    lex->depth = 0;
+    lex->depth = (flags >> 16) & 0xFFF; /* JSON_DECODE_NESTED() */
 
     lex_scan(lex, error);
     if (!(flags & JSON_DECODE_ANY)) {
@@ -900,6 +1325,11 @@ static int string_get(void *data) {
 }
 
 json_t *json_loads(const char *string, size_t flags, json_error_t *error) {
+    return json_loads_arena(string, flags, NULL, error);
+}
+
+json_t *json_loads_arena(const char *string, size_t flags, json_arena_t *arena,
+                         json_error_t *error) {
     lex_t lex;
     json_t *result;
     string_data_t stream_data;
@@ -917,6 +1347,11 @@ json_t *json_loads(const char *string, size_t flags, json_error_t *error) {
     if (lex_init(&lex, string_get, flags, (void *)&stream_data))
         return NULL;
 
+    lex.arena = arena;
+    lex.window = string;
+    lex.window_end = string + strlen(string);
+    lex.window_pos = &stream_data.pos;
+    lex.insitu = (flags & JSON_INSITU) != 0;
     result = parse_json(&lex, flags, error);
 
     lex_close(&lex);
@@ -941,6 +1376,11 @@ static int buffer_get(void *data) {
 }
 
 json_t *json_loadb(const char *buffer, size_t buflen, size_t flags, json_error_t *error) {
+    return json_loadb_arena(buffer, buflen, flags, NULL, error);
+}
+
+json_t *json_loadb_arena(const char *buffer, size_t buflen, size_t flags,
+                         json_arena_t *arena, json_error_t *error) {
     lex_t lex;
     json_t *result;
     buffer_data_t stream_data;
@@ -959,6 +1399,11 @@ json_t *json_loadb(const char *buffer, size_t buflen, size_t flags, json_error_t
     if (lex_init(&lex, buffer_get, flags, (void *)&stream_data))
         return NULL;
 
+    lex.arena = arena;
+    lex.window = buffer;
+    lex.window_end = buffer + buflen;
+    lex.window_pos = &stream_data.pos;
+    lex.insitu = (flags & JSON_INSITU) != 0;
     result = parse_json(&lex, flags, error);
 
     lex_close(&lex);
@@ -1028,6 +1473,90 @@ json_t *json_loadfd(int input, size_t flags, json_error_t *error) {
     return result;
 }
 
+/* Maps a regular, non-empty file read-only into memory, and gives its
+   size. NULL if it can't be mapped: the file is a pipe, empty or
+   special, or the platform has no mappings. */
+const char *json_map_file(const char *path, size_t *size) {
+#if defined(_WIN32)
+    HANDLE file, mapping;
+    LARGE_INTEGER file_size;
+    const char *data;
+
+    if (!path || !size)
+        return NULL;
+
+    file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+                       FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (file == INVALID_HANDLE_VALUE)
+        return NULL;
+
+    if (GetFileType(file) != FILE_TYPE_DISK || !GetFileSizeEx(file, &file_size) ||
+        file_size.QuadPart <= 0 || (unsigned long long)file_size.QuadPart > (size_t)-1) {
+        CloseHandle(file);
+        return NULL;
+    }
+
+    mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (!mapping) {
+        CloseHandle(file);
+        return NULL;
+    }
+
+    /* the view keeps the mapping and the file open */
+    data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    CloseHandle(mapping);
+    CloseHandle(file);
+    if (data)
+        *size = (size_t)file_size.QuadPart;
+    return data;
+#elif defined(JSON_LOAD_MMAP)
+    struct stat st;
+    void *map;
+    int fd;
+
+    if (!path || !size)
+        return NULL;
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return NULL;
+
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size <= 0 ||
+        (unsigned long long)st.st_size > (size_t)-1) {
+        close(fd);
+        return NULL;
+    }
+
+    map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return NULL;
+
+#ifdef MADV_SEQUENTIAL
+    madvise(map, (size_t)st.st_size, MADV_SEQUENTIAL);
+#endif
+    *size = (size_t)st.st_size;
+    return map;
+#else
+    (void)path;
+    (void)size;
+    return NULL;
+#endif
+}
+
+void json_unmap_file(const char *data, size_t size) {
+    if (!data)
+        return;
+#if defined(_WIN32)
+    (void)size;
+    UnmapViewOfFile(data);
+#elif defined(JSON_LOAD_MMAP)
+    munmap((void *)data, size);
+#else
+    (void)size;
+#endif
+}
+
 json_t *json_load_file(const char *path, size_t flags, json_error_t *error) {
     json_t *result;
     FILE *fp;
@@ -1039,6 +1568,22 @@ json_t *json_load_file(const char *path, size_t flags, json_error_t *error) {
         return NULL;
     }
 
+    /* regular files are mapped and lexed straight from memory, pipes,
+       empty files and the like are read as a stream. A file truncated
+       while mapped raises SIGBUS, hence JSON_DISABLE_MMAP. */
+    if (!(flags & JSON_DISABLE_MMAP)) {
+        size_t size;
+        const char *data = json_map_file(path, &size);
+
+        if (data) {
+            /* the values can't point into the mapping, it goes away below */
+            result = json_loadb(data, size, flags & ~(size_t)JSON_INSITU, error);
+            json_unmap_file(data, size);
+            jsonp_error_set_source(error, path);
+            return result;
+        }
+    }
+
     fp = fopen(path, "rb");
     if (!fp) {
         error_set(error, NULL, json_error_cannot_open_file, "unable to open %s: %s", path,
@@ -1104,3 +1649,501 @@ json_t *json_load_callback(json_load_callback_t callback, void *arg, size_t flag
     lex_close(&lex);
     return result;
 }
+
+/*** pull parser ***/
+
+struct json_reader_t {
+    lex_t lex;
+    size_t flags;
+    json_error_t *error;
+    int event;       /* the last event returned */
+    int started;     /* the top level value has begun */
+    int need_comma;  /* a value of the innermost container was read */
+    int after_key;   /* an object key was read, its value comes next */
+    size_t depth;    /* open containers */
+    char stack[JSON_PARSER_MAX_DEPTH]; /* '{' or '[' per open container */
+    FILE *file;      /* opened by json_reader_file() */
+    int fd;          /* read by json_reader_fd() */
+    union {
+        buffer_data_t buffer;
+        callback_data_t callback;
+    } source;
+};
+
+static json_reader_t *reader_new(size_t flags, json_error_t *error) {
+    json_reader_t *reader = jsonp_malloc(sizeof(json_reader_t));
+    if (!reader) {
+        error_set(error, NULL, json_error_out_of_memory, "out of memory");
+        return NULL;
+    }
+
+    reader->flags = flags;
+    reader->error = error;
+    reader->event = JSON_EVENT_NONE;
+    reader->started = 0;
+    reader->need_comma = 0;
+    reader->after_key = 0;
+    reader->depth = 0;
+    reader->file = NULL;
+    reader->fd = -1;
+    return reader;
+}
+
+json_reader_t *json_reader_buffer(const char *buffer, size_t buflen, size_t flags,
+                                  json_error_t *error) {
+    json_reader_t *reader;
+
+    jsonp_error_init(error, "<buffer>");
+
+    if (buffer == NULL) {
+        error_set(error, NULL, json_error_invalid_argument, "wrong arguments");
+        return NULL;
+    }
+
+    reader = reader_new(flags, error);
+    if (!reader)
+        return NULL;
+
+    reader->source.buffer.data = buffer;
+    reader->source.buffer.pos = 0;
+    reader->source.buffer.len = buflen;
+
+    if (lex_init(&reader->lex, buffer_get, flags, &reader->source.buffer)) {
+        jsonp_free(reader);
+        return NULL;
+    }
+
+    reader->lex.window = buffer;
+    reader->lex.window_end = buffer + buflen;
+    reader->lex.window_pos = &reader->source.buffer.pos;
+    reader->lex.insitu = (flags & JSON_INSITU) != 0;
+    return reader;
+}
+
+json_reader_t *json_reader_callback(json_load_callback_t callback, void *arg,
+                                    size_t flags, json_error_t *error) {
+    json_reader_t *reader;
+
+    jsonp_error_init(error, "<callback>");
+
+    if (callback == NULL) {
+        error_set(error, NULL, json_error_invalid_argument, "wrong arguments");
+        return NULL;
+    }
+
+    reader = reader_new(flags, error);
+    if (!reader)
+        return NULL;
+
+    memset(&reader->source.callback, 0, sizeof(reader->source.callback));
+    reader->source.callback.callback = callback;
+    reader->source.callback.arg = arg;
+
+    if (lex_init(&reader->lex, (get_func)callback_get, flags, &reader->source.callback)) {
+        jsonp_free(reader);
+        return NULL;
+    }
+    return reader;
+}
+
+static size_t file_read(void *buffer, size_t buflen, void *data) {
+    return fread(buffer, 1, buflen, (FILE *)data);
+}
+
+json_reader_t *json_reader_file(const char *path, size_t flags, json_error_t *error) {
+    json_reader_t *reader;
+    FILE *fp;
+
+    jsonp_error_init(error, path);
+
+    if (path == NULL) {
+        error_set(error, NULL, json_error_invalid_argument, "wrong arguments");
+        return NULL;
+    }
+
+    fp = fopen(path, "rb");
+    if (!fp) {
+        error_set(error, NULL, json_error_cannot_open_file, "unable to open %s: %s", path,
+                  strerror(errno));
+        return NULL;
+    }
+
+    reader = json_reader_callback(file_read, fp, flags, error);
+    if (!reader) {
+        fclose(fp);
+        return NULL;
+    }
+
+    jsonp_error_set_source(error, path);
+    reader->file = fp;
+    return reader;
+}
+
+static size_t fd_read(void *buffer, size_t buflen, void *data) {
+#ifdef HAVE_UNISTD_H
+    ssize_t len;
+
+    do
+        len = read(*(int *)data, buffer, buflen);
+    while (len < 0 && errno == EINTR);
+    if (len > 0)
+        return (size_t)len;
+#endif
+    return 0;
+}
+
+json_reader_t *json_reader_stream(FILE *input, size_t flags, json_error_t *error) {
+    json_reader_t *reader;
+
+    if (input == NULL) {
+        jsonp_error_init(error, "<stream>");
+        error_set(error, NULL, json_error_invalid_argument, "wrong arguments");
+        return NULL;
+    }
+
+    reader = json_reader_callback(file_read, input, flags, error);
+    if (reader)
+        jsonp_error_set_source(error, input == stdin ? "<stdin>" : "<stream>");
+    return reader;
+}
+
+json_reader_t *json_reader_fd(int input, size_t flags, json_error_t *error) {
+    json_reader_t *reader;
+
+    if (input < 0) {
+        jsonp_error_init(error, "<stream>");
+        error_set(error, NULL, json_error_invalid_argument, "wrong arguments");
+        return NULL;
+    }
+
+    reader = json_reader_callback(fd_read, NULL, flags, error);
+    if (!reader)
+        return NULL;
+
+    reader->fd = input;
+    reader->source.callback.arg = &reader->fd;
+    jsonp_error_set_source(error, "<stream>");
+    return reader;
+}
+
+void json_reader_close(json_reader_t *reader) {
+    if (!reader)
+        return;
+
+    lex_close(&reader->lex);
+    if (reader->file)
+        fclose(reader->file);
+    jsonp_free(reader);
+}
+
+static int reader_fail(json_reader_t *reader, enum json_error_code code,
+                       const char *msg) {
+    error_set(reader->error, &reader->lex, code, "%s", msg);
+    reader->event = JSON_EVENT_ERROR;
+    return JSON_EVENT_ERROR;
+}
+
+/* the value that starts with the current token has ended */
+static int reader_value_done(json_reader_t *reader, int event) {
+    reader->need_comma = 1;
+    reader->event = event;
+    return event;
+}
+
+/* Emit the event of a value starting with the current token */
+static int reader_value(json_reader_t *reader) {
+    lex_t *lex = &reader->lex;
+
+    reader->started = 1;
+
+    switch (lex->token) {
+        case '{':
+        case '[':
+            if (reader->depth >= JSON_PARSER_MAX_DEPTH)
+                return reader_fail(reader, json_error_stack_overflow,
+                                   "maximum parsing depth reached");
+            reader->stack[reader->depth++] = (char)lex->token;
+            reader->need_comma = 0;
+            reader->event =
+                lex->token == '{' ? JSON_EVENT_OBJECT_START : JSON_EVENT_ARRAY_START;
+            return reader->event;
+
+        case TOKEN_STRING:
+            if (!(reader->flags & JSON_ALLOW_NUL) &&
+                memchr(lex->value.string.val, '\0', lex->value.string.len))
+                return reader_fail(reader, json_error_null_character,
+                                   "\\u0000 is not allowed without JSON_ALLOW_NUL");
+            return reader_value_done(reader, JSON_EVENT_STRING);
+
+        case TOKEN_INTEGER:
+            return reader_value_done(reader, JSON_EVENT_INTEGER);
+
+        case TOKEN_REAL:
+            return reader_value_done(reader, JSON_EVENT_REAL);
+
+        case TOKEN_TRUE:
+            return reader_value_done(reader, JSON_EVENT_TRUE);
+
+        case TOKEN_FALSE:
+            return reader_value_done(reader, JSON_EVENT_FALSE);
+
+        case TOKEN_NULL:
+            return reader_value_done(reader, JSON_EVENT_NULL);
+
+        case TOKEN_INVALID:
+            return reader_fail(reader, json_error_invalid_syntax, "invalid token");
+
+        default:
+            return reader_fail(reader, json_error_invalid_syntax, "unexpected token");
+    }
+}
+
+static int reader_close_container(json_reader_t *reader) {
+    int token = reader->stack[--reader->depth];
+    return reader_value_done(reader, token == '{' ? JSON_EVENT_OBJECT_END
+                                                  : JSON_EVENT_ARRAY_END);
+}
+
+int json_reader_next(json_reader_t *reader) {
+    lex_t *lex;
+
+    if (!reader)
+        return JSON_EVENT_ERROR;
+    if (reader->event == JSON_EVENT_ERROR || reader->event == JSON_EVENT_END)
+        return reader->event;
+
+    lex = &reader->lex;
+
+    if (reader->started && reader->depth == 0) {
+        /* the top level value is complete */
+        if (!(reader->flags & JSON_DISABLE_EOF_CHECK)) {
+            lex_scan(lex, reader->error);
+            if (lex->token != TOKEN_EOF)
+                return reader_fail(reader, json_error_end_of_input_expected,
+                                   "end of file expected");
+        }
+        if (reader->error)
+            reader->error->position = (int)lex->stream.position;
+        reader->event = JSON_EVENT_END;
+        return JSON_EVENT_END;
+    }
+
+    lex_scan(lex, reader->error);
+
+    if (reader->depth == 0) {
+        if (!(reader->flags & JSON_DECODE_ANY) && lex->token != '[' && lex->token != '{')
+            return reader_fail(reader, json_error_invalid_syntax, "'[' or '{' expected");
+        return reader_value(reader);
+    }
+
+    if (reader->stack[reader->depth - 1] == '[') {
+        if (lex->token == ']')
+            return reader_close_container(reader);
+        if (reader->need_comma) {
+            if (lex->token != ',')
+                return reader_fail(reader, json_error_invalid_syntax, "']' expected");
+            lex_scan(lex, reader->error);
+        }
+        if (lex->token == TOKEN_EOF)
+            return reader_fail(reader, json_error_invalid_syntax, "']' expected");
+        return reader_value(reader);
+    }
+
+    if (reader->after_key) {
+        if (lex->token != ':')
+            return reader_fail(reader, json_error_invalid_syntax, "':' expected");
+        reader->after_key = 0;
+        lex_scan(lex, reader->error);
+        return reader_value(reader);
+    }
+
+    if (lex->token == '}')
+        return reader_close_container(reader);
+    if (reader->need_comma) {
+        if (lex->token != ',')
+            return reader_fail(reader, json_error_invalid_syntax, "'}' expected");
+        lex_scan(lex, reader->error);
+    }
+
+    if (lex->token != TOKEN_STRING)
+        return reader_fail(reader, json_error_invalid_syntax, "string or '}' expected");
+    if (memchr(lex->value.string.val, '\0', lex->value.string.len))
+        return reader_fail(reader, json_error_null_byte_in_key,
+                           "NUL byte in object key not supported");
+
+    reader->after_key = 1;
+    reader->event = JSON_EVENT_KEY;
+    return JSON_EVENT_KEY;
+}
+
+const char *json_reader_string(const json_reader_t *reader, size_t *length) {
+    if (!reader ||
+        (reader->event != JSON_EVENT_KEY && reader->event != JSON_EVENT_STRING)) {
+        if (length)
+            *length = 0;
+        return NULL;
+    }
+
+    if (length)
+        *length = reader->lex.value.string.len;
+    return reader->lex.value.string.val;
+}
+
+json_int_t json_reader_integer(const json_reader_t *reader) {
+    if (!reader || reader->event != JSON_EVENT_INTEGER)
+        return 0;
+
+    return reader->lex.value.integer;
+}
+
+double json_reader_real(const json_reader_t *reader) {
+    if (!reader)
+        return 0.0;
+    if (reader->event == JSON_EVENT_INTEGER)
+        return (double)reader->lex.value.integer;
+    if (reader->event == JSON_EVENT_REAL)
+        return reader->lex.value.real;
+    return 0.0;
+}
+
+size_t json_reader_depth(const json_reader_t *reader) {
+    return reader ? reader->depth : 0;
+}
+
+/* Build the value the last event started, consuming the rest of it if
+   it's an object or an array. */
+json_t *json_reader_value(json_reader_t *reader) {
+    json_t *json;
+
+    if (!reader)
+        return NULL;
+
+    switch (reader->event) {
+        case JSON_EVENT_OBJECT_START:
+        case JSON_EVENT_ARRAY_START:
+            /* lex->token is still the opening bracket, parse_value()
+               reads the container itself */
+            reader->depth--;
+            break;
+
+        case JSON_EVENT_STRING:
+        case JSON_EVENT_INTEGER:
+        case JSON_EVENT_REAL:
+        case JSON_EVENT_TRUE:
+        case JSON_EVENT_FALSE:
+        case JSON_EVENT_NULL:
+            break;
+
+        default:
+            return NULL;
+    }
+
+    reader->lex.depth = reader->depth;
+    json = parse_value(&reader->lex, reader->flags, reader->error);
+    if (!json) {
+        reader->event = JSON_EVENT_ERROR;
+        return NULL;
+    }
+
+    reader_value_done(reader, JSON_EVENT_NONE);
+    return json;
+}
+
+/* Skip the rest of the value the last event started */
+int json_reader_skip(json_reader_t *reader) {
+    size_t depth;
+
+    if (!reader || reader->event == JSON_EVENT_ERROR)
+        return -1;
+    if (reader->event != JSON_EVENT_OBJECT_START &&
+        reader->event != JSON_EVENT_ARRAY_START)
+        return 0;
+
+    depth = reader->depth;
+    while (reader->depth >= depth) {
+        if (json_reader_next(reader) == JSON_EVENT_ERROR)
+            return -1;
+    }
+    return 0;
+}
+
+int json_reader_event(const json_reader_t *reader) {
+    return reader ? reader->event : JSON_EVENT_ERROR;
+}
+
+/* Read the next whole top level value, for input that holds a sequence
+   of them like newline delimited JSON. The lexer and its buffers are
+   reused from one document to the next. */
+json_t *json_reader_document(json_reader_t *reader) {
+    lex_t *lex;
+    json_t *json;
+
+    if (!reader || reader->event == JSON_EVENT_ERROR || reader->event == JSON_EVENT_END)
+        return NULL;
+
+    lex = &reader->lex;
+    if (reader->depth) {
+        error_set(reader->error, lex, json_error_invalid_argument,
+                  "not at the top level");
+        return NULL;
+    }
+
+    lex_scan(lex, reader->error);
+    if (lex->token == TOKEN_EOF) {
+        if (reader->error)
+            reader->error->position = (int)lex->stream.position;
+        reader->event = JSON_EVENT_END;
+        return NULL;
+    }
+
+    if (!(reader->flags & JSON_DECODE_ANY) && lex->token != '[' && lex->token != '{') {
+        reader_fail(reader, json_error_invalid_syntax, "'[' or '{' expected");
+        return NULL;
+    }
+
+    lex->depth = 0;
+    lex->single_line = (reader->flags & JSON_DECODE_LINES) != 0;
+    json = parse_value(lex, reader->flags, reader->error);
+    lex->single_line = 0;
+    if (!json) {
+        reader->event = JSON_EVENT_ERROR;
+        return NULL;
+    }
+
+    reader->started = 0;
+    reader->event = JSON_EVENT_NONE;
+    return json;
+}
+
+/* Recover from an error by dropping the rest of the current line, so
+   that reading goes on with the next line of newline delimited input.
+   Bytes of invalid UTF-8 are skipped like any other. */
+int json_reader_skip_line(json_reader_t *reader) {
+    stream_t *stream;
+    int c;
+
+    if (!reader)
+        return -1;
+
+    stream = &reader->lex.stream;
+    do {
+        if (stream->state == STREAM_STATE_ERROR) {
+            stream->state = STREAM_STATE_OK;
+            stream->buffer[0] = '\0';
+            stream->buffer_pos = 0;
+        }
+        c = stream_get(stream, NULL);
+    } while (c != '\n' && c != STREAM_STATE_EOF);
+
+    if (reader->error) {
+        /* jsonp_error_set() keeps the first error, make room for the next */
+        reader->error->text[0] = '\0';
+    }
+
+    reader->event = JSON_EVENT_NONE;
+    reader->started = 0;
+    reader->need_comma = 0;
+    reader->after_key = 0;
+    reader->depth = 0;
+    return 0;
+}
@@ -12,6 +12,10 @@
 #include "jansson.h"
 #include "jansson_private.h"
 
+#ifdef HAVE_SCHED_H
+#include <sched.h>
+#endif
+
 /* C89 allows these to be macros */
 #undef malloc
 #undef free
@@ -59,3 +63,205 @@ void json_get_alloc_funcs(json_malloc_t *malloc_fn, json_free_t *free_fn) {
     if (free_fn)
         *free_fn = do_free;
 }
+
+/*** arena ***/
+
+#define ARENA_DEFAULT_BLOCK_SIZE 65536
+
+/* Every allocation is rounded up to a multiple of this */
+typedef union {
+    void *p;
+    double d;
+    json_int_t i;
+} arena_align_t;
+
+#define ARENA_ALIGN       sizeof(arena_align_t)
+#define arena_round(size) (((size) + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1))
+
+typedef struct arena_block {
+    struct arena_block *next;
+    size_t size; /* bytes available after the header */
+    size_t used;
+} arena_block_t;
+
+#define ARENA_HEADER_SIZE      arena_round(sizeof(arena_block_t))
+#define arena_block_data(blk_) ((char *)(blk_) + ARENA_HEADER_SIZE)
+
+struct json_arena_t {
+    arena_block_t *first;
+    arena_block_t *current;
+    size_t block_size;
+    size_t used;          /* bytes handed out since the last reset */
+    volatile char locked; /* see jsonp_arena_lock() */
+};
+
+static arena_block_t *arena_block_new(size_t size) {
+    arena_block_t *block;
+
+    if (size > (size_t)-1 - ARENA_HEADER_SIZE)
+        return NULL;
+
+    block = jsonp_malloc(ARENA_HEADER_SIZE + size);
+    if (!block)
+        return NULL;
+
+    block->next = NULL;
+    block->size = size;
+    block->used = 0;
+    return block;
+}
+
+json_arena_t *json_arena_create(size_t block_size) {
+    json_arena_t *arena;
+
+    if (block_size == 0)
+        block_size = ARENA_DEFAULT_BLOCK_SIZE;
+
+    arena = jsonp_malloc(sizeof(json_arena_t));
+    if (!arena)
+        return NULL;
+
+    arena->block_size = arena_round(block_size);
+    arena->first = arena->current = arena_block_new(arena->block_size);
+    arena->used = 0;
+    arena->locked = 0;
+    if (!arena->first) {
+        jsonp_free(arena);
+        return NULL;
+    }
+
+    return arena;
+}
+
+/* Blocks are kept for reuse; a block further down the list is rewound
+   only when the allocator moves into it, which makes this O(1) */
+void json_arena_reset(json_arena_t *arena) {
+    if (!arena)
+        return;
+
+    arena->current = arena->first;
+    arena->current->used = 0;
+    arena->used = 0;
+}
+
+void json_arena_destroy(json_arena_t *arena) {
+    arena_block_t *block, *next;
+
+    if (!arena)
+        return;
+
+    for (block = arena->first; block; block = next) {
+        next = block->next;
+        jsonp_free(block);
+    }
+    jsonp_free(arena);
+}
+
+size_t json_arena_used(const json_arena_t *arena) { return arena ? arena->used : 0; }
+
+static void *arena_alloc(json_arena_t *arena, size_t size) {
+    arena_block_t *block = arena->current;
+    void *ptr;
+
+    if (!size || size > (size_t)-1 - ARENA_ALIGN)
+        return NULL;
+    size = arena_round(size);
+
+    if (block->size - block->used < size) {
+        /* move on to a retained block if it's big enough, otherwise
+           put a fresh one in between */
+        if (block->next && block->next->size >= size) {
+            block = block->next;
+        } else {
+            arena_block_t *fresh = arena_block_new(max(size, arena->block_size));
+            if (!fresh)
+                return NULL;
+
+            fresh->next = block->next;
+            block->next = fresh;
+            block = fresh;
+        }
+        block->used = 0;
+        arena->current = block;
+    }
+
+    ptr = arena_block_data(block) + block->used;
+    block->used += size;
+    arena->used += size;
+    return ptr;
+}
+
+void *jsonp_arena_malloc(json_arena_t *arena, size_t size) {
+    if (!arena)
+        return jsonp_malloc(size);
+
+    return arena_alloc(arena, size);
+}
+
+char *jsonp_arena_strndup(json_arena_t *arena, const char *str, size_t len) {
+    char *new_str;
+
+    if (!arena)
+        return jsonp_strndup(str, len);
+
+    new_str = arena_alloc(arena, len + 1);
+    if (!new_str)
+        return NULL;
+
+    memcpy(new_str, str, len);
+    new_str[len] = '\0';
+    return new_str;
+}
+
+/* Whether ptr was handed out by arena since its last reset. The current
+   block is tried first, as values are mostly stored right after being
+   allocated; blocks past it only hold memory from before the reset. */
+int jsonp_arena_owns(const json_arena_t *arena, const void *ptr) {
+    const arena_block_t *block = arena->current;
+    const char *p = ptr;
+
+    if (p >= arena_block_data(block) && p < arena_block_data(block) + block->used)
+        return 1;
+
+    for (block = arena->first; block != arena->current; block = block->next) {
+        if (p >= arena_block_data(block) && p < arena_block_data(block) + block->used)
+            return 1;
+    }
+    return 0;
+}
+
+void jsonp_arena_free(json_arena_t *arena, void *ptr) {
+    /* arena memory is only released as a whole */
+    if (!arena)
+        jsonp_free(ptr);
+}
+
+#ifdef HAVE_SCHED_YIELD
+#define arena_yield() sched_yield()
+#else
+#define arena_yield() ((void)0)
+#endif
+
+/* Allocating into an arena is otherwise never safe from several threads,
+   and still isn't alongside a thread changing values of the arena */
+void jsonp_arena_lock(json_arena_t *arena) {
+#if defined(HAVE_ATOMIC_BUILTINS)
+    while (__atomic_test_and_set(&arena->locked, __ATOMIC_ACQUIRE))
+        arena_yield();
+#elif defined(HAVE_SYNC_BUILTINS)
+    while (__sync_lock_test_and_set(&arena->locked, 1))
+        arena_yield();
+#else
+    (void)arena;
+#endif
+}
+
+void jsonp_arena_unlock(json_arena_t *arena) {
+#if defined(HAVE_ATOMIC_BUILTINS)
+    __atomic_clear(&arena->locked, __ATOMIC_RELEASE);
+#elif defined(HAVE_SYNC_BUILTINS)
+    __sync_lock_release(&arena->locked);
+#else
+    (void)arena;
+#endif
+}
@@ -16,11 +16,13 @@ typedef struct {
     int column;
     size_t pos;
     char token;
+    char lenient; /* '{' of a template whose keys needn't all be unpacked */
 } token_t;
 
 typedef struct {
     const char *start;
     const char *fmt;
+    const token_t *tokens; /* of a compiled template, instead of fmt */
     token_t prev_token;
     token_t token;
     token_t next_token;
@@ -46,6 +48,7 @@ static void scanner_init(scanner_t *s, json_error_t *error, size_t flags,
     s->error = error;
     s->flags = flags;
     s->fmt = s->start = fmt;
+    s->tokens = NULL;
     memset(&s->prev_token, 0, sizeof(token_t));
     memset(&s->token, 0, sizeof(token_t));
     memset(&s->next_token, 0, sizeof(token_t));
@@ -65,6 +68,14 @@ static void next_token(scanner_t *s) {
         return;
     }
 
+    if (s->tokens) {
+        /* replay what json_template_compile() scanned, up to the final '\0' */
+        s->token = *s->tokens;
+        if (token(s))
+            s->tokens++;
+        return;
+    }
+
     if (!token(s) && !*s->fmt)
         return;
 
@@ -473,8 +484,9 @@ static int unpack_object(scanner_t *s, json_t *root, va_list *ap) {
        multiple times.
     */
     hashtable_t key_set;
+    int track_keys = !s->token.lenient;
 
-    if (hashtable_init(&key_set)) {
+    if (track_keys && hashtable_init(&key_set)) {
         set_error(s, "<internal>", json_error_out_of_memory, "Out of memory");
         return -1;
     }
@@ -544,7 +556,8 @@ static int unpack_object(scanner_t *s, json_t *root, va_list *ap) {
         if (unpack(s, value, ap))
             goto out;
 
-        hashtable_set(&key_set, key, strlen(key), json_null());
+        if (track_keys)
+            hashtable_set(&key_set, key, strlen(key), json_null());
         next_token(s);
     }
 
@@ -591,7 +604,8 @@ static int unpack_object(scanner_t *s, json_t *root, va_list *ap) {
     ret = 0;
 
 out:
-    hashtable_close(&key_set);
+    if (track_keys)
+        hashtable_close(&key_set);
     return ret;
 }
 
@@ -816,34 +830,24 @@ static int unpack(scanner_t *s, json_t *root, va_list *ap) {
     }
 }
 
-json_t *json_vpack_ex(json_error_t *error, size_t flags, const char *fmt, va_list ap) {
-    scanner_t s;
+static json_t *vpack(scanner_t *s, va_list ap) {
     va_list ap_copy;
     json_t *value;
 
-    if (!fmt || !*fmt) {
-        jsonp_error_init(error, "<format>");
-        jsonp_error_set(error, -1, -1, 0, json_error_invalid_argument,
-                        "NULL or empty format string");
-        return NULL;
-    }
-    jsonp_error_init(error, NULL);
-
-    scanner_init(&s, error, flags, fmt);
-    next_token(&s);
+    next_token(s);
 
     va_copy(ap_copy, ap);
-    value = pack(&s, &ap_copy);
+    value = pack(s, &ap_copy);
     va_end(ap_copy);
 
-    /* This will cover all situations where s.has_error is true */
+    /* This will cover all situations where s->has_error is true */
     if (!value)
         return NULL;
 
-    next_token(&s);
-    if (token(&s)) {
+    next_token(s);
+    if (token(s)) {
         json_decref(value);
-        set_error(&s, "<format>", json_error_invalid_format,
+        set_error(s, "<format>", json_error_invalid_format,
                   "Garbage after format string");
         return NULL;
     }
@@ -851,6 +855,43 @@ json_t *json_vpack_ex(json_error_t *error, size_t flags, const char *fmt, va_lis
     return value;
 }
 
+static int vunpack(scanner_t *s, json_t *root, va_list ap) {
+    va_list ap_copy;
+
+    next_token(s);
+
+    va_copy(ap_copy, ap);
+    if (unpack(s, root, &ap_copy)) {
+        va_end(ap_copy);
+        return -1;
+    }
+    va_end(ap_copy);
+
+    next_token(s);
+    if (token(s)) {
+        set_error(s, "<format>", json_error_invalid_format,
+                  "Garbage after format string");
+        return -1;
+    }
+
+    return 0;
+}
+
+json_t *json_vpack_ex(json_error_t *error, size_t flags, const char *fmt, va_list ap) {
+    scanner_t s;
+
+    if (!fmt || !*fmt) {
+        jsonp_error_init(error, "<format>");
+        jsonp_error_set(error, -1, -1, 0, json_error_invalid_argument,
+                        "NULL or empty format string");
+        return NULL;
+    }
+    jsonp_error_init(error, NULL);
+
+    scanner_init(&s, error, flags, fmt);
+    return vpack(&s, ap);
+}
+
 json_t *json_pack_ex(json_error_t *error, size_t flags, const char *fmt, ...) {
     json_t *value;
     va_list ap;
@@ -876,7 +917,6 @@ json_t *json_pack(const char *fmt, ...) {
 int json_vunpack_ex(json_t *root, json_error_t *error, size_t flags, const char *fmt,
                     va_list ap) {
     scanner_t s;
-    va_list ap_copy;
 
     if (!root) {
         jsonp_error_init(error, "<root>");
@@ -893,23 +933,7 @@ int json_vunpack_ex(json_t *root, json_error_t *error, size_t flags, const char
     jsonp_error_init(error, NULL);
 
     scanner_init(&s, error, flags, fmt);
-    next_token(&s);
-
-    va_copy(ap_copy, ap);
-    if (unpack(&s, root, &ap_copy)) {
-        va_end(ap_copy);
-        return -1;
-    }
-    va_end(ap_copy);
-
-    next_token(&s);
-    if (token(&s)) {
-        set_error(&s, "<format>", json_error_invalid_format,
-                  "Garbage after format string");
-        return -1;
-    }
-
-    return 0;
+    return vunpack(&s, root, ap);
 }
 
 int json_unpack_ex(json_t *root, json_error_t *error, size_t flags, const char *fmt,
@@ -934,3 +958,134 @@ int json_unpack(json_t *root, const char *fmt, ...) {
 
     return ret;
 }
+
+/*** compiled templates ***/
+
+struct json_template_t {
+    size_t flags;
+    token_t tokens[1]; /* up to and including the final '\0' token */
+};
+
+/* Unpacking an object only needs to remember its keys to report the ones
+   left over, i.e. if it ends in '!' or JSON_STRICT applies. Tokens from
+   a malformed format are left alone, their errors come when executed. */
+static void mark_lenient(json_template_t *tmpl, size_t count) {
+    token_t *tokens = tmpl->tokens;
+    size_t i, j, depth;
+
+    for (i = 0; i < count; i++) {
+        if (tokens[i].token != '{')
+            continue;
+
+        depth = 0;
+        for (j = i; j < count && tokens[j].token; j++) {
+            char t = tokens[j].token;
+
+            if (t == '{' || t == '[')
+                depth++;
+            else if ((t == '}' || t == ']') && --depth == 0)
+                break;
+        }
+        if (j == count || tokens[j].token != '}')
+            continue;
+
+        if (tokens[j - 1].token == '*' ||
+            (tokens[j - 1].token != '!' && !(tmpl->flags & JSON_STRICT)))
+            tokens[i].lenient = 1;
+    }
+}
+
+json_template_t *json_template_compile(const char *fmt, size_t flags,
+                                       json_error_t *error) {
+    json_template_t *tmpl;
+    scanner_t s;
+    size_t count = 0, max_tokens;
+
+    if (!fmt || !*fmt) {
+        jsonp_error_init(error, "<format>");
+        jsonp_error_set(error, -1, -1, 0, json_error_invalid_argument,
+                        "NULL or empty format string");
+        return NULL;
+    }
+    jsonp_error_init(error, NULL);
+
+    /* every token but the last takes at least one character */
+    max_tokens = strlen(fmt) + 1;
+    tmpl = jsonp_malloc(sizeof(json_template_t) + (max_tokens - 1) * sizeof(token_t));
+    if (!tmpl) {
+        jsonp_error_set(error, -1, -1, 0, json_error_out_of_memory, "Out of memory");
+        return NULL;
+    }
+    tmpl->flags = flags;
+
+    scanner_init(&s, error, flags, fmt);
+    do {
+        next_token(&s);
+        tmpl->tokens[count++] = s.token;
+    } while (token(&s));
+
+    mark_lenient(tmpl, count);
+    return tmpl;
+}
+
+void json_template_free(json_template_t *tmpl) { jsonp_free(tmpl); }
+
+json_t *json_template_vpack(const json_template_t *tmpl, json_error_t *error, va_list ap) {
+    scanner_t s;
+
+    if (!tmpl) {
+        jsonp_error_init(error, "<format>");
+        jsonp_error_set(error, -1, -1, 0, json_error_invalid_argument, "NULL template");
+        return NULL;
+    }
+    jsonp_error_init(error, NULL);
+
+    scanner_init(&s, error, tmpl->flags, "");
+    s.tokens = tmpl->tokens;
+    return vpack(&s, ap);
+}
+
+json_t *json_template_pack(const json_template_t *tmpl, json_error_t *error, ...) {
+    json_t *value;
+    va_list ap;
+
+    va_start(ap, error);
+    value = json_template_vpack(tmpl, error, ap);
+    va_end(ap);
+
+    return value;
+}
+
+int json_template_vunpack(const json_template_t *tmpl, json_t *root, json_error_t *error,
+                          va_list ap) {
+    scanner_t s;
+
+    if (!root) {
+        jsonp_error_init(error, "<root>");
+        jsonp_error_set(error, -1, -1, 0, json_error_null_value, "NULL root value");
+        return -1;
+    }
+
+    if (!tmpl) {
+        jsonp_error_init(error, "<format>");
+        jsonp_error_set(error, -1, -1, 0, json_error_invalid_argument, "NULL template");
+        return -1;
+    }
+    jsonp_error_init(error, NULL);
+
+    scanner_init(&s, error, tmpl->flags, "");
+    s.tokens = tmpl->tokens;
+    return vunpack(&s, root, ap);
+}
+
+int json_template_unpack(const json_template_t *tmpl, json_t *root, json_error_t *error,
+                         ...) {
+    int ret;
+    va_list ap;
+
+    va_start(ap, error);
+    ret = json_template_vunpack(tmpl, root, error, ap);
+    va_end(ap);
+
+    return ret;
+}
@@ -0,0 +1,595 @@
+/*
+ * Copyright (c) 2009-2016 Petri Lehtinen <petri@digip.org>
+ *
+ * Jansson is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+/* Patches: JSON Merge Patch (RFC 7386) and JSON Patch (RFC 6902), applied
+   in place, and the diffs that produce them. Values are shared, not
+   copied, between documents and patches, and unchanged sub-trees are
+   passed over as soon as they are found equal: at once if they are the
+   same value, as after json_copy(), or after comparing digests cached
+   by json_hash(). */
+
+#include "jansson_private.h"
+
+#include <string.h>
+
+#include "jansson.h"
+#include "strbuffer.h"
+
+/* The digests of the containers are cached by the first comparison, so
+   comparing their children later costs little. */
+static int same_value(json_t *a, json_t *b) {
+    if (a == b)
+        return 1;
+    if (json_typeof(a) != json_typeof(b))
+        return 0;
+    return json_hash(a) == json_hash(b) && json_equal(a, b);
+}
+
+/*** merge patch ***/
+
+static int has_nulls(const json_t *object, int depth) {
+    const char *key;
+    json_t *value;
+
+    if (depth > JSON_PARSER_MAX_DEPTH)
+        return 1;
+
+    json_object_foreach((json_t *)object, key, value) {
+        if (json_is_null(value) || (json_is_object(value) && has_nulls(value, depth + 1)))
+            return 1;
+    }
+    return 0;
+}
+
+/* patch applied to {}: nulls dropped, which are removals */
+static json_t *strip_nulls(json_t *patch, int depth) {
+    const char *key;
+    size_t key_len;
+    json_t *value, *result;
+
+    if (!has_nulls(patch, depth))
+        return json_incref(patch);
+    if (depth > JSON_PARSER_MAX_DEPTH)
+        return NULL;
+
+    result = json_object();
+    if (!result)
+        return NULL;
+
+    json_object_keylen_foreach(patch, key, key_len, value) {
+        if (json_is_null(value))
+            continue;
+        value = json_is_object(value) ? strip_nulls(value, depth + 1) : json_incref(value);
+        if (json_object_setn_new_nocheck(result, key, key_len, value)) {
+            json_decref(result);
+            return NULL;
+        }
+    }
+    return result;
+}
+
+static int merge_patch(json_t *target, json_t *patch, int depth) {
+    const char *key;
+    size_t key_len;
+    json_t *value, *member;
+
+    if (depth > JSON_PARSER_MAX_DEPTH)
+        return -1;
+
+    json_object_keylen_foreach(patch, key, key_len, value) {
+        if (json_is_null(value)) {
+            json_object_deln(target, key, key_len);
+            continue;
+        }
+
+        if (json_is_object(value)) {
+            member = json_object_getn(target, key, key_len);
+            if (json_is_object(member)) {
+                member = json_object_getn_mutable(target, key, key_len);
+                if (!member || merge_patch(member, value, depth + 1))
+                    return -1;
+                continue;
+            }
+            value = strip_nulls(value, depth + 1);
+        } else
+            value = json_incref(value);
+
+        if (json_object_setn_new_nocheck(target, key, key_len, value))
+            return -1;
+    }
+    return 0;
+}
+
+/* Applies patch to target in place. Both must be objects: a patch that
+   is not one replaces the target altogether. */
+int json_merge_patch(json_t *target, const json_t *patch) {
+    if (!json_is_object(target) || !json_is_object(patch))
+        return -1;
+
+    return merge_patch(target, (json_t *)patch, 0);
+}
+
+static json_t *merge_diff(json_t *from, json_t *to, int depth) {
+    const char *key;
+    size_t key_len;
+    json_t *value, *old, *patch;
+
+    if (depth > JSON_PARSER_MAX_DEPTH)
+        return NULL;
+
+    patch = json_object();
+    if (!patch)
+        return NULL;
+
+    json_object_keylen_foreach(from, key, key_len, value) {
+        if (!json_object_getn(to, key, key_len) &&
+            json_object_setn_new_nocheck(patch, key, key_len, json_null()))
+            goto error;
+    }
+
+    json_object_keylen_foreach(to, key, key_len, value) {
+        old = json_object_getn(from, key, key_len);
+        if (old == value)
+            continue;
+
+        if (json_is_object(old) && json_is_object(value)) {
+            value = merge_diff(old, value, depth + 1);
+            if (value && json_object_size(value) == 0) {
+                json_decref(value);
+                continue;
+            }
+        } else if (old && same_value(old, value))
+            continue;
+        else
+            value = json_incref(value);
+
+        if (json_object_setn_new_nocheck(patch, key, key_len, value))
+            goto error;
+    }
+    return patch;
+
+error:
+    json_decref(patch);
+    return NULL;
+}
+
+/* The merge patch that turns from into to, {} if they are equal. Nulls
+   in to can't be told from removals, as in any merge patch. */
+json_t *json_merge_diff(const json_t *from, const json_t *to) {
+    if (!from || !to)
+        return NULL;
+    if (!json_is_object(from) || !json_is_object(to))
+        return json_incref((json_t *)to);
+
+    return merge_diff((json_t *)from, (json_t *)to, 0);
+}
+
+/*** JSON Patch ***/
+
+typedef struct {
+    json_t *root;
+    json_error_t *error;
+    size_t op; /* index of the operation applied */
+    strbuffer_t token;
+} patcher_t;
+
+static int patch_error(patcher_t *patcher, enum json_error_code code, const char *msg,
+                       const char *pointer) {
+    if (pointer)
+        jsonp_error_set(patcher->error, -1, -1, patcher->op, code, "operation %d: %s: %s",
+                        (int)patcher->op, msg, pointer);
+    else
+        jsonp_error_set(patcher->error, -1, -1, patcher->op, code, "operation %d: %s",
+                        (int)patcher->op, msg);
+    return -1;
+}
+
+/* The array index a token gives, size for "-", or (size_t)-1 */
+static size_t token_index(const char *token, size_t len, size_t size) {
+    size_t index = 0, i;
+
+    if (len == 1 && token[0] == '-')
+        return size;
+    if (len == 0 || len > 18 || (token[0] == '0' && len > 1))
+        return (size_t)-1;
+    for (i = 0; i < len; i++) {
+        if (token[i] < '0' || token[i] > '9')
+            return (size_t)-1;
+        index = index * 10 + (size_t)(token[i] - '0');
+    }
+    return index;
+}
+
+/* The container pointer points into, made changeable in place, with the
+   last token of pointer unescaped in patcher->token. */
+static json_t *pointer_parent(patcher_t *patcher, const char *pointer) {
+    const char *last = strrchr(pointer, '/'), *p;
+    json_t *parent;
+    char *prefix;
+
+    if (!last)
+        return NULL;
+
+    strbuffer_clear(&patcher->token);
+    for (p = last + 1; *p; p++) {
+        char c = *p;
+        if (c == '~') {
+            if (p[1] != '0' && p[1] != '1')
+                return NULL;
+            c = *++p == '0' ? '~' : '/';
+        }
+        if (strbuffer_append_byte(&patcher->token, c))
+            return NULL;
+    }
+
+    prefix = jsonp_strndup(pointer, (size_t)(last - pointer));
+    if (!prefix)
+        return NULL;
+    parent = json_pointer_get_mutable(patcher->root, prefix);
+    jsonp_free(prefix);
+
+    return json_is_object(parent) || json_is_array(parent) ? parent : NULL;
+}
+
+/* Replaces the contents of the root, which stays the same value. */
+static int replace_root(patcher_t *patcher, json_t *value) {
+    json_t *root = patcher->root;
+    int ret;
+
+    if (json_typeof(root) != json_typeof(value))
+        return patch_error(patcher, json_error_wrong_type,
+                           "the document can't change type in place", "");
+    if (root == value)
+        return 0;
+
+    json_incref(value);
+    if (json_is_object(root))
+        ret = json_object_clear(root) || json_object_update(root, value);
+    else
+        ret = json_array_clear(root) || json_array_extend(root, value);
+    json_decref(value);
+    return ret ? -1 : 0;
+}
+
+/* value is a new reference */
+static int patch_add(patcher_t *patcher, const char *pointer, json_t *value, int replace) {
+    json_t *parent;
+    size_t index;
+    const char *key;
+    size_t key_len;
+
+    if (!*pointer) {
+        int ret = replace_root(patcher, value);
+        json_decref(value);
+        return ret;
+    }
+
+    parent = pointer_parent(patcher, pointer);
+    if (!parent) {
+        json_decref(value);
+        return patch_error(patcher, json_error_item_not_found, "no such container", pointer);
+    }
+
+    key = strbuffer_value(&patcher->token);
+    key_len = patcher->token.length;
+
+    if (json_is_object(parent)) {
+        if (replace && !json_object_getn(parent, key, key_len)) {
+            json_decref(value);
+            return patch_error(patcher, json_error_item_not_found, "no such member",
+                               pointer);
+        }
+        return json_object_setn_new_nocheck(parent, key, key_len, value);
+    }
+
+    index = token_index(key, key_len, json_array_size(parent));
+    if (index == (size_t)-1 || index > json_array_size(parent) ||
+        (replace && index == json_array_size(parent))) {
+        json_decref(value);
+        return patch_error(patcher, json_error_index_out_of_range, "bad array index",
+                           pointer);
+    }
+    if (replace)
+        return json_array_set_new(parent, index, value);
+    return json_array_insert_new(parent, index, value);
+}
+
+static int patch_remove(patcher_t *patcher, const char *pointer) {
+    json_t *parent;
+    const char *key;
+    size_t key_len, index;
+
+    if (!*pointer)
+        return patch_error(patcher, json_error_invalid_argument,
+                           "can't remove the document", pointer);
+
+    parent = pointer_parent(patcher, pointer);
+    if (!parent)
+        return patch_error(patcher, json_error_item_not_found, "no such container", pointer);
+
+    key = strbuffer_value(&patcher->token);
+    key_len = patcher->token.length;
+
+    if (json_is_object(parent)) {
+        if (json_object_deln(parent, key, key_len))
+            return patch_error(patcher, json_error_item_not_found, "no such member",
+                               pointer);
+        return 0;
+    }
+
+    index = token_index(key, key_len, json_array_size(parent));
+    if (index >= json_array_size(parent))
+        return patch_error(patcher, json_error_index_out_of_range, "bad array index",
+                           pointer);
+    return json_array_remove(parent, index);
+}
+
+static int patch_op(patcher_t *patcher, json_t *op) {
+    const char *name = json_string_value(json_object_get(op, "op"));
+    const char *path = json_string_value(json_object_get(op, "path"));
+    const char *from = json_string_value(json_object_get(op, "from"));
+    json_t *value = json_object_get(op, "value"), *found;
+
+    if (!name || !path)
+        return patch_error(patcher, json_error_invalid_format,
+                           "\"op\" and \"path\" must be strings", NULL);
+
+    if (!strcmp(name, "add") || !strcmp(name, "replace") || !strcmp(name, "test")) {
+        if (!value)
+            return patch_error(patcher, json_error_invalid_format, "missing \"value\"",
+                               NULL);
+        if (name[0] == 't') {
+            found = json_pointer_get(patcher->root, path);
+            if (!found || !same_value(found, value))
+                return patch_error(patcher, json_error_invalid_argument, "test failed",
+                                   path);
+            return 0;
+        }
+        return patch_add(patcher, path, json_incref(value), name[0] == 'r');
+    }
+
+    if (!strcmp(name, "remove"))
+        return patch_remove(patcher, path);
+
+    if (!strcmp(name, "move") || !strcmp(name, "copy")) {
+        size_t from_len;
+
+        if (!from)
+            return patch_error(patcher, json_error_invalid_format, "missing \"from\"", NULL);
+        found = json_pointer_get(patcher->root, from);
+        if (!found)
+            return patch_error(patcher, json_error_item_not_found, "no such value", from);
+
+        if (name[0] == 'c') {
+            /* a copy of its own, the two may be changed apart */
+            value = json_deep_copy(found);
+            return value ? patch_add(patcher, path, value, 0) : -1;
+        }
+
+        if (!strcmp(from, path))
+            return 0;
+        from_len = strlen(from);
+        if (!strncmp(from, path, from_len) && path[from_len] == '/')
+            return patch_error(patcher, json_error_invalid_argument,
+                               "can't move a value into itself", path);
+
+        json_incref(found);
+        if (patch_remove(patcher, from)) {
+            json_decref(found);
+            return -1;
+        }
+        return patch_add(patcher, path, found, 0);
+    }
+
+    return patch_error(patcher, json_error_invalid_format, "unknown operation", name);
+}
+
+/* Applies the operations of patch to root in order. root is changed in
+   place, and stays as it was if any operation fails: the values along
+   the paths written to are replaced by copies, see json_copy(). Arena
+   documents are changed in place instead, so for them the backup is a
+   deep copy and a failure writes copies of it back into the arena. */
+int json_patch_apply(json_t *root, const json_t *patch, json_error_t *error) {
+    patcher_t patcher;
+    json_t *backup;
+    size_t i;
+    int ret = 0;
+
+    jsonp_error_init(error, "<patch>");
+    if (!(json_is_object(root) || json_is_array(root)) || !json_is_array(patch)) {
+        jsonp_error_set(error, -1, -1, 0, json_error_invalid_argument,
+                        "expected a document and an array of operations");
+        return -1;
+    }
+
+    backup = (root->flags & JSON_NODE_ARENA) ? json_deep_copy(root) : json_copy(root);
+    if (!backup || strbuffer_init(&patcher.token)) {
+        json_decref(backup);
+        jsonp_error_set(error, -1, -1, 0, json_error_out_of_memory, "Out of memory");
+        return -1;
+    }
+    patcher.root = root;
+    patcher.error = error;
+
+    for (i = 0; i < json_array_size(patch) && !ret; i++) {
+        json_t *op = json_array_get(patch, i);
+
+        patcher.op = i;
+        if (!json_is_object(op))
+            ret = patch_error(&patcher, json_error_invalid_format,
+                              "operations must be objects", NULL);
+        else if (patch_op(&patcher, op))
+            ret = -1;
+    }
+
+    if (ret) {
+        if (!error || !error->text[0])
+            patch_error(&patcher, json_error_out_of_memory, "Out of memory", NULL);
+        /* back to the values shared with backup */
+        if (json_is_object(root)) {
+            json_object_clear(root);
+            json_object_update(root, backup);
+        } else {
+            json_array_clear(root);
+            json_array_extend(root, backup);
+        }
+    }
+
+    strbuffer_close(&patcher.token);
+    json_decref(backup);
+    return ret;
+}
+
+/*** JSON Patch diff ***/
+
+typedef struct {
+    json_t *patch;
+    strbuffer_t path; /* JSON Pointer of the values compared */
+} differ_t;
+
+static int diff_op(differ_t *differ, const char *name, json_t *value) {
+    json_t *op = json_object();
+
+    if (!op || json_object_set_new_nocheck(op, "op", json_string_nocheck(name)) ||
+        json_object_set_new_nocheck(op, "path", json_string(differ->path.value)) ||
+        (value && json_object_set_nocheck(op, "value", value))) {
+        json_decref(op);
+        return -1;
+    }
+    return json_array_append_new(differ->patch, op);
+}
+
+static int push_key(differ_t *differ, const char *key, size_t key_len) {
+    size_t i;
+
+    if (strbuffer_append_byte(&differ->path, '/'))
+        return -1;
+    for (i = 0; i < key_len; i++) {
+        int ret;
+        if (key[i] == '~')
+            ret = strbuffer_append_bytes(&differ->path, "~0", 2);
+        else if (key[i] == '/')
+            ret = strbuffer_append_bytes(&differ->path, "~1", 2);
+        else
+            ret = strbuffer_append_byte(&differ->path, key[i]);
+        if (ret)
+            return -1;
+    }
+    return 0;
+}
+
+static int push_index(differ_t *differ, size_t index) {
+    char buf[24];
+    int len = snprintf(buf, sizeof(buf), "/%lu", (unsigned long)index);
+
+    return strbuffer_append_bytes(&differ->path, buf, (size_t)len);
+}
+
+static void pop_path(differ_t *differ, size_t length) {
+    differ->path.length = length;
+    differ->path.value[length] = '\0';
+}
+
+static int diff_value(differ_t *differ, json_t *from, json_t *to, int depth);
+
+static int diff_object(differ_t *differ, json_t *from, json_t *to, int depth) {
+    size_t length = differ->path.length, key_len;
+    const char *key;
+    json_t *value, *old;
+    int ret = 0;
+
+    json_object_keylen_foreach(from, key, key_len, value) {
+        if (json_object_getn(to, key, key_len))
+            continue;
+        ret = push_key(differ, key, key_len) || diff_op(differ, "remove", NULL);
+        pop_path(differ, length);
+        if (ret)
+            return -1;
+    }
+
+    json_object_keylen_foreach(to, key, key_len, value) {
+        old = json_object_getn(from, key, key_len);
+        if (push_key(differ, key, key_len))
+            return -1;
+        ret = old ? diff_value(differ, old, value, depth + 1)
+                  : diff_op(differ, "add", value);
+        pop_path(differ, length);
+        if (ret)
+            return -1;
+    }
+    return 0;
+}
+
+/* The common start and end are skipped, the elements in between are
+   compared pairwise, and what is left over removed or added. */
+static int diff_array(differ_t *differ, json_t *from, json_t *to, int depth) {
+    size_t length = differ->path.length;
+    size_t m = json_array_size(from), n = json_array_size(to), start = 0, i;
+    int ret = 0;
+
+    while (start < m && start < n &&
+           same_value(json_array_get(from, start), json_array_get(to, start)))
+        start++;
+    while (m > start && n > start &&
+           same_value(json_array_get(from, m - 1), json_array_get(to, n - 1))) {
+        m--;
+        n--;
+    }
+
+    for (i = start; i < m && i < n && !ret; i++) {
+        ret = push_index(differ, i) ||
+              diff_value(differ, json_array_get(from, i), json_array_get(to, i), depth + 1);
+        pop_path(differ, length);
+    }
+    for (i = m; i > n && !ret; i--) {
+        ret = push_index(differ, i - 1) || diff_op(differ, "remove", NULL);
+        pop_path(differ, length);
+    }
+    for (i = m; i < n && !ret; i++) {
+        ret = push_index(differ, i) || diff_op(differ, "add", json_array_get(to, i));
+        pop_path(differ, length);
+    }
+    return ret ? -1 : 0;
+}
+
+/* Containers are walked rather than hashed as a whole, so that the
+   members shared with a json_copy() are passed over without a look. */
+static int diff_value(differ_t *differ, json_t *from, json_t *to, int depth) {
+    if (from == to)
+        return 0;
+    if (depth > JSON_PARSER_MAX_DEPTH)
+        return -1;
+
+    if (json_is_object(from) && json_is_object(to))
+        return diff_object(differ, from, to, depth);
+    if (json_is_array(from) && json_is_array(to))
+        return diff_array(differ, from, to, depth);
+    if (same_value(from, to))
+        return 0;
+    return diff_op(differ, "replace", to);
+}
+
+/* The JSON Patch that turns from into to, [] if they are equal. */
+json_t *json_patch_diff(const json_t *from, const json_t *to) {
+    differ_t differ;
+
+    if (!from || !to)
+        return NULL;
+
+    differ.patch = json_array();
+    if (!differ.patch || strbuffer_init(&differ.path)) {
+        json_decref(differ.patch);
+        return NULL;
+    }
+
+    if (diff_value(&differ, (json_t *)from, (json_t *)to, 0)) {
+        json_decref(differ.patch);
+        differ.patch = NULL;
+    }
+    strbuffer_close(&differ.path);
+    return differ.patch;
+}
@@ -0,0 +1,720 @@
+/*
+ * Copyright (c) 2009-2016 Petri Lehtinen <petri@digip.org>
+ *
+ * Jansson is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+/* Path queries: a JSON Pointer (RFC 6901) or a subset of JSONPath is
+   compiled once into a list of steps, with object keys unescaped and
+   hashed, then evaluated against any number of documents. Several paths
+   can be evaluated together, in one walk over the document that visits
+   shared prefixes once. */
+
+#include "jansson_private.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef HAVE_STDINT_H
+#include <stdint.h>
+#endif
+
+#include "jansson.h"
+
+enum path_kind {
+    PATH_KEY,      /* object member, or array element for pointer tokens */
+    PATH_INDEX,    /* array element, negative counts from the end */
+    PATH_WILDCARD, /* every member or element */
+    PATH_FILTER    /* every member or element the filter accepts */
+};
+
+enum path_op { OP_EXISTS, OP_EQ, OP_NE, OP_LT, OP_LE, OP_GT, OP_GE };
+
+typedef struct path_step {
+    enum path_kind kind;
+    const char *key; /* in json_path_t.keys */
+    size_t key_len;
+    size_t hash;
+    json_int_t index; /* -1 for a pointer token that can't be an index */
+
+    /* filters: [?(@<sub> <op> <literal>)] */
+    enum path_op op;
+    struct path_step *sub;
+    size_t sub_count;
+    json_t *literal;
+} path_step_t;
+
+struct json_path_t {
+    size_t count;
+    int wide; /* a step may match more than one child */
+    char *keys;
+    path_step_t steps[1];
+};
+
+typedef struct {
+    const char *start;
+    const char *p;
+    char *keys; /* where the next unescaped key goes */
+    json_error_t *error;
+} path_parser_t;
+
+static int path_error(path_parser_t *parser, const char *msg) {
+    size_t pos = (size_t)(parser->p - parser->start);
+    jsonp_error_set(parser->error, 1, (int)pos + 1, pos, json_error_invalid_format, "%s",
+                    msg);
+    return -1;
+}
+
+static void set_key(path_step_t *step, char *key, size_t key_len) {
+    key[key_len] = '\0';
+    step->kind = PATH_KEY;
+    step->key = key;
+    step->key_len = key_len;
+    step->hash = json_object_key_hash(key, key_len);
+    step->index = -1;
+}
+
+/* A pointer token is also an array index if it is a decimal number
+   without a leading zero. */
+static json_int_t token_index(const char *key, size_t key_len) {
+    json_int_t index = 0;
+    size_t i;
+
+    /* 18 digits always fit */
+    if (key_len == 0 || key_len > 18 || (key[0] == '0' && key_len > 1))
+        return -1;
+    for (i = 0; i < key_len; i++) {
+        if (key[i] < '0' || key[i] > '9')
+            return -1;
+        index = index * 10 + (key[i] - '0');
+    }
+    return index;
+}
+
+static int parse_pointer(path_parser_t *parser, path_step_t *steps, size_t *count) {
+    const char *p = parser->p;
+    char *key;
+    size_t len;
+
+    while (*p) {
+        if (*p != '/') {
+            parser->p = p;
+            return path_error(parser, "JSON Pointer must start with '/'");
+        }
+        key = parser->keys;
+        len = 0;
+        for (p++; *p && *p != '/'; p++) {
+            if (*p == '~') {
+                if (p[1] != '0' && p[1] != '1') {
+                    parser->p = p;
+                    return path_error(parser, "'~' must be followed by '0' or '1'");
+                }
+                key[len++] = p[1] == '0' ? '~' : '/';
+                p++;
+            } else
+                key[len++] = *p;
+        }
+        set_key(&steps[*count], key, len);
+        steps[*count].index = token_index(key, len);
+        (*count)++;
+        parser->keys += len + 1;
+    }
+    parser->p = p;
+    return 0;
+}
+
+/* 'name' or "name", p at the opening quote */
+static int parse_quoted(path_parser_t *parser, path_step_t *step) {
+    char quote = *parser->p++;
+    char *key = parser->keys;
+    size_t len = 0;
+
+    while (*parser->p != quote) {
+        if (!*parser->p)
+            return path_error(parser, "unterminated key");
+        if (*parser->p == '\\' && parser->p[1])
+            parser->p++;
+        key[len++] = *parser->p++;
+    }
+    parser->p++;
+    set_key(step, key, len);
+    parser->keys += len + 1;
+    return 0;
+}
+
+static void skip_spaces(path_parser_t *parser) {
+    while (*parser->p == ' ')
+        parser->p++;
+}
+
+/* .name, ['name'] or [index]; the steps a filter path may have */
+static int parse_simple(path_parser_t *parser, path_step_t *step) {
+    const char *p = parser->p;
+    char *end;
+    size_t len;
+
+    if (*p == '.') {
+        p++;
+        len = strcspn(p, ".[]()=!<> ");
+        if (len == 0 || (len == 1 && *p == '*')) {
+            parser->p = p;
+            return path_error(parser, "expected a key after '.'");
+        }
+        memcpy(parser->keys, p, len);
+        set_key(step, parser->keys, len);
+        parser->keys += len + 1;
+        parser->p = p + len;
+        return 0;
+    }
+
+    /* [ */
+    parser->p++;
+    skip_spaces(parser);
+    if (*parser->p == '\'' || *parser->p == '"') {
+        if (parse_quoted(parser, step))
+            return -1;
+    } else {
+        step->kind = PATH_INDEX;
+        step->index = strtoll(parser->p, &end, 10);
+        if (end == parser->p)
+            return path_error(parser, "expected a key or an index");
+        parser->p = end;
+    }
+    skip_spaces(parser);
+    if (*parser->p != ']')
+        return path_error(parser, "expected ']'");
+    parser->p++;
+    return 0;
+}
+
+/* ?(@<path> <op> <literal>), p at the '?' */
+static int parse_filter_body(path_parser_t *parser, path_step_t *step) {
+    static const struct {
+        const char *text;
+        enum path_op op;
+    } ops[] = {{"==", OP_EQ}, {"!=", OP_NE}, {"<=", OP_LE},
+               {">=", OP_GE}, {"<", OP_LT},  {">", OP_GT}};
+    const char *literal;
+    size_t i, len;
+
+    step->kind = PATH_FILTER;
+    step->op = OP_EXISTS;
+    step->sub_count = 0;
+
+    parser->p++;
+    skip_spaces(parser);
+    if (parser->p[0] != '(' || parser->p[1] != '@')
+        return path_error(parser, "expected '(@' after '?'");
+    parser->p += 2;
+
+    /* never more steps than characters left */
+    step->sub = jsonp_malloc((strlen(parser->p) + 1) * sizeof(path_step_t));
+    if (!step->sub)
+        return path_error(parser, "out of memory");
+    while (*parser->p == '.' || *parser->p == '[') {
+        if (parse_simple(parser, &step->sub[step->sub_count]))
+            return -1;
+        step->sub_count++;
+    }
+
+    skip_spaces(parser);
+    for (i = 0; i < sizeof(ops) / sizeof(ops[0]); i++) {
+        len = strlen(ops[i].text);
+        if (strncmp(parser->p, ops[i].text, len) == 0) {
+            step->op = ops[i].op;
+            parser->p += len;
+            break;
+        }
+    }
+
+    if (step->op != OP_EXISTS) {
+        skip_spaces(parser);
+        if (*parser->p == '\'') {
+            path_step_t key;
+            if (parse_quoted(parser, &key))
+                return -1;
+            step->literal = json_stringn(key.key, key.key_len);
+        } else {
+            literal = parser->p;
+            if (*parser->p == '"') {
+                for (parser->p++; *parser->p && *parser->p != '"'; parser->p++) {
+                    if (*parser->p == '\\' && parser->p[1])
+                        parser->p++;
+                }
+                if (*parser->p)
+                    parser->p++;
+            } else {
+                parser->p += strcspn(parser->p, " )]");
+            }
+            step->literal = json_loadb(literal, (size_t)(parser->p - literal),
+                                       JSON_DECODE_ANY, NULL);
+        }
+        if (!step->literal)
+            return path_error(parser, "invalid filter value");
+    }
+
+    skip_spaces(parser);
+    if (*parser->p != ')')
+        return path_error(parser, "expected ')'");
+    parser->p++;
+    skip_spaces(parser);
+    if (*parser->p != ']')
+        return path_error(parser, "expected ']'");
+    parser->p++;
+    return 0;
+}
+
+static int parse_filter(path_parser_t *parser, path_step_t *step) {
+    if (parse_filter_body(parser, step) == 0)
+        return 0;
+
+    jsonp_free(step->sub);
+    json_decref(step->literal);
+    return -1;
+}
+
+static int parse_jsonpath(path_parser_t *parser, path_step_t *steps, size_t *count,
+                          int *wide) {
+    path_step_t *step;
+    const char *q;
+
+    parser->p++; /* $ */
+    while (*parser->p) {
+        step = &steps[*count];
+        memset(step, 0, sizeof(*step));
+
+        if (parser->p[0] == '.' && parser->p[1] == '.')
+            return path_error(parser, "recursive descent is not supported");
+
+        if (parser->p[0] == '.' && parser->p[1] == '*') {
+            step->kind = PATH_WILDCARD;
+            parser->p += 2;
+        } else if (parser->p[0] == '[') {
+            for (q = parser->p + 1; *q == ' '; q++)
+                ;
+            if (*q == '*') {
+                step->kind = PATH_WILDCARD;
+                parser->p = q + 1;
+                skip_spaces(parser);
+                if (*parser->p != ']')
+                    return path_error(parser, "expected ']'");
+                parser->p++;
+            } else if (*q == '?') {
+                parser->p = q;
+                if (parse_filter(parser, step))
+                    return -1;
+            } else if (parse_simple(parser, step))
+                return -1;
+        } else if (parser->p[0] == '.') {
+            if (parse_simple(parser, step))
+                return -1;
+        } else
+            return path_error(parser, "expected '.' or '['");
+
+        if (step->kind == PATH_WILDCARD || step->kind == PATH_FILTER)
+            *wide = 1;
+        (*count)++;
+    }
+    return 0;
+}
+
+json_path_t *json_path_compile(const char *path, json_error_t *error) {
+    json_path_t *compiled;
+    path_parser_t parser;
+    size_t length;
+    int ret;
+
+    jsonp_error_init(error, "<path>");
+    if (!path) {
+        jsonp_error_set(error, -1, -1, 0, json_error_invalid_argument, "NULL path");
+        return NULL;
+    }
+
+    /* every step takes at least one character, and unescaping keys only
+       shrinks them, leaving room for their terminating '\0' */
+    length = strlen(path);
+    compiled =
+        jsonp_malloc(sizeof(json_path_t) + length * sizeof(path_step_t) + length + 1);
+    if (!compiled) {
+        jsonp_error_set(error, -1, -1, 0, json_error_out_of_memory, "Out of memory");
+        return NULL;
+    }
+    compiled->count = 0;
+    compiled->wide = 0;
+    compiled->keys = (char *)&compiled->steps[length + 1];
+
+    parser.start = path;
+    parser.p = path;
+    parser.keys = compiled->keys;
+    parser.error = error;
+
+    if (*path == '$')
+        ret = parse_jsonpath(&parser, compiled->steps, &compiled->count, &compiled->wide);
+    else
+        ret = parse_pointer(&parser, compiled->steps, &compiled->count);
+
+    if (ret) {
+        json_path_free(compiled);
+        return NULL;
+    }
+    return compiled;
+}
+
+void json_path_free(json_path_t *path) {
+    size_t i;
+
+    if (!path)
+        return;
+
+    for (i = 0; i < path->count; i++) {
+        if (path->steps[i].kind == PATH_FILTER) {
+            jsonp_free(path->steps[i].sub);
+            json_decref(path->steps[i].literal);
+        }
+    }
+    jsonp_free(path);
+}
+
+static json_t *step_array(const json_t *json, json_int_t index) {
+    size_t size = json_array_size(json);
+
+    if (index < 0)
+        index += (json_int_t)size;
+    if (index < 0 || (size_t)index >= size)
+        return NULL;
+    return json_array_get(json, (size_t)index);
+}
+
+/* follows steps that each name one child */
+static json_t *get_direct(const json_t *json, const path_step_t *steps, size_t count) {
+    size_t i;
+
+    for (i = 0; json && i < count; i++) {
+        if (json_is_object(json)) {
+            json = steps[i].kind == PATH_KEY
+                       ? json_object_getn_hashed(json, steps[i].key, steps[i].key_len,
+                                                 steps[i].hash)
+                       : NULL;
+        } else if (json_is_array(json)) {
+            json = steps[i].index >= 0 || steps[i].kind == PATH_INDEX
+                       ? step_array(json, steps[i].index)
+                       : NULL;
+        } else
+            json = NULL;
+    }
+    return (json_t *)json;
+}
+
+static int compare(const json_t *value, const json_t *literal) {
+    double a, b;
+
+    if (json_is_number(value) && json_is_number(literal)) {
+        if (json_is_integer(value) && json_is_integer(literal)) {
+            json_int_t x = json_integer_value(value), y = json_integer_value(literal);
+            return x < y ? -1 : x > y;
+        }
+        a = json_number_value(value);
+        b = json_number_value(literal);
+        return a < b ? -1 : a > b;
+    }
+    if (json_is_string(value) && json_is_string(literal)) {
+        size_t la = json_string_length(value), lb = json_string_length(literal);
+        int c = memcmp(json_string_value(value), json_string_value(literal),
+                       la < lb ? la : lb);
+        return c ? (c < 0 ? -1 : 1) : (la < lb ? -1 : la > lb);
+    }
+    return json_equal(value, literal) ? 0 : 2; /* 2: unordered */
+}
+
+static int filter_accepts(const path_step_t *step, json_t *child) {
+    json_t *value = get_direct(child, step->sub, step->sub_count);
+    int c;
+
+    if (!value)
+        return 0;
+    if (step->op == OP_EXISTS)
+        return 1;
+
+    c = compare(value, step->literal);
+    switch (step->op) {
+        case OP_EQ:
+            return c == 0;
+        case OP_NE:
+            return c != 0;
+        case OP_LT:
+            return c == -1;
+        case OP_LE:
+            return c == -1 || c == 0;
+        case OP_GT:
+            return c == 1;
+        case OP_GE:
+            return c == 1 || c == 0;
+        default:
+            return 0;
+    }
+}
+
+/* key is NULL for array elements */
+static int step_matches(const path_step_t *step, const char *key, size_t key_len,
+                        size_t index, size_t size, json_t *child) {
+    switch (step->kind) {
+        case PATH_KEY:
+            if (key)
+                return key_len == step->key_len && memcmp(key, step->key, key_len) == 0;
+            return step->index >= 0 && (size_t)step->index == index;
+        case PATH_INDEX:
+            if (key)
+                return 0;
+            if (step->index < 0)
+                return (json_int_t)index - (json_int_t)size == step->index;
+            return (size_t)step->index == index;
+        case PATH_WILDCARD:
+            return 1;
+        case PATH_FILTER:
+            return filter_accepts(step, child);
+    }
+    return 0;
+}
+
+/* A path of a batch at some node: paths[index] has matched up to step. */
+typedef struct {
+    json_t *child; /* while grouping, where the state goes next */
+    size_t group;  /* while grouping, the first index going there */
+    const json_path_t *path;
+    size_t index;
+    size_t step;
+} path_state_t;
+
+static int compare_children(const void *a, const void *b) {
+    const path_state_t *x = a, *y = b;
+
+    if (x->child != y->child)
+        return (uintptr_t)x->child < (uintptr_t)y->child ? -1 : 1;
+    return x->index < y->index ? -1 : x->index > y->index;
+}
+
+static int compare_groups(const void *a, const void *b) {
+    const path_state_t *x = a, *y = b;
+
+    if (x->group != y->group)
+        return x->group < y->group ? -1 : 1;
+    return x->index < y->index ? -1 : x->index > y->index;
+}
+
+static int visit(json_t *json, const path_state_t *states, size_t count,
+                 json_path_callback_t callback, void *data);
+
+static int visit_child(json_t *child, const char *key, size_t key_len, size_t index,
+                       size_t size, const path_state_t *states, size_t count,
+                       path_state_t *next, json_path_callback_t callback, void *data) {
+    size_t i, n = 0;
+
+    for (i = 0; i < count; i++) {
+        const path_state_t *s = &states[i];
+        if (s->step < s->path->count &&
+            step_matches(&s->path->steps[s->step], key, key_len, index, size, child)) {
+            next[n] = *s;
+            next[n].step++;
+            n++;
+        }
+    }
+    return n ? visit(child, next, n, callback, data) : 0;
+}
+
+static int visit(json_t *json, const path_state_t *states, size_t count,
+                 json_path_callback_t callback, void *data) {
+    path_state_t small[16], *next;
+    size_t i, j, open = 0;
+    int wide = 0, ret = 0;
+
+    for (i = 0; i < count; i++) {
+        const path_state_t *s = &states[i];
+        if (s->step == s->path->count) {
+            if (callback(s->index, json, data))
+                return -1;
+        } else {
+            enum path_kind kind = s->path->steps[s->step].kind;
+            if (kind == PATH_WILDCARD || kind == PATH_FILTER)
+                wide = 1;
+            open++;
+        }
+    }
+    if (!open || !(json_is_object(json) || json_is_array(json)))
+        return 0;
+
+    next = open <= sizeof(small) / sizeof(small[0])
+               ? small
+               : jsonp_malloc(open * sizeof(path_state_t));
+    if (!next)
+        return -1;
+
+    if (wide) {
+        /* every child, with the paths that step into it */
+        if (json_is_object(json)) {
+            const char *key;
+            size_t key_len;
+            json_t *value;
+
+            json_object_keylen_foreach(json, key, key_len, value) {
+                if ((ret = visit_child(value, key, key_len, 0, 0, states, count, next,
+                                       callback, data)))
+                    break;
+            }
+        } else {
+            size_t size = json_array_size(json);
+
+            for (i = 0; i < size && !ret; i++)
+                ret = visit_child(json_array_get(json, i), NULL, 0, i, size, states,
+                                  count, next, callback, data);
+        }
+    } else {
+        /* each step names one child: look them up and descend once into each,
+           with all the paths that lead there */
+        size_t n = 0;
+
+        for (i = 0; i < count; i++) {
+            const path_state_t *s = &states[i];
+            if (s->step == s->path->count)
+                continue;
+            next[n] = *s;
+            next[n].child = get_direct(json, &s->path->steps[s->step], 1);
+            next[n].step++;
+            if (next[n].child)
+                n++;
+        }
+        if (n > 1) {
+            /* group by child, then order the groups by their first path, so
+               that the order doesn't depend on where the children are */
+            qsort(next, n, sizeof(path_state_t), compare_children);
+            for (i = 0; i < n; i++)
+                next[i].group = i > 0 && next[i].child == next[i - 1].child
+                                    ? next[i - 1].group
+                                    : next[i].index;
+            qsort(next, n, sizeof(path_state_t), compare_groups);
+        }
+
+        for (i = 0; i < n && !ret; i = j) {
+            for (j = i + 1; j < n && next[j].child == next[i].child; j++)
+                ;
+            ret = visit(next[i].child, &next[i], j - i, callback, data);
+        }
+    }
+
+    if (next != small)
+        jsonp_free(next);
+    return ret;
+}
+
+/* Calls callback(index, value, data) for every value that paths[index]
+   matches, walking the document once. The matches of a path come in
+   document order, those of different paths interleaved. Returns 0 on
+   success, -1 if a callback returned non-zero or out of memory. */
+int json_path_query_batch(const json_t *root, const json_path_t *const *paths,
+                          size_t count, json_path_callback_t callback, void *data) {
+    path_state_t small[16], *states;
+    size_t i;
+    int ret;
+
+    if (!root || !paths || !callback)
+        return -1;
+    if (count == 0)
+        return 0;
+
+    states = count <= sizeof(small) / sizeof(small[0])
+                 ? small
+                 : jsonp_malloc(count * sizeof(path_state_t));
+    if (!states)
+        return -1;
+
+    for (i = 0; i < count; i++) {
+        states[i].child = NULL;
+        states[i].group = 0;
+        states[i].path = paths[i];
+        states[i].index = i;
+        states[i].step = 0;
+    }
+    ret = visit((json_t *)root, states, count, callback, data);
+
+    if (states != small)
+        jsonp_free(states);
+    return ret;
+}
+
+int json_path_query(const json_t *root, const json_path_t *path,
+                    json_path_callback_t callback, void *data) {
+    if (!path)
+        return -1;
+    return json_path_query_batch(root, &path, 1, callback, data);
+}
+
+static int keep_first(size_t index, json_t *value, void *data) {
+    (void)index;
+    *(json_t **)data = value;
+    return 1;
+}
+
+json_t *json_path_get(const json_t *root, const json_path_t *path) {
+    json_t *value = NULL;
+
+    if (!root || !path)
+        return NULL;
+    if (!path->wide)
+        return get_direct(root, path->steps, path->count);
+
+    json_path_query(root, path, keep_first, &value);
+    return value;
+}
+
+/* Like get_direct(), making each value on the way changeable in place */
+json_t *json_path_get_mutable(json_t *root, const json_path_t *path) {
+    json_t *json = root;
+    size_t i;
+
+    if (!root || !path || path->wide)
+        return NULL;
+
+    for (i = 0; json && i < path->count; i++) {
+        const path_step_t *step = &path->steps[i];
+
+        if (json_is_object(json)) {
+            json = step->kind == PATH_KEY
+                       ? json_object_getn_mutable(json, step->key, step->key_len)
+                       : NULL;
+        } else if (json_is_array(json) && (step->index >= 0 || step->kind == PATH_INDEX)) {
+            json_int_t index = step->index;
+
+            if (index < 0)
+                index += (json_int_t)json_array_size(json);
+            json = index >= 0 ? json_array_get_mutable(json, (size_t)index) : NULL;
+        } else
+            json = NULL;
+    }
+    return json;
+}
+
+json_t *json_pointer_get_mutable(json_t *root, const char *pointer) {
+    json_path_t *path;
+    json_t *value;
+
+    if (!pointer || (*pointer && *pointer != '/'))
+        return NULL;
+
+    path = json_path_compile(pointer, NULL);
+    value = json_path_get_mutable(root, path);
+    json_path_free(path);
+    return value;
+}
+
+json_t *json_pointer_get(const json_t *root, const char *pointer) {
+    json_path_t *path;
+    json_t *value;
+
+    if (!pointer || (*pointer && *pointer != '/'))
+        return NULL;
+
+    path = json_path_compile(pointer, NULL);
+    value = json_path_get(root, path);
+    json_path_free(path);
+    return value;
+}
@@ -0,0 +1,235 @@
+/*
+ * Copyright (c) 2009-2016 Petri Lehtinen <petri@digip.org>
+ *
+ * Jansson is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+/* Shortest round-trip decimal digits of a double, following the Ryu
+   algorithm by Ulf Adams ("Ryu: fast float-to-string conversion",
+   PLDI 2018). Only the digit generation lives here, the layout is done
+   by jsonp_dtostr() in strconv.c. */
+
+#include "jansson_private.h"
+#include <string.h>
+
+#ifdef HAVE_CONFIG_H
+#include <jansson_private_config.h>
+#endif
+
+#ifdef HAVE_STDINT_H
+#include <stdint.h>
+#endif
+
+#include "ryu_table.h"
+
+#define DOUBLE_MANTISSA_BITS 52
+#define DOUBLE_EXPONENT_BITS 11
+#define DOUBLE_BIAS          1023
+
+#if defined(__SIZEOF_INT128__)
+#define RYU_HAVE_UINT128 1
+#endif
+
+/* bits(5^e) for 0 < e <= 3528 */
+static int32_t pow5bits(int32_t e) { return (int32_t)(((uint32_t)e * 1217359) >> 19) + 1; }
+
+/* floor(log10(2^e)) for 0 <= e <= 1650 */
+static uint32_t log10_pow2(int32_t e) { return ((uint32_t)e * 78913) >> 18; }
+
+/* floor(log10(5^e)) for 0 <= e <= 2620 */
+static uint32_t log10_pow5(int32_t e) { return ((uint32_t)e * 732923) >> 20; }
+
+static uint32_t pow5_factor(uint64_t value) {
+    uint32_t count = 0;
+
+    while (value % 5 == 0) {
+        value /= 5;
+        count++;
+    }
+    return count;
+}
+
+static int multiple_of_pow5(uint64_t value, uint32_t p) { return pow5_factor(value) >= p; }
+
+static int multiple_of_pow2(uint64_t value, uint32_t p) {
+    return (value & ((UINT64_C(1) << p) - 1)) == 0;
+}
+
+/* (m * mul) >> j for 64 < j < 128, mul being a 128-bit table entry */
+static uint64_t mul_shift64(uint64_t m, const uint64_t *mul, int32_t j) {
+#ifdef RYU_HAVE_UINT128
+    const unsigned __int128 b0 = (unsigned __int128)m * mul[0];
+    const unsigned __int128 b2 = (unsigned __int128)m * mul[1];
+    return (uint64_t)(((b0 >> 64) + b2) >> (j - 64));
+#else
+    /* 64x64 -> 128 multiplication from 32-bit halves */
+    uint64_t m_lo = (uint32_t)m, m_hi = m >> 32;
+    uint64_t b0_hi = 0, b2_lo = 0, b2_hi = 0, sum, hi;
+    int k;
+
+    for (k = 0; k < 2; k++) {
+        uint64_t x_lo = (uint32_t)mul[k], x_hi = mul[k] >> 32;
+        uint64_t ll = m_lo * x_lo, lh = m_lo * x_hi, hl = m_hi * x_lo, hh = m_hi * x_hi;
+        uint64_t mid = (ll >> 32) + (uint32_t)lh + (uint32_t)hl;
+        uint64_t lo = (mid << 32) | (uint32_t)ll;
+        uint64_t high = hh + (lh >> 32) + (hl >> 32) + (mid >> 32);
+
+        if (k == 0)
+            b0_hi = high;
+        else {
+            b2_lo = lo;
+            b2_hi = high;
+        }
+    }
+
+    sum = b0_hi + b2_lo;
+    hi = b2_hi + (sum < b0_hi);
+    j -= 64;
+    return j == 0 ? sum : (hi << (64 - j)) | (sum >> j);
+#endif
+}
+
+static int decimal_length17(uint64_t v) {
+    int length = 1;
+
+    while (v >= 10) {
+        v /= 10;
+        length++;
+    }
+    return length;
+}
+
+/* Compute the shortest decimal digits*10^exponent that reads back as
+   value, picking the closest one if there are several. value must be
+   finite, its sign is ignored. Returns the number of digits. */
+int jsonp_dtoa_shortest(double value, uint64_t *digits, int *exponent) {
+    uint64_t bits, ieee_mantissa, m2, mv, vr, vp, vm, output;
+    uint32_t ieee_exponent, mm_shift;
+    int32_t e2, e10, removed = 0;
+    int even, vm_trailing_zeros = 0, vr_trailing_zeros = 0;
+    uint8_t last_removed_digit = 0;
+
+    memcpy(&bits, &value, sizeof(bits));
+    ieee_mantissa = bits & ((UINT64_C(1) << DOUBLE_MANTISSA_BITS) - 1);
+    ieee_exponent =
+        (uint32_t)((bits >> DOUBLE_MANTISSA_BITS) & ((1u << DOUBLE_EXPONENT_BITS) - 1));
+
+    if (ieee_exponent == 0 && ieee_mantissa == 0) {
+        *digits = 0;
+        *exponent = 0;
+        return 1;
+    }
+
+    /* value = m2 * 2^e2, with two extra bits for the interval bounds */
+    if (ieee_exponent == 0) {
+        e2 = 1 - DOUBLE_BIAS - DOUBLE_MANTISSA_BITS - 2;
+        m2 = ieee_mantissa;
+    } else {
+        e2 = (int32_t)ieee_exponent - DOUBLE_BIAS - DOUBLE_MANTISSA_BITS - 2;
+        m2 = (UINT64_C(1) << DOUBLE_MANTISSA_BITS) | ieee_mantissa;
+    }
+    even = (m2 & 1) == 0;
+
+    /* the halfway points to the neighbours are mv - 1 - mm_shift and
+       mv + 2, the lower gap is smaller at powers of two */
+    mv = 4 * m2;
+    mm_shift = ieee_mantissa != 0 || ieee_exponent <= 1;
+
+    /* convert to a decimal power base */
+    if (e2 >= 0) {
+        const uint32_t q = log10_pow2(e2) - (e2 > 3);
+        const int32_t k = RYU_POW5_INV_BITCOUNT + pow5bits((int32_t)q) - 1;
+        const int32_t i = -e2 + (int32_t)q + k;
+
+        e10 = (int32_t)q;
+        vr = mul_shift64(4 * m2, RYU_POW5_INV_SPLIT[q], i);
+        vp = mul_shift64(4 * m2 + 2, RYU_POW5_INV_SPLIT[q], i);
+        vm = mul_shift64(4 * m2 - 1 - mm_shift, RYU_POW5_INV_SPLIT[q], i);
+
+        if (q <= 21) {
+            /* only one of mp, mv and mm can be a multiple of 5 */
+            if (mv % 5 == 0)
+                vr_trailing_zeros = multiple_of_pow5(mv, q);
+            else if (even)
+                vm_trailing_zeros = multiple_of_pow5(mv - 1 - mm_shift, q);
+            else
+                vp -= multiple_of_pow5(mv + 2, q);
+        }
+    } else {
+        const uint32_t q = log10_pow5(-e2) - (-e2 > 1);
+        const int32_t i = -e2 - (int32_t)q;
+        const int32_t k = pow5bits(i) - RYU_POW5_BITCOUNT;
+        const int32_t j = (int32_t)q - k;
+
+        e10 = (int32_t)q + e2;
+        vr = mul_shift64(4 * m2, RYU_POW5_SPLIT[i], j);
+        vp = mul_shift64(4 * m2 + 2, RYU_POW5_SPLIT[i], j);
+        vm = mul_shift64(4 * m2 - 1 - mm_shift, RYU_POW5_SPLIT[i], j);
+
+        if (q <= 1) {
+            /* mv has at least q trailing zero bits, so does mm if
+               mm_shift is 1 */
+            vr_trailing_zeros = 1;
+            if (even)
+                vm_trailing_zeros = mm_shift == 1;
+            else
+                vp--;
+        } else if (q < 63) {
+            vr_trailing_zeros = multiple_of_pow2(mv, q);
+        }
+    }
+
+    /* remove digits while the interval still contains a shorter number */
+    if (vm_trailing_zeros || vr_trailing_zeros) {
+        /* general case, rare */
+        while (vp / 10 > vm / 10) {
+            vm_trailing_zeros &= vm % 10 == 0;
+            vr_trailing_zeros &= last_removed_digit == 0;
+            last_removed_digit = (uint8_t)(vr % 10);
+            vr /= 10;
+            vp /= 10;
+            vm /= 10;
+            removed++;
+        }
+        if (vm_trailing_zeros) {
+            while (vm % 10 == 0) {
+                vr_trailing_zeros &= last_removed_digit == 0;
+                last_removed_digit = (uint8_t)(vr % 10);
+                vr /= 10;
+                vp /= 10;
+                vm /= 10;
+                removed++;
+            }
+        }
+        if (vr_trailing_zeros && last_removed_digit == 5 && vr % 2 == 0) {
+            /* exactly halfway, round to even */
+            last_removed_digit = 4;
+        }
+        output = vr + ((vr == vm && (!even || !vm_trailing_zeros)) ||
+                       last_removed_digit >= 5);
+    } else {
+        /* common case */
+        int round_up = 0;
+
+        if (vp / 100 > vm / 100) {
+            round_up = vr % 100 >= 50;
+            vr /= 100;
+            vp /= 100;
+            vm /= 100;
+            removed += 2;
+        }
+        while (vp / 10 > vm / 10) {
+            round_up = vr % 10 >= 5;
+            vr /= 10;
+            vp /= 10;
+            vm /= 10;
+            removed++;
+        }
+        output = vr + (vr == vm || round_up);
+    }
+
+    *digits = output;
+    *exponent = e10 + removed;
+    return decimal_length17(output);
+}
@@ -0,0 +1,344 @@
+/*
+ * Copyright (c) 2009-2016 Petri Lehtinen <petri@digip.org>
+ *
+ * Jansson is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+/* Vectorized scanning of string bytes. The kernels find the next byte
+   that the lexer or the dumper has to look at, 16 or 32 bytes at a
+   time; everything they skip is plain ASCII. The kernel is chosen at
+   run time (AVX2 over SSE2 on x86, NEON on AArch64) with a scalar
+   fallback elsewhere. */
+
+#include "utf.h"
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) ||                   \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define UTF8_SPAN_SSE2 1
+#include <emmintrin.h>
+#if defined(__GNUC__) && (defined(__clang__) || __GNUC__ >= 5)
+#define UTF8_SPAN_AVX2 1
+#include <immintrin.h>
+#endif
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#define UTF8_SPAN_NEON 1
+#include <arm_neon.h>
+#endif
+
+typedef size_t (*span_func)(const char *buffer, size_t size, int escape_slash);
+
+/* plain: printable ASCII that needs no escaping in a JSON string */
+static int plain_byte(unsigned char u, int escape_slash) {
+    return u >= 0x20 && u < 0x80 && u != '"' && u != '\\' && !(escape_slash && u == '/');
+}
+
+static size_t span_plain_scalar(const char *buffer, size_t size, int escape_slash) {
+    size_t i = 0;
+
+    while (i < size && plain_byte((unsigned char)buffer[i], escape_slash))
+        i++;
+    return i;
+}
+
+/* structural: what the splitter has to look at, '"' ',' and brackets
+   outside strings, '"' and '\\' inside */
+static int structural_byte(unsigned char u, int in_string) {
+    if (in_string)
+        return u == '"' || u == '\\';
+    return u == '"' || u == ',' || (u | 0x20) == '{' || (u | 0x20) == '}';
+}
+
+static size_t span_structure_scalar(const char *buffer, size_t size, int in_string) {
+    size_t i = 0;
+
+    while (i < size && !structural_byte((unsigned char)buffer[i], in_string))
+        i++;
+    return i;
+}
+
+static size_t span_ascii_scalar(const char *buffer, size_t size, int unused) {
+    size_t i = 0;
+
+    (void)unused;
+    while (i < size && (unsigned char)buffer[i] < 0x80)
+        i++;
+    return i;
+}
+
+#if defined(UTF8_SPAN_SSE2) || defined(UTF8_SPAN_AVX2)
+static unsigned int bit_scan(unsigned int mask) {
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanForward(&index, mask);
+    return index;
+#else
+    return __builtin_ctz(mask);
+#endif
+}
+#endif
+
+#ifdef UTF8_SPAN_SSE2
+static size_t span_plain_sse2(const char *buffer, size_t size, int escape_slash) {
+    const __m128i quote = _mm_set1_epi8('"');
+    const __m128i backslash = _mm_set1_epi8('\\');
+    const __m128i slash = _mm_set1_epi8(escape_slash ? '/' : '"');
+    const __m128i space = _mm_set1_epi8(0x20);
+    size_t i = 0;
+
+    for (; i + 16 <= size; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(buffer + i));
+
+        /* signed compare: catches both control bytes and bytes >= 0x80 */
+        __m128i special = _mm_or_si128(
+            _mm_or_si128(_mm_cmpeq_epi8(v, quote), _mm_cmpeq_epi8(v, backslash)),
+            _mm_or_si128(_mm_cmpeq_epi8(v, slash), _mm_cmplt_epi8(v, space)));
+        unsigned int mask = (unsigned int)_mm_movemask_epi8(special);
+        if (mask)
+            return i + bit_scan(mask);
+    }
+    return i + span_plain_scalar(buffer + i, size - i, escape_slash);
+}
+
+static size_t span_ascii_sse2(const char *buffer, size_t size, int unused) {
+    size_t i = 0;
+
+    for (; i + 16 <= size; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(buffer + i));
+        unsigned int mask = (unsigned int)_mm_movemask_epi8(v);
+        if (mask)
+            return i + bit_scan(mask);
+    }
+    return i + span_ascii_scalar(buffer + i, size - i, unused);
+}
+
+static size_t span_structure_sse2(const char *buffer, size_t size, int in_string) {
+    /* '[' ']' '{' '}' are '{' and '}' with the 0x20 bit set; inside
+       strings the fold is off and the last two compares repeat '"' */
+    const __m128i fold = _mm_set1_epi8(in_string ? 0 : 0x20);
+    const __m128i quote = _mm_set1_epi8('"');
+    const __m128i other = _mm_set1_epi8(in_string ? '\\' : ',');
+    const __m128i open = _mm_set1_epi8(in_string ? '"' : '{');
+    const __m128i close = _mm_set1_epi8(in_string ? '"' : '}');
+    size_t i = 0;
+
+    for (; i + 16 <= size; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(buffer + i));
+        __m128i folded = _mm_or_si128(v, fold);
+        __m128i special = _mm_or_si128(
+            _mm_or_si128(_mm_cmpeq_epi8(v, quote), _mm_cmpeq_epi8(v, other)),
+            _mm_or_si128(_mm_cmpeq_epi8(folded, open), _mm_cmpeq_epi8(folded, close)));
+        unsigned int mask = (unsigned int)_mm_movemask_epi8(special);
+        if (mask)
+            return i + bit_scan(mask);
+    }
+    return i + span_structure_scalar(buffer + i, size - i, in_string);
+}
+#endif
+
+#ifdef UTF8_SPAN_AVX2
+__attribute__((target("avx2"))) static size_t span_plain_avx2(const char *buffer,
+                                                              size_t size,
+                                                              int escape_slash) {
+    const __m256i quote = _mm256_set1_epi8('"');
+    const __m256i backslash = _mm256_set1_epi8('\\');
+    const __m256i slash = _mm256_set1_epi8(escape_slash ? '/' : '"');
+    const __m256i space = _mm256_set1_epi8(0x20);
+    size_t i = 0;
+
+    for (; i + 32 <= size; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(buffer + i));
+
+        /* signed compare: catches both control bytes and bytes >= 0x80 */
+        __m256i special = _mm256_or_si256(
+            _mm256_or_si256(_mm256_cmpeq_epi8(v, quote), _mm256_cmpeq_epi8(v, backslash)),
+            _mm256_or_si256(_mm256_cmpeq_epi8(v, slash), _mm256_cmpgt_epi8(space, v)));
+        unsigned int mask = (unsigned int)_mm256_movemask_epi8(special);
+        if (mask) {
+            _mm256_zeroupper();
+            return i + bit_scan(mask);
+        }
+    }
+
+    /* clear the upper halves before running SSE code, mixing the two
+       with dirty upper state is slow on many CPUs */
+    _mm256_zeroupper();
+    return i + span_plain_sse2(buffer + i, size - i, escape_slash);
+}
+
+__attribute__((target("avx2"))) static size_t span_ascii_avx2(const char *buffer,
+                                                              size_t size, int unused) {
+    size_t i = 0;
+
+    for (; i + 32 <= size; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(buffer + i));
+        unsigned int mask = (unsigned int)_mm256_movemask_epi8(v);
+        if (mask) {
+            _mm256_zeroupper();
+            return i + bit_scan(mask);
+        }
+    }
+
+    _mm256_zeroupper();
+    return i + span_ascii_sse2(buffer + i, size - i, unused);
+}
+
+__attribute__((target("avx2"))) static size_t span_structure_avx2(const char *buffer,
+                                                                  size_t size,
+                                                                  int in_string) {
+    const __m256i fold = _mm256_set1_epi8(in_string ? 0 : 0x20);
+    const __m256i quote = _mm256_set1_epi8('"');
+    const __m256i other = _mm256_set1_epi8(in_string ? '\\' : ',');
+    const __m256i open = _mm256_set1_epi8(in_string ? '"' : '{');
+    const __m256i close = _mm256_set1_epi8(in_string ? '"' : '}');
+    size_t i = 0;
+
+    for (; i + 32 <= size; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(buffer + i));
+        __m256i folded = _mm256_or_si256(v, fold);
+        __m256i special = _mm256_or_si256(
+            _mm256_or_si256(_mm256_cmpeq_epi8(v, quote), _mm256_cmpeq_epi8(v, other)),
+            _mm256_or_si256(_mm256_cmpeq_epi8(folded, open),
+                            _mm256_cmpeq_epi8(folded, close)));
+        unsigned int mask = (unsigned int)_mm256_movemask_epi8(special);
+        if (mask) {
+            _mm256_zeroupper();
+            return i + bit_scan(mask);
+        }
+    }
+
+    _mm256_zeroupper();
+    return i + span_structure_sse2(buffer + i, size - i, in_string);
+}
+#endif
+
+#ifdef UTF8_SPAN_NEON
+/* index of the first non-zero byte of a 0x00/0xFF mask vector */
+static size_t neon_first(uint8x16_t special) {
+    uint64_t bits = vget_lane_u64(
+        vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(special), 4)), 0);
+    return __builtin_ctzll(bits) >> 2;
+}
+
+static size_t span_plain_neon(const char *buffer, size_t size, int escape_slash) {
+    const uint8x16_t quote = vdupq_n_u8('"');
+    const uint8x16_t backslash = vdupq_n_u8('\\');
+    const uint8x16_t slash = vdupq_n_u8(escape_slash ? '/' : '"');
+    const uint8x16_t space = vdupq_n_u8(0x20);
+    const uint8x16_t high = vdupq_n_u8(0x80);
+    size_t i = 0;
+
+    for (; i + 16 <= size; i += 16) {
+        uint8x16_t v = vld1q_u8((const uint8_t *)(buffer + i));
+        uint8x16_t special =
+            vorrq_u8(vorrq_u8(vceqq_u8(v, quote), vceqq_u8(v, backslash)),
+                     vorrq_u8(vceqq_u8(v, slash),
+                              vorrq_u8(vcltq_u8(v, space), vcgeq_u8(v, high))));
+        if (vmaxvq_u8(special))
+            return i + neon_first(special);
+    }
+    return i + span_plain_scalar(buffer + i, size - i, escape_slash);
+}
+
+static size_t span_ascii_neon(const char *buffer, size_t size, int unused) {
+    const uint8x16_t high = vdupq_n_u8(0x80);
+    size_t i = 0;
+
+    for (; i + 16 <= size; i += 16) {
+        uint8x16_t v = vld1q_u8((const uint8_t *)(buffer + i));
+        uint8x16_t special = vcgeq_u8(v, high);
+        if (vmaxvq_u8(special))
+            return i + neon_first(special);
+    }
+    return i + span_ascii_scalar(buffer + i, size - i, unused);
+}
+
+static size_t span_structure_neon(const char *buffer, size_t size, int in_string) {
+    const uint8x16_t fold = vdupq_n_u8(in_string ? 0 : 0x20);
+    const uint8x16_t quote = vdupq_n_u8('"');
+    const uint8x16_t other = vdupq_n_u8(in_string ? '\\' : ',');
+    const uint8x16_t open = vdupq_n_u8(in_string ? '"' : '{');
+    const uint8x16_t close = vdupq_n_u8(in_string ? '"' : '}');
+    size_t i = 0;
+
+    for (; i + 16 <= size; i += 16) {
+        uint8x16_t v = vld1q_u8((const uint8_t *)(buffer + i));
+        uint8x16_t folded = vorrq_u8(v, fold);
+        uint8x16_t special = vorrq_u8(vorrq_u8(vceqq_u8(v, quote), vceqq_u8(v, other)),
+                                      vorrq_u8(vceqq_u8(folded, open), vceqq_u8(folded, close)));
+        if (vmaxvq_u8(special))
+            return i + neon_first(special);
+    }
+    return i + span_structure_scalar(buffer + i, size - i, in_string);
+}
+#endif
+
+static size_t span_plain_resolve(const char *buffer, size_t size, int escape_slash);
+static size_t span_ascii_resolve(const char *buffer, size_t size, int unused);
+static size_t span_structure_resolve(const char *buffer, size_t size, int in_string);
+
+static span_func span_plain = span_plain_resolve;
+static span_func span_ascii = span_ascii_resolve;
+static span_func span_structure = span_structure_resolve;
+
+/* Pick the kernels on first use. Racing threads store the same
+   pointers, so no locking is needed. */
+static void span_select(void) {
+#if defined(UTF8_SPAN_AVX2)
+    if (__builtin_cpu_supports("avx2")) {
+        span_plain = span_plain_avx2;
+        span_ascii = span_ascii_avx2;
+        span_structure = span_structure_avx2;
+        return;
+    }
+#endif
+#if defined(UTF8_SPAN_SSE2)
+    span_plain = span_plain_sse2;
+    span_ascii = span_ascii_sse2;
+    span_structure = span_structure_sse2;
+#elif defined(UTF8_SPAN_NEON)
+    span_plain = span_plain_neon;
+    span_ascii = span_ascii_neon;
+    span_structure = span_structure_neon;
+#else
+    span_plain = span_plain_scalar;
+    span_ascii = span_ascii_scalar;
+    span_structure = span_structure_scalar;
+#endif
+}
+
+static size_t span_plain_resolve(const char *buffer, size_t size, int escape_slash) {
+    span_select();
+    return span_plain(buffer, size, escape_slash);
+}
+
+static size_t span_ascii_resolve(const char *buffer, size_t size, int unused) {
+    span_select();
+    return span_ascii(buffer, size, unused);
+}
+
+static size_t span_structure_resolve(const char *buffer, size_t size, int in_string) {
+    span_select();
+    return span_structure(buffer, size, in_string);
+}
+
+/* Length of the leading run of printable ASCII bytes other than '"' and
+   '\\' (and '/' if escape_slash is set), i.e. bytes to copy verbatim. */
+size_t utf8_span_plain(const char *buffer, size_t size, int escape_slash) {
+    return span_plain(buffer, size, escape_slash);
+}
+
+/* Length of the leading run of ASCII bytes. */
+size_t utf8_span_ascii(const char *buffer, size_t size) {
+    return span_ascii(buffer, size, 0);
+}
+
+/* Length of the leading run of bytes that don't change the structure of
+   a document: up to the next '"', ',' or bracket, or inside a string
+   (in_string set) up to the next '"' or '\\'. */
+size_t utf8_span_structure(const char *buffer, size_t size, int in_string) {
+    return span_structure(buffer, size, in_string);
+}
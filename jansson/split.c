@@ -0,0 +1,225 @@
+/*
+ * Copyright (c) 2009-2016 Petri Lehtinen <petri@digip.org>
+ *
+ * Jansson is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+/* Structural splitting: finds where the elements of a top-level array,
+   the members of an object, or the documents of a multi-document input,
+   begin and end without parsing them, so the pieces can be decoded
+   independently (e.g. on several threads, or only when needed). Only
+   strings and bracket nesting are tracked, the pieces themselves are
+   validated by whoever parses them. */
+
+#include "jansson_private.h"
+
+#include <string.h>
+
+#include "jansson.h"
+#include "utf.h"
+
+static int is_space(char c) { return c == ' ' || c == '\t' || c == '\n' || c == '\r'; }
+
+static const char *skip_space(const char *p, const char *end) {
+    while (p < end && is_space(*p))
+        p++;
+    return p;
+}
+
+/* p is just past an opening '"'. Returns the position just past the
+   closing one, NULL if the string is unterminated. */
+static const char *skip_string(const char *p, const char *end) {
+    while (p < end) {
+        p += utf8_span_structure(p, end - p, 1);
+        if (p >= end)
+            break;
+        if (*p == '"')
+            return p + 1;
+        /* backslash, the escaped byte can't end the string */
+        if (end - p < 2)
+            break;
+        p += 2;
+    }
+    return NULL;
+}
+
+/* Returns the end of the value starting at p, NULL if the input ends
+   inside it. A container ends at the bracket that closes it, whatever
+   its kind; mismatches are left to the parser. */
+static const char *skip_value(const char *p, const char *end) {
+    size_t depth = 0;
+
+    if (*p == '"')
+        return skip_string(p + 1, end);
+
+    if (*p != '[' && *p != '{') {
+        /* scalar: up to whitespace or the next structural byte */
+        while (p < end && !is_space(*p) && *p != ',' && *p != '"' && (*p | 0x20) != '{' &&
+               (*p | 0x20) != '}')
+            p++;
+        return p;
+    }
+
+    while (p < end) {
+        p += utf8_span_structure(p, end - p, 0);
+        if (p >= end)
+            break;
+
+        switch (*p) {
+            case '"':
+                p = skip_string(p + 1, end);
+                if (!p)
+                    return NULL;
+                continue;
+            case '[':
+            case '{':
+                depth++;
+                break;
+            case ']':
+            case '}':
+                if (--depth == 0)
+                    return p + 1;
+                break;
+        }
+        p++;
+    }
+    return NULL;
+}
+
+static int split_emit(const char *buffer, const char *start, const char *stop,
+                      json_split_callback_t callback, void *data) {
+    return callback((size_t)(start - buffer), (size_t)(stop - start), data);
+}
+
+/* Calls callback(offset, length, data) for every element of the array
+   that makes up buffer, in order. Returns 0 on success, -1 if buffer is
+   not an array, is cut short, has anything but whitespace after the
+   array, or if callback returned non-zero. */
+int json_split_array(const char *buffer, size_t buflen, json_split_callback_t callback,
+                     void *data) {
+    const char *end = buffer + buflen;
+    const char *p, *stop;
+
+    if (!buffer || !callback)
+        return -1;
+
+    p = skip_space(buffer, end);
+    if (p >= end || *p != '[')
+        return -1;
+
+    p = skip_space(p + 1, end);
+    if (p < end && *p == ']') {
+        p++;
+    } else {
+        while (1) {
+            if (p >= end || *p == ',' || *p == ']' || *p == '}')
+                return -1;
+
+            stop = skip_value(p, end);
+            if (!stop || stop == p)
+                return -1;
+            if (split_emit(buffer, p, stop, callback, data))
+                return -1;
+
+            p = skip_space(stop, end);
+            if (p >= end)
+                return -1;
+            if (*p == ']') {
+                p++;
+                break;
+            }
+            if (*p != ',')
+                return -1;
+            p = skip_space(p + 1, end);
+        }
+    }
+
+    return skip_space(p, end) == end ? 0 : -1;
+}
+
+/* Calls callback(key_offset, key_length, offset, length, data) for every
+   member of the object that makes up buffer, in order. Returns 0 on
+   success, -1 if buffer is not an object, is cut short, has anything but
+   whitespace after the object, or if callback returned non-zero. */
+int json_split_object(const char *buffer, size_t buflen,
+                      json_split_member_callback_t callback, void *data) {
+    const char *end = buffer + buflen;
+    const char *p, *key, *key_end, *stop;
+
+    if (!buffer || !callback)
+        return -1;
+
+    p = skip_space(buffer, end);
+    if (p >= end || *p != '{')
+        return -1;
+
+    p = skip_space(p + 1, end);
+    if (p < end && *p == '}') {
+        p++;
+    } else {
+        while (1) {
+            if (p >= end || *p != '"')
+                return -1;
+
+            key = p + 1;
+            p = skip_string(key, end);
+            if (!p)
+                return -1;
+            key_end = p - 1; /* the closing quote */
+
+            p = skip_space(p, end);
+            if (p >= end || *p != ':')
+                return -1;
+            p = skip_space(p + 1, end);
+            if (p >= end || *p == ',' || *p == '}' || *p == ']')
+                return -1;
+
+            stop = skip_value(p, end);
+            if (!stop || stop == p)
+                return -1;
+            if (callback((size_t)(key - buffer), (size_t)(key_end - key),
+                         (size_t)(p - buffer), (size_t)(stop - p), data))
+                return -1;
+
+            p = skip_space(stop, end);
+            if (p >= end)
+                return -1;
+            if (*p == '}') {
+                p++;
+                break;
+            }
+            if (*p != ',')
+                return -1;
+            p = skip_space(p + 1, end);
+        }
+    }
+
+    return skip_space(p, end) == end ? 0 : -1;
+}
+
+/* Calls callback(offset, length, data) for every top-level value of a
+   sequence of documents separated by whitespace, e.g. newline delimited
+   JSON. Returns 0 on success, -1 if a document is cut short or if
+   callback returned non-zero. */
+int json_split_documents(const char *buffer, size_t buflen, json_split_callback_t callback,
+                         void *data) {
+    const char *end = buffer + buflen;
+    const char *p, *stop;
+
+    if (!buffer || !callback)
+        return -1;
+
+    p = skip_space(buffer, end);
+    while (p < end) {
+        stop = skip_value(p, end);
+        if (!stop)
+            return -1;
+        if (stop == p) /* a stray ',' or closing bracket */
+            stop++;
+        if (split_emit(buffer, p, stop, callback, data))
+            return -1;
+        p = skip_space(stop, end);
+    }
+    return 0;
+}
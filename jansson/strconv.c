@@ -2,10 +2,15 @@
 #include "strbuffer.h"
 #include <assert.h>
 #include <errno.h>
+#include <float.h>
 #include <math.h>
 #include <stdio.h>
 #include <string.h>
 
+#include "lemire_table.h"
+
+#define l_isdigit(c) ('0' <= (c) && (c) <= '9')
+
 /* need jansson_private_config.h to get the correct snprintf */
 #ifdef HAVE_CONFIG_H
 #include <jansson_private_config.h>
@@ -27,7 +32,7 @@ static char get_decimal_point() {
     return buf[1];
 }
 
-static void to_locale(strbuffer_t *strbuffer) {
+static void to_locale(char *buffer) {
     char point;
     char *pos;
 
@@ -37,30 +42,270 @@ static void to_locale(strbuffer_t *strbuffer) {
         return;
     }
 
-    pos = strchr(strbuffer->value, '.');
+    pos = strchr(buffer, '.');
     if (pos)
         *pos = point;
 }
 
-int jsonp_strtod(strbuffer_t *strbuffer, double *out) {
+/* the slow path: libc strtod() on a NUL-terminated copy in the decimal
+   point of the current locale */
+static int strtod_libc(const char *str, size_t length, double *out) {
+    char stack[64];
+    char *buffer = stack;
     double value;
     char *end;
+    int ret = 0;
+
+    if (length >= sizeof(stack)) {
+        buffer = jsonp_malloc(length + 1);
+        if (!buffer)
+            return -1;
+    }
+    memcpy(buffer, str, length);
+    buffer[length] = '\0';
 
-    to_locale(strbuffer);
+    to_locale(buffer);
 
     errno = 0;
-    value = strtod(strbuffer->value, &end);
-    assert(end == strbuffer->value + strbuffer->length);
+    value = strtod(buffer, &end);
+    assert(end == buffer + length);
 
     if ((value == HUGE_VAL || value == -HUGE_VAL) && errno == ERANGE) {
         /* Overflow */
+        ret = -1;
+    } else
+        *out = value;
+
+    if (buffer != stack)
+        jsonp_free(buffer);
+    return ret;
+}
+
+static int leading_zeros64(uint64_t value) {
+#if defined(__GNUC__)
+    return __builtin_clzll(value);
+#else
+    int count = 0;
+    while (!(value & (UINT64_C(1) << 63))) {
+        value <<= 1;
+        count++;
+    }
+    return count;
+#endif
+}
+
+/* 64x64 -> 128 bit multiplication */
+static void mul128(uint64_t a, uint64_t b, uint64_t *high, uint64_t *low) {
+#if defined(__SIZEOF_INT128__)
+    unsigned __int128 product = (unsigned __int128)a * b;
+    *high = (uint64_t)(product >> 64);
+    *low = (uint64_t)product;
+#else
+    uint64_t a_lo = (uint32_t)a, a_hi = a >> 32;
+    uint64_t b_lo = (uint32_t)b, b_hi = b >> 32;
+    uint64_t ll = a_lo * b_lo, lh = a_lo * b_hi, hl = a_hi * b_lo, hh = a_hi * b_hi;
+    uint64_t mid = (ll >> 32) + (uint32_t)lh + (uint32_t)hl;
+    *low = (mid << 32) | (uint32_t)ll;
+    *high = hh + (lh >> 32) + (hl >> 32) + (mid >> 32);
+#endif
+}
+
+/* Eisel-Lemire: the double nearest to w * 10^q for w != 0, see Daniel
+   Lemire, "Number Parsing at a Gigabyte per Second" (2021). Returns -1
+   when the truncated power of five leaves the rounding ambiguous, and
+   for results outside the normal range; strtod() decides those. */
+static int eisel_lemire(uint64_t w, int q, int negative, double *out) {
+    const uint64_t *factor;
+    uint64_t upper, lower, mantissa, upper_bit, bits;
+    int64_t exponent;
+    int lz;
+
+    if (q < LEMIRE_SMALLEST_POWER || q > LEMIRE_LARGEST_POWER)
+        return -1;
+
+    factor = LEMIRE_POW5[q - LEMIRE_SMALLEST_POWER];
+
+    /* floor(log2(5^q)) + q + 1023 + 63, valid for -400 < q < 350 */
+    exponent = ((((int64_t)q) * (152170 + 65536)) >> 16) + 1024 + 63;
+    lz = leading_zeros64(w);
+    w <<= lz;
+
+    mul128(w, factor[0], &upper, &lower);
+    if ((upper & 0x1FF) == 0x1FF && lower + w < lower) {
+        /* the leading 55 bits may be off by one, use 128 bits of the
+           power of five */
+        uint64_t product_high, product_low, middle;
+
+        mul128(w, factor[1], &product_high, &product_low);
+        middle = lower + product_high;
+        if (middle < lower)
+            upper++;
+        if (middle + 1 == 0 && (upper & 0x1FF) == 0x1FF && product_low + w < product_low)
+            return -1;
+        lower = middle;
+    }
+
+    upper_bit = upper >> 63;
+    mantissa = upper >> (upper_bit + 9);
+    lz += (int)(1 ^ upper_bit);
+
+    /* possibly halfway between two doubles */
+    if (upper == (mantissa << (upper_bit + 9)) || (mantissa & 3) == 1)
         return -1;
+
+    mantissa += 1;
+    mantissa >>= 1;
+    if (mantissa >= (UINT64_C(1) << 53)) {
+        /* rounding carried into the next binade */
+        mantissa = UINT64_C(1) << 52;
+        lz--;
     }
+    mantissa &= ~(UINT64_C(1) << 52);
+
+    exponent -= lz;
+    if (exponent < 1 || exponent > 2046)
+        return -1;
 
-    *out = value;
+    bits = mantissa | ((uint64_t)exponent << 52) | ((uint64_t)negative << 63);
+    memcpy(out, &bits, sizeof(bits));
     return 0;
 }
 
+
+#if defined(FLT_EVAL_METHOD) && FLT_EVAL_METHOD == 0
+static const double exact_powers_of_ten[] = {1e0,  1e1,  1e2,  1e3,  1e4,  1e5,
+                                             1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+                                             1e12, 1e13, 1e14, 1e15, 1e16, 1e17,
+                                             1e18, 1e19, 1e20, 1e21, 1e22};
+#endif
+
+/* Convert the well-formed JSON number str[0..length) to a double without
+   looking at the locale. With up to 19 significant digits this takes a
+   single multiplication when both the digits and the power of ten are
+   exact doubles, and Eisel-Lemire otherwise. Longer or ambiguous input
+   goes through strtod(). Returns -1 on overflow. */
+int jsonp_strtod(const char *str, size_t length, double *out) {
+    const char *p = str, *end = str + length;
+    uint64_t w = 0;
+    int negative = 0, digits = 0, q = 0, exp = 0, exp_negative = 0;
+
+    if (*p == '-') {
+        negative = 1;
+        p++;
+    }
+
+    /* significant digits, leading zeros excluded */
+    while (p < end && *p == '0')
+        p++;
+    while (p < end && l_isdigit(*p)) {
+        if (digits < 19)
+            w = 10 * w + (uint64_t)(*p - '0');
+        else
+            q++;
+        if (w)
+            digits++;
+        p++;
+    }
+    if (p < end && *p == '.') {
+        p++;
+        if (!w) {
+            while (p < end && *p == '0') {
+                q--;
+                p++;
+            }
+        }
+        while (p < end && l_isdigit(*p)) {
+            if (digits < 19) {
+                w = 10 * w + (uint64_t)(*p - '0');
+                q--;
+            }
+            if (w)
+                digits++;
+            p++;
+        }
+    }
+    if (p < end && (*p == 'e' || *p == 'E')) {
+        p++;
+        if (*p == '-' || *p == '+')
+            exp_negative = *p++ == '-';
+        while (p < end && l_isdigit(*p)) {
+            if (exp < 100000)
+                exp = 10 * exp + (*p - '0');
+            p++;
+        }
+    }
+    q += exp_negative ? -exp : exp;
+
+    if (digits > 19)
+        return strtod_libc(str, length, out);
+
+    if (w == 0) {
+        *out = negative ? -0.0 : 0.0;
+        return 0;
+    }
+
+#if defined(FLT_EVAL_METHOD) && FLT_EVAL_METHOD == 0
+    if (w <= (UINT64_C(1) << 53) && -22 <= q && q <= 22) {
+        double value = (double)w;
+        if (q < 0)
+            value /= exact_powers_of_ten[-q];
+        else
+            value *= exact_powers_of_ten[q];
+        *out = negative ? -value : value;
+        return 0;
+    }
+#endif
+
+    if (eisel_lemire(w, q, negative, out) == 0)
+        return 0;
+
+    return strtod_libc(str, length, out);
+}
+
+static const char digit_pairs[201] = "00010203040506070809"
+                                     "10111213141516171819"
+                                     "20212223242526272829"
+                                     "30313233343536373839"
+                                     "40414243444546474849"
+                                     "50515253545556575859"
+                                     "60616263646566676869"
+                                     "70717273747576777879"
+                                     "80818283848586878889"
+                                     "90919293949596979899";
+
+/* Write value in decimal to buffer, which must hold at least 21 bytes.
+   Two digits are produced per division. Returns the length excluding
+   the terminating NUL. */
+int jsonp_itostr(char *buffer, json_int_t value) {
+    char tmp[20];
+    char *p = tmp + sizeof(tmp);
+    unsigned long long u = (unsigned long long)value;
+    int length;
+
+    if (value < 0)
+        u = 0 - u;
+
+    while (u >= 100) {
+        unsigned int pair = (unsigned int)(u % 100) * 2;
+        u /= 100;
+        *--p = digit_pairs[pair + 1];
+        *--p = digit_pairs[pair];
+    }
+    if (u >= 10) {
+        *--p = digit_pairs[u * 2 + 1];
+        *--p = digit_pairs[u * 2];
+    } else
+        *--p = (char)('0' + u);
+
+    length = (int)(tmp + sizeof(tmp) - p);
+    if (value < 0)
+        *buffer++ = '-';
+    memcpy(buffer, p, length);
+    buffer[length] = '\0';
+
+    return length + (value < 0);
+}
+
 #if DTOA_ENABLED
 /* see dtoa.c */
 char *dtoa_r(double dd, int mode, int ndigits, int *decpt, int *sign, char **rve,
@@ -167,6 +412,116 @@ int jsonp_dtostr(char *buffer, size_t size, double value, int precision) {
     return (int)(p - buffer);
 }
 #else /* DTOA_ENABLED == 0 */
+static int dtostr_printf(char *buffer, size_t size, double value, int precision);
+
+/* Format value like dtostr_printf() does, but from the shortest round-trip
+   digits of jsonp_dtoa_shortest(). Without a precision those digits are
+   the output, in the "%.17g" layout. With a precision they are rounded
+   to %.*g's digits, which gives the same result as rounding the exact
+   value unless the discarded part is exactly one half, see below.
+   Returns -1 where only printf can tell. */
+static int dtostr_shortest(char *buffer, size_t size, double value, int precision) {
+    char digits_buf[20];
+    uint64_t digits;
+    int exponent, length, sci_exp, i;
+    char *p = buffer;
+
+    if (!isfinite(value))
+        return -1;
+
+    length = jsonp_dtoa_shortest(value, &digits, &exponent);
+
+    if (precision == 0)
+        precision = 17;
+    else if (fabs(value) < DBL_MIN && value != 0) {
+        /* subnormals carry fewer digits than the argument below needs */
+        return -1;
+    } else if (length > precision) {
+        /* Rounding the shortest digits is exact: any rounding boundary
+           strictly between them and the value would be a shorter or
+           closer candidate. A tie, though, depends on which side of the
+           boundary the exact value lies. */
+        uint64_t scale = 1, rest;
+
+        for (i = precision; i < length; i++)
+            scale *= 10;
+        rest = digits % scale;
+        digits /= scale;
+        if (rest * 2 == scale)
+            return -1;
+        if (rest * 2 > scale)
+            digits++;
+        exponent += length - precision;
+    } else if (precision >= 16) {
+        /* %.16g and %.17g may print digits beyond the shortest ones */
+        return -1;
+    }
+
+    /* drop trailing zeros, %g does not print them; this also takes
+       care of a carry like 9.96 -> 10.0 */
+    while (digits != 0 && digits % 10 == 0) {
+        digits /= 10;
+        exponent++;
+    }
+    length = 0;
+    do {
+        digits_buf[length++] = (char)('0' + digits % 10);
+        digits /= 10;
+    } while (digits);
+    sci_exp = exponent + length - 1;
+
+    /* the longest output is like "-1.2345678901234567e-308" */
+    if (size <= 24)
+        return -1;
+
+    if (signbit(value))
+        *p++ = '-';
+
+    if (sci_exp < -4 || sci_exp >= precision) {
+        *p++ = digits_buf[length - 1];
+        if (length > 1) {
+            *p++ = '.';
+            for (i = length - 2; i >= 0; i--)
+                *p++ = digits_buf[i];
+        }
+        *p++ = 'e';
+        p += jsonp_itostr(p, sci_exp);
+    } else if (sci_exp < 0) {
+        *p++ = '0';
+        *p++ = '.';
+        for (i = sci_exp + 1; i < 0; i++)
+            *p++ = '0';
+        for (i = length - 1; i >= 0; i--)
+            *p++ = digits_buf[i];
+    } else {
+        for (i = length - 1; i >= 0; i--) {
+            *p++ = digits_buf[i];
+            if (i == length - 1 - sci_exp && i > 0)
+                *p++ = '.';
+        }
+        if (sci_exp >= length) {
+            /* pad the integer part, then add ".0" so that the value
+               decodes as a real again */
+            for (i = length; i <= sci_exp; i++)
+                *p++ = '0';
+        }
+        if (sci_exp >= length - 1) {
+            *p++ = '.';
+            *p++ = '0';
+        }
+    }
+    *p = '\0';
+
+    return (int)(p - buffer);
+}
+
+int jsonp_dtostr(char *buffer, size_t size, double value, int precision) {
+    int length = dtostr_shortest(buffer, size, value, precision);
+    if (length < 0)
+        length = dtostr_printf(buffer, size, value, precision);
+    return length;
+}
+
 static void from_locale(char *buffer) {
     char point;
     char *pos;
@@ -182,7 +537,7 @@ static void from_locale(char *buffer) {
         *pos = '.';
 }
 
-int jsonp_dtostr(char *buffer, size_t size, double value, int precision) {
+static int dtostr_printf(char *buffer, size_t size, double value, int precision) {
     int ret;
     char *start, *end;
     size_t length;
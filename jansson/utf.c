@@ -141,7 +141,13 @@ int utf8_check_string(const char *string, size_t length) {
     size_t i;
 
     for (i = 0; i < length; i++) {
-        size_t count = utf8_check_first(string[i]);
+        size_t count;
+
+        i += utf8_span_ascii(string + i, length - i);
+        if (i == length)
+            break;
+
+        count = utf8_check_first(string[i]);
         if (count == 0)
             return 0;
         else if (count > 1) {
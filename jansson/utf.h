@@ -25,4 +25,9 @@ const char *utf8_iterate(const char *buffer, size_t size, int32_t *codepoint);
 
 int utf8_check_string(const char *string, size_t length);
 
+/* vectorized, see simd.c */
+size_t utf8_span_plain(const char *buffer, size_t size, int escape_slash);
+size_t utf8_span_ascii(const char *buffer, size_t size);
+size_t utf8_span_structure(const char *buffer, size_t size, int in_string);
+
 #endif
@@ -37,32 +37,185 @@ static JSON_INLINE int isnan(double x) { return x != x; }
 static JSON_INLINE int isinf(double x) { return !isnan(x) && isnan(x - x); }
 #endif
 
-json_t *do_deep_copy(const json_t *json, hashtable_t *parents);
+json_t *do_deep_copy(const json_t *json, loop_set_t *parents, json_arena_t *arena);
 
 static JSON_INLINE void json_init(json_t *json, json_type type) {
     json->type = type;
+    json->flags = 0;
     json->refcount = 1;
 }
 
-int jsonp_loop_check(hashtable_t *parents, const json_t *json, char *key, size_t key_size,
-                     size_t *key_len_out) {
-    size_t key_len = snprintf(key, key_size, "%p", json);
+/* Digests cached by json_hash() are valid while the epochs of the hash
+   domains of everything they cover stay the same. A change moves the
+   epoch of its own domain only, and only if a digest was computed since
+   it last moved, so documents that are never hashed don't pay for it and
+   changing one document leaves the digests of most others valid. */
+typedef struct {
+    volatile size_t epoch;
+    volatile int hashed; /* a digest may depend on this epoch */
+    char padding[64 - sizeof(size_t) - sizeof(int)];
+} hash_domain_t;
 
-    if (key_len_out)
-        *key_len_out = key_len;
+static hash_domain_t hash_domains[JSON_HASH_DOMAINS];
+static volatile unsigned int hash_domain_next;
 
-    if (hashtable_get(parents, key, key_len))
+/* A domain for a new document, 0 is left to values made one by one */
+unsigned int jsonp_hash_domain(void) {
+    return JSONP_INC(&hash_domain_next) % (JSON_HASH_DOMAINS - 1) + 1;
+}
+
+/* Called before json changes. hashed is cleared before the epoch moves:
+   json_hash() reads the epoch before it sets hashed, so a digest never
+   gets an epoch that is final while hashed is clear. */
+static JSON_INLINE void hash_touch(json_t *json) {
+    hash_domain_t *domain = &hash_domains[json_domain(json)];
+
+    if (JSONP_LOAD(&domain->hashed)) {
+        JSONP_STORE(&domain->hashed, 0);
+        JSONP_INC(&domain->epoch);
+    }
+}
+
+/* Arena values are immortal: reference counting never deletes them */
+static JSON_INLINE void json_init_arena(json_t *json, json_type type,
+                                        json_arena_t *arena) {
+    json_init(json, type);
+    if (arena) {
+        json->flags |= JSON_NODE_ARENA;
+        json->refcount = (size_t)-1;
+    }
+}
+
+/* Values stored into a container must not be freed before it: heap
+   values and values of another arena are deep copied into an arena
+   container, arena values into a heap one, and the reference passed in
+   is released. Other immortal values (true, false, null and shared
+   ones) are never freed and are stored as they are. */
+static json_t *arena_adopt(json_arena_t *arena, json_t *value) {
+    json_t *copy;
+    loop_set_t parents_set;
+
+    if (!value)
+        return value;
+    if (value->flags & JSON_NODE_ARENA) {
+        if (arena && jsonp_arena_owns(arena, value))
+            return value;
+    } else if (!arena || value->refcount == (size_t)-1)
+        return value;
+
+    jsonp_loop_init(&parents_set);
+    copy = do_deep_copy(value, &parents_set, arena);
+    jsonp_loop_close(&parents_set);
+
+    json_decref(value);
+    return copy;
+}
+
+void jsonp_loop_init(loop_set_t *set) {
+    memset(set->inline_slots, 0, sizeof(set->inline_slots));
+    set->slots = set->inline_slots;
+    set->mask = LOOP_SET_INLINE - 1;
+    set->count = 0;
+}
+
+void jsonp_loop_close(loop_set_t *set) {
+    if (set->slots != set->inline_slots)
+        jsonp_free(set->slots);
+    set->slots = NULL;
+}
+
+static size_t loop_slot(const loop_set_t *set, const json_t *json) {
+    size_t hash = (size_t)((uintptr_t)json >> 4) * (size_t)0x9E3779B97F4A7C15ULL;
+    return (hash ^ (hash >> 16)) & set->mask;
+}
+
+static int loop_grow(loop_set_t *set) {
+    const json_t **old = set->slots;
+    size_t old_size = set->mask + 1, i;
+    const json_t **slots = jsonp_malloc(2 * old_size * sizeof(json_t *));
+
+    if (!slots)
+        return -1;
+    memset(slots, 0, 2 * old_size * sizeof(json_t *));
+
+    set->slots = slots;
+    set->mask = 2 * old_size - 1;
+    for (i = 0; i < old_size; i++) {
+        if (old[i]) {
+            size_t slot = loop_slot(set, old[i]);
+            while (slots[slot])
+                slot = (slot + 1) & set->mask;
+            slots[slot] = old[i];
+        }
+    }
+
+    if (old != set->inline_slots)
+        jsonp_free(old);
+    return 0;
+}
+
+int jsonp_loop_enter(loop_set_t *set, const json_t *json) {
+    size_t slot;
+
+    if (!set)
+        return 0;
+
+    /* keep at least half of the slots free */
+    if (2 * (set->count + 1) > set->mask + 1 && loop_grow(set))
         return -1;
 
-    return hashtable_set(parents, key, key_len, json_null());
+    slot = loop_slot(set, json);
+    while (set->slots[slot]) {
+        if (set->slots[slot] == json)
+            return -1;
+        slot = (slot + 1) & set->mask;
+    }
+
+    set->slots[slot] = json;
+    set->count++;
+    return 0;
+}
+
+void jsonp_loop_leave(loop_set_t *set, const json_t *json) {
+    size_t slot, next;
+
+    if (!set)
+        return;
+
+    slot = loop_slot(set, json);
+    while (set->slots[slot] != json) {
+        if (!set->slots[slot])
+            return;
+        slot = (slot + 1) & set->mask;
+    }
+
+    /* move later entries of the probe sequence back into the hole */
+    next = slot;
+    while (1) {
+        size_t home;
+
+        next = (next + 1) & set->mask;
+        if (!set->slots[next])
+            break;
+
+        home = loop_slot(set, set->slots[next]);
+        if (((next - home) & set->mask) >= ((next - slot) & set->mask)) {
+            set->slots[slot] = set->slots[next];
+            slot = next;
+        }
+    }
+    set->slots[slot] = NULL;
+    set->count--;
 }
 
 /*** object ***/
 
 extern volatile uint32_t hashtable_seed;
 
-json_t *json_object(void) {
-    json_object_t *object = jsonp_malloc(sizeof(json_object_t));
+json_t *json_object(void) { return jsonp_object_arena(NULL); }
+
+json_t *jsonp_object_arena(json_arena_t *arena) {
+    json_object_t *object = jsonp_arena_malloc(arena, sizeof(json_object_t));
     if (!object)
         return NULL;
 
@@ -71,10 +224,13 @@ json_t *json_object(void) {
         json_object_seed(0);
     }
 
-    json_init(&object->json, JSON_OBJECT);
+    json_init_arena(&object->json, JSON_OBJECT, arena);
+    object->hash = 0;
+    object->hash_epochs = 0;
+    object->hash_domains = 0;
 
-    if (hashtable_init(&object->hashtable)) {
-        jsonp_free(object);
+    if (hashtable_init_arena(&object->hashtable, arena)) {
+        jsonp_arena_free(arena, object);
         return NULL;
     }
 
@@ -113,6 +269,54 @@ json_t *json_object_getn(const json_t *json, const char *key, size_t key_len) {
     return hashtable_get(&object->hashtable, key, key_len);
 }
 
+/* hash must be json_object_key_hash() of key, which stays valid for the
+   lifetime of the process */
+json_t *json_object_getn_hashed(const json_t *json, const char *key, size_t key_len,
+                                size_t hash) {
+    json_object_t *object;
+
+    if (!key || !json_is_object(json))
+        return NULL;
+
+    object = json_to_object(json);
+    return hashtable_get_hashed(&object->hashtable, key, key_len, hash);
+}
+
+size_t json_object_key_hash(const char *key, size_t key_len) {
+    if (!key)
+        return 0;
+
+    return hashtable_hash(key, key_len);
+}
+
+/* hash as for json_object_getn_hashed() */
+int json_object_setn_new_hashed(json_t *json, const char *key, size_t key_len, size_t hash,
+                                json_t *value) {
+    json_object_t *object;
+
+    if (!value)
+        return -1;
+
+    if (!key || !json_is_object(json) || json == value ||
+        !utf8_check_string(key, key_len)) {
+        json_decref(value);
+        return -1;
+    }
+    object = json_to_object(json);
+    hash_touch(json);
+
+    value = arena_adopt(object->hashtable.arena, value);
+    if (!value)
+        return -1;
+
+    if (hashtable_set_hashed(&object->hashtable, key, key_len, hash, value)) {
+        json_decref(value);
+        return -1;
+    }
+
+    return 0;
+}
+
 int json_object_set_new_nocheck(json_t *json, const char *key, json_t *value) {
     if (!key) {
         json_decref(value);
@@ -133,6 +337,11 @@ int json_object_setn_new_nocheck(json_t *json, const char *key, size_t key_len,
         return -1;
     }
     object = json_to_object(json);
+    hash_touch(json);
+
+    value = arena_adopt(object->hashtable.arena, value);
+    if (!value)
+        return -1;
 
     if (hashtable_set(&object->hashtable, key, key_len, value)) {
         json_decref(value);
@@ -142,6 +351,41 @@ int json_object_setn_new_nocheck(json_t *json, const char *key, size_t key_len,
     return 0;
 }
 
+json_t *json_object_get_key(const json_t *json, const json_key_t *key) {
+    json_object_t *object;
+
+    if (!key || !json_is_object(json))
+        return NULL;
+
+    object = json_to_object(json);
+    return hashtable_get_key(&object->hashtable, key);
+}
+
+int json_object_set_key_new(json_t *json, const json_key_t *key, json_t *value) {
+    json_object_t *object;
+
+    if (!value)
+        return -1;
+
+    if (!key || !json_is_object(json) || json == value) {
+        json_decref(value);
+        return -1;
+    }
+    object = json_to_object(json);
+    hash_touch(json);
+
+    value = arena_adopt(object->hashtable.arena, value);
+    if (!value)
+        return -1;
+
+    if (hashtable_set_key(&object->hashtable, key, value)) {
+        json_decref(value);
+        return -1;
+    }
+
+    return 0;
+}
+
 int json_object_set_new(json_t *json, const char *key, json_t *value) {
     if (!key) {
         json_decref(value);
@@ -160,6 +404,24 @@ int json_object_setn_new(json_t *json, const char *key, size_t key_len, json_t *
     return json_object_setn_new_nocheck(json, key, key_len, value);
 }
 
+const json_key_t *json_key_intern(const char *key) {
+    if (!key)
+        return NULL;
+
+    return json_key_internn(key, strlen(key));
+}
+
+const json_key_t *json_key_internn(const char *key, size_t key_len) {
+    if (!key || !utf8_check_string(key, key_len))
+        return NULL;
+
+    return hashtable_intern(key, key_len);
+}
+
+const char *json_key_value(const json_key_t *key) { return key ? key->key : NULL; }
+
+size_t json_key_length(const json_key_t *key) { return key ? key->key_len : 0; }
+
 int json_object_del(json_t *json, const char *key) {
     if (!key)
         return -1;
@@ -174,6 +436,7 @@ int json_object_deln(json_t *json, const char *key, size_t key_len) {
         return -1;
 
     object = json_to_object(json);
+    hash_touch(json);
     return hashtable_del(&object->hashtable, key, key_len);
 }
 
@@ -184,6 +447,7 @@ int json_object_clear(json_t *json) {
         return -1;
 
     object = json_to_object(json);
+    hash_touch(json);
     hashtable_clear(&object->hashtable);
 
     return 0;
@@ -237,18 +501,16 @@ int json_object_update_missing(json_t *object, json_t *other) {
     return 0;
 }
 
-int do_object_update_recursive(json_t *object, json_t *other, hashtable_t *parents) {
+int do_object_update_recursive(json_t *object, json_t *other, loop_set_t *parents) {
     const char *key;
     size_t key_len;
     json_t *value;
-    char loop_key[LOOP_KEY_LEN];
     int res = 0;
-    size_t loop_key_len;
 
     if (!json_is_object(object) || !json_is_object(other))
         return -1;
 
-    if (jsonp_loop_check(parents, other, loop_key, sizeof(loop_key), &loop_key_len))
+    if (jsonp_loop_enter(parents, other))
         return -1;
 
     json_object_keylen_foreach(other, key, key_len, value) {
@@ -267,19 +529,18 @@ int do_object_update_recursive(json_t *object, json_t *other, hashtable_t *paren
         }
     }
 
-    hashtable_del(parents, loop_key, loop_key_len);
+    jsonp_loop_leave(parents, other);
 
     return res;
 }
 
 int json_object_update_recursive(json_t *object, json_t *other) {
     int res;
-    hashtable_t parents_set;
+    loop_set_t parents_set;
 
-    if (hashtable_init(&parents_set))
-        return -1;
+    jsonp_loop_init(&parents_set);
     res = do_object_update_recursive(object, other, &parents_set);
-    hashtable_close(&parents_set);
+    jsonp_loop_close(&parents_set);
 
     return res;
 }
@@ -341,10 +602,38 @@ int json_object_iter_set_new(json_t *json, void *iter, json_t *value) {
         return -1;
     }
 
+    hash_touch(json);
+    value = arena_adopt(json_to_object(json)->hashtable.arena, value);
+    if (!value)
+        return -1;
+
     hashtable_iter_set(iter, value);
     return 0;
 }
 
+size_t json_object_get_items(const json_t *json, size_t *position,
+                             json_object_item_t *items, size_t count) {
+    const hashtable_t *hashtable;
+    size_t i, n = 0;
+
+    if (!json_is_object(json) || !position)
+        return 0;
+    hashtable = &json_to_object(json)->hashtable;
+
+    for (i = *position; i < hashtable->used && n < count; i++) {
+        const struct hashtable_pair *pair = hashtable->entries[i].pair;
+
+        if (!pair)
+            continue;
+        items[n].key = pair->key;
+        items[n].key_len = pair->key_len;
+        items[n].value = pair->value;
+        n++;
+    }
+    *position = i;
+    return n;
+}
+
 void *json_object_key_to_iter(const char *key) {
     if (!key)
         return NULL;
@@ -356,12 +645,22 @@ static int json_object_equal(const json_t *object1, const json_t *object2) {
     const char *key;
     size_t key_len;
     const json_t *value1, *value2;
+    void *iter2;
 
     if (json_object_size(object1) != json_object_size(object2))
         return 0;
 
+    iter2 = json_object_iter((json_t *)object2);
     json_object_keylen_foreach((json_t *)object1, key, key_len, value1) {
-        value2 = json_object_getn(object2, key, key_len);
+        /* objects built alike keep their keys in the same order, so try
+           the member at the same position before a lookup */
+        if (iter2 && json_object_iter_key_len(iter2) == key_len &&
+            memcmp(json_object_iter_key(iter2), key, key_len) == 0)
+            value2 = json_object_iter_value(iter2);
+        else
+            value2 = json_object_getn(object2, key, key_len);
+        if (iter2)
+            iter2 = json_object_iter_next((json_t *)object2, iter2);
 
         if (!json_equal(value1, value2))
             return 0;
@@ -387,73 +686,253 @@ static json_t *json_object_copy(json_t *object) {
     return result;
 }
 
-static json_t *json_object_deep_copy(const json_t *object, hashtable_t *parents) {
-    json_t *result;
-    void *iter;
-    char loop_key[LOOP_KEY_LEN];
-    size_t loop_key_len;
+/*** array ***/
+
+json_t *json_array(void) { return jsonp_array_arena(NULL); }
 
-    if (jsonp_loop_check(parents, object, loop_key, sizeof(loop_key), &loop_key_len))
+json_t *jsonp_array_arena(json_arena_t *arena) {
+    json_array_t *array = jsonp_arena_malloc(arena, sizeof(json_array_t));
+    if (!array)
         return NULL;
+    json_init_arena(&array->json, JSON_ARRAY, arena);
 
-    result = json_object();
-    if (!result)
-        goto out;
+    array->entries = 0;
+    array->size = 8;
+    array->arena = arena;
+    array->packed = 0;
+    array->values = NULL;
+    array->hash = 0;
+    array->hash_epochs = 0;
+    array->hash_domains = 0;
+
+    array->table = jsonp_arena_malloc(arena, array->size * sizeof(json_t *));
+    if (!array->table) {
+        jsonp_arena_free(arena, array);
+        return NULL;
+    }
 
-    /* Cannot use json_object_foreach because object has to be cast
-       non-const */
-    iter = json_object_iter((json_t *)object);
-    while (iter) {
-        const char *key;
-        size_t key_len;
-        const json_t *value;
-        key = json_object_iter_key(iter);
-        key_len = json_object_iter_key_len(iter);
-        value = json_object_iter_value(iter);
-
-        if (json_object_setn_new_nocheck(result, key, key_len,
-                                         do_deep_copy(value, parents))) {
-            json_decref(result);
-            result = NULL;
-            break;
-        }
-        iter = json_object_iter_next((json_t *)object, iter);
+    return &array->json;
+}
+
+static void json_delete_array(json_array_t *array) {
+    size_t i;
+
+    /* a packed array may have nodes of some elements in its table */
+    if (array->table) {
+        for (i = 0; i < array->entries; i++)
+            json_decref(array->table[i]);
     }
+    if (array->packed)
+        jsonp_free(array->values);
 
-out:
-    hashtable_del(parents, loop_key, loop_key_len);
+    jsonp_free(array->table);
+    jsonp_free(array);
+}
 
-    return result;
+static size_t packed_width(int type) {
+    return type == JSON_REAL ? sizeof(double) : sizeof(json_int_t);
 }
 
-/*** array ***/
+/* Makes room for size elements in a packed array, and in its table of
+   nodes if it has one */
+static int packed_reserve(json_array_t *array, size_t size) {
+    size_t width = packed_width(array->packed);
+    json_t **table = NULL;
+    void *values;
 
-json_t *json_array(void) {
-    json_array_t *array = jsonp_malloc(sizeof(json_array_t));
-    if (!array)
+    if (size <= array->size)
+        return 0;
+    if (size > (size_t)-1 / width || size > (size_t)-1 / sizeof(json_t *))
+        return -1;
+
+    values = jsonp_arena_malloc(array->arena, size * width);
+    if (!values)
+        return -1;
+    if (array->table) {
+        table = jsonp_arena_malloc(array->arena, size * sizeof(json_t *));
+        if (!table) {
+            jsonp_arena_free(array->arena, values);
+            return -1;
+        }
+        memcpy(table, array->table, array->entries * sizeof(json_t *));
+        memset(table + array->entries, 0, (size - array->entries) * sizeof(json_t *));
+        jsonp_arena_free(array->arena, array->table);
+        array->table = table;
+    }
+
+    if (array->entries)
+        memcpy(values, array->values, array->entries * width);
+    jsonp_arena_free(array->arena, array->values);
+    array->values = values;
+    array->size = size;
+    return 0;
+}
+
+/* Returns where the next packed value of type goes, turning an empty
+   array into a packed one. NULL if array holds anything else. */
+static void *array_pack_slot(json_array_t *array, int type) {
+    if (array->packed != type) {
+        if (array->entries)
+            return NULL;
+        /* empty, so there are no nodes in the table */
+        jsonp_arena_free(array->arena, array->table);
+        jsonp_arena_free(array->arena, array->values);
+        array->table = NULL;
+        array->values = NULL;
+        array->size = 0;
+        array->packed = type;
+    }
+
+    if (array->entries == array->size &&
+        packed_reserve(array, array->size ? array->size * 2 : 8))
         return NULL;
-    json_init(&array->json, JSON_ARRAY);
 
-    array->entries = 0;
-    array->size = 8;
+    return (char *)array->values + array->entries * packed_width(type);
+}
 
-    array->table = jsonp_malloc(array->size * sizeof(json_t *));
-    if (!array->table) {
-        jsonp_free(array);
+int jsonp_array_pack_real(json_t *json, double value) {
+    json_array_t *array = json_to_array(json);
+    double *slot = array_pack_slot(array, JSON_REAL);
+
+    if (!slot)
+        return -1;
+    *slot = value;
+    array->entries++;
+    return 0;
+}
+
+int jsonp_array_pack_integer(json_t *json, json_int_t value) {
+    json_array_t *array = json_to_array(json);
+    json_int_t *slot = array_pack_slot(array, JSON_INTEGER);
+
+    if (!slot)
+        return -1;
+    *slot = value;
+    array->entries++;
+    return 0;
+}
+
+/* Where the current value of element index of a packed array is. That's
+   its node if it has one, which may have been changed since. table is
+   the table of nodes as loaded by the caller, or NULL. */
+static const void *packed_value(const json_array_t *array, json_t **table, size_t index) {
+    json_t *node = table ? JSONP_LOAD(&table[index]) : NULL;
+
+    if (array->packed == JSON_REAL)
+        return node ? (const void *)&json_to_real(node)->value
+                    : (const void *)((const double *)array->values + index);
+    return node ? (const void *)&json_to_integer(node)->value
+                : (const void *)((const json_int_t *)array->values + index);
+}
+
+/* The table of nodes of a packed array, made on first use. Threads only
+   reading the array may race here and in array_node(): the table and
+   each node in it are installed with a compare-and-swap, and a thread
+   that loses drops its own. Arena arrays allocate under the arena lock. */
+static json_t **packed_table(json_array_t *array) {
+    json_t **table = JSONP_LOAD(&array->table);
+    size_t size = array->size * sizeof(json_t *);
+
+    if (table || !size)
+        return table;
+
+    if (array->arena)
+        jsonp_arena_lock(array->arena);
+    table = jsonp_arena_malloc(array->arena, size);
+    if (array->arena)
+        jsonp_arena_unlock(array->arena);
+    if (!table)
         return NULL;
+    memset(table, 0, size);
+
+    if (!JSONP_CAS(&array->table, NULL, table)) {
+        jsonp_arena_free(array->arena, table);
+        table = JSONP_LOAD(&array->table);
     }
+    return table;
+}
 
-    return &array->json;
+/* The node of element index of a packed array, made on first use */
+static json_t *array_node(json_array_t *array, size_t index) {
+    json_t **table = packed_table(array), *node;
+
+    if (!table)
+        return NULL;
+    node = JSONP_LOAD(&table[index]);
+    if (node)
+        return node;
+
+    if (array->arena)
+        jsonp_arena_lock(array->arena);
+    if (array->packed == JSON_REAL)
+        node = jsonp_real_arena(array->arena, ((const double *)array->values)[index]);
+    else
+        node = jsonp_integer_arena(array->arena, ((const json_int_t *)array->values)[index]);
+    if (array->arena)
+        jsonp_arena_unlock(array->arena);
+    if (!node)
+        return NULL;
+    /* a digest covering the array covers the new node too */
+    node->flags |= array->json.flags & (JSON_NODE_LOCAL | JSON_NODE_DOMAIN);
+
+    if (!JSONP_CAS(&table[index], NULL, node)) {
+        json_decref(node);
+        node = JSONP_LOAD(&table[index]);
+    }
+    return node;
 }
 
-static void json_delete_array(json_array_t *array) {
+/* Turns a packed array into an ordinary one, making the nodes its
+   elements don't have yet. Only for changes, which no reader races
+   with; on allocation failure it is left packed. */
+static int array_unpack(json_array_t *array) {
     size_t i;
 
-    for (i = 0; i < array->entries; i++)
-        json_decref(array->table[i]);
+    if (!array->packed)
+        return 0;
+    if (array->size < 8 && packed_reserve(array, 8))
+        return -1;
+    if (!packed_table(array))
+        return -1;
+
+    for (i = 0; i < array->entries; i++) {
+        if (!array_node(array, i))
+            return -1;
+    }
 
-    jsonp_free(array->table);
-    jsonp_free(array);
+    jsonp_arena_free(array->arena, array->values);
+    array->values = NULL;
+    array->packed = 0;
+    return 0;
+}
+
+const json_t *jsonp_array_peek(const json_t *json, size_t index, jsonp_shadow_t *shadow) {
+    json_array_t *array = json_to_array(json);
+    json_t **table, *node;
+    const void *value;
+
+    if (index >= array->entries)
+        return NULL;
+    if (!array->packed)
+        return array->table[index];
+
+    table = JSONP_LOAD(&array->table);
+    node = table ? JSONP_LOAD(&table[index]) : NULL;
+    if (node)
+        return node;
+
+    /* immortal, so passing it around never touches the reference count */
+    value = packed_value(array, NULL, index);
+    if (array->packed == JSON_REAL) {
+        json_init(&shadow->real.json, JSON_REAL);
+        shadow->real.json.refcount = (size_t)-1;
+        shadow->real.value = *(const double *)value;
+        return &shadow->real.json;
+    }
+    json_init(&shadow->integer.json, JSON_INTEGER);
+    shadow->integer.json.refcount = (size_t)-1;
+    shadow->integer.value = *(const json_int_t *)value;
+    return &shadow->integer.json;
 }
 
 size_t json_array_size(const json_t *json) {
@@ -472,6 +951,10 @@ json_t *json_array_get(const json_t *json, size_t index) {
     if (index >= array->entries)
         return NULL;
 
+    /* a packed array makes the node of just this element */
+    if (array->packed)
+        return array_node(array, index);
+
     return array->table[index];
 }
 
@@ -487,10 +970,15 @@ int json_array_set_new(json_t *json, size_t index, json_t *value) {
     }
     array = json_to_array(json);
 
-    if (index >= array->entries) {
+    if (index >= array->entries || array_unpack(array)) {
         json_decref(value);
         return -1;
     }
+    hash_touch(json);
+
+    value = arena_adopt(array->arena, value);
+    if (!value)
+        return -1;
 
     json_decref(array->table[index]);
     array->table[index] = value;
@@ -517,7 +1005,7 @@ static json_t **json_array_grow(json_array_t *array, size_t amount, int copy) {
     old_table = array->table;
 
     new_size = max(array->size + amount, array->size * 2);
-    new_table = jsonp_malloc(new_size * sizeof(json_t *));
+    new_table = jsonp_arena_malloc(array->arena, new_size * sizeof(json_t *));
     if (!new_table)
         return NULL;
 
@@ -526,7 +1014,7 @@ static json_t **json_array_grow(json_array_t *array, size_t amount, int copy) {
 
     if (copy) {
         array_copy(array->table, 0, old_table, 0, array->entries);
-        jsonp_free(old_table);
+        jsonp_arena_free(array->arena, old_table);
         return array->table;
     }
 
@@ -545,6 +1033,16 @@ int json_array_append_new(json_t *json, json_t *value) {
     }
     array = json_to_array(json);
 
+    if (array_unpack(array)) {
+        json_decref(value);
+        return -1;
+    }
+    hash_touch(json);
+
+    value = arena_adopt(array->arena, value);
+    if (!value)
+        return -1;
+
     if (!json_array_grow(array, 1, 1)) {
         json_decref(value);
         return -1;
@@ -569,10 +1067,15 @@ int json_array_insert_new(json_t *json, size_t index, json_t *value) {
     }
     array = json_to_array(json);
 
-    if (index > array->entries) {
+    if (index > array->entries || array_unpack(array)) {
         json_decref(value);
         return -1;
     }
+    hash_touch(json);
+
+    value = arena_adopt(array->arena, value);
+    if (!value)
+        return -1;
 
     old_table = json_array_grow(array, 1, 0);
     if (!old_table) {
@@ -583,7 +1086,7 @@ int json_array_insert_new(json_t *json, size_t index, json_t *value) {
     if (old_table != array->table) {
         array_copy(array->table, 0, old_table, 0, index);
         array_copy(array->table, index + 1, old_table, index, array->entries - index);
-        jsonp_free(old_table);
+        jsonp_arena_free(array->arena, old_table);
     } else
         array_move(array, index + 1, index, array->entries - index);
 
@@ -602,6 +1105,19 @@ int json_array_remove(json_t *json, size_t index) {
 
     if (index >= array->entries)
         return -1;
+    hash_touch(json);
+
+    if (array->packed) {
+        size_t width = packed_width(array->packed);
+        char *values = array->values;
+
+        memmove(values + index * width, values + (index + 1) * width,
+                (array->entries - index - 1) * width);
+        if (!array->table) {
+            array->entries--;
+            return 0;
+        }
+    }
 
     json_decref(array->table[index]);
 
@@ -610,6 +1126,9 @@ int json_array_remove(json_t *json, size_t index) {
         array_move(array, index, index + 1, array->entries - index - 1);
 
     array->entries--;
+    /* the table of a packed array has no node past the end */
+    if (array->packed)
+        array->table[array->entries] = NULL;
 
     return 0;
 }
@@ -621,9 +1140,14 @@ int json_array_clear(json_t *json) {
     if (!json_is_array(json))
         return -1;
     array = json_to_array(json);
+    hash_touch(json);
 
-    for (i = 0; i < array->entries; i++)
-        json_decref(array->table[i]);
+    if (array->table) {
+        for (i = 0; i < array->entries; i++) {
+            json_decref(array->table[i]);
+            array->table[i] = NULL;
+        }
+    }
 
     array->entries = 0;
     return 0;
@@ -638,9 +1162,32 @@ int json_array_extend(json_t *json, json_t *other_json) {
     array = json_to_array(json);
     other = json_to_array(other_json);
 
+    if (array_unpack(array))
+        return -1;
+    /* other is only read: its elements become nodes as in json_array_get() */
+    for (i = 0; other->packed && i < other->entries; i++) {
+        if (!array_node(other, i))
+            return -1;
+    }
+    hash_touch(json);
+
     if (!json_array_grow(array, other->entries, 1))
         return -1;
 
+    if (array->arena || other->arena) {
+        /* other may be array itself, so don't touch entries until done */
+        size_t entries = other->entries;
+
+        for (i = 0; i < entries; i++) {
+            json_t *value = arena_adopt(array->arena, json_incref(other->table[i]));
+            if (!value)
+                return -1;
+            array->table[array->entries + i] = value;
+        }
+        array->entries += entries;
+        return 0;
+    }
+
     for (i = 0; i < other->entries; i++)
         json_incref(other->table[i]);
 
@@ -650,18 +1197,174 @@ int json_array_extend(json_t *json, json_t *other_json) {
     return 0;
 }
 
-static int json_array_equal(const json_t *array1, const json_t *array2) {
-    size_t i, size;
+int json_array_reserve(json_t *json, size_t size) {
+    json_array_t *array;
+    json_t **table;
 
-    size = json_array_size(array1);
-    if (size != json_array_size(array2))
-        return 0;
+    if (!json_is_array(json))
+        return -1;
+    array = json_to_array(json);
+
+    if (array->packed)
+        return packed_reserve(array, size);
+    if (size <= array->size)
+        return 0;
+    if (size > (size_t)-1 / sizeof(json_t *))
+        return -1;
+
+    /* exactly size, unlike the doubling of json_array_grow() */
+    table = jsonp_arena_malloc(array->arena, size * sizeof(json_t *));
+    if (!table)
+        return -1;
+
+    array_copy(table, 0, array->table, 0, array->entries);
+    jsonp_arena_free(array->arena, array->table);
+    array->table = table;
+    array->size = size;
+    return 0;
+}
+
+/* an array with room for exactly count entries */
+/* A packed array of count values of type copied from values: no node is
+   made until an element is asked for, see array_node() */
+static json_t *array_of_packed(int type, const void *values, size_t count) {
+    json_t *json;
+    json_array_t *array;
+
+    if (count && !values)
+        return NULL;
+    json = json_array();
+    if (!json || !count)
+        return json;
+
+    array = json_to_array(json);
+    if (!array_pack_slot(array, type) || packed_reserve(array, count)) {
+        json_decref(json);
+        return NULL;
+    }
+    memcpy(array->values, values, count * packed_width(type));
+    array->entries = count;
+    return json;
+}
+
+json_t *json_array_of_reals(const double *values, size_t count) {
+    return array_of_packed(JSON_REAL, values, count);
+}
+
+json_t *json_array_of_integers(const json_int_t *values, size_t count) {
+    return array_of_packed(JSON_INTEGER, values, count);
+}
+
+size_t json_array_get_reals(const json_t *json, size_t index, double *values,
+                            size_t count) {
+    const json_array_t *array;
+    size_t i;
+
+    if (!json_is_array(json))
+        return 0;
+    array = json_to_array(json);
+
+    if (array->packed) {
+        json_t **table = JSONP_LOAD(&((json_array_t *)array)->table);
+
+        for (i = 0; i < count && index + i < array->entries; i++) {
+            const void *value = packed_value(array, table, index + i);
+
+            if (array->packed == JSON_REAL)
+                values[i] = *(const double *)value;
+            else
+                values[i] = (double)*(const json_int_t *)value;
+        }
+        return i;
+    }
+
+    for (i = 0; i < count && index + i < array->entries; i++) {
+        const json_t *value = array->table[index + i];
+
+        if (json_is_real(value))
+            values[i] = json_to_real(value)->value;
+        else if (json_is_integer(value))
+            values[i] = (double)json_to_integer(value)->value;
+        else
+            break;
+    }
+    return i;
+}
+
+size_t json_array_get_integers(const json_t *json, size_t index, json_int_t *values,
+                               size_t count) {
+    const json_array_t *array;
+    size_t i;
+
+    if (!json_is_array(json))
+        return 0;
+    array = json_to_array(json);
+
+    if (array->packed == JSON_REAL)
+        return 0;
+    if (array->packed) {
+        json_t **table = JSONP_LOAD(&((json_array_t *)array)->table);
+
+        if (index >= array->entries)
+            return 0;
+        i = count < array->entries - index ? count : array->entries - index;
+        if (!table) {
+            memcpy(values, (const json_int_t *)array->values + index, i * sizeof(json_int_t));
+            return i;
+        }
+        for (i = 0; i < count && index + i < array->entries; i++)
+            values[i] = *(const json_int_t *)packed_value(array, table, index + i);
+        return i;
+    }
+
+    for (i = 0; i < count && index + i < array->entries; i++) {
+        const json_t *value = array->table[index + i];
+
+        if (!json_is_integer(value))
+            break;
+        values[i] = json_to_integer(value)->value;
+    }
+    return i;
+}
+
+size_t json_array_get_values(const json_t *json, size_t index, json_t **values,
+                             size_t count) {
+    json_array_t *array;
+
+    if (!json_is_array(json))
+        return 0;
+    array = json_to_array(json);
+
+    if (index >= array->entries)
+        return 0;
+    if (count > array->entries - index)
+        count = array->entries - index;
+    if (array->packed) {
+        size_t i;
+
+        for (i = 0; i < count; i++) {
+            if (!(values[i] = array_node(array, index + i)))
+                return i;
+        }
+        return count;
+    }
+    memcpy(values, array->table + index, count * sizeof(json_t *));
+    return count;
+}
+
+static int json_array_equal(const json_t *array1, const json_t *array2) {
+    size_t i, size;
+
+    size = json_array_size(array1);
+    if (size != json_array_size(array2))
+        return 0;
 
     for (i = 0; i < size; i++) {
-        json_t *value1, *value2;
+        jsonp_shadow_t shadow1, shadow2;
+        const json_t *value1, *value2;
 
-        value1 = json_array_get(array1, i);
-        value2 = json_array_get(array2, i);
+        value1 = jsonp_array_peek(array1, i, &shadow1);
+        value2 = jsonp_array_peek(array2, i, &shadow2);
 
         if (!json_equal(value1, value2))
             return 0;
@@ -670,71 +1373,89 @@ static int json_array_equal(const json_t *array1, const json_t *array2) {
     return 1;
 }
 
-static json_t *json_array_copy(json_t *array) {
-    json_t *result;
-    size_t i;
-
-    result = json_array();
-    if (!result)
-        return NULL;
+/* Gives result, a new empty array, a copy of the packed values of json */
+static int array_copy_packed(json_t *result, const json_t *json) {
+    const json_array_t *array = json_to_array(json);
+    json_array_t *copy = json_to_array(result);
+    json_t **table = JSONP_LOAD(&((json_array_t *)array)->table);
+    size_t width = packed_width(array->packed), i;
+    void *values;
 
-    for (i = 0; i < json_array_size(array); i++)
-        json_array_append(result, json_array_get(array, i));
-
-    return result;
+    values = jsonp_arena_malloc(copy->arena, max(array->entries, 1) * width);
+    if (!values)
+        return -1;
+    memcpy(values, array->values, array->entries * width);
+    for (i = 0; table && i < array->entries; i++)
+        memcpy((char *)values + i * width, packed_value(array, table, i), width);
+
+    jsonp_arena_free(copy->arena, copy->table);
+    copy->table = NULL;
+    copy->values = values;
+    copy->packed = array->packed;
+    copy->size = copy->entries = array->entries;
+    return 0;
 }
 
-static json_t *json_array_deep_copy(const json_t *array, hashtable_t *parents) {
+static json_t *json_array_copy(json_t *array) {
     json_t *result;
     size_t i;
-    char loop_key[LOOP_KEY_LEN];
-    size_t loop_key_len;
-
-    if (jsonp_loop_check(parents, array, loop_key, sizeof(loop_key), &loop_key_len))
-        return NULL;
 
     result = json_array();
     if (!result)
-        goto out;
+        return NULL;
 
-    for (i = 0; i < json_array_size(array); i++) {
-        if (json_array_append_new(result,
-                                  do_deep_copy(json_array_get(array, i), parents))) {
+    if (json_to_array(array)->packed) {
+        if (array_copy_packed(result, array)) {
             json_decref(result);
-            result = NULL;
-            break;
+            return NULL;
         }
+        return result;
     }
 
-out:
-    hashtable_del(parents, loop_key, loop_key_len);
+    for (i = 0; i < json_array_size(array); i++)
+        json_array_append(result, json_array_get(array, i));
 
     return result;
 }
 
 /*** string ***/
 
-static json_t *string_create(const char *value, size_t len, int own) {
+static json_t *string_create(json_arena_t *arena, const char *value, size_t len,
+                             int own) {
     char *v;
     json_string_t *string;
 
     if (!value)
         return NULL;
 
+    if (!own && len <= JSON_STRING_INLINE) {
+        /* one allocation for both */
+        string = jsonp_arena_malloc(arena, sizeof(json_string_t) + len + 1);
+        if (!string)
+            return NULL;
+        json_init_arena(&string->json, JSON_STRING, arena);
+        string->json.flags |= JSON_NODE_INLINE;
+        string->value = (char *)(string + 1);
+        memcpy(string->value, value, len);
+        string->value[len] = '\0';
+        string->length = len;
+        return &string->json;
+    }
+
     if (own)
         v = (char *)value;
     else {
-        v = jsonp_strndup(value, len);
+        v = jsonp_arena_strndup(arena, value, len);
         if (!v)
             return NULL;
     }
 
-    string = jsonp_malloc(sizeof(json_string_t));
+    string = jsonp_arena_malloc(arena, sizeof(json_string_t));
     if (!string) {
-        jsonp_free(v);
+        jsonp_arena_free(arena, v);
         return NULL;
     }
-    json_init(&string->json, JSON_STRING);
+    json_init_arena(&string->json, JSON_STRING, arena);
     string->value = v;
     string->length = len;
 
@@ -745,16 +1466,33 @@ json_t *json_string_nocheck(const char *value) {
     if (!value)
         return NULL;
 
-    return string_create(value, strlen(value), 0);
+    return string_create(NULL, value, strlen(value), 0);
 }
 
 json_t *json_stringn_nocheck(const char *value, size_t len) {
-    return string_create(value, len, 0);
+    return string_create(NULL, value, len, 0);
 }
 
 /* this is private; "steal" is not a public API concept */
 json_t *jsonp_stringn_nocheck_own(const char *value, size_t len) {
-    return string_create(value, len, 1);
+    return string_create(NULL, value, len, 1);
+}
+
+json_t *jsonp_stringn_nocheck_arena(json_arena_t *arena, const char *value, size_t len) {
+    return string_create(arena, value, len, 0);
+}
+
+json_t *jsonp_stringn_nocheck_own_arena(json_arena_t *arena, const char *value,
+                                        size_t len) {
+    return string_create(arena, value, len, 1);
+}
+
+json_t *jsonp_stringn_nocheck_borrow_arena(json_arena_t *arena, const char *value,
+                                           size_t len) {
+    json_t *json = string_create(arena, value, len, 1);
+    if (json)
+        json->flags |= JSON_NODE_BORROWED;
+    return json;
 }
 
 json_t *json_string(const char *value) {
@@ -796,15 +1534,31 @@ int json_string_setn_nocheck(json_t *json, const char *value, size_t len) {
     char *dup;
     json_string_t *string;
 
-    if (!json_is_string(json) || !value)
+    if (!json_is_string(json) || !value || (json->flags & JSON_NODE_SHARED))
         return -1;
 
+    string = json_to_string(json);
+    hash_touch(json);
+
+    if (json->flags & JSON_NODE_ARENA) {
+        /* the owning arena is unknown here, only rewrite in place */
+        if (len > string->length)
+            return -1;
+
+        memmove(string->value, value, len);
+        string->value[len] = '\0';
+        string->length = len;
+        return 0;
+    }
+
     dup = jsonp_strndup(value, len);
     if (!dup)
         return -1;
 
-    string = json_to_string(json);
-    jsonp_free(string->value);
+    if (json->flags & (JSON_NODE_BORROWED | JSON_NODE_INLINE))
+        json->flags &= ~(JSON_NODE_BORROWED | JSON_NODE_INLINE);
+    else
+        jsonp_free(string->value);
     string->value = dup;
     string->length = len;
 
@@ -826,7 +1580,8 @@ int json_string_setn(json_t *json, const char *value, size_t len) {
 }
 
 static void json_delete_string(json_string_t *string) {
-    jsonp_free(string->value);
+    if (!(string->json.flags & (JSON_NODE_BORROWED | JSON_NODE_INLINE)))
+        jsonp_free(string->value);
     jsonp_free(string);
 }
 
@@ -888,13 +1643,57 @@ json_t *json_sprintf(const char *fmt, ...) {
     return result;
 }
 
+/*** shared values ***/
+
+/* static tables, m(n) for every n of a run */
+#define REPEAT4(m, n)   m(n), m((n) + 1), m((n) + 2), m((n) + 3)
+#define REPEAT16(m, n)  REPEAT4(m, n), REPEAT4(m, (n) + 4), REPEAT4(m, (n) + 8), REPEAT4(m, (n) + 12)
+#define REPEAT64(m, n)  REPEAT16(m, n), REPEAT16(m, (n) + 16), REPEAT16(m, (n) + 32), REPEAT16(m, (n) + 48)
+#define REPEAT128(m, n) REPEAT64(m, n), REPEAT64(m, (n) + 64)
+#define REPEAT256(m, n) REPEAT128(m, n), REPEAT128(m, (n) + 128)
+
+#define SHARED_NODE(type) {(type), JSON_NODE_SHARED, (size_t)-1}
+
+#define SHARED_MIN -128
+#define SHARED_MAX 1023
+
+#define SHARED_CHAR(c)    (char)(c), '\0'
+#define SHARED_STRING(c)  {SHARED_NODE(JSON_STRING), &shared_chars[2 * (c)], 1}
+#define SHARED_INTEGER(n) {SHARED_NODE(JSON_INTEGER), (n)}
+
+static char shared_chars[] = {REPEAT128(SHARED_CHAR, 0)};
+static json_string_t shared_strings[] = {REPEAT128(SHARED_STRING, 0)};
+static json_string_t shared_empty = {SHARED_NODE(JSON_STRING), &shared_chars[1], 0};
+
+static json_integer_t shared_integers[] = {
+    REPEAT128(SHARED_INTEGER, SHARED_MIN),  REPEAT256(SHARED_INTEGER, 0),
+    REPEAT256(SHARED_INTEGER, 256),         REPEAT256(SHARED_INTEGER, 512),
+    REPEAT256(SHARED_INTEGER, 768),
+};
+
+json_t *jsonp_shared_string(const char *value, size_t len) {
+    if (len == 0)
+        return &shared_empty.json;
+    if (len == 1 && (unsigned char)value[0] < 0x80)
+        return &shared_strings[(unsigned char)value[0]].json;
+    return NULL;
+}
+
+json_t *jsonp_shared_integer(json_int_t value) {
+    if (value < SHARED_MIN || value > SHARED_MAX)
+        return NULL;
+    return &shared_integers[value - SHARED_MIN].json;
+}
+
 /*** integer ***/
 
-json_t *json_integer(json_int_t value) {
-    json_integer_t *integer = jsonp_malloc(sizeof(json_integer_t));
+json_t *json_integer(json_int_t value) { return jsonp_integer_arena(NULL, value); }
+
+json_t *jsonp_integer_arena(json_arena_t *arena, json_int_t value) {
+    json_integer_t *integer = jsonp_arena_malloc(arena, sizeof(json_integer_t));
     if (!integer)
         return NULL;
-    json_init(&integer->json, JSON_INTEGER);
+    json_init_arena(&integer->json, JSON_INTEGER, arena);
 
     integer->value = value;
     return &integer->json;
@@ -908,9 +1707,10 @@ json_int_t json_integer_value(const json_t *json) {
 }
 
 int json_integer_set(json_t *json, json_int_t value) {
-    if (!json_is_integer(json))
+    if (!json_is_integer(json) || (json->flags & JSON_NODE_SHARED))
         return -1;
 
+    hash_touch(json);
     json_to_integer(json)->value = value;
 
     return 0;
@@ -928,16 +1728,18 @@ static json_t *json_integer_copy(const json_t *integer) {
 
 /*** real ***/
 
-json_t *json_real(double value) {
+json_t *json_real(double value) { return jsonp_real_arena(NULL, value); }
+
+json_t *jsonp_real_arena(json_arena_t *arena, double value) {
     json_real_t *real;
 
     if (isnan(value) || isinf(value))
         return NULL;
 
-    real = jsonp_malloc(sizeof(json_real_t));
+    real = jsonp_arena_malloc(arena, sizeof(json_real_t));
     if (!real)
         return NULL;
-    json_init(&real->json, JSON_REAL);
+    json_init_arena(&real->json, JSON_REAL, arena);
 
     real->value = value;
     return &real->json;
@@ -954,6 +1756,7 @@ int json_real_set(json_t *json, double value) {
     if (!json_is_real(json) || isnan(value) || isinf(value))
         return -1;
 
+    hash_touch(json);
     json_to_real(json)->value = value;
 
     return 0;
@@ -983,26 +1786,23 @@ double json_number_value(const json_t *json) {
 /*** simple values ***/
 
 json_t *json_true(void) {
-    static json_t the_true = {JSON_TRUE, (size_t)-1};
+    static json_t the_true = {JSON_TRUE, 0, (size_t)-1};
     return &the_true;
 }
 
 json_t *json_false(void) {
-    static json_t the_false = {JSON_FALSE, (size_t)-1};
+    static json_t the_false = {JSON_FALSE, 0, (size_t)-1};
     return &the_false;
 }
 
 json_t *json_null(void) {
-    static json_t the_null = {JSON_NULL, (size_t)-1};
+    static json_t the_null = {JSON_NULL, 0, (size_t)-1};
     return &the_null;
 }
 
 /*** deletion ***/
 
-void json_delete(json_t *json) {
-    if (!json)
-        return;
-
+static void delete_value(json_t *json) {
     switch (json_typeof(json)) {
         case JSON_OBJECT:
             json_delete_object(json_to_object(json));
@@ -1026,9 +1826,619 @@ void json_delete(json_t *json) {
     /* json_delete is not called for true, false or null */
 }
 
+/* Drops the reference a container holds to each of its objects and
+   arrays, from *position on, until one of them is left unreferenced and
+   returned. Their slots are cleared, deleting the container only
+   releases its other values. */
+static json_t *delete_next(json_t *json, size_t *position) {
+    json_t **slot;
+
+    while (1) {
+        if (json_is_object(json)) {
+            hashtable_t *hashtable = &json_to_object(json)->hashtable;
+            struct hashtable_pair *pair;
+
+            if (*position == hashtable->used)
+                return NULL;
+            pair = hashtable->entries[(*position)++].pair;
+            if (!pair)
+                continue;
+            slot = &pair->value;
+        } else {
+            json_array_t *array = json_to_array(json);
+
+            if (array->packed || *position == array->entries)
+                return NULL;
+            slot = &array->table[(*position)++];
+        }
+
+        if (*slot && (json_is_object(*slot) || json_is_array(*slot))) {
+            json_t *value = *slot;
+
+            *slot = NULL;
+            if (value->refcount != (size_t)-1 &&
+                ((value->flags & JSON_NODE_LOCAL) ? --value->refcount
+                                                  : JSON_INTERNAL_DECREF(value)) == 0)
+                return value;
+        }
+    }
+}
+
+typedef struct {
+    json_t *json;
+    size_t position;
+} delete_frame_t;
+
+/* Containers are taken apart on a stack of their own rather than by
+   recursion, children first. */
+void json_delete(json_t *json) {
+    delete_frame_t small[32], *stack = small;
+    size_t capacity = sizeof(small) / sizeof(small[0]), top = 0;
+
+    if (!json)
+        return;
+    if (!json_is_object(json) && !json_is_array(json)) {
+        delete_value(json);
+        return;
+    }
+
+    stack[top].json = json;
+    stack[top].position = 0;
+    top++;
+
+    while (top > 0) {
+        delete_frame_t *frame = &stack[top - 1];
+        json_t *child = delete_next(frame->json, &frame->position);
+
+        if (!child) {
+            delete_value(frame->json);
+            top--;
+            continue;
+        }
+
+        if (top == capacity) {
+            delete_frame_t *grown = jsonp_malloc(2 * capacity * sizeof(delete_frame_t));
+
+            if (!grown) {
+                /* out of memory, a stack of its own is all it takes */
+                json_delete(child);
+                continue;
+            }
+            memcpy(grown, stack, top * sizeof(delete_frame_t));
+            if (stack != small)
+                jsonp_free(stack);
+            stack = grown;
+            capacity *= 2;
+        }
+        stack[top].json = child;
+        stack[top].position = 0;
+        top++;
+    }
+
+    if (stack != small)
+        jsonp_free(stack);
+}
+
+/*** thread confinement ***/
+
+typedef struct {
+    json_t *json;
+    size_t position; /* next entry of an object, next element of an array */
+} local_frame_t;
+
+/* Moves to the next child of the container on top of the stack; 0 when
+   there are none left. */
+static int local_next(local_frame_t *frame, json_t **child) {
+    if (json_is_object(frame->json)) {
+        const hashtable_t *hashtable = &json_to_object(frame->json)->hashtable;
+
+        while (frame->position < hashtable->used) {
+            const struct hashtable_pair *pair = hashtable->entries[frame->position++].pair;
+
+            if (pair) {
+                *child = pair->value;
+                return 1;
+            }
+        }
+    } else {
+        const json_array_t *array = json_to_array(frame->json);
+
+        /* a packed array only has the nodes made so far */
+        while (frame->position < array->entries) {
+            *child = array->table[frame->position++];
+            if (*child)
+                return 1;
+        }
+    }
+    return 0;
+}
+
+/* Switches json and what it contains to plain or atomic counting, on a
+   stack of its own rather than by recursion. Confining stops at values
+   that something else references too, as another thread may hold them;
+   they and everything in them stay atomic. */
+static int set_local(json_t *json, int local) {
+    local_frame_t small[32], *stack = small;
+    size_t capacity = sizeof(small) / sizeof(small[0]), top = 0;
+    loop_set_t parents;
+    int res = 0;
+
+    jsonp_loop_init(&parents);
+    while (1) {
+        /* immortal values are never counted, and may be shared already */
+        size_t refcount = JSONP_LOAD(&json->refcount);
+
+        if (refcount != (size_t)-1 && (!local || refcount == 1)) {
+            if (local)
+                json->flags |= JSON_NODE_LOCAL;
+            else if (json->flags & JSON_NODE_LOCAL)
+                json->flags &= ~JSON_NODE_LOCAL;
+
+            if (json_is_object(json) || (json_is_array(json) && json_to_array(json)->table)) {
+                if (top == capacity) {
+                    local_frame_t *grown = jsonp_malloc(2 * capacity * sizeof(local_frame_t));
+
+                    if (!grown) {
+                        res = -1;
+                        break;
+                    }
+                    memcpy(grown, stack, top * sizeof(local_frame_t));
+                    if (stack != small)
+                        jsonp_free(stack);
+                    stack = grown;
+                    capacity *= 2;
+                }
+                if (jsonp_loop_enter(&parents, json)) {
+                    res = -1;
+                    break;
+                }
+                stack[top].json = json;
+                stack[top].position = 0;
+                top++;
+            }
+        }
+
+        /* the next child, leaving the containers that are done */
+        while (top > 0 && !local_next(&stack[top - 1], &json))
+            jsonp_loop_leave(&parents, stack[--top].json);
+        if (top == 0)
+            break;
+    }
+
+    jsonp_loop_close(&parents);
+    if (stack != small)
+        jsonp_free(stack);
+    return res;
+}
+
+int json_confine(json_t *json) {
+    if (!json)
+        return -1;
+
+    return set_local(json, 1);
+}
+
+int json_publish(json_t *json) {
+    if (!json)
+        return -1;
+
+    return set_local(json, 0);
+}
+
+/*** walking ***/
+
+typedef struct {
+    json_t *json;
+    size_t position; /* next entry of an object, next element of an array */
+    size_t index;    /* members of an object visited so far */
+} visit_frame_t;
+
+/* Moves to the next child of the container on top of the stack; 0 when
+   there are none left, -1 if the node of a packed element can't be made. */
+static int visit_next(visit_frame_t *frame, const char **key, size_t *key_len,
+                      size_t *index, json_t **value) {
+    if (json_is_object(frame->json)) {
+        const hashtable_t *hashtable = &json_to_object(frame->json)->hashtable;
+
+        while (frame->position < hashtable->used) {
+            const struct hashtable_pair *pair = hashtable->entries[frame->position++].pair;
+
+            if (pair) {
+                *key = pair->key;
+                *key_len = pair->key_len;
+                *index = frame->index++;
+                *value = pair->value;
+                return 1;
+            }
+        }
+    } else {
+        json_array_t *array = json_to_array(frame->json);
+
+        if (frame->position < array->entries) {
+            *key = NULL;
+            *key_len = 0;
+            *index = frame->position;
+            /* children are handed out as nodes, see json_array_get() */
+            *value = array->packed ? array_node(array, frame->position)
+                                   : array->table[frame->position];
+            frame->position++;
+            return *value ? 1 : -1;
+        }
+    }
+    return 0;
+}
+
+int json_visit(json_t *json, json_visit_callback_t callback, void *data, size_t flags) {
+    visit_frame_t small[32], *stack = small;
+    size_t capacity = sizeof(small) / sizeof(small[0]), depth = 0;
+    loop_set_t parents_set, *parents = (flags & JSON_ACYCLIC) ? NULL : &parents_set;
+    const char *key = NULL;
+    size_t key_len = 0, index = 0;
+    int res = 0, ret, next = 0;
+
+    if (!json || !callback)
+        return -1;
+
+    if (parents)
+        jsonp_loop_init(parents);
+
+    while (json) {
+        ret = callback(key, key_len, index, json, depth, data);
+        if (ret != 0 && ret != JSON_VISIT_SKIP) {
+            res = -1;
+            break;
+        }
+
+        if (ret == 0 && (json_is_object(json) || json_is_array(json))) {
+            if (depth == capacity) {
+                visit_frame_t *grown = jsonp_malloc(2 * capacity * sizeof(visit_frame_t));
+
+                if (!grown) {
+                    res = -1;
+                    break;
+                }
+                memcpy(grown, stack, depth * sizeof(visit_frame_t));
+                if (stack != small)
+                    jsonp_free(stack);
+                stack = grown;
+                capacity *= 2;
+            }
+            if (parents && jsonp_loop_enter(parents, json)) {
+                res = -1;
+                break;
+            }
+            stack[depth].json = json;
+            stack[depth].position = 0;
+            stack[depth].index = 0;
+            depth++;
+        }
+
+        /* the next child, leaving the containers that are done */
+        json = NULL;
+        while (depth > 0 &&
+               (next = visit_next(&stack[depth - 1], &key, &key_len, &index, &json)) == 0) {
+            depth--;
+            if (parents)
+                jsonp_loop_leave(parents, stack[depth].json);
+        }
+        if (next < 0) {
+            res = -1;
+            break;
+        }
+    }
+
+    if (parents)
+        jsonp_loop_close(parents);
+    if (stack != small)
+        jsonp_free(stack);
+    return res;
+}
+
+/*** hashing ***/
+
+#define HASH_MUL 0xc6a4a7935bd1e995ULL
+
+static JSON_INLINE uint64_t hash_mix(uint64_t h) {
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+/* MurmurHash64A */
+static uint64_t hash_bytes(const char *data, size_t len, uint64_t seed) {
+    uint64_t h = seed ^ (len * HASH_MUL), k;
+    size_t i;
+
+    for (i = 0; i + 8 <= len; i += 8) {
+        memcpy(&k, data + i, 8);
+        k *= HASH_MUL;
+        k ^= k >> 47;
+        k *= HASH_MUL;
+        h ^= k;
+        h *= HASH_MUL;
+    }
+    if (i < len) {
+        k = 0;
+        memcpy(&k, data + i, len - i);
+        h ^= k;
+        h *= HASH_MUL;
+    }
+    h ^= h >> 47;
+    h *= HASH_MUL;
+    h ^= h >> 47;
+    return h;
+}
+
+/* Sum of the epochs of the hash domains in domains, a bit for each */
+static size_t hash_epochs(uint64_t domains) {
+    size_t epochs = 0;
+    unsigned int d;
+
+    for (d = 0; domains; d++, domains >>= 1) {
+        if (domains & 1)
+            epochs += JSONP_LOAD(&hash_domains[d].epoch);
+    }
+    return epochs;
+}
+
+/* The domains a digest of json depends on, not counting its children */
+static JSON_INLINE uint64_t hash_domain_of(const json_t *json) {
+    /* true, false, null, shared values and packed elements never change */
+    if (json->refcount == (size_t)-1 && !(json->flags & JSON_NODE_ARENA))
+        return 0;
+    return (uint64_t)1 << json_domain(json);
+}
+
+/* Gives the digest cached in an object or array, if still valid, and
+   the domains it depends on; 0 if there is none. The domains are
+   published last, epochs before the digest they were read for. */
+static JSON_INLINE uint64_t cached_hash(const json_t *json, size_t *hash) {
+    const volatile size_t *stored_hash, *stored_epochs;
+    const volatile uint64_t *stored_domains;
+    uint64_t domains;
+    size_t epochs;
+
+    if (json_is_object(json)) {
+        json_object_t *object = json_to_object(json);
+        stored_hash = &object->hash;
+        stored_epochs = &object->hash_epochs;
+        stored_domains = &object->hash_domains;
+    } else if (json_is_array(json)) {
+        json_array_t *array = json_to_array(json);
+        stored_hash = &array->hash;
+        stored_epochs = &array->hash_epochs;
+        stored_domains = &array->hash_domains;
+    } else
+        return 0;
+
+    domains = JSONP_LOAD(stored_domains);
+    if (!domains)
+        return 0;
+    epochs = JSONP_LOAD(stored_epochs);
+    *hash = JSONP_LOAD(stored_hash);
+    return hash_epochs(domains) == epochs ? domains : 0;
+}
+
+/* Caches the digest of a container whose children all depend on no
+   other domains than domains. Threads hashing the same value may do so
+   at the same time, they store the same digest. */
+static void hash_publish(json_t *json, uint64_t h, uint64_t domains) {
+    volatile size_t *stored_hash, *stored_epochs;
+    volatile uint64_t *stored_domains;
+    size_t epochs = hash_epochs(domains);
+    uint64_t left = domains;
+    unsigned int d;
+
+    /* after the epochs are read, see hash_touch() */
+    for (d = 0; left; d++, left >>= 1) {
+        if ((left & 1) && !JSONP_LOAD(&hash_domains[d].hashed))
+            JSONP_STORE(&hash_domains[d].hashed, 1);
+    }
+
+    if (json_is_object(json)) {
+        json_object_t *object = json_to_object(json);
+        stored_hash = &object->hash;
+        stored_epochs = &object->hash_epochs;
+        stored_domains = &object->hash_domains;
+    } else {
+        json_array_t *array = json_to_array(json);
+        stored_hash = &array->hash;
+        stored_epochs = &array->hash_epochs;
+        stored_domains = &array->hash_domains;
+    }
+    JSONP_STORE(stored_hash, (size_t)h);
+    JSONP_STORE(stored_epochs, epochs);
+    JSONP_STORE(stored_domains, domains);
+}
+
+/* Digest of a value that is not a container */
+static uint64_t hash_scalar(const json_t *json) {
+    switch (json_typeof(json)) {
+        case JSON_STRING:
+            return hash_bytes(json_string_value(json), json_string_length(json), 0x737472);
+        case JSON_INTEGER:
+            return hash_mix((uint64_t)json_integer_value(json) ^ 0x696e74);
+        case JSON_REAL: {
+            /* 0.0 == -0.0 */
+            double d = json_real_value(json) + 0.0;
+            uint64_t bits;
+
+            memcpy(&bits, &d, sizeof(bits));
+            return hash_mix(bits ^ 0x7265616c);
+        }
+        default:
+            /* true, false and null are immortal singletons */
+            return hash_mix((uint64_t)json_typeof(json) + 1);
+    }
+}
+
+typedef struct {
+    json_t *json;
+    size_t position; /* next entry of an object, next element of an array */
+    uint64_t h;      /* digest of the children so far */
+    uint64_t key;    /* digest of the key of the child being hashed */
+    uint64_t domains; /* hash domains it and its children so far depend on */
+    int complete;    /* no descendant was cut short */
+} hash_frame_t;
+
+/* Digest of a container given the digest of its children. Containers
+   that are cut short get it without their children. */
+static JSON_INLINE uint64_t hash_container(const json_t *json, uint64_t h) {
+    if (json_is_object(json))
+        return hash_mix(h ^ json_object_size(json) ^ 0x6f626a);
+    return h;
+}
+
+static JSON_INLINE uint64_t hash_start(const json_t *json) {
+    return json_is_object(json) ? 0 : hash_mix(json_array_size(json) ^ 0x617272);
+}
+
+static JSON_INLINE void hash_add(hash_frame_t *frame, uint64_t h) {
+    if (json_is_object(frame->json)) {
+        /* members in any order hash the same, as they compare equal */
+        frame->h += hash_mix(frame->key ^ h);
+    } else {
+        frame->h ^= h;
+        frame->h *= HASH_MUL;
+        frame->h ^= frame->h >> 47;
+    }
+}
+
+/* Moves to the next child of the container on top of the stack; 0 when
+   there are none left. */
+static int hash_next(hash_frame_t *frame, json_t **child, jsonp_shadow_t *shadow) {
+    if (json_is_object(frame->json)) {
+        const hashtable_t *hashtable = &json_to_object(frame->json)->hashtable;
+
+        while (frame->position < hashtable->used) {
+            const struct hashtable_pair *pair = hashtable->entries[frame->position++].pair;
+
+            if (pair) {
+                frame->key = hash_bytes(pair->key, pair->key_len, 0x6f);
+                *child = pair->value;
+                return 1;
+            }
+        }
+        return 0;
+    }
+    *child = (json_t *)jsonp_array_peek(frame->json, frame->position, shadow);
+    if (!*child)
+        return 0;
+    frame->position++;
+    return 1;
+}
+
+/* Hashes containers on a stack of their own rather than by recursion.
+   Containers deeper than JSON_PARSER_MAX_DEPTH, ones that contain
+   themselves and ones past the point where the stack could not grow are
+   cut short: they are hashed by size alone, and neither they nor the
+   containers around them cache their digest, as it depends on where
+   they were reached from. Nothing but the cached digests is written to,
+   so threads may hash the same value at the same time. */
+static uint64_t do_hash(const json_t *root) {
+    hash_frame_t small[32], *stack = small;
+    size_t capacity = sizeof(small) / sizeof(small[0]), top = 0, cached;
+    json_t *json = (json_t *)root;
+    jsonp_shadow_t shadow;
+    loop_set_t parents;
+    uint64_t h = 0, domains = 0;
+
+    jsonp_loop_init(&parents);
+    while (1) {
+        int pushed = 0;
+
+        /* h becomes the digest of json and domains what it depends on,
+           unless it has children to hash */
+        if ((domains = cached_hash(json, &cached)) != 0) {
+            h = cached;
+        } else if (!json_is_object(json) && !json_is_array(json)) {
+            h = hash_scalar(json);
+            domains = hash_domain_of(json);
+        } else {
+            int cut = top == JSON_PARSER_MAX_DEPTH;
+
+            if (!cut && top == capacity) {
+                hash_frame_t *grown = jsonp_malloc(2 * capacity * sizeof(hash_frame_t));
+
+                if (grown) {
+                    memcpy(grown, stack, top * sizeof(hash_frame_t));
+                    if (stack != small)
+                        jsonp_free(stack);
+                    stack = grown;
+                    capacity *= 2;
+                } else
+                    cut = 1;
+            }
+            if (cut || jsonp_loop_enter(&parents, json)) {
+                h = hash_container(json, hash_start(json));
+                domains = hash_domain_of(json);
+                if (top > 0)
+                    stack[top - 1].complete = 0;
+            } else {
+                stack[top].json = json;
+                stack[top].position = 0;
+                stack[top].h = hash_start(json);
+                stack[top].domains = hash_domain_of(json);
+                stack[top].complete = 1;
+                top++;
+                pushed = 1;
+            }
+        }
+
+        /* add h to its parent and take the next child, leaving the
+           containers that are done */
+        while (top > 0) {
+            hash_frame_t *frame = &stack[top - 1];
+
+            if (!pushed) {
+                hash_add(frame, h);
+                frame->domains |= domains;
+            }
+            pushed = 0;
+            if (hash_next(frame, &json, &shadow))
+                break;
+
+            json = frame->json;
+            h = hash_container(json, frame->h);
+            domains = frame->domains;
+            jsonp_loop_leave(&parents, json);
+            if (!frame->complete) {
+                if (top > 1)
+                    stack[top - 2].complete = 0;
+            } else
+                hash_publish(json, h, domains);
+            top--;
+        }
+        if (top == 0)
+            break;
+    }
+
+    jsonp_loop_close(&parents);
+    if (stack != small)
+        jsonp_free(stack);
+    return h;
+}
+
+/* A digest of the contents of json: values that json_equal() finds equal
+   have the same one. Digests of objects and arrays are cached in them
+   until something they contain changes. Threads may hash a value at the
+   same time, but like any other change, changing it must not race with
+   other threads using it. */
+size_t json_hash(const json_t *json) {
+    if (!json)
+        return 0;
+
+    return (size_t)do_hash(json);
+}
+
 /*** equality ***/
 
 int json_equal(const json_t *json1, const json_t *json2) {
+    size_t hash1, hash2;
+
     if (!json1 || !json2)
         return 0;
 
@@ -1041,9 +2451,13 @@ int json_equal(const json_t *json1, const json_t *json2) {
 
     switch (json_typeof(json1)) {
         case JSON_OBJECT:
-            return json_object_equal(json1, json2);
         case JSON_ARRAY:
-            return json_array_equal(json1, json2);
+            /* digests json_hash() left behind rule out most differences */
+            if (cached_hash(json1, &hash1) && cached_hash(json2, &hash2) &&
+                hash1 != hash2)
+                return 0;
+            return json_is_object(json1) ? json_object_equal(json1, json2)
+                                         : json_array_equal(json1, json2);
         case JSON_STRING:
             return json_string_equal(json1, json2);
         case JSON_INTEGER:
@@ -1058,20 +2472,27 @@ int json_equal(const json_t *json1, const json_t *json2) {
 /*** copying ***/
 
 json_t *json_copy(json_t *json) {
+    json_t *result;
+
     if (!json)
         return NULL;
 
     switch (json_typeof(json)) {
         case JSON_OBJECT:
-            return json_object_copy(json);
+            result = json_object_copy(json);
+            break;
         case JSON_ARRAY:
-            return json_array_copy(json);
+            result = json_array_copy(json);
+            break;
         case JSON_STRING:
-            return json_string_copy(json);
+            result = json_string_copy(json);
+            break;
         case JSON_INTEGER:
-            return json_integer_copy(json);
+            result = json_integer_copy(json);
+            break;
         case JSON_REAL:
-            return json_real_copy(json);
+            result = json_real_copy(json);
+            break;
         case JSON_TRUE:
         case JSON_FALSE:
         case JSON_NULL:
@@ -1079,37 +2500,100 @@ json_t *json_copy(json_t *json) {
         default:
             return NULL;
     }
+
+    /* changing the copy leaves digests of the original valid */
+    if (result && result != json)
+        jsonp_set_domain(result, jsonp_hash_domain());
+    return result;
 }
 
 json_t *json_deep_copy(const json_t *json) {
     json_t *res;
-    hashtable_t parents_set;
+    loop_set_t parents_set;
 
-    if (hashtable_init(&parents_set))
-        return NULL;
-    res = do_deep_copy(json, &parents_set);
-    hashtable_close(&parents_set);
+    jsonp_loop_init(&parents_set);
+    res = do_deep_copy(json, &parents_set, NULL);
+    jsonp_loop_close(&parents_set);
 
     return res;
 }
 
-json_t *do_deep_copy(const json_t *json, hashtable_t *parents) {
+/*** copy-on-write ***/
+
+/* Whether value, a child of container, needs a copy of its own before
+   being changed: something else references it, a copy made by
+   json_copy() for instance. Arena documents are changed in place, and
+   true, false and null never change. */
+static int cow_shared(const json_t *container, const json_t *value) {
+    if (container->flags & JSON_NODE_ARENA)
+        return 0;
+    if (json_is_true(value) || json_is_false(value) || json_is_null(value))
+        return 0;
+    return value->refcount != 1;
+}
+
+json_t *json_object_get_mutable(json_t *json, const char *key) {
+    if (!key)
+        return NULL;
+
+    return json_object_getn_mutable(json, key, strlen(key));
+}
+
+json_t *json_object_getn_mutable(json_t *json, const char *key, size_t key_len) {
+    json_t *value = json_object_getn(json, key, key_len), *copy;
+
+    if (!value || !cow_shared(json, value))
+        return value;
+
+    copy = json_copy(value);
+    if (!copy || json_object_setn_new_nocheck(json, key, key_len, copy))
+        return NULL;
+    return copy;
+}
+
+json_t *json_array_get_mutable(json_t *json, size_t index) {
+    json_t *value = json_array_get(json, index), *copy;
+
+    if (!value || !cow_shared(json, value))
+        return value;
+
+    copy = json_copy(value);
+    if (!copy || json_array_set_new(json, index, copy))
+        return NULL;
+    return copy;
+}
+
+/* A copy of json in hash domain domain, left empty if it's an object or
+   an array that isn't packed: do_deep_copy() adds their children. */
+static json_t *copy_value(const json_t *json, json_arena_t *arena, unsigned int domain) {
+    json_t *result;
+
     if (!json)
         return NULL;
 
     switch (json_typeof(json)) {
         case JSON_OBJECT:
-            return json_object_deep_copy(json, parents);
+            result = jsonp_object_arena(arena);
+            break;
         case JSON_ARRAY:
-            return json_array_deep_copy(json, parents);
+            result = jsonp_array_arena(arena);
+            if (result && json_to_array(json)->packed && array_copy_packed(result, json)) {
+                json_decref(result);
+                return NULL;
+            }
+            break;
             /* for the rest of the types, deep copying doesn't differ from
                shallow copying */
         case JSON_STRING:
-            return json_string_copy(json);
+            result = string_create(arena, json_string_value(json), json_string_length(json),
+                                   0);
+            break;
         case JSON_INTEGER:
-            return json_integer_copy(json);
+            result = jsonp_integer_arena(arena, json_integer_value(json));
+            break;
         case JSON_REAL:
-            return json_real_copy(json);
+            result = jsonp_real_arena(arena, json_real_value(json));
+            break;
         case JSON_TRUE:
         case JSON_FALSE:
         case JSON_NULL:
@@ -1117,4 +2601,105 @@ json_t *do_deep_copy(const json_t *json, hashtable_t *parents) {
         default:
             return NULL;
     }
+
+    if (result)
+        jsonp_set_domain(result, domain);
+    return result;
+}
+
+typedef struct {
+    const json_t *json;
+    json_t *copy;
+    size_t position; /* next entry or element of json */
+    unsigned int domain;
+} copy_frame_t;
+
+/* Copies the children of the container on top of the stack one at a
+   time; 0 when there are none left. */
+static int copy_next(copy_frame_t *frame, json_arena_t *arena, const json_t **child,
+                     json_t **copy) {
+    if (json_is_object(frame->json)) {
+        const hashtable_t *hashtable = &json_to_object(frame->json)->hashtable;
+
+        while (frame->position < hashtable->used) {
+            const struct hashtable_pair *pair = hashtable->entries[frame->position++].pair;
+
+            if (!pair)
+                continue;
+            *child = pair->value;
+            *copy = copy_value(pair->value, arena, frame->domain);
+            return json_object_setn_new_nocheck(frame->copy, pair->key, pair->key_len, *copy)
+                       ? -1
+                       : 1;
+        }
+    } else {
+        const json_array_t *array = json_to_array(frame->json);
+
+        if (frame->position < array->entries) {
+            *child = array->table[frame->position++];
+            *copy = copy_value(*child, arena, frame->domain);
+            return json_array_append_new(frame->copy, *copy) ? -1 : 1;
+        }
+    }
+    return 0;
+}
+
+/* Copies containers on a stack of their own rather than by recursion,
+   parents first: a child is added before its own children are copied. */
+json_t *do_deep_copy(const json_t *json, loop_set_t *parents, json_arena_t *arena) {
+    copy_frame_t small[32], *stack = small;
+    size_t capacity = sizeof(small) / sizeof(small[0]), top = 0;
+    unsigned int domain = jsonp_hash_domain();
+    json_t *result, *copy;
+    int ret;
+
+    result = copy = copy_value(json, arena, domain);
+    if (!result)
+        return NULL;
+
+    while (1) {
+        /* copy is the copy of json, children to come if it's a container */
+        if (json_is_object(json) || (json_is_array(json) && !json_to_array(json)->packed)) {
+            if (jsonp_loop_enter(parents, json))
+                goto error;
+            if (top == capacity) {
+                copy_frame_t *grown = jsonp_malloc(2 * capacity * sizeof(copy_frame_t));
+
+                if (!grown) {
+                    jsonp_loop_leave(parents, json);
+                    goto error;
+                }
+                memcpy(grown, stack, top * sizeof(copy_frame_t));
+                if (stack != small)
+                    jsonp_free(stack);
+                stack = grown;
+                capacity *= 2;
+            }
+            stack[top].json = json;
+            stack[top].copy = copy;
+            stack[top].position = 0;
+            stack[top].domain = domain;
+            top++;
+        }
+
+        /* the next child, leaving the containers that are done */
+        while (top > 0 && (ret = copy_next(&stack[top - 1], arena, &json, &copy)) == 0)
+            jsonp_loop_leave(parents, stack[--top].json);
+        if (top == 0)
+            break;
+        if (ret < 0)
+            goto error;
+    }
+
+    if (stack != small)
+        jsonp_free(stack);
+    return result;
+
+error:
+    while (top > 0)
+        jsonp_loop_leave(parents, stack[--top].json);
+    if (stack != small)
+        jsonp_free(stack);
+    json_decref(result);
+    return NULL;
 }
@@ -1,11 +1,31 @@
 #pragma once
 
+#include <cerrno>
 #include <cstdio>
+#include <cstdlib>
 #include <jansson.h>
 #include <string.h>
 #include <type_traits>
 #include <typeinfo>
 #include <cassert>
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <limits>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <sys/uio.h>
+#include <unistd.h>
+#endif
 
 // https://jansson.readthedocs.io/en/latest/apiref.html#c.json_object_update
 enum ObjectUpdateType
@@ -21,6 +41,50 @@ enum ObjectUpdateType
 
 namespace fdxx {
 
+// ===========================================================================
+// Arena
+// ===========================================================================
+// Memory region for whole documents. JSON loaded into an arena needs no
+// decref(), everything is released at once by Reset() or the destructor.
+class Arena
+{
+public:
+	// @param blockSize  Size of each memory block, 0 for the default (64 KiB).
+	explicit Arena(size_t blockSize = 0)
+	{
+		m_arena = json_arena_create(blockSize);
+	}
+
+	~Arena()
+	{
+		json_arena_destroy(m_arena);
+	}
+
+	Arena(const Arena&) = delete;
+	Arena& operator=(const Arena&) = delete;
+
+	// Releases all JSON loaded into the arena, keeping its memory for reuse.
+	// Any JSON pointer obtained from the arena is invalid afterwards.
+	void Reset()
+	{
+		json_arena_reset(m_arena);
+	}
+
+	// Retrieves the number of bytes handed out since the last Reset().
+	size_t Used()
+	{
+		return json_arena_used(m_arena);
+	}
+
+	json_arena_t *Get()
+	{
+		return m_arena;
+	}
+
+private:
+	json_arena_t *m_arena;
+};
+
 struct JSON : public json_t
 {
 	// Create JSON
@@ -35,6 +99,40 @@ struct JSON : public json_t
 	static JSON *CreateObject()	{ return (JSON*)json_object(); }
 	static JSON *CreateArray()	{ return (JSON*)json_array(); }
 
+	// Creates an array of the values, with its table allocated once. Arrays
+	// of numbers are packed: the node of an element is made when asked for.
+	//
+	// @param values     Values to copy, strings are copied too.
+	// @param count      Number of values.
+	// @return           JSON pointer, or nullptr on failure.
+	static JSON *CreateArray(const double *values, size_t count)		{ return (JSON*)json_array_of_reals(values, count); }
+	static JSON *CreateArray(const json_int_t *values, size_t count)	{ return (JSON*)json_array_of_integers(values, count); }
+	static JSON *CreateArray(const float *values, size_t count)			{ std::vector<double> wide(values, values + count); return (JSON*)json_array_of_reals(wide.data(), count); }
+	static JSON *CreateArray(const int *values, size_t count)			{ std::vector<json_int_t> wide(values, values + count); return (JSON*)json_array_of_integers(wide.data(), count); }
+	static JSON *CreateArray(const bool *values, size_t count)			{ return CreateArrayOf(values, count); }
+	static JSON *CreateArray(const char *const *values, size_t count)	{ return CreateArrayOf(values, count); }
+
+	template<typename T>
+	static JSON *CreateArrayOf(const T *values, size_t count)
+	{
+		json_t *array = json_array();
+		if (!array || json_array_reserve(array, count) != 0)
+		{
+			json_decref(array);
+			return nullptr;
+		}
+
+		for (size_t i = 0; i < count; i++)
+		{
+			if (json_array_append_new(array, JSON::Create(values[i])) != 0)
+			{
+				json_decref(array);
+				return nullptr;
+			}
+		}
+		return (JSON*)array;
+	}
+
 	// Loads a JSON from a file.
 	//
 	// @param file		 File to read from.
@@ -63,6 +161,38 @@ struct JSON : public json_t
 		return (JSON*)j;
 	}
 
+	// Loads a JSON from a writable buffer, decoding strings in place.
+	// String values point into the buffer, so it must outlive the result.
+	//
+	// @param buffer     Buffer to read from, modified by the call.
+	// @param size       Size of the buffer.
+	// @param flags      Decoding flags.
+	// @return           JSON pointer, or nullptr on failure.
+	static JSON *FromBufferInSitu(char *buffer, size_t size, size_t flags = 0)
+	{
+		json_error_t error;
+		json_t *j = json_loadb(buffer, size, flags | JSON_INSITU, &error);
+		if (!j)
+			printf("[JSON::FromBufferInSitu] Invalid JSON in line %d, column %d: %s\n", error.line, error.column, error.text);
+		return (JSON*)j;
+	}
+
+	// Loads a JSON from a string into an arena.
+	// The result lives until arena.Reset() and must not be decref'd.
+	//
+	// @param str        String to read from.
+	// @param flags      Decoding flags.
+	// @param arena      Arena to allocate all values from.
+	// @return           JSON pointer, or nullptr on failure.
+	static JSON *FromString(const char *str, size_t flags, Arena &arena)
+	{
+		json_error_t error;
+		json_t *j = json_loads_arena(str, flags, arena.Get(), &error);
+		if (!j)
+			printf("[JSON::FromString] Invalid JSON in line %d, column %d: %s\n", error.line, error.column, error.text);
+		return (JSON*)j;
+	}
+
 	// Retrieves a value from the JSON.
 	//
 	// @return           Value read.
@@ -121,6 +251,124 @@ struct JSON : public json_t
 		return json_dumpb(this, buffer, size, flags);
 	}
 
+	// Writes the JSON representation of json to out, replacing its contents.
+	// The capacity of out is reused: it is encoded straight into the string,
+	// and only encoded a second time when it had to grow. A string kept
+	// across calls stops allocating once it fits the largest output.
+	//
+	// @param out        String to write to.
+	// @param flags      Encoding flags.
+	// @return           True on success, false on failure.
+	bool ToString(std::string &out, size_t flags = 0)
+	{
+		out.resize(out.capacity());
+		size_t size = json_dumpb(this, out.empty() ? nullptr : &out[0], out.size(), flags);
+		if (size > out.size())
+		{
+			// some headroom, so that slightly larger outputs still fit next time
+			out.reserve(size + size / 8);
+			out.resize(size);
+			size = json_dumpb(this, &out[0], size, flags);
+		}
+
+		out.resize(size);
+		return size > 0;
+	}
+
+	// Passes the JSON representation of json to sink(const char *data, size_t size)
+	// piece by piece, e.g. to append it to a buffer of your own. The sink
+	// returns false to stop.
+	//
+	// @param sink       Callable receiving the output.
+	// @param flags      Encoding flags.
+	// @return           True on success, false on failure or if stopped.
+	template<typename Sink>
+	bool Dump(Sink &&sink, size_t flags = 0)
+	{
+		json_dump_callback_t callback = [](const char *buffer, size_t size, void *data) -> int
+		{
+			return (*(typename std::remove_reference<Sink>::type*)data)(buffer, size) ? 0 : -1;
+		};
+		return json_dump_callback(this, callback, &sink, flags) == 0;
+	}
+
+	// Encodes the JSON as CBOR into out, replacing its contents and reusing
+	// its capacity as ToString(std::string&) does. Numbers keep their exact
+	// bits and strings are copied as they are, so it's cheaper than text
+	// for both ends of an internal hop.
+	//
+	// @param out        String to write to.
+	// @param flags      Encoding flags (JSON_ENCODE_ANY, JSON_ACYCLIC).
+	// @return           True on success, false on failure.
+	bool ToCBOR(std::string &out, size_t flags = 0)
+	{
+		out.resize(out.capacity());
+		size_t size = json_cbor_dumpb(this, out.empty() ? nullptr : &out[0], out.size(), flags);
+		if (size > out.size())
+		{
+			out.reserve(size + size / 8);
+			out.resize(size);
+			size = json_cbor_dumpb(this, &out[0], size, flags);
+		}
+
+		out.resize(size);
+		return size > 0;
+	}
+
+	// Passes the CBOR encoding of the JSON to sink(const char *data, size_t size)
+	// piece by piece, as Dump() does with text. The sink returns false to stop.
+	//
+	// @param sink       Callable receiving the output.
+	// @param flags      Encoding flags (JSON_ENCODE_ANY, JSON_ACYCLIC).
+	// @return           True on success, false on failure or if stopped.
+	template<typename Sink>
+	bool DumpCBOR(Sink &&sink, size_t flags = 0)
+	{
+		json_dump_callback_t callback = [](const char *buffer, size_t size, void *data) -> int
+		{
+			return (*(typename std::remove_reference<Sink>::type*)data)(buffer, size) ? 0 : -1;
+		};
+		return json_cbor_dump_callback(this, callback, &sink, flags) == 0;
+	}
+
+	// Decodes a JSON from CBOR.
+	// With JSON_INSITU the buffer is modified and long strings point into it,
+	// so it must be writable and outlive the result.
+	//
+	// @param buffer     Buffer to read from.
+	// @param size       Size of the buffer.
+	// @param flags      Decoding flags.
+	// @return           JSON pointer, or nullptr on failure.
+	static JSON *FromCBOR(const char *buffer, size_t size, size_t flags = 0)
+	{
+		json_error_t error;
+		json_t *j = json_cbor_loadb(buffer, size, flags, &error);
+		if (!j)
+			printf("[JSON::FromCBOR] Invalid CBOR at byte %d: %s\n", error.position, error.text);
+		return (JSON*)j;
+	}
+
+	// Decodes a JSON from CBOR read piece by piece from
+	// source(void *buffer, size_t size), which returns the number of bytes
+	// it wrote, 0 at the end of the input.
+	//
+	// @param source     Callable providing the input.
+	// @param flags      Decoding flags.
+	// @return           JSON pointer, or nullptr on failure.
+	template<typename Source>
+	static JSON *LoadCBOR(Source &&source, size_t flags = 0)
+	{
+		json_load_callback_t callback = [](void *buffer, size_t size, void *data) -> size_t
+		{
+			return (*(typename std::remove_reference<Source>::type*)data)(buffer, size);
+		};
+		json_error_t error;
+		json_t *j = json_cbor_load_callback(callback, &source, flags, &error);
+		if (!j)
+			printf("[JSON::LoadCBOR] Invalid CBOR at byte %d: %s\n", error.position, error.text);
+		return (JSON*)j;
+	}
+
 	// Returns a deep copy of value, 
 	// Copying objects preserves the insertion order of keys.
 	//
@@ -130,6 +378,84 @@ struct JSON : public json_t
 		return (JSON*)json_deep_copy(this);
 	}
 
+	// Copy-on-write copy: everything but the JSON itself is shared with the
+	// original until changed. Reach what to change through Mutable() or
+	// FindMutable(), which copy only the containers along the way:
+	//
+	//     JSON *config = base->Clone();
+	//     config->Mutable("server").SetValue("port", 8080);
+	//
+	// @return           New JSON, or nullptr on failure.
+	JSON *Clone()
+	{
+		return (JSON*)json_copy(this);
+	}
+
+	// Finds a value by JSON Pointer to change it, copying what it shares
+	// with a Clone() along the way. The JSON itself must not be shared.
+	//
+	// @param pointer    JSON Pointer, "" for the JSON itself.
+	// @return           JSON pointer, or nullptr if there is no such value.
+	JSON *FindMutable(const char *pointer)
+	{
+		return (JSON*)json_pointer_get_mutable(this, pointer);
+	}
+
+	// Applies an RFC 7386 merge patch in place: members of patch replace or,
+	// if null, remove those of this object, recursively.
+	//
+	// @param patch      Object to merge, whose values are shared, not copied.
+	// @return           True on success, false on failure.
+	bool MergePatch(const JSON *patch)
+	{
+		return json_merge_patch(this, patch) == 0;
+	}
+
+	// Applies an RFC 6902 JSON Patch in place, all of its operations or none.
+	//
+	// @param patch      Array of operations.
+	// @return           True on success, false on failure.
+	bool Patch(const JSON *patch)
+	{
+		json_error_t error;
+		if (json_patch_apply(this, patch, &error) == 0)
+			return true;
+		printf("[JSON::Patch] %s\n", error.text);
+		return false;
+	}
+
+	// Computes the JSON Patch that turns this JSON into other. Unchanged
+	// parts are skipped as soon as they compare equal, at once if shared
+	// after a Clone().
+	//
+	// @return           Array of operations, nullptr on failure.
+	JSON *Diff(const JSON *other) const
+	{
+		return (JSON*)json_patch_diff(this, other);
+	}
+
+	// Computes the merge patch that turns this object into other.
+	//
+	// @return           Merge patch, nullptr on failure.
+	JSON *MergeDiff(const JSON *other) const
+	{
+		return (JSON*)json_merge_diff(this, other);
+	}
+
+	// Compares the contents of two JSON, as json_equal() does. Digests cached
+	// by Hash() let it reject most unequal objects and arrays at once.
+	bool Equal(const JSON *other) const
+	{
+		return json_equal(this, other) != 0;
+	}
+
+	// Digest of the contents, the same for JSON that are Equal(). It is cached
+	// in objects and arrays until something in them changes.
+	size_t Hash() const
+	{
+		return json_hash(this);
+	}
+
 	// https://jansson.readthedocs.io/en/latest/apiref.html#reference-count
 	// Decrement the reference count of json. 
 	// As soon as a call to json_decref() drops the reference count to zero, 
@@ -147,6 +473,55 @@ struct JSON : public json_t
 		return (JSON*)json_incref(this);
 	}
 
+	// Switches the JSON and everything in it to non-atomic reference counting,
+	// for documents only one thread references at a time (see JSON_DECODE_CONFINED).
+	// Values referenced more than once stay atomic, with everything in them.
+	//
+	// @return           True on success, false if it contains itself or out of memory.
+	bool Confine()
+	{
+		return (json_confine(this) == 0);
+	}
+
+	// Switches back to atomic reference counting, before sharing between threads.
+	//
+	// @return           True on success, false if it contains itself or out of memory;
+	//                   the JSON must not be shared then.
+	bool Publish()
+	{
+		return (json_publish(this) == 0);
+	}
+
+	// Finds a value by JSON Pointer (RFC 6901), e.g. "/a/b/3/c". To look the
+	// same path up many times, compile it once with JSONPath.
+	//
+	// @param pointer    JSON Pointer, "" for the JSON itself.
+	// @return           JSON pointer, or nullptr if there is no such value.
+	JSON *Find(const char *pointer)
+	{
+		return (JSON*)json_pointer_get(this, pointer);
+	}
+
+	// Calls visitor(std::string_view key, size_t index, JSON *value, size_t depth)
+	// for the JSON and everything in it, parents first, without recursing, so
+	// that input of any depth can be walked (see json_visit()). key.data() is
+	// nullptr but for members of objects. The visitor returns 0 to go on,
+	// JSON_VISIT_SKIP not to enter value, anything else to stop.
+	//
+	// @param visitor    Callable called for every value.
+	// @param flags      JSON_ACYCLIC to skip the circular reference check.
+	// @return           True on success, false if stopped or on failure.
+	template<typename Visitor>
+	bool Visit(Visitor &&visitor, size_t flags = 0)
+	{
+		json_visit_callback_t callback = [](const char *key, size_t key_len, size_t index, json_t *value, size_t depth, void *data) -> int
+		{
+			return (int)(*(typename std::remove_reference<Visitor>::type*)data)(
+				std::string_view(key, key_len), index, (JSON*)value, depth);
+		};
+		return json_visit(this, callback, &visitor, flags) == 0;
+	}
+
 
 
 
@@ -154,6 +529,69 @@ struct JSON : public json_t
 	// JSON Object functions
 	// ===========================================================================
 
+	// Handle to an interned key, see json_key_intern().
+	// Build it once and reuse it: lookups in objects whose key was set through
+	// an InternedKey, or loaded with JSON_INTERN_KEYS, only compare pointers.
+	// Handles are cheap to copy and valid for the lifetime of the process.
+	class InternedKey
+	{
+	public:
+		// @param key        Key string, must be valid UTF-8.
+		explicit InternedKey(const char *key)
+		{
+			m_key = json_key_intern(key);
+			if (!m_key)
+				printf("[JSON::InternedKey] Failed to intern key: %s\n", key);
+		}
+
+		const char *Str() const
+		{
+			return json_key_value(m_key);
+		}
+
+		size_t Length() const
+		{
+			return json_key_length(m_key);
+		}
+
+		const json_key_t *Get() const
+		{
+			return m_key;
+		}
+
+	private:
+		const json_key_t *m_key;
+	};
+
+	// Precomputed key for repeated lookups: the length and hash are worked out
+	// once, so lookups and SetValue() through it skip strlen() and hashing.
+	// The string is not copied and must stay valid, typically a literal:
+	//     static const JSON::Key id("id");
+	class Key
+	{
+	public:
+		// @param key        Key string.
+		explicit Key(const char *key) : Key(key, strlen(key)) {}
+
+		// @param key        Key string.
+		// @param length     Length of the key.
+		Key(const char *key, size_t length)
+		{
+			m_key = key;
+			m_length = length;
+			m_hash = json_object_key_hash(key, length);
+		}
+
+		const char *Str() const		{ return m_key; }
+		size_t Length() const		{ return m_length; }
+		size_t Hash() const			{ return m_hash; }
+
+	private:
+		const char *m_key;
+		size_t m_length;
+		size_t m_hash;
+	};
+
 	// Get JSON reference.
 	//
 	// @param key        Key string.
@@ -164,6 +602,36 @@ struct JSON : public json_t
 		return *(JSON*)json_object_get(this, key);
 	}
 
+	// Get JSON reference.
+	//
+	// @param key        Interned key.
+	// @return           JSON reference.
+	JSON& operator[](const InternedKey &key)
+	{
+		assert(this);
+		return *(JSON*)json_object_get_key(this, key.Get());
+	}
+
+	// Get JSON reference.
+	//
+	// @param key        Precomputed key.
+	// @return           JSON reference.
+	JSON& operator[](const Key &key)
+	{
+		assert(this);
+		return *(JSON*)json_object_getn_hashed(this, key.Str(), key.Length(), key.Hash());
+	}
+
+	// Get JSON reference to change, copying it first if shared (see Clone).
+	//
+	// @param key        Key string.
+	// @return           JSON reference.
+	JSON& Mutable(const char *key)
+	{
+		assert(this);
+		return *(JSON*)json_object_get_mutable(this, key);
+	}
+
 	// Retrieves a value from the object.
 	//
 	// @param key        Key string.
@@ -174,6 +642,26 @@ struct JSON : public json_t
 		return (*this)[key].GetValue<T>();
 	}
 
+	// Retrieves a value from the object.
+	//
+	// @param key        Interned key.
+	// @return           Value read.
+	template<typename T>
+	T GetValue(const InternedKey &key)
+	{
+		return (*this)[key].GetValue<T>();
+	}
+
+	// Retrieves a value from the object.
+	//
+	// @param key        Precomputed key.
+	// @return           Value read.
+	template<typename T>
+	T GetValue(const Key &key)
+	{
+		return (*this)[key].GetValue<T>();
+	}
+
 	// Returns whether or not a value in the object is null.
 	//
 	// @param key        Key string.
@@ -183,6 +671,24 @@ struct JSON : public json_t
 		return json_is_null(json_object_get(this, key));
 	}
 
+	// Returns whether or not a value in the object is null.
+	//
+	// @param key        Interned key.
+	// @return           True if the value is null, false otherwise.
+	bool IsNull(const InternedKey &key)
+	{
+		return json_is_null(json_object_get_key(this, key.Get()));
+	}
+
+	// Returns whether or not a value in the object is null.
+	//
+	// @param key        Precomputed key.
+	// @return           True if the value is null, false otherwise.
+	bool IsNull(const Key &key)
+	{
+		return json_is_null(json_object_getn_hashed(this, key.Str(), key.Length(), key.Hash()));
+	}
+
 	// Returns whether or not a key exists in the object.
 	//
 	// @param key        Key string.
@@ -192,6 +698,24 @@ struct JSON : public json_t
 		return json_object_get(this, key) != nullptr;
 	}
 
+	// Returns whether or not a key exists in the object.
+	//
+	// @param key        Interned key.
+	// @return           True if the key exists, false otherwise.
+	bool HasKey(const InternedKey &key)
+	{
+		return json_object_get_key(this, key.Get()) != nullptr;
+	}
+
+	// Returns whether or not a key exists in the object.
+	//
+	// @param key        Precomputed key.
+	// @return           True if the key exists, false otherwise.
+	bool HasKey(const Key &key)
+	{
+		return json_object_getn_hashed(this, key.Str(), key.Length(), key.Hash()) != nullptr;
+	}
+
 	// Sets an array or object value in the object, 
 	// either inserting a new entry or replacing an old one.
 	//
@@ -206,6 +730,20 @@ struct JSON : public json_t
 		return (json_object_set_new(this, key, value) == 0);
 	}
 
+	// Sets an array or object value in the object, 
+	// either inserting a new entry or replacing an old one.
+	//
+	// @param key        Interned key.
+	// @param value      Value to store at this key.
+	// @param incref     Whether to increase the reference count of VALUE.
+	// @return           True on success, false on failure.
+	bool Set(const InternedKey &key, JSON *value, bool incref = false)
+	{
+		if (incref)
+			return (json_object_set_key(this, key.Get(), value) == 0);
+		return (json_object_set_key_new(this, key.Get(), value) == 0);
+	}
+
 	// Sets a value in the object
 	// either inserting a new entry or replacing an old one.
 	//
@@ -218,18 +756,42 @@ struct JSON : public json_t
 		return (json_object_set_new(this, key, JSON::Create(value)) == 0);
 	}
 
-	// Sets a null value in the object.
+	// Sets a value in the object
 	// either inserting a new entry or replacing an old one.
 	//
-	// @param key        Key string.
+	// @param key        Interned key.
+	// @param value      Value to store at this key.
 	// @return           True on success, false on failure.
-	bool SetNullValue(const char *key)
+	template<typename T>
+	bool SetValue(const InternedKey &key, T value)
 	{
-		return (json_object_set_new(this, key, json_null()) == 0);
+		return (json_object_set_key_new(this, key.Get(), JSON::Create(value)) == 0);
 	}
 
-	// Update object with the key-value pairs from other.
-	// https://jansson.readthedocs.io/en/latest/apiref.html#c.json_object_update
+	// Sets a value in the object
+	// either inserting a new entry or replacing an old one.
+	//
+	// @param key        Precomputed key.
+	// @param value      Value to store at this key.
+	// @return           True on success, false on failure.
+	template<typename T>
+	bool SetValue(const Key &key, T value)
+	{
+		return (json_object_setn_new_hashed(this, key.Str(), key.Length(), key.Hash(), JSON::Create(value)) == 0);
+	}
+
+	// Sets a null value in the object.
+	// either inserting a new entry or replacing an old one.
+	//
+	// @param key        Key string.
+	// @return           True on success, false on failure.
+	bool SetNullValue(const char *key)
+	{
+		return (json_object_set_new(this, key, json_null()) == 0);
+	}
+
+	// Update object with the key-value pairs from other.
+	// https://jansson.readthedocs.io/en/latest/apiref.html#c.json_object_update
 	//
 	// @param other      Other object.
 	// @param Type       enum ObjectUpdateType.
@@ -283,6 +845,82 @@ struct JSON : public json_t
 		return json_object_size(this);
 	}
 
+	// Range over the members of the object, in insertion order:
+	//     for (auto [key, value] : json->Items())
+	//         printf("%.*s\n", (int)key.size(), key.data());
+	// Members are fetched a batch at a time (json_object_get_items), so the
+	// object must not change during the loop. Keys are null-terminated.
+	class ObjectItems
+	{
+	public:
+		struct Item
+		{
+			std::string_view key;
+			JSON *value;
+		};
+
+		class Iterator
+		{
+		public:
+			explicit Iterator(ObjectItems *items) : m_items(items) {}
+
+			Item operator*() const
+			{
+				const json_object_item_t &item = m_items->m_batch[m_items->m_next];
+				return {std::string_view(item.key, item.key_len), (JSON*)item.value};
+			}
+
+			Iterator &operator++()
+			{
+				if (++m_items->m_next == m_items->m_count)
+					m_items->Fetch();
+				return *this;
+			}
+
+			// Iterators share the batch of their range, so any one is at the end once the batches run out.
+			bool operator!=(const Iterator &) const
+			{
+				return m_items->m_next < m_items->m_count;
+			}
+
+		private:
+			ObjectItems *m_items;
+		};
+
+		explicit ObjectItems(JSON *json) : m_json(json) {}
+
+		Iterator begin()
+		{
+			m_position = 0;
+			Fetch();
+			return Iterator(this);
+		}
+
+		Iterator end()
+		{
+			return Iterator(this);
+		}
+
+	private:
+		void Fetch()
+		{
+			m_count = json_object_get_items(m_json, &m_position, m_batch, sizeof(m_batch) / sizeof(m_batch[0]));
+			m_next = 0;
+		}
+
+		JSON *m_json;
+		size_t m_position = 0;
+		size_t m_count = 0;
+		size_t m_next = 0;
+		json_object_item_t m_batch[32];
+	};
+
+	// Members of the object, see ObjectItems.
+	ObjectItems Items()
+	{
+		return ObjectItems(this);
+	}
+
 
 
 
@@ -302,6 +940,16 @@ struct JSON : public json_t
 		return *(JSON*)json_array_get(this, index);
 	}
 
+	// Get JSON reference to change, copying it first if shared (see Clone).
+	//
+	// @param index      Index in the array.
+	// @return           JSON reference.
+	JSON& Mutable(size_t index)
+	{
+		assert(this);
+		return *(JSON*)json_array_get_mutable(this, index);
+	}
+
 	// Retrieves a value from the array.
 	//
 	// @param index      Index in the array.
@@ -309,6 +957,21 @@ struct JSON : public json_t
 	template<typename T>
 	T GetValue(size_t index)
 	{
+		// Numbers are read without creating nodes for a packed array (JSON_DECODE_PACKED).
+		if constexpr (std::is_same_v<T, float> || std::is_same_v<T, double>)
+		{
+			double value = 0.0;
+			json_array_get_reals(this, index, &value, 1);
+			return (T)value;
+		}
+
+		if constexpr (std::is_same_v<T, int> || std::is_same_v<T, json_int_t>)
+		{
+			json_int_t value = 0;
+			json_array_get_integers(this, index, &value, 1);
+			return (T)value;
+		}
+
 		return (*this)[index].GetValue<T>();
 	}
 	
@@ -451,41 +1114,2043 @@ struct JSON : public json_t
 	{
 		return json_array_size(this);
 	}
+
+	// Range over the elements of the array:
+	//     for (JSON *element : json->Elements())
+	//         ...
+	// Elements are fetched a batch at a time (json_array_get_values) rather
+	// than looked up one by one, so the array must not change during the loop.
+	class ArrayElements
+	{
+	public:
+		class Iterator
+		{
+		public:
+			explicit Iterator(ArrayElements *elements) : m_elements(elements) {}
+
+			JSON *operator*() const
+			{
+				return (JSON*)m_elements->m_batch[m_elements->m_next];
+			}
+
+			Iterator &operator++()
+			{
+				if (++m_elements->m_next == m_elements->m_count)
+					m_elements->Fetch();
+				return *this;
+			}
+
+			// Iterators share the batch of their range, as for ObjectItems.
+			bool operator!=(const Iterator &) const
+			{
+				return m_elements->m_next < m_elements->m_count;
+			}
+
+		private:
+			ArrayElements *m_elements;
+		};
+
+		explicit ArrayElements(JSON *json) : m_json(json) {}
+
+		Iterator begin()
+		{
+			m_index = 0;
+			Fetch();
+			return Iterator(this);
+		}
+
+		Iterator end()
+		{
+			return Iterator(this);
+		}
+
+	private:
+		void Fetch()
+		{
+			m_count = json_array_get_values(m_json, m_index, m_batch, sizeof(m_batch) / sizeof(m_batch[0]));
+			m_index += m_count;
+			m_next = 0;
+		}
+
+		JSON *m_json;
+		size_t m_index = 0;
+		size_t m_count = 0;
+		size_t m_next = 0;
+		json_t *m_batch[64];
+	};
+
+	// Elements of the array, see ArrayElements.
+	ArrayElements Elements()
+	{
+		return ArrayElements(this);
+	}
+
+	// Makes room for size elements in total, so that appending up to
+	// that many doesn't reallocate the array.
+	//
+	// @param size       Number of elements to make room for.
+	// @return           True on success, false on failure.
+	bool Reserve(size_t size)
+	{
+		return (json_array_reserve(this, size) == 0);
+	}
+
+	// Copies the values of up to count elements, starting at index.
+	// Stops early at the end of the array or at an element of another type,
+	// integers are accepted for float and double. Strings point into the
+	// array and stay valid as long as their elements do.
+	//
+	// @param values     Buffer of at least count values.
+	// @param count      Maximum number of values to copy.
+	// @param index      Index of the first element.
+	// @return           Number of values copied.
+	size_t CopyTo(double *values, size_t count, size_t index = 0)
+	{
+		return json_array_get_reals(this, index, values, count);
+	}
+
+	size_t CopyTo(json_int_t *values, size_t count, size_t index = 0)
+	{
+		return json_array_get_integers(this, index, values, count);
+	}
+
+	size_t CopyTo(float *values, size_t count, size_t index = 0)
+	{
+		return CopyConverted<double>(values, count, index);
+	}
+
+	size_t CopyTo(int *values, size_t count, size_t index = 0)
+	{
+		return CopyConverted<json_int_t>(values, count, index);
+	}
+
+	size_t CopyTo(bool *values, size_t count, size_t index = 0)
+	{
+		size_t i = 0;
+		for (json_t *value; i < count && json_is_boolean(value = json_array_get(this, index + i)); i++)
+			values[i] = json_is_true(value);
+		return i;
+	}
+
+	size_t CopyTo(const char **values, size_t count, size_t index = 0)
+	{
+		size_t i = 0;
+		for (json_t *value; i < count && json_is_string(value = json_array_get(this, index + i)); i++)
+			values[i] = json_string_value(value);
+		return i;
+	}
+
+private:
+	// Copies through a small buffer of the wider type, which reads a packed array
+	// without creating nodes.
+	template<typename Wide, typename T>
+	size_t CopyConverted(T *values, size_t count, size_t index)
+	{
+		Wide buffer[256];
+		size_t total = 0;
+
+		while (total < count)
+		{
+			size_t want = count - total < 256 ? count - total : 256;
+			size_t got = CopyTo(buffer, want, index + total);
+
+			for (size_t i = 0; i < got; i++)
+				values[total + i] = (T)buffer[i];
+			total += got;
+			if (got < want)
+				break;
+		}
+		return total;
+	}
 };
 
 
 // ===========================================================================
-// JSONObjectKeys
+// JSONPtr
 // ===========================================================================
-class JSONObjectKeys
+// Owns one reference to a JSON and drops it when destroyed. Moving hands the
+// reference over without touching the count, Release() gives it to a call that
+// steals it (Set, Push and Insert with incref = false):
+//
+//     JSONPtr value(JSON::CreateArray(reals, count));
+//     root->Set("values", value.Release());
+class JSONPtr
 {
 public:
-	JSONObjectKeys(JSON *json)
+	JSONPtr() : m_json(nullptr) {}
+
+	// Takes over a reference, e.g. of a newly created JSON.
+	explicit JSONPtr(JSON *json) : m_json(json) {}
+
+	JSONPtr(const JSONPtr &other) : m_json(other.m_json ? other.m_json->incref() : nullptr) {}
+
+	JSONPtr(JSONPtr &&other) noexcept : m_json(other.m_json)
+	{
+		other.m_json = nullptr;
+	}
+
+	~JSONPtr()
+	{
+		json_decref(m_json);
+	}
+
+	JSONPtr& operator=(JSONPtr other) noexcept
+	{
+		std::swap(m_json, other.m_json);
+		return *this;
+	}
+
+	// Adds a reference to a JSON owned elsewhere.
+	static JSONPtr Share(JSON *json)
+	{
+		return JSONPtr(json ? json->incref() : nullptr);
+	}
+
+	// Drops the reference held, taking over json instead.
+	void Reset(JSON *json = nullptr)
 	{
+		json_decref(m_json);
 		m_json = json;
-		m_iter = json_object_iter(json);
 	}
 
-	bool GetKeyValue(const char **key, JSON **value = nullptr)
+	// Gives up the reference without dropping it.
+	//
+	// @return           The JSON, whose reference now belongs to the caller.
+	JSON *Release()
 	{
-		*key = json_object_iter_key(m_iter);
-		if (*key == nullptr)
+		JSON *json = m_json;
+		m_json = nullptr;
+		return json;
+	}
+
+	JSON *Get() const				{ return m_json; }
+	JSON *operator->() const		{ return m_json; }
+	JSON &operator*() const			{ return *m_json; }
+	explicit operator bool() const	{ return m_json != nullptr; }
+
+private:
+	JSON *m_json;
+};
+
+
+// ===========================================================================
+// JSONTemplate
+// ===========================================================================
+// A json_pack()/json_unpack() format scanned once and reused, for formats run
+// over and over. Unpacking an object that doesn't end in '!' also skips
+// tracking its keys:
+//
+//     static JSONTemplate record("{s:s, s:i, s:o}");
+//     JSON *json = record.Pack("name", name, "id", id, "tags", tags->incref());
+//     record.Unpack(json, "name", &name, "id", &id, "tags", &tags);
+class JSONTemplate
+{
+public:
+	// @param format     Format as for json_pack() / json_unpack().
+	// @param flags      Unpacking flags (JSON_STRICT, JSON_VALIDATE_ONLY).
+	explicit JSONTemplate(const char *format, size_t flags = 0)
+	{
+		json_error_t error;
+		m_template = json_template_compile(format, flags, &error);
+		if (!m_template)
+			printf("[JSONTemplate] %s\n", error.text);
+	}
+
+	~JSONTemplate()
+	{
+		json_template_free(m_template);
+	}
+
+	JSONTemplate(const JSONTemplate&) = delete;
+	JSONTemplate& operator=(const JSONTemplate&) = delete;
+
+	// Builds a JSON from the arguments, as json_pack() does.
+	//
+	// @return           New JSON, nullptr on failure.
+	template<typename... Args>
+	JSON *Pack(Args... args)
+	{
+		static_assert((std::is_scalar_v<Args> && ...), "pack arguments must be scalars or pointers");
+		json_error_t error;
+		json_t *json = json_template_pack(m_template, &error, args...);
+		if (!json)
+			printf("[JSONTemplate::Pack] %s\n", error.text);
+		return (JSON*)json;
+	}
+
+	// Reads values out of a JSON into the arguments, as json_unpack() does.
+	//
+	// @return           True on success, false on failure.
+	template<typename... Args>
+	bool Unpack(JSON *root, Args... args)
+	{
+		static_assert((std::is_scalar_v<Args> && ...), "unpack arguments must be pointers");
+		json_error_t error;
+		if (json_template_unpack(m_template, root, &error, args...) == 0)
+			return true;
+		printf("[JSONTemplate::Unpack] %s\n", error.text);
+		return false;
+	}
+
+	// Checks the characters and bracket nesting of a format, at compile time
+	// if used in a static_assert:
+	//
+	//     static_assert(JSONTemplate::ValidFormat("{s:s, s:[i, i]}"));
+	static constexpr bool ValidFormat(const char *format)
+	{
+		constexpr const char allowed[] = " \t\n,:siIbfFOon?*!#%+";
+		char stack[64] = {};
+		size_t depth = 0;
+
+		if (!format || !*format)
 			return false;
-		
-		if (value)
+
+		for (const char *p = format; *p; p++)
 		{
-			*value = (JSON*)json_object_iter_value(m_iter);
-			if (*value == nullptr)
+			if (*p == '{' || *p == '[')
+			{
+				if (depth == sizeof(stack))
+					return false;
+				stack[depth++] = *p;
+			}
+			else if (*p == '}' || *p == ']')
+			{
+				if (!depth || stack[--depth] != (*p == '}' ? '{' : '['))
+					return false;
+			}
+			else
+			{
+				const char *a = allowed;
+				while (*a && *a != *p)
+					a++;
+				if (!*a)
+					return false;
+			}
+		}
+		return depth == 0;
+	}
+
+private:
+	json_template_t *m_template;
+};
+
+
+// ===========================================================================
+// JSONPath
+// ===========================================================================
+// A JSON Pointer ("/a/b/3") or JSONPath ("$.items[?(@.price < 10)].name")
+// compiled once: keys are unescaped and hashed up front, so following it is
+// a lookup per step. Several paths can be evaluated in one walk:
+//
+//     static JSONPath id("/user/id"), tags("$.user.tags[*]");
+//     const JSONPath *paths[] = {&id, &tags};
+//     JSONPath::QueryBatch(root, paths, 2, [](size_t index, JSON *value) { ... });
+class JSONPath
+{
+public:
+	// @param path       JSON Pointer, or JSONPath if it starts with '$'.
+	explicit JSONPath(const char *path)
+	{
+		json_error_t error;
+		m_path = json_path_compile(path, &error);
+		if (!m_path)
+			printf("[JSONPath] %s, at %d\n", error.text, error.column);
+	}
+
+	~JSONPath()
+	{
+		json_path_free(m_path);
+	}
+
+	JSONPath(const JSONPath&) = delete;
+	JSONPath& operator=(const JSONPath&) = delete;
+
+	// Returns whether or not the path compiled.
+	bool IsValid() const
+	{
+		return m_path != nullptr;
+	}
+
+	// Finds the first value the path matches.
+	//
+	// @return           JSON pointer, or nullptr if nothing matches.
+	JSON *Get(JSON *root) const
+	{
+		return (JSON*)json_path_get(root, m_path);
+	}
+
+	// Finds the value a path without wildcards or filters leads to, to change
+	// it, copying what it shares with a Clone() along the way.
+	//
+	// @return           JSON pointer, or nullptr if there is no such value.
+	JSON *GetMutable(JSON *root) const
+	{
+		return (JSON*)json_path_get_mutable(root, m_path);
+	}
+
+	// Calls fn(JSON*) for every value the path matches, in document order.
+	// fn may return false to stop.
+	//
+	// @return           False if stopped or failed.
+	template<typename F>
+	bool Query(JSON *root, F &&fn) const
+	{
+		auto callback = [](size_t, json_t *value, void *data) -> int {
+			return Call(*(std::remove_reference_t<F>*)data, (JSON*)value) ? 0 : 1;
+		};
+		return json_path_query(root, m_path, callback, &fn) == 0;
+	}
+
+	// Calls fn(size_t index, JSON*) for every value that paths[index] matches,
+	// walking the document once. Paths with a common prefix share its lookups.
+	//
+	// @return           False if stopped or failed.
+	template<typename F>
+	static bool QueryBatch(JSON *root, const JSONPath *const *paths, size_t count, F &&fn)
+	{
+		std::vector<const json_path_t*> compiled(count);
+		for (size_t i = 0; i < count; i++)
+		{
+			if (!paths[i]->m_path)
 				return false;
+			compiled[i] = paths[i]->m_path;
 		}
 
-		m_iter = json_object_iter_next(m_json, m_iter);
-		return true;
+		auto callback = [](size_t index, json_t *value, void *data) -> int {
+			return Call(*(std::remove_reference_t<F>*)data, index, (JSON*)value) ? 0 : 1;
+		};
+		return json_path_query_batch(root, compiled.data(), count, callback, &fn) == 0;
 	}
 
 private:
-	json_t *m_json;
-	void *m_iter;
+	// fn may return void, to never stop
+	template<typename F, typename... Args>
+	static bool Call(F &fn, Args... args)
+	{
+		if constexpr (std::is_void_v<std::invoke_result_t<F&, Args...>>)
+		{
+			fn(args...);
+			return true;
+		}
+		else
+			return fn(args...);
+	}
+
+	json_path_t *m_path;
+};
+
+
+// ===========================================================================
+// JSONHashSet
+// ===========================================================================
+// Distinct JSON values, by contents. Holds a reference to each value, which
+// must not change while in the set. Dedup() copies a document sharing one
+// value between all equal sub-trees, including those already in the set:
+//
+//     JSONHashSet pool;
+//     for (JSON *record : records)
+//         compact.push_back(pool.Dedup(record));
+class JSONHashSet
+{
+public:
+	JSONHashSet() = default;
+
+	~JSONHashSet()
+	{
+		Clear();
+	}
+
+	JSONHashSet(const JSONHashSet&) = delete;
+	JSONHashSet& operator=(const JSONHashSet&) = delete;
+
+	// Adds a value unless an equal one is in the set.
+	//
+	// @return           The value in the set, json or the one equal to it.
+	JSON *Insert(JSON *json)
+	{
+		auto result = m_values.insert(json);
+		if (result.second)
+			json->incref();
+		return *result.first;
+	}
+
+	// @return           The value equal to json, nullptr if none.
+	JSON *Find(JSON *json) const
+	{
+		auto it = m_values.find(json);
+		return it != m_values.end() ? *it : nullptr;
+	}
+
+	bool Contains(JSON *json) const
+	{
+		return m_values.count(json) != 0;
+	}
+
+	size_t Size() const
+	{
+		return m_values.size();
+	}
+
+	void Clear()
+	{
+		for (JSON *json : m_values)
+			json->decref();
+		m_values.clear();
+	}
+
+	// Deep copies a JSON, hash-consing it: every sub-tree equal to one seen
+	// before is that same value, with one more reference.
+	//
+	// @return           New reference, nullptr on failure.
+	JSON *Dedup(JSON *json)
+	{
+		if (JSON *found = Find(json))
+			return found->incref();
+
+		json_t *copy;
+		if (json_is_object(json))
+		{
+			const char *key;
+			size_t keyLength;
+			json_t *value;
+
+			copy = json_object();
+			if (!copy)
+				return nullptr;
+			json_object_keylen_foreach(json, key, keyLength, value)
+			{
+				if (json_object_setn_new_nocheck(copy, key, keyLength, Dedup((JSON*)value)) != 0)
+				{
+					json_decref(copy);
+					return nullptr;
+				}
+			}
+		}
+		else if (json_is_array(json))
+		{
+			size_t size = json_array_size(json);
+
+			copy = json_array();
+			if (!copy || json_array_reserve(copy, size) != 0)
+			{
+				json_decref(copy);
+				return nullptr;
+			}
+			for (size_t i = 0; i < size; i++)
+			{
+				if (json_array_append_new(copy, Dedup((JSON*)json_array_get(json, i))) != 0)
+				{
+					json_decref(copy);
+					return nullptr;
+				}
+			}
+		}
+		else
+			copy = json_deep_copy(json);
+
+		if (!copy)
+			return nullptr;
+		Insert((JSON*)copy);
+		return (JSON*)copy;
+	}
+
+private:
+	struct Hasher
+	{
+		size_t operator()(const JSON *json) const	{ return json_hash(json); }
+	};
+
+	struct Equals
+	{
+		bool operator()(const JSON *a, const JSON *b) const	{ return json_equal(a, b) != 0; }
+	};
+
+	std::unordered_set<JSON*, Hasher, Equals> m_values;
+};
+
+
+// ===========================================================================
+// JSONObjectKeys
+// ===========================================================================
+class JSONObjectKeys
+{
+public:
+	JSONObjectKeys(JSON *json)
+	{
+		m_json = json;
+		m_iter = json_object_iter(json);
+	}
+
+	bool GetKeyValue(const char **key, JSON **value = nullptr)
+	{
+		*key = json_object_iter_key(m_iter);
+		if (*key == nullptr)
+			return false;
+		
+		if (value)
+		{
+			*value = (JSON*)json_object_iter_value(m_iter);
+			if (*value == nullptr)
+				return false;
+		}
+
+		m_iter = json_object_iter_next(m_json, m_iter);
+		return true;
+	}
+
+private:
+	json_t *m_json;
+	void *m_iter;
+};
+
+
+// ===========================================================================
+// JSONReader
+// ===========================================================================
+// Pull parser: reads a document event by event (json_event) without building
+// it, so memory use doesn't grow with the input. Value() turns just the
+// current sub-tree into a JSON, e.g. one element of a huge array at a time:
+//
+//     JSONReader reader;
+//     if (reader.OpenFile("records.json") && reader.Next() == JSON_EVENT_ARRAY_START)
+//         while (JSON *record = reader.NextValue())
+//             record->decref();
+class JSONReader
+{
+public:
+	JSONReader()
+	{
+		m_reader = nullptr;
+		m_event = JSON_EVENT_NONE;
+	}
+
+	~JSONReader()
+	{
+		json_reader_close(m_reader);
+	}
+
+	JSONReader(const JSONReader&) = delete;
+	JSONReader& operator=(const JSONReader&) = delete;
+
+	// Opens a file for reading.
+	//
+	// @param file       File to read from.
+	// @param flags      Decoding flags.
+	// @return           True on success, false on failure.
+	bool OpenFile(const char *file, size_t flags = 0)
+	{
+		json_reader_close(m_reader);
+		m_reader = json_reader_file(file, flags, &m_error);
+		m_event = JSON_EVENT_NONE;
+		if (!m_reader)
+			printf("[JSONReader::OpenFile] %s\n", m_error.text);
+		return m_reader != nullptr;
+	}
+
+	// Opens a buffer for reading. The buffer must outlive the reader.
+	//
+	// @param buffer     Buffer to read from.
+	// @param size       Size of the buffer.
+	// @param flags      Decoding flags.
+	// @return           True on success, false on failure.
+	bool OpenBuffer(const char *buffer, size_t size, size_t flags = 0)
+	{
+		json_reader_close(m_reader);
+		m_reader = json_reader_buffer(buffer, size, flags, &m_error);
+		m_event = JSON_EVENT_NONE;
+		return m_reader != nullptr;
+	}
+
+	// Reads the next event.
+	//
+	// @return           json_event, JSON_EVENT_END after the document and
+	//                   JSON_EVENT_ERROR on invalid input.
+	int Next()
+	{
+		m_event = json_reader_next(m_reader);
+		if (m_event == JSON_EVENT_ERROR)
+			PrintError("Next");
+		return m_event;
+	}
+
+	// Retrieves the string of a JSON_EVENT_KEY or JSON_EVENT_STRING event,
+	// valid until the next call on the reader.
+	//
+	// @param length     Optional pointer to receive the length.
+	// @return           String, or nullptr for other events.
+	const char *GetString(size_t *length = nullptr)
+	{
+		return json_reader_string(m_reader, length);
+	}
+
+	json_int_t GetInteger()
+	{
+		return json_reader_integer(m_reader);
+	}
+
+	// Retrieves the number of a JSON_EVENT_REAL or JSON_EVENT_INTEGER event.
+	double GetReal()
+	{
+		return json_reader_real(m_reader);
+	}
+
+	// Retrieves the number of open objects and arrays.
+	size_t Depth()
+	{
+		return json_reader_depth(m_reader);
+	}
+
+	// Builds the value the last event started. Objects and arrays are read
+	// up to their end, the next event is the one after them.
+	//
+	// @return           JSON pointer, or nullptr if the event starts no value or on failure.
+	JSON *Value()
+	{
+		if (m_event < JSON_EVENT_OBJECT_START || m_event == JSON_EVENT_OBJECT_END ||
+			m_event == JSON_EVENT_ARRAY_END || m_event == JSON_EVENT_KEY)
+			return nullptr;
+
+		json_t *j = json_reader_value(m_reader);
+		m_event = j ? JSON_EVENT_NONE : JSON_EVENT_ERROR;
+		if (!j)
+			PrintError("Value");
+		return (JSON*)j;
+	}
+
+	// Reads the next value of the current array.
+	//
+	// @return           JSON pointer, or nullptr at the end of the array or on failure.
+	JSON *NextValue()
+	{
+		Next();
+		return Value();
+	}
+
+	// Skips the rest of the object or array the last event started.
+	//
+	// @return           True on success, false on failure.
+	bool Skip()
+	{
+		if (json_reader_skip(m_reader) == 0)
+		{
+			m_event = JSON_EVENT_NONE;
+			return true;
+		}
+		PrintError("Skip");
+		return false;
+	}
+
+	// Passes every remaining event to handler(reader, event) until the end
+	// of the document or until the handler returns false.
+	//
+	// @param handler    Callable taking (JSONReader&, int).
+	// @return           True if the document was read to its end, false otherwise.
+	template<typename Handler>
+	bool Parse(Handler &&handler)
+	{
+		int event;
+		while ((event = Next()) > 0)
+		{
+			if (!handler(*this, event))
+				return false;
+		}
+		return event == JSON_EVENT_END;
+	}
+
+private:
+	void PrintError(const char *fn)
+	{
+		printf("[JSONReader::%s] Invalid JSON in line %d, column %d: %s\n", fn, m_error.line, m_error.column, m_error.text);
+	}
+
+	json_reader_t *m_reader;
+	json_error_t m_error;
+	int m_event;
+};
+
+
+// ===========================================================================
+// JSONLinesReader
+// ===========================================================================
+// Reads newline delimited JSON (one document per line) record by record.
+// One lexer and its buffers serve the whole input, errors report the line
+// of the input they were found on.
+class JSONLinesReader
+{
+public:
+	JSONLinesReader()
+	{
+		m_reader = nullptr;
+	}
+
+	~JSONLinesReader()
+	{
+		json_reader_close(m_reader);
+	}
+
+	JSONLinesReader(const JSONLinesReader&) = delete;
+	JSONLinesReader& operator=(const JSONLinesReader&) = delete;
+
+	// Opens a file for reading.
+	//
+	// @param file       File to read from.
+	// @param flags      Decoding flags.
+	// @return           True on success, false on failure.
+	bool OpenFile(const char *file, size_t flags = 0)
+	{
+		json_reader_close(m_reader);
+		m_reader = json_reader_file(file, flags | JSON_DECODE_ANY | JSON_DECODE_LINES, &m_error);
+		if (!m_reader)
+			printf("[JSONLinesReader::OpenFile] %s\n", m_error.text);
+		return m_reader != nullptr;
+	}
+
+	// Reads from an open stream, which is not closed by the reader.
+	bool OpenStream(FILE *file, size_t flags = 0)
+	{
+		json_reader_close(m_reader);
+		m_reader = json_reader_stream(file, flags | JSON_DECODE_ANY | JSON_DECODE_LINES, &m_error);
+		return m_reader != nullptr;
+	}
+
+	// Reads from a file descriptor, which is not closed by the reader.
+	bool OpenFd(int fd, size_t flags = 0)
+	{
+		json_reader_close(m_reader);
+		m_reader = json_reader_fd(fd, flags | JSON_DECODE_ANY | JSON_DECODE_LINES, &m_error);
+		return m_reader != nullptr;
+	}
+
+	// Reads from memory, e.g. a mapped file. The buffer must outlive the reader.
+	bool OpenBuffer(const char *buffer, size_t size, size_t flags = 0)
+	{
+		json_reader_close(m_reader);
+		m_reader = json_reader_buffer(buffer, size, flags | JSON_DECODE_ANY | JSON_DECODE_LINES, &m_error);
+		return m_reader != nullptr;
+	}
+
+	// Reads the next record.
+	//
+	// @param skipInvalid   Whether to report and skip invalid lines instead of stopping.
+	// @return              JSON pointer, or nullptr at the end of the input or on failure.
+	JSON *Next(bool skipInvalid = false)
+	{
+		while (true)
+		{
+			json_t *j = json_reader_document(m_reader);
+			if (j || json_reader_event(m_reader) != JSON_EVENT_ERROR)
+				return (JSON*)j;
+
+			printf("[JSONLinesReader::Next] Invalid JSON in line %d, column %d: %s\n", m_error.line, m_error.column, m_error.text);
+			if (!skipInvalid || json_reader_skip_line(m_reader) != 0)
+				return nullptr;
+		}
+	}
+
+	// Reads up to count records.
+	//
+	// @param records       Array receiving the records, each must be decref'd.
+	// @param count         Maximum number of records to read.
+	// @param skipInvalid   Whether to report and skip invalid lines instead of stopping.
+	// @return              Number of records read, less than count at the end of the input.
+	size_t ReadBatch(JSON **records, size_t count, bool skipInvalid = false)
+	{
+		size_t i = 0;
+		while (i < count && (records[i] = Next(skipInvalid)) != nullptr)
+			i++;
+		return i;
+	}
+
+	// Returns whether the whole input was read.
+	bool IsEnd()
+	{
+		return json_reader_event(m_reader) == JSON_EVENT_END;
+	}
+
+	// Retrieves the last error, its line is the line of the input.
+	const json_error_t &Error()
+	{
+		return m_error;
+	}
+
+private:
+	json_reader_t *m_reader;
+	json_error_t m_error;
+};
+
+
+// ===========================================================================
+// JSONLinesWriter
+// ===========================================================================
+// Writes newline delimited JSON. Records are dumped compactly into one
+// reusable buffer, which goes out with a single write once it holds
+// bufferSize bytes, on Flush(), or on destruction.
+class JSONLinesWriter
+{
+public:
+	// @param fd          File descriptor to write to, not closed by the writer.
+	// @param bufferSize  Number of buffered bytes that triggers a write.
+	explicit JSONLinesWriter(int fd, size_t bufferSize = 1 << 20)
+	{
+		Init(fd, nullptr, bufferSize);
+	}
+
+	// @param file        Stream to write to, not closed by the writer.
+	// @param bufferSize  Number of buffered bytes that triggers a write.
+	explicit JSONLinesWriter(FILE *file, size_t bufferSize = 1 << 20)
+	{
+		Init(-1, file, bufferSize);
+	}
+
+	~JSONLinesWriter()
+	{
+		Flush();
+		free(m_buffer);
+	}
+
+	JSONLinesWriter(const JSONLinesWriter&) = delete;
+	JSONLinesWriter& operator=(const JSONLinesWriter&) = delete;
+
+	// Appends a record.
+	//
+	// @param record     Value to write.
+	// @param flags      Encoding flags, the output is always compact.
+	// @return           True on success, false on failure.
+	bool Write(JSON *record, size_t flags = 0)
+	{
+		flags = (flags & ~(size_t)JSON_MAX_INDENT) | JSON_COMPACT | JSON_ENCODE_ANY;
+		if (!m_buffer && !Reserve(m_bufferSize))
+			return false;
+
+		// dump into the free space first, grow only for records that don't fit
+		size_t room = m_capacity - m_size;
+		size_t length = json_dumpb(record, m_buffer + m_size, room, flags);
+		if (length == 0)
+			return false;
+
+		if (length + 1 > room)
+		{
+			if (!Reserve(m_size + length + 1))
+				return false;
+			json_dumpb(record, m_buffer + m_size, m_capacity - m_size, flags);
+		}
+
+		m_buffer[m_size + length] = '\n';
+		m_size += length + 1;
+
+		if (m_size >= m_bufferSize)
+			return Flush();
+		return true;
+	}
+
+	// Writes out the buffered records.
+	//
+	// @return           True on success, false on failure.
+	bool Flush()
+	{
+		size_t done = 0;
+		while (done < m_size)
+		{
+			size_t n;
+			if (m_file)
+				n = fwrite(m_buffer + done, 1, m_size - done, m_file);
+			else
+			{
+#ifdef _WIN32
+				int ret = _write(m_fd, m_buffer + done, (unsigned int)(m_size - done));
+#else
+				ssize_t ret = write(m_fd, m_buffer + done, m_size - done);
+#endif
+				n = ret > 0 ? (size_t)ret : 0;
+			}
+
+			if (n == 0)
+			{
+				printf("[JSONLinesWriter::Flush] write failed\n");
+				memmove(m_buffer, m_buffer + done, m_size - done);
+				m_size -= done;
+				return false;
+			}
+			done += n;
+		}
+
+		m_size = 0;
+		if (m_file)
+			return fflush(m_file) == 0;
+		return true;
+	}
+
+	// Retrieves the number of buffered bytes.
+	size_t Pending()
+	{
+		return m_size;
+	}
+
+private:
+	void Init(int fd, FILE *file, size_t bufferSize)
+	{
+		m_fd = fd;
+		m_file = file;
+		m_bufferSize = bufferSize ? bufferSize : 1;
+		m_buffer = nullptr;
+		m_size = 0;
+		m_capacity = 0;
+	}
+
+	bool Reserve(size_t size)
+	{
+		size_t capacity = m_capacity ? m_capacity : m_bufferSize + 4096;
+		while (capacity < size)
+			capacity *= 2;
+
+		char *buffer = (char*)realloc(m_buffer, capacity);
+		if (!buffer)
+			return false;
+
+		m_buffer = buffer;
+		m_capacity = capacity;
+		return true;
+	}
+
+	int m_fd;
+	FILE *m_file;
+	char *m_buffer;
+	size_t m_size;
+	size_t m_capacity;
+	size_t m_bufferSize;
+};
+
+
+// ===========================================================================
+// JSONParallelLoader
+// ===========================================================================
+// Loads large inputs on several threads. json_split_array() (or
+// json_split_documents()) finds where the elements begin and end, the
+// threads decode them into separate values, and the values are put
+// together in input order.
+//
+// Input that doesn't split, or any element that fails to decode, is loaded
+// again on the calling thread, so errors are reported as by json_loadb().
+class JSONParallelLoader
+{
+public:
+	// @param threads    Number of threads, 0 for one per hardware thread.
+	explicit JSONParallelLoader(size_t threads = 0)
+	{
+		m_threads = threads ? threads : std::thread::hardware_concurrency();
+		if (!m_threads)
+			m_threads = 1;
+	}
+
+	// Loads a JSON, splitting a top-level array across the threads.
+	//
+	// @param buffer     Buffer to read from.
+	// @param size       Size of the buffer.
+	// @param flags      Decoding flags, JSON_INSITU is ignored.
+	// @return           JSON pointer, or nullptr on failure.
+	JSON *LoadArray(const char *buffer, size_t size, size_t flags = 0)
+	{
+		std::vector<Span> spans;
+		if (json_split_array(buffer, size, AddSpan, &spans) == 0)
+		{
+			if (json_t *array = LoadSpans(buffer, spans, flags, 1))
+				return (JSON*)array;
+		}
+
+		json_error_t error;
+		json_t *j = json_loadb(buffer, size, flags & ~(size_t)JSON_INSITU, &error);
+		if (!j)
+			printf("[JSONParallelLoader::LoadArray] Invalid JSON in line %d, column %d: %s\n", error.line, error.column, error.text);
+		return (JSON*)j;
+	}
+
+	// Loads a file with LoadArray(). Regular files are mapped into memory,
+	// see json_load_file() for JSON_DISABLE_MMAP.
+	//
+	// @param file       File to read from.
+	// @param flags      Decoding flags.
+	// @return           JSON pointer, or nullptr on failure.
+	JSON *LoadFile(const char *file, size_t flags = 0)
+	{
+		size_t size;
+		const char *data = (flags & JSON_DISABLE_MMAP) ? nullptr : json_map_file(file, &size);
+		if (data)
+		{
+			JSON *json = LoadArray(data, size, flags);
+			json_unmap_file(data, size);
+			return json;
+		}
+
+		FILE *fp = fopen(file, "rb");
+		if (!fp)
+		{
+			printf("[JSONParallelLoader::LoadFile] Unable to open %s\n", file);
+			return nullptr;
+		}
+
+		std::vector<char> buffer;
+		char chunk[65536];
+		size_t read;
+		while ((read = fread(chunk, 1, sizeof(chunk), fp)) > 0)
+			buffer.insert(buffer.end(), chunk, chunk + read);
+		fclose(fp);
+
+		return LoadArray(buffer.data(), buffer.size(), flags);
+	}
+
+	// Loads a whitespace separated sequence of documents, e.g. newline
+	// delimited JSON, into an array with one element per document.
+	//
+	// @param buffer     Buffer to read from.
+	// @param size       Size of the buffer.
+	// @param flags      Decoding flags, JSON_INSITU is ignored.
+	// @return           Array of the documents, or nullptr on failure.
+	JSON *LoadDocuments(const char *buffer, size_t size, size_t flags = 0)
+	{
+		std::vector<Span> spans;
+		if (json_split_documents(buffer, size, AddSpan, &spans) == 0)
+		{
+			if (json_t *array = LoadSpans(buffer, spans, flags, 0))
+				return (JSON*)array;
+		}
+
+		json_error_t error;
+		json_reader_t *reader = json_reader_buffer(buffer, size, (flags | JSON_DECODE_ANY) & ~(size_t)JSON_INSITU, &error);
+		if (!reader)
+			return nullptr;
+
+		json_t *array = json_array();
+		while (json_t *document = json_reader_document(reader))
+			json_array_append_new(array, document);
+
+		if (json_reader_event(reader) == JSON_EVENT_ERROR)
+		{
+			printf("[JSONParallelLoader::LoadDocuments] Invalid JSON in line %d, column %d: %s\n", error.line, error.column, error.text);
+			json_decref(array);
+			array = nullptr;
+		}
+		json_reader_close(reader);
+		return (JSON*)array;
+	}
+
+	size_t Threads()
+	{
+		return m_threads;
+	}
+
+private:
+	struct Span
+	{
+		size_t offset;
+		size_t length;
+	};
+
+	// Elements handed to a thread at a time.
+	static const size_t BATCH = 256;
+
+	static int AddSpan(size_t offset, size_t length, void *data)
+	{
+		((std::vector<Span>*)data)->push_back({offset, length});
+		return 0;
+	}
+
+	// Decodes every span into an array, nullptr if any of them fails.
+	// The spans are decoded as if inside nested containers, so the depth
+	// limit still covers the whole input.
+	json_t *LoadSpans(const char *buffer, const std::vector<Span> &spans, size_t flags, size_t nested)
+	{
+		std::vector<json_t*> values(spans.size(), nullptr);
+		std::atomic<size_t> next(0);
+		std::atomic<bool> failed(false);
+
+		nested += (flags >> 16) & 0xFFF;
+		flags &= ~JSON_DECODE_NESTED(0xFFF);
+		flags = (flags | JSON_DECODE_ANY | JSON_DECODE_NESTED(nested)) & ~(size_t)JSON_INSITU;
+		auto work = [&]()
+		{
+			size_t begin;
+			while (!failed.load(std::memory_order_relaxed) && (begin = next.fetch_add(BATCH)) < spans.size())
+			{
+				size_t end = std::min(begin + BATCH, spans.size());
+				for (size_t i = begin; i < end; i++)
+				{
+					values[i] = json_loadb(buffer + spans[i].offset, spans[i].length, flags, nullptr);
+					if (!values[i])
+					{
+						failed = true;
+						break;
+					}
+				}
+			}
+		};
+
+		size_t count = std::min(m_threads, (spans.size() + BATCH - 1) / BATCH);
+		std::vector<std::thread> threads;
+		for (size_t i = 1; i < count; i++)
+			threads.emplace_back(work);
+		work();
+		for (std::thread &thread : threads)
+			thread.join();
+
+		json_t *array = failed ? nullptr : json_array();
+		for (json_t *value : values)
+		{
+			if (array)
+				json_array_append_new(array, value);
+			else
+				json_decref(value);
+		}
+		return array;
+	}
+
+	size_t m_threads;
+};
+
+
+// ===========================================================================
+// JSONParallelDumper
+// ===========================================================================
+// Encodes the children of a large array or object on several threads.
+// json_dump_range() encodes consecutive ranges of children into separate
+// chunks, and the chunks are written out in order as they finish, several
+// at a time with writev(). At most a few chunks per thread are held ahead
+// of the writer.
+//
+// Anything else (scalars, small containers, objects with JSON_SORT_KEYS)
+// is encoded on the calling thread, the output is the same either way.
+class JSONParallelDumper
+{
+public:
+	// @param threads    Number of threads, 0 for one per hardware thread.
+	explicit JSONParallelDumper(size_t threads = 0)
+	{
+		m_threads = threads ? threads : std::thread::hardware_concurrency();
+		if (!m_threads)
+			m_threads = 1;
+	}
+
+	// Writes a JSON to a file descriptor.
+	//
+	// @param json       JSON to encode.
+	// @param fd         File descriptor to write to, not closed.
+	// @param flags      Encoding flags.
+	// @return           True on success, false on failure.
+	bool DumpFd(JSON *json, int fd, size_t flags = 0)
+	{
+		if (!Splittable(json, flags))
+			return json_dumpfd(json, fd, flags) == 0;
+
+		return Run(json, flags, 4 * m_threads, [fd](Chunk *chunks, size_t count)
+		{
+			return WriteChunks(fd, chunks, count);
+		});
+	}
+
+	// Writes a JSON to a file, replacing it.
+	//
+	// @param json       JSON to encode.
+	// @param file       Path of the file.
+	// @param flags      Encoding flags.
+	// @return           True on success, false on failure.
+	bool DumpFile(JSON *json, const char *file, size_t flags = 0)
+	{
+		FILE *fp = fopen(file, "wb");
+		if (!fp)
+		{
+			printf("[JSONParallelDumper::DumpFile] Unable to open %s\n", file);
+			return false;
+		}
+
+#ifdef _WIN32
+		bool result = DumpFd(json, _fileno(fp), flags);
+#else
+		bool result = DumpFd(json, fileno(fp), flags);
+#endif
+		return fclose(fp) == 0 && result;
+	}
+
+	// Encodes a JSON to a string, like JSON::ToString().
+	//
+	// @param json       JSON to encode.
+	// @param flags      Encoding flags.
+	// @return           String (free it with free()), or nullptr on failure.
+	char *ToString(JSON *json, size_t flags = 0)
+	{
+		if (!Splittable(json, flags))
+			return json_dumps(json, flags);
+
+		char *result = nullptr;
+		size_t size = 0;
+		bool ok = Run(json, flags, (size_t)-1, [&](Chunk *chunks, size_t count)
+		{
+			size_t add = 0;
+			for (size_t i = 0; i < count; i++)
+				add += chunks[i].size;
+
+			char *buffer = (char*)realloc(result, size + add + 1);
+			if (!buffer)
+				return false;
+
+			result = buffer;
+			for (size_t i = 0; i < count; i++)
+			{
+				memcpy(result + size, chunks[i].data, chunks[i].size);
+				size += chunks[i].size;
+			}
+			result[size] = '\0';
+			return true;
+		});
+
+		if (!ok)
+		{
+			free(result);
+			return nullptr;
+		}
+		return result;
+	}
+
+	size_t Threads()
+	{
+		return m_threads;
+	}
+
+private:
+	struct Chunk
+	{
+		char *data;
+		size_t size;
+		size_t capacity;
+		int state; // 0 pending, 1 done, -1 failed
+	};
+
+	// Children encoded into one chunk per thread and round, at least.
+	static const size_t MIN_CHILDREN = 64;
+
+	static size_t Children(JSON *json)
+	{
+		return json_is_object(json) ? json_object_size(json) : json_array_size(json);
+	}
+
+	bool Splittable(JSON *json, size_t flags)
+	{
+		if (m_threads < 2 || (!json_is_array(json) && !json_is_object(json)))
+			return false;
+		if (json_is_object(json) && (flags & JSON_SORT_KEYS))
+			return false;
+		return Children(json) >= 2 * MIN_CHILDREN;
+	}
+
+	static int Append(const char *buffer, size_t size, void *data)
+	{
+		Chunk *chunk = (Chunk*)data;
+		if (chunk->size + size > chunk->capacity)
+		{
+			size_t capacity = chunk->capacity ? chunk->capacity : 4096;
+			while (capacity < chunk->size + size)
+				capacity *= 2;
+
+			char *grown = (char*)realloc(chunk->data, capacity);
+			if (!grown)
+				return -1;
+			chunk->data = grown;
+			chunk->capacity = capacity;
+		}
+
+		memcpy(chunk->data + chunk->size, buffer, size);
+		chunk->size += size;
+		return 0;
+	}
+
+	// Writes the chunks in order, going on after partial writes and
+	// retrying writes interrupted by a signal, like write_fd() in dump.c.
+	static bool WriteChunks(int fd, Chunk *chunks, size_t count)
+	{
+		size_t index = 0, offset = 0;
+		while (true)
+		{
+			while (index < count && chunks[index].size == offset)
+			{
+				offset = 0;
+				index++;
+			}
+			if (index == count)
+				return true;
+
+#ifdef _WIN32
+			int ret = _write(fd, chunks[index].data + offset, (unsigned int)(chunks[index].size - offset));
+#else
+			struct iovec iov[64];
+			int n = 0;
+			for (size_t i = index; i < count && n < 64; i++, n++)
+			{
+				iov[n].iov_base = chunks[i].data + (i == index ? offset : 0);
+				iov[n].iov_len = chunks[i].size - (i == index ? offset : 0);
+			}
+			ssize_t ret = writev(fd, iov, n);
+#endif
+			if (ret < 0 && errno == EINTR)
+				continue;
+			if (ret <= 0)
+			{
+				printf("[JSONParallelDumper::WriteChunks] write failed\n");
+				return false;
+			}
+
+			size_t written = (size_t)ret;
+			while (index < count && written >= chunks[index].size - offset)
+			{
+				written -= chunks[index].size - offset;
+				offset = 0;
+				index++;
+			}
+			offset += written;
+		}
+	}
+
+	// Encodes the chunks on the threads while the calling thread hands
+	// every run of finished chunks to sink(chunks, count), in order.
+	// Threads stay at most `ahead` chunks in front of the sink.
+	template<typename Sink>
+	bool Run(JSON *json, size_t flags, size_t ahead, Sink sink)
+	{
+		size_t children = Children(json);
+		size_t count = std::min(children / MIN_CHILDREN, 8 * m_threads);
+		std::vector<Chunk> chunks(count, Chunk{nullptr, 0, 0, 0});
+
+		std::mutex mutex;
+		std::condition_variable changed;
+		size_t next = 0, sunk = 0;
+		bool failed = false;
+
+		auto work = [&]()
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			while (!failed && next < count)
+			{
+				if (next - sunk >= ahead)
+				{
+					changed.wait(lock);
+					continue;
+				}
+
+				size_t i = next++;
+				lock.unlock();
+				size_t begin = children * i / count, end = children * (i + 1) / count;
+				int res = json_dump_range(json, begin, end - begin, Append, &chunks[i], flags);
+				lock.lock();
+
+				chunks[i].state = res == 0 ? 1 : -1;
+				changed.notify_all();
+			}
+		};
+
+		std::vector<std::thread> threads;
+		for (size_t i = 0; i < m_threads; i++)
+			threads.emplace_back(work);
+
+		std::unique_lock<std::mutex> lock(mutex);
+		while (!failed && sunk < count)
+		{
+			if (chunks[sunk].state == 0)
+			{
+				changed.wait(lock);
+				continue;
+			}
+			if (chunks[sunk].state < 0)
+			{
+				failed = true;
+				break;
+			}
+
+			size_t end = sunk;
+			while (end < count && chunks[end].state > 0)
+				end++;
+			lock.unlock();
+
+			bool ok = sink(&chunks[sunk], end - sunk);
+			for (size_t i = sunk; i < end; i++)
+			{
+				free(chunks[i].data);
+				chunks[i].data = nullptr;
+			}
+			lock.lock();
+
+			failed = !ok;
+			sunk = end;
+			changed.notify_all();
+		}
+		changed.notify_all();
+		lock.unlock();
+
+		for (std::thread &thread : threads)
+			thread.join();
+		for (Chunk &chunk : chunks)
+			free(chunk.data);
+		return !failed;
+	}
+
+	size_t m_threads;
+};
+
+
+// ===========================================================================
+// JSONLazy
+// ===========================================================================
+// Read-only view of a document that decodes only what is accessed. The first
+// access to a container finds where its children are (json_split_object() /
+// json_split_array(), no nodes are built), Get() decodes one value and keeps it
+// until the view is destroyed. Reading a few fields of a large document costs
+// skipping over the rest, not decoding it:
+//
+//     JSONLazy doc(response, length);
+//     int code = doc["status"]["code"].GetValue<int>();
+//
+// The buffer must outlive the view. Only what is decoded gets validated; a
+// missing key or index gives an empty view, whose Get() returns nullptr. Views
+// change as they are read, use one from one thread at a time.
+class JSONLazy
+{
+public:
+	// @param buffer     JSON text, which is not copied.
+	// @param length     Length of the text.
+	// @param flags      Decoding flags for the values decoded.
+	JSONLazy(const char *buffer, size_t length, size_t flags = 0)
+	{
+		m_buffer = buffer;
+		m_length = length;
+		m_flags = (flags | JSON_DECODE_ANY) & ~(size_t)JSON_INSITU;
+		m_json = nullptr;
+		m_valid = buffer != nullptr;
+		m_scanned = !m_valid;
+	}
+
+	~JSONLazy()
+	{
+		json_decref(m_json);
+	}
+
+	JSONLazy(JSONLazy &&other) noexcept
+		: m_buffer(other.m_buffer), m_length(other.m_length), m_flags(other.m_flags),
+		  m_json(other.m_json), m_valid(other.m_valid), m_scanned(other.m_scanned),
+		  m_keys(std::move(other.m_keys)), m_children(std::move(other.m_children))
+	{
+		other.m_json = nullptr;
+	}
+
+	JSONLazy(const JSONLazy&) = delete;
+	JSONLazy& operator=(const JSONLazy&) = delete;
+
+	// Returns whether or not the value exists.
+	bool IsValid()
+	{
+		return m_valid;
+	}
+
+	// Retrieves the type of the value from its first byte, without decoding it.
+	//
+	// @return           Type, JSON_NULL for a missing value.
+	json_type Type()
+	{
+		size_t i = 0;
+		while (i < m_length && (m_buffer[i] == ' ' || m_buffer[i] == '\t' || m_buffer[i] == '\n' || m_buffer[i] == '\r'))
+			i++;
+		if (!m_valid || i == m_length)
+			return JSON_NULL;
+
+		switch (m_buffer[i])
+		{
+			case '{': return JSON_OBJECT;
+			case '[': return JSON_ARRAY;
+			case '"': return JSON_STRING;
+			case 't': return JSON_TRUE;
+			case 'f': return JSON_FALSE;
+			case 'n': return JSON_NULL;
+		}
+		for (; i < m_length; i++)
+		{
+			if (m_buffer[i] == '.' || m_buffer[i] == 'e' || m_buffer[i] == 'E')
+				return JSON_REAL;
+		}
+		return JSON_INTEGER;
+	}
+
+	// Get the view of an object member.
+	//
+	// @param key        Key of the member.
+	// @return           View of the member, an empty view if there is none.
+	JSONLazy& operator[](const char *key)
+	{
+		Scan();
+		// the last of duplicate keys wins, as when decoding
+		for (size_t i = m_keys.size(); i-- > 0; )
+		{
+			if (m_keys[i] == key)
+				return m_children[i];
+		}
+		return Missing();
+	}
+
+	// Get the view of an array element.
+	//
+	// @param index      Index in the array.
+	// @return           View of the element, an empty view if there is none.
+	JSONLazy& operator[](size_t index)
+	{
+		Scan();
+		if (!m_keys.empty() || index >= m_children.size() || Type() != JSON_ARRAY)
+			return Missing();
+		return m_children[index];
+	}
+
+	// Retrieves the number of members or elements.
+	size_t Size()
+	{
+		Scan();
+		return m_children.size();
+	}
+
+	// Retrieves the key of a member by position, for iterating over an object.
+	//
+	// @return           Key, nullptr if out of range.
+	const char *Key(size_t index)
+	{
+		Scan();
+		return index < m_keys.size() ? m_keys[index].c_str() : nullptr;
+	}
+
+	// Decodes the value on first use.
+	//
+	// @return           Decoded JSON, owned by the view, nullptr if missing or invalid.
+	JSON *Get()
+	{
+		if (!m_json && m_valid)
+		{
+			json_error_t error;
+			m_json = json_loadb(m_buffer, m_length, m_flags, &error);
+			if (!m_json)
+			{
+				printf("[JSONLazy::Get] Invalid JSON in line %d, column %d: %s\n", error.line, error.column, error.text);
+				m_valid = false;
+			}
+		}
+		return (JSON*)m_json;
+	}
+
+	// Retrieves a value, decoding only this part of the document.
+	template<typename T>
+	T GetValue()
+	{
+		JSON *json = Get();
+		return json ? json->GetValue<T>() : T{};
+	}
+
+	template<typename T>
+	T GetValue(const char *key)
+	{
+		return (*this)[key].GetValue<T>();
+	}
+
+	template<typename T>
+	T GetValue(size_t index)
+	{
+		return (*this)[index].GetValue<T>();
+	}
+
+private:
+	static JSONLazy& Missing()
+	{
+		// never scanned nor decoded, so sharing it is safe
+		static JSONLazy missing(nullptr, 0);
+		return missing;
+	}
+
+	void Scan()
+	{
+		if (m_scanned)
+			return;
+		m_scanned = true;
+
+		int ret = 0;
+		json_type type = Type();
+		if (type == JSON_OBJECT)
+			ret = json_split_object(m_buffer, m_length, AddMember, this);
+		else if (type == JSON_ARRAY)
+			ret = json_split_array(m_buffer, m_length, AddElement, this);
+
+		if (ret != 0)
+		{
+			printf("[JSONLazy::Scan] Invalid JSON\n");
+			m_keys.clear();
+			m_children.clear();
+		}
+	}
+
+	static int AddMember(size_t keyOffset, size_t keyLength, size_t offset, size_t length, void *data)
+	{
+		JSONLazy *self = (JSONLazy*)data;
+		const char *key = self->m_buffer + keyOffset;
+
+		if (memchr(key, '\\', keyLength))
+		{
+			// decode the escapes of the quoted key
+			json_t *decoded = json_loadb(key - 1, keyLength + 2, JSON_DECODE_ANY, nullptr);
+			if (!decoded)
+				return -1;
+			self->m_keys.emplace_back(json_string_value(decoded), json_string_length(decoded));
+			json_decref(decoded);
+		}
+		else
+			self->m_keys.emplace_back(key, keyLength);
+
+		return AddElement(offset, length, data);
+	}
+
+	static int AddElement(size_t offset, size_t length, void *data)
+	{
+		JSONLazy *self = (JSONLazy*)data;
+		self->m_children.emplace_back(self->m_buffer + offset, length, self->m_flags);
+		return 0;
+	}
+
+	const char *m_buffer;
+	size_t m_length;
+	size_t m_flags;
+	json_t *m_json;
+	bool m_valid;
+	bool m_scanned;
+	std::vector<std::string> m_keys;
+	std::vector<JSONLazy> m_children;
+};
+
+} // namespace fdxx
+
+// ===========================================================================
+// JSONStruct
+// ===========================================================================
+// Binds C++ structs to JSON objects, member by member, without building a
+// document: Decode() reads straight from the pull reader's events into the
+// struct, Encode() writes compact JSON straight to a sink. Members are listed
+// once with JSONEX_FIELDS, in the namespace of the struct:
+//
+//     struct Player { std::string name; int score; std::vector<int> items; };
+//     JSONEX_FIELDS(Player, name, score, items)
+//
+//     Player player;
+//     if (fdxx::JSONStruct::Decode(body, length, player))
+//         fdxx::JSONStruct::ToString(player, reply);
+//
+// Members can be bool, integers, floating point, std::string, std::vector,
+// std::optional (null when empty) and other bound structs. Unknown keys are
+// skipped and missing ones leave the member as it is; a value of the wrong
+// type, or an integer out of range of its member, fails the whole Decode().
+// Up to 32 members per struct.
+#define JSONEX_EXPAND(x) x
+#define JSONEX_FE_1(m, x) m(x)
+#define JSONEX_FE_2(m, x, ...) m(x) JSONEX_EXPAND(JSONEX_FE_1(m, __VA_ARGS__))
+#define JSONEX_FE_3(m, x, ...) m(x) JSONEX_EXPAND(JSONEX_FE_2(m, __VA_ARGS__))
+#define JSONEX_FE_4(m, x, ...) m(x) JSONEX_EXPAND(JSONEX_FE_3(m, __VA_ARGS__))
+#define JSONEX_FE_5(m, x, ...) m(x) JSONEX_EXPAND(JSONEX_FE_4(m, __VA_ARGS__))
+#define JSONEX_FE_6(m, x, ...) m(x) JSONEX_EXPAND(JSONEX_FE_5(m, __VA_ARGS__))
+#define JSONEX_FE_7(m, x, ...) m(x) JSONEX_EXPAND(JSONEX_FE_6(m, __VA_ARGS__))
+#define JSONEX_FE_8(m, x, ...) m(x) JSONEX_EXPAND(JSONEX_FE_7(m, __VA_ARGS__))
+#define JSONEX_FE_9(m, x, ...) m(x) JSONEX_EXPAND(JSONEX_FE_8(m, __VA_ARGS__))
+#define JSONEX_FE_10(m, x, ...) m(x) JSONEX_EXPAND(JSONEX_FE_9(m, __VA_ARGS__))
+#define JSONEX_FE_11(m, x, ...) m(x) JSONEX_EXPAND(JSONEX_FE_10(m, __VA_ARGS__))
+#define JSONEX_FE_12(m, x, ...) m(x) JSONEX_EXPAND(JSONEX_FE_11(m, __VA_ARGS__))
+#define JSONEX_FE_13(m, x, ...) m(x) JSONEX_EXPAND(JSONEX_FE_12(m, __VA_ARGS__))
+#define JSONEX_FE_14(m, x, ...) m(x) JSONEX_EXPAND(JSONEX_FE_13(m, __VA_ARGS__))
+#define JSONEX_FE_15(m, x, ...) m(x) JSONEX_EXPAND(JSONEX_FE_14(m, __VA_ARGS__))
+#define JSONEX_FE_16(m, x, ...) m(x) JSONEX_EXPAND(JSONEX_FE_15(m, __VA_ARGS__))
+#define JSONEX_FE_17(m, x, ...) m(x) JSONEX_EXPAND(JSONEX_FE_16(m, __VA_ARGS__))
+#define JSONEX_FE_18(m, x, ...) m(x) JSONEX_EXPAND(JSONEX_FE_17(m, __VA_ARGS__))
+#define JSONEX_FE_19(m, x, ...) m(x) JSONEX_EXPAND(JSONEX_FE_18(m, __VA_ARGS__))
+#define JSONEX_FE_20(m, x, ...) m(x) JSONEX_EXPAND(JSONEX_FE_19(m, __VA_ARGS__))
+#define JSONEX_FE_21(m, x, ...) m(x) JSONEX_EXPAND(JSONEX_FE_20(m, __VA_ARGS__))
+#define JSONEX_FE_22(m, x, ...) m(x) JSONEX_EXPAND(JSONEX_FE_21(m, __VA_ARGS__))
+#define JSONEX_FE_23(m, x, ...) m(x) JSONEX_EXPAND(JSONEX_FE_22(m, __VA_ARGS__))
+#define JSONEX_FE_24(m, x, ...) m(x) JSONEX_EXPAND(JSONEX_FE_23(m, __VA_ARGS__))
+#define JSONEX_FE_25(m, x, ...) m(x) JSONEX_EXPAND(JSONEX_FE_24(m, __VA_ARGS__))
+#define JSONEX_FE_26(m, x, ...) m(x) JSONEX_EXPAND(JSONEX_FE_25(m, __VA_ARGS__))
+#define JSONEX_FE_27(m, x, ...) m(x) JSONEX_EXPAND(JSONEX_FE_26(m, __VA_ARGS__))
+#define JSONEX_FE_28(m, x, ...) m(x) JSONEX_EXPAND(JSONEX_FE_27(m, __VA_ARGS__))
+#define JSONEX_FE_29(m, x, ...) m(x) JSONEX_EXPAND(JSONEX_FE_28(m, __VA_ARGS__))
+#define JSONEX_FE_30(m, x, ...) m(x) JSONEX_EXPAND(JSONEX_FE_29(m, __VA_ARGS__))
+#define JSONEX_FE_31(m, x, ...) m(x) JSONEX_EXPAND(JSONEX_FE_30(m, __VA_ARGS__))
+#define JSONEX_FE_32(m, x, ...) m(x) JSONEX_EXPAND(JSONEX_FE_31(m, __VA_ARGS__))
+#define JSONEX_FE_COUNT(_1, _2, _3, _4, _5, _6, _7, _8, _9, _10, _11, _12, _13, _14, _15, _16, _17, _18, _19, _20, _21, _22, _23, _24, _25, _26, _27, _28, _29, _30, _31, _32, N, ...) N
+#define JSONEX_FOR_EACH(m, ...) \
+	JSONEX_EXPAND(JSONEX_FE_COUNT(__VA_ARGS__, JSONEX_FE_32, JSONEX_FE_31, JSONEX_FE_30, JSONEX_FE_29, JSONEX_FE_28, JSONEX_FE_27, JSONEX_FE_26, JSONEX_FE_25, JSONEX_FE_24, JSONEX_FE_23, JSONEX_FE_22, JSONEX_FE_21, JSONEX_FE_20, JSONEX_FE_19, JSONEX_FE_18, JSONEX_FE_17, JSONEX_FE_16, JSONEX_FE_15, JSONEX_FE_14, JSONEX_FE_13, JSONEX_FE_12, JSONEX_FE_11, JSONEX_FE_10, JSONEX_FE_9, JSONEX_FE_8, JSONEX_FE_7, JSONEX_FE_6, JSONEX_FE_5, JSONEX_FE_4, JSONEX_FE_3, JSONEX_FE_2, JSONEX_FE_1)(m, __VA_ARGS__))
+
+#define JSONEX_FIELD_(member) f(#member, sizeof(#member) - 1, self.member);
+
+// Defines JSONExFields(self, f), which calls f(name, length, member) for every
+// listed member in order. Found by argument-dependent lookup.
+#define JSONEX_FIELDS(Type, ...) \
+	template<typename F> inline void JSONExFields(Type &self, F &&f) { JSONEX_FOR_EACH(JSONEX_FIELD_, __VA_ARGS__) } \
+	template<typename F> inline void JSONExFields(const Type &self, F &&f) { JSONEX_FOR_EACH(JSONEX_FIELD_, __VA_ARGS__) }
+
+namespace fdxx {
+
+class JSONStruct
+{
+public:
+	// Decodes a JSON into value.
+	//
+	// @param buffer     JSON text.
+	// @param size       Length of the text.
+	// @param value      Value to decode into, e.g. a bound struct or a std::vector of them.
+	// @param flags      Decoding flags.
+	// @return           True on success, false on invalid JSON or a mismatch.
+	template<typename T>
+	static bool Decode(const char *buffer, size_t size, T &value, size_t flags = 0)
+	{
+		Decoder decoder;
+		decoder.m_reader = json_reader_buffer(buffer, size, flags | JSON_DECODE_ANY, &decoder.m_error);
+		if (!decoder.m_reader)
+			return false;
+
+		int event = json_reader_next(decoder.m_reader);
+		bool ok = event > 0 && decoder.Value(event, value);
+		if (ok)
+		{
+			// nothing but whitespace after the value
+			decoder.m_field = nullptr;
+			event = json_reader_next(decoder.m_reader);
+			ok = event == JSON_EVENT_END || (event != JSON_EVENT_ERROR && decoder.Mismatch());
+		}
+
+		if (!ok)
+			decoder.PrintError();
+		json_reader_close(decoder.m_reader);
+		return ok;
+	}
+
+	// Passes the compact JSON encoding of value to sink(const char *data, size_t size)
+	// piece by piece. The sink returns false to stop.
+	//
+	// @param value      Value to encode.
+	// @param sink       Callable receiving the output.
+	// @param flags      Encoding flags (JSON_ENSURE_ASCII, JSON_ESCAPE_SLASH, JSON_REAL_PRECISION).
+	// @return           True on success, false on failure or if stopped.
+	template<typename T, typename Sink>
+	static bool Encode(const T &value, Sink &&sink, size_t flags = 0)
+	{
+		Encoder encoder;
+		encoder.m_callback = [](const char *buffer, size_t size, void *data) -> int
+		{
+			return (*(typename std::remove_reference<Sink>::type*)data)(buffer, size) ? 0 : -1;
+		};
+		encoder.m_data = &sink;
+		encoder.m_flags = flags;
+		return encoder.Value(value);
+	}
+
+	// Encodes value into out, replacing its contents.
+	//
+	// @param value      Value to encode.
+	// @param out        String to write to.
+	// @param flags      Encoding flags, as for Encode().
+	// @return           True on success, false on failure.
+	template<typename T>
+	static bool ToString(const T &value, std::string &out, size_t flags = 0)
+	{
+		out.clear();
+		return Encode(value, [&out](const char *data, size_t size)
+		{
+			out.append(data, size);
+			return true;
+		}, flags);
+	}
+
+private:
+	template<typename T, typename = void>
+	struct IsBound : std::false_type {};
+	template<typename T>
+	struct IsBound<T, std::void_t<decltype(JSONExFields(std::declval<T&>(), 0))>> : std::true_type {};
+
+	template<typename T>
+	struct IsVector : std::false_type {};
+	template<typename T, typename A>
+	struct IsVector<std::vector<T, A>> : std::true_type {};
+
+	template<typename T>
+	struct IsOptional : std::false_type {};
+	template<typename T>
+	struct IsOptional<std::optional<T>> : std::true_type {};
+
+	template<typename T>
+	static constexpr bool Unsupported = false;
+
+	struct Decoder
+	{
+		json_reader_t *m_reader = nullptr;
+		json_error_t m_error;
+		const char *m_field = nullptr; // the member being decoded
+		bool m_mismatch = false;
+
+		bool Mismatch()
+		{
+			m_mismatch = true;
+			return false;
+		}
+
+		void PrintError()
+		{
+			if (!m_mismatch)
+				printf("[JSONStruct::Decode] Invalid JSON in line %d, column %d: %s\n", m_error.line, m_error.column, m_error.text);
+			else if (m_field)
+				printf("[JSONStruct::Decode] Unexpected value for \"%s\"\n", m_field);
+			else
+				printf("[JSONStruct::Decode] Unexpected value\n");
+		}
+
+		// Decodes the value the event started.
+		template<typename T>
+		bool Value(int event, T &value)
+		{
+			if constexpr (std::is_same_v<T, bool>)
+			{
+				if (event != JSON_EVENT_TRUE && event != JSON_EVENT_FALSE)
+					return Mismatch();
+				value = event == JSON_EVENT_TRUE;
+			}
+			else if constexpr (std::is_integral_v<T>)
+			{
+				if (event != JSON_EVENT_INTEGER)
+					return Mismatch();
+				json_int_t integer = json_reader_integer(m_reader);
+				if constexpr (std::is_signed_v<T>)
+				{
+					if (integer < (json_int_t)std::numeric_limits<T>::min() || integer > (json_int_t)std::numeric_limits<T>::max())
+						return Mismatch();
+				}
+				else if (integer < 0 || (unsigned long long)integer > (unsigned long long)std::numeric_limits<T>::max())
+					return Mismatch();
+				value = (T)integer;
+			}
+			else if constexpr (std::is_floating_point_v<T>)
+			{
+				if (event != JSON_EVENT_REAL && event != JSON_EVENT_INTEGER)
+					return Mismatch();
+				value = (T)json_reader_real(m_reader);
+			}
+			else if constexpr (std::is_same_v<T, std::string>)
+			{
+				if (event != JSON_EVENT_STRING)
+					return Mismatch();
+				size_t length;
+				const char *str = json_reader_string(m_reader, &length);
+				value.assign(str, length);
+			}
+			else if constexpr (IsOptional<T>::value)
+			{
+				if (event == JSON_EVENT_NULL)
+					value.reset();
+				else
+					return Value(event, value ? *value : value.emplace());
+			}
+			else if constexpr (IsVector<T>::value)
+			{
+				if (event != JSON_EVENT_ARRAY_START)
+					return Mismatch();
+				value.clear();
+				while ((event = json_reader_next(m_reader)) != JSON_EVENT_ARRAY_END)
+				{
+					if (event <= 0 || !Value(event, value.emplace_back()))
+						return false;
+				}
+			}
+			else if constexpr (IsBound<T>::value)
+			{
+				if (event != JSON_EVENT_OBJECT_START)
+					return Mismatch();
+				while ((event = json_reader_next(m_reader)) == JSON_EVENT_KEY)
+				{
+					size_t length;
+					const char *key = json_reader_string(m_reader, &length);
+					bool found = false, ok = true;
+
+					// the key is compared before the reader moves on to its value
+					JSONExFields(value, [&](const char *name, size_t nameLength, auto &member)
+					{
+						if (found || nameLength != length || memcmp(name, key, length) != 0)
+							return;
+						found = true;
+						m_field = name;
+						event = json_reader_next(m_reader);
+						ok = event > 0 && Value(event, member);
+					});
+
+					if (!found)
+					{
+						// unknown key
+						event = json_reader_next(m_reader);
+						ok = event > 0 && json_reader_skip(m_reader) == 0;
+					}
+					if (!ok)
+						return false;
+				}
+				if (event != JSON_EVENT_OBJECT_END)
+					return event == JSON_EVENT_ERROR ? false : Mismatch();
+			}
+			else
+				static_assert(Unsupported<T>, "JSONStruct: unsupported member type");
+			return true;
+		}
+	};
+
+	struct Encoder
+	{
+		json_dump_callback_t m_callback;
+		void *m_data;
+		size_t m_flags;
+
+		bool Write(const char *data, size_t size)
+		{
+			return m_callback(data, size, m_data) == 0;
+		}
+
+		template<typename T>
+		bool Value(const T &value)
+		{
+			if constexpr (std::is_same_v<T, bool>)
+				return value ? Write("true", 4) : Write("false", 5);
+			else if constexpr (std::is_integral_v<T>)
+				return json_dump_integer((json_int_t)value, m_callback, m_data) == 0;
+			else if constexpr (std::is_floating_point_v<T>)
+				return json_dump_real((double)value, m_callback, m_data, m_flags) == 0;
+			else if constexpr (std::is_same_v<T, std::string>)
+				return json_dump_string(value.data(), value.size(), m_callback, m_data, m_flags) == 0;
+			else if constexpr (IsOptional<T>::value)
+				return value ? Value(*value) : Write("null", 4);
+			else if constexpr (IsVector<T>::value)
+			{
+				if (!Write("[", 1))
+					return false;
+				for (size_t i = 0; i < value.size(); i++)
+				{
+					if ((i > 0 && !Write(",", 1)) || !Value(value[i]))
+						return false;
+				}
+				return Write("]", 1);
+			}
+			else if constexpr (IsBound<T>::value)
+			{
+				bool ok = Write("{", 1);
+				bool first = true;
+				// member names are identifiers, there is nothing to escape
+				JSONExFields(value, [&](const char *name, size_t length, const auto &member)
+				{
+					ok = ok && Write(first ? "\"" : ",\"", first ? 1 : 2) && Write(name, length) &&
+						Write("\":", 2) && Value(member);
+					first = false;
+				});
+				return ok && Write("}", 1);
+			}
+			else
+				static_assert(Unsupported<T>, "JSONStruct: unsupported member type");
+		}
+	};
 };
 
 } // namespace fdxx
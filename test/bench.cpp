@@ -0,0 +1,124 @@
+#include "../janssonex.hpp"
+#include <chrono>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Number formatting benchmark: dumps numeric arrays with the built-in
+// formatter and compares against the previous snprintf based path.
+
+typedef std::chrono::steady_clock Clock;
+
+void printfn(const char *format, ...);
+double Seconds(Clock::time_point start);
+fdxx::JSON *MakeReals(size_t count);
+fdxx::JSON *MakeIntegers(size_t count);
+size_t LegacyDump(fdxx::JSON *array, size_t precision);
+void Bench(const char *name, fdxx::JSON *array, size_t flags, size_t rounds);
+
+
+int main(int argc, char **argv)
+{
+	size_t count = argc > 1 ? strtoul(argv[1], NULL, 10) : 200000;
+	size_t rounds = 10;
+
+	fdxx::JSON *reals = MakeReals(count);
+	fdxx::JSON *integers = MakeIntegers(count);
+
+	Bench("real", reals, JSON_COMPACT, rounds);
+	Bench("real precision(6)", reals, JSON_COMPACT | JSON_REAL_PRECISION(6), rounds);
+	Bench("integer", integers, JSON_COMPACT, rounds);
+
+	reals->decref();
+	integers->decref();
+	printfn("--- bench end ---");
+}
+
+double Seconds(Clock::time_point start)
+{
+	return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+fdxx::JSON *MakeReals(size_t count)
+{
+	fdxx::JSON *array = fdxx::JSON::CreateArray();
+	srand(1);
+	for (size_t i = 0; i < count; i++)
+	{
+		// coordinates and telemetry-like values
+		double value = (rand() - RAND_MAX / 2) / 1000.0 + rand() / (double)RAND_MAX;
+		array->PushValue<double>(value);
+	}
+	return array;
+}
+
+fdxx::JSON *MakeIntegers(size_t count)
+{
+	fdxx::JSON *array = fdxx::JSON::CreateArray();
+	srand(2);
+	for (size_t i = 0; i < count; i++)
+		array->PushValue<json_int_t>(((json_int_t)rand() << 20) - rand());
+	return array;
+}
+
+// The formatting the dumper did before: snprintf() for every number,
+// then the ".0" and exponent fix-ups of jsonp_dtostr().
+size_t LegacyDump(fdxx::JSON *array, size_t precision)
+{
+	char buffer[32];
+	size_t total = 0;
+	size_t size = array->ArrSize();
+
+	for (size_t i = 0; i < size; i++)
+	{
+		json_t *value = (json_t*)&(*array)[i];
+		int length;
+
+		if (json_is_integer(value))
+			length = snprintf(buffer, sizeof(buffer), "%" JSON_INTEGER_FORMAT, json_integer_value(value));
+		else
+		{
+			length = snprintf(buffer, sizeof(buffer), "%.*g", precision ? (int)precision : 17, json_real_value(value));
+			if (!strchr(buffer, '.') && !strchr(buffer, 'e'))
+				length += 2;
+			if (char *exp = strchr(buffer, 'e'))
+				length -= (exp[1] == '+') + (exp[2] == '0');
+		}
+		total += length + 1;
+	}
+	return total + 1;
+}
+
+void Bench(const char *name, fdxx::JSON *array, size_t flags, size_t rounds)
+{
+	size_t bytes = 0;
+	Clock::time_point start = Clock::now();
+	for (size_t i = 0; i < rounds; i++)
+	{
+		char *str = array->ToString(flags);
+		bytes += strlen(str);
+		free(str);
+	}
+	double current = Seconds(start);
+
+	size_t legacyBytes = 0;
+	start = Clock::now();
+	for (size_t i = 0; i < rounds; i++)
+		legacyBytes += LegacyDump(array, (flags >> 11) & 0x1F);
+	double legacy = Seconds(start);
+
+	double values = (double)array->ArrSize() * rounds;
+	printfn("%-18s dump %7.1f ns/value (%5.1f MB/s), snprintf %7.1f ns/value", name,
+		current * 1e9 / values, bytes / current / 1e6, legacy * 1e9 / values);
+	(void)legacyBytes;
+}
+
+void printfn(const char *format, ...)
+{
+	va_list args;
+	va_start(args, format);
+	vprintf(format, args);
+	va_end(args);
+	printf("\n");
+}
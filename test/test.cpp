@@ -5,11 +5,52 @@
 #include <stdlib.h>
 #include <string.h>
 
+struct Player
+{
+	std::string name;
+	int score = 0;
+	std::vector<int> items;
+	std::optional<double> ratio;
+};
+JSONEX_FIELDS(Player, name, score, items, ratio)
+
+struct Team
+{
+	std::string name;
+	bool active = false;
+	std::vector<Player> players;
+};
+JSONEX_FIELDS(Team, name, active, players)
+
 void printfn(const char *format, ...);
 void PrintJson(fdxx::JSON *json, size_t flags = 0);
 void Test1(char **buffer);
 void Test2(char **buffer);
 void Test3(char **buffer);
+void Test4(char **buffer);
+void Test5(char **buffer);
+void Test6(char **buffer);
+void Test7(char **buffer);
+void Test8(char **buffer);
+void Test9(char **buffer);
+void Test10(char **buffer);
+void Test11(char **buffer);
+void Test12(char **buffer);
+void Test13(char **buffer);
+void Test14(char **buffer);
+void Test15(char **buffer);
+void Test16(char **buffer);
+void Test17(char **buffer);
+void Test18(char **buffer);
+void Test19(char **buffer);
+void Test20(char **buffer);
+void Test21(char **buffer);
+void Test22(char **buffer);
+void Test23(char **buffer);
+void Test24(char **buffer);
+void Test25(char **buffer);
+void Test26(char **buffer);
+void Test27(char **buffer);
 void IterObject(fdxx::JSON *root);
 void IterArray(fdxx::JSON *root, const char *name);
 
@@ -20,6 +61,30 @@ int main(int argc, char **argv)
 	Test1(&buffer);
 	Test2(&buffer);
 	Test3(&buffer);
+	Test4(&buffer);
+	Test5(&buffer);
+	Test6(&buffer);
+	Test7(&buffer);
+	Test8(&buffer);
+	Test9(&buffer);
+	Test10(&buffer);
+	Test11(&buffer);
+	Test12(&buffer);
+	Test13(&buffer);
+	Test14(&buffer);
+	Test15(&buffer);
+	Test16(&buffer);
+	Test17(&buffer);
+	Test18(&buffer);
+	Test19(&buffer);
+	Test20(&buffer);
+	Test21(&buffer);
+	Test22(&buffer);
+	Test23(&buffer);
+	Test24(&buffer);
+	Test25(&buffer);
+	Test26(&buffer);
+	Test27(&buffer);
 	free(buffer);
 	printfn("--- json test end ---");
 }
@@ -186,6 +251,666 @@ void Test3(char **buffer)
 	root->decref();
 }
 
+void Test4(char **buffer)
+{
+	printfn("--- Arena Test ---");
+	fdxx::Arena arena, other;
+	fdxx::JSON *kept = fdxx::JSON::CreateObject();
+	std::string overwrite = "[\"overwritten\"";
+	for (int i = 0; i < 100; i++)
+		overwrite += ", \"overwritten\"";
+	overwrite += "]";
+
+	for (int i = 0; i < 3; i++)
+	{
+		fdxx::JSON *root = fdxx::JSON::FromString(*buffer, 0, arena);
+		root->SetValue<int>("round", i);
+		printfn("round = %i, strKey = %s, used = %s", root->GetValue<int>("round"), root->GetValue<const char*>("strKey"), arena.Used() ? "yes" : "no");
+
+		// values stored into a heap container or another arena are copied
+		fdxx::JSON *doc = fdxx::JSON::FromString("{}", 0, other);
+		doc->Set("Array", &(*root)["Array"]);
+		kept->Set("Array", &(*root)["Array"]);
+		arena.Reset();
+		fdxx::JSON::FromString(overwrite.c_str(), 0, arena);
+
+		printfn("other = %s, heap = %s", (*doc)["Array"][0ul]["strArray"].GetValue<const char*>(1ul), (*kept)["Array"][0ul]["strArray"].GetValue<const char*>(0ul));
+		arena.Reset();
+		other.Reset();
+	}
+	kept->decref();
+}
+
+void Test5(char **buffer)
+{
+	printfn("--- InSitu Test ---");
+	size_t len = strlen(*buffer);
+	char *copy = (char*)malloc(len);
+	memcpy(copy, *buffer, len);
+
+	fdxx::JSON *root = fdxx::JSON::FromBufferInSitu(copy, len);
+	const char *str = root->GetValue<const char*>("strKey");
+	printfn("strKey = %s, in buffer = %i", str, str >= copy && str < copy + len);
+	PrintJson(&(*root)["Array"][0ul], JSON_COMPACT);
+
+	root->decref();
+	free(copy);
+}
+
+void Test6(char **buffer)
+{
+	printfn("--- Interned Key Test ---");
+	static const fdxx::JSON::InternedKey strKey("strKey");
+	static const fdxx::JSON::InternedKey round("round");
+	static const fdxx::JSON::Key intKey("intKey");
+
+	fdxx::JSON *root = fdxx::JSON::FromString(*buffer, JSON_INTERN_KEYS);
+	root->SetValue<int>(round, 7);
+	root->SetValue<int>(intKey, 2);
+	printfn("strKey = %s, round = %i, has = %i", root->GetValue<const char*>(strKey), root->GetValue<int>("round"), root->HasKey(round));
+	printfn("intKey = %i, null = %i", root->GetValue<int>(intKey), root->IsNull(intKey));
+	root->decref();
+
+	// keys too long to intern are kept as plain ones
+	std::string longKey(300, 'k');
+	fdxx::JSON *longRoot = fdxx::JSON::FromString(("{\"" + longKey + "\": 1}").c_str(), JSON_INTERN_KEYS);
+	printfn("interned = %d, long key = %i", json_key_intern(longKey.c_str()) != nullptr, longRoot->GetValue<int>(longKey.c_str()));
+	longRoot->decref();
+}
+
+void Test7(char **buffer)
+{
+	printfn("--- Reader Test ---");
+	fdxx::JSONReader reader;
+	reader.OpenBuffer(*buffer, strlen(*buffer));
+
+	// top-level keys, with the "Array" member built on its own
+	reader.Parse([](fdxx::JSONReader &reader, int event)
+	{
+		if (event == JSON_EVENT_KEY && reader.Depth() == 1)
+		{
+			bool array = !strcmp(reader.GetString(), "Array");
+			printfn("key = %s", reader.GetString());
+			if (reader.Next() == JSON_EVENT_ARRAY_START && array)
+			{
+				fdxx::JSON *value = reader.Value();
+				PrintJson(value, JSON_COMPACT);
+				value->decref();
+			}
+			else
+				reader.Skip();
+		}
+		return true;
+	});
+}
+
+void Test8(char **buffer)
+{
+	printfn("--- JSON Lines Test ---");
+	FILE *file = tmpfile();
+	fdxx::JSON *root = fdxx::JSON::FromString(*buffer);
+	{
+		fdxx::JSONLinesWriter writer(file);
+		writer.Write(&(*root)["Array"][0ul]);
+		writer.Write(&(*root)["Array"][1ul], JSON_INDENT(4));
+		writer.Write(&(*root)["intKey"]);
+	}
+	root->decref();
+	fputs("{\"bad\": }\n{\"cut\": 1\n[\"last\"]\n", file);
+	rewind(file);
+
+	fdxx::JSONLinesReader reader;
+	fdxx::JSON *records[8];
+	reader.OpenStream(file);
+	size_t count = reader.ReadBatch(records, 8, true);
+	printfn("records = %zu, end = %i", count, reader.IsEnd());
+	for (size_t i = 0; i < count; i++)
+	{
+		PrintJson(records[i], JSON_COMPACT | JSON_ENCODE_ANY);
+		records[i]->decref();
+	}
+	fclose(file);
+}
+
+void Test9(char **buffer)
+{
+	printfn("--- Parallel Load Test ---");
+	fdxx::JSON *root = fdxx::JSON::FromString(*buffer);
+	fdxx::JSON *array = fdxx::JSON::CreateArray();
+	for (int i = 0; i < 2000; i++)
+		array->Push(&(*root)["Array"][i % 2 ? 0ul : 1ul], true);
+	char *str = array->ToString(JSON_COMPACT);
+	root->decref();
+
+	fdxx::JSONParallelLoader loader(4);
+	fdxx::JSON *loaded = loader.LoadArray(str, strlen(str));
+	printfn("size = %zu, equal = %i", loaded->ArrSize(), json_equal(loaded, array));
+	loaded->decref();
+	array->decref();
+	free(str);
+
+	const char *documents = "{\"a\": 1}\n[2, \"3\"]\n\"four\" 5\n";
+	fdxx::JSON *loadedDocs = loader.LoadDocuments(documents, strlen(documents));
+	PrintJson(loadedDocs, JSON_COMPACT);
+	loadedDocs->decref();
+
+	// elements count against the depth limit of the whole array
+	for (int depth = JSON_PARSER_MAX_DEPTH; depth <= JSON_PARSER_MAX_DEPTH + 1; depth++)
+	{
+		std::string nested = "[1, " + std::string(depth - 1, '[') + std::string(depth - 1, ']') + "]";
+		FILE *file = fopen("parallel_test.json", "wb");
+		fwrite(nested.data(), 1, nested.size(), file);
+		fclose(file);
+
+		fdxx::JSON *deep = loader.LoadFile("parallel_test.json");
+		printfn("depth = %d, loaded = %i", depth, deep != nullptr);
+		if (deep)
+			deep->decref();
+	}
+	remove("parallel_test.json");
+}
+
+void Test10(char **buffer)
+{
+	printfn("--- Parallel Dump Test ---");
+	fdxx::JSON *root = fdxx::JSON::FromString(*buffer);
+	fdxx::JSON *object = fdxx::JSON::CreateObject();
+	for (int i = 0; i < 1000; i++)
+	{
+		char key[16];
+		snprintf(key, sizeof(key), "key%i", i);
+		object->Set(key, &(*root)["Array"][i % 2 ? 0ul : 1ul], true);
+	}
+	root->decref();
+
+	fdxx::JSONParallelDumper dumper(4);
+	char *expected = object->ToString(JSON_INDENT(2));
+	char *str = dumper.ToString(object, JSON_INDENT(2));
+	printfn("string equal = %i", !strcmp(str, expected));
+	free(str);
+
+	FILE *file = tmpfile();
+	dumper.DumpFd(object, fileno(file), JSON_INDENT(2));
+	fseek(file, 0, SEEK_END);
+	size_t size = (size_t)ftell(file);
+	rewind(file);
+	fdxx::JSON *loaded = (fdxx::JSON*)json_loadf(file, 0, nullptr);
+	printfn("fd equal = %i, same size = %i", json_equal(loaded, object), size == strlen(expected));
+	loaded->decref();
+	fclose(file);
+	free(expected);
+	object->decref();
+}
+
+void Test11(char **buffer)
+{
+	printfn("--- Reusable Buffer Test ---");
+	fdxx::JSON *root = fdxx::JSON::FromString(*buffer);
+	std::string out;
+	root->ToString(out, JSON_COMPACT);
+	size_t capacity = out.capacity();
+	root->ToString(out, JSON_COMPACT);
+	printfn("%s", out.c_str());
+	printfn("length = %zu, same capacity = %i", out.size(), out.capacity() == capacity);
+
+	size_t bytes = 0;
+	root->Dump([&bytes](const char *data, size_t size)
+	{
+		bytes += size;
+		return true;
+	}, JSON_COMPACT);
+	printfn("sink bytes = %zu", bytes);
+	root->decref();
+}
+
+void Test12(char **buffer)
+{
+	printfn("--- Bulk Array Test ---");
+	const double reals[] = {1.5, -2.25, 3.0, 1e100};
+	const char *strings[] = {"a", "b", "c"};
+	fdxx::JSON *array = fdxx::JSON::CreateArray(reals, 4);
+	fdxx::JSON *names = fdxx::JSON::CreateArray(strings, 3);
+	array->PushValue<int>(5);
+	array->PushValue<const char*>("end");
+	PrintJson(array, JSON_COMPACT);
+	PrintJson(names, JSON_COMPACT);
+
+	const int ints[] = {1, 2, 3};
+	fdxx::JSON *numbers = fdxx::JSON::CreateArray(ints, 3);
+	numbers->SetValue<int>((size_t)1, 20);
+	json_integer_set(&(*numbers)[2], 30);
+	PrintJson(numbers, JSON_COMPACT);
+	numbers->decref();
+
+	double out[8];
+	const char *outStrings[3];
+	size_t count = array->CopyTo(out, 8);
+	size_t stringCount = names->CopyTo(outStrings, 3);
+	printfn("copied = %zu, last = %g, strings = %zu %s", count, out[count - 1], stringCount, outStrings[2]);
+	array->decref();
+	names->decref();
+}
+
+void Test13(char **buffer)
+{
+	printfn("--- Packed Array Test ---");
+	fdxx::JSON *root = fdxx::JSON::FromString("{\"reals\": [0.5, 1.25, -3.0], \"ints\": [1, 2, 3, 4]}", JSON_DECODE_PACKED);
+	fdxx::JSON &reals = (*root)["reals"];
+	fdxx::JSON &ints = (*root)["ints"];
+	printfn("reals = %zu, [1] = %g, ints = %zu, [3] = %d", reals.ArrSize(), reals.GetValue<double>(1), ints.ArrSize(), ints.GetValue<int>(3));
+	PrintJson(root, JSON_COMPACT);
+
+	// threads reading the same elements get the same nodes
+	fdxx::JSON *many = fdxx::JSON::FromString("[1, 2, 3, 4, 5, 6, 7, 8, 9, 10]", JSON_DECODE_PACKED);
+	std::vector<fdxx::JSON*> nodes[4];
+	std::vector<std::thread> threads;
+	for (int i = 0; i < 4; i++)
+		threads.emplace_back([&, i]() { for (size_t j = 0; j < many->ArrSize(); j++) nodes[i].push_back(&(*many)[j]); });
+	for (std::thread &thread : threads)
+		thread.join();
+	printfn("same nodes = %d", nodes[0] == nodes[1] && nodes[0] == nodes[2] && nodes[0] == nodes[3]);
+	many->Remove(0ul);
+	PrintJson(many, JSON_COMPACT);
+	many->decref();
+
+	ints.SetValue<int>(0ul, 10);
+	ints.PushValue<const char*>("end");
+	PrintJson(&ints, JSON_COMPACT);
+	root->decref();
+}
+
+void Test14(char **buffer)
+{
+	printfn("--- Confined JSON Test ---");
+	fdxx::JSONPtr root(fdxx::JSON::FromString("{\"list\": [\"a\", \"b\"]}", JSON_DECODE_CONFINED));
+	fdxx::JSONPtr list = fdxx::JSONPtr::Share(&(*root)["list"]);
+	fdxx::JSONPtr copy = list;
+	fdxx::JSONPtr moved = std::move(copy);
+	printfn("local = %d, refcount = %zu, moved = %d", (list->flags & JSON_NODE_LOCAL) != 0, (size_t)list->refcount, !copy && moved);
+
+	fdxx::JSONPtr value(fdxx::JSON::Create("c"));
+	list->Push(value.Release());
+	root->Publish();
+	printfn("local = %d, size = %zu", (list->flags & JSON_NODE_LOCAL) != 0, list->ArrSize());
+	PrintJson(root.Get(), JSON_COMPACT);
+
+	// values referenced elsewhere too stay atomic
+	fdxx::JSONPtr other(fdxx::JSON::FromString("{\"kept\": [1], \"shared\": [2]}"));
+	fdxx::JSONPtr shared = fdxx::JSONPtr::Share(&(*other)["shared"]);
+	bool confined = other->Confine();
+	printfn("confined = %d, kept local = %d, shared local = %d", confined, ((*other)["kept"].flags & JSON_NODE_LOCAL) != 0, (shared->flags & JSON_NODE_LOCAL) != 0);
+}
+
+void Test15(char **buffer)
+{
+	printfn("--- Template Test ---");
+	static_assert(fdxx::JSONTemplate::ValidFormat("{s:s, s:i, s:[f, f]}"));
+	static_assert(!fdxx::JSONTemplate::ValidFormat("{s:s, s:i]"));
+
+	fdxx::JSONTemplate record("{s:s, s:i, s:[f, f]}");
+	const char *name;
+	int id;
+	double x, y;
+	for (int i = 0; i < 2; i++)
+	{
+		fdxx::JSON *json = record.Pack("name", "point", "id", i, "pos", 1.5 * i, -2.0);
+		PrintJson(json, JSON_COMPACT);
+		record.Unpack(json, "name", &name, "id", &id, "pos", &x, &y);
+		printfn("name = %s, id = %d, pos = %g %g", name, id, x, y);
+		json->decref();
+	}
+}
+
+void Test16(char **buffer)
+{
+	printfn("--- Lazy JSON Test ---");
+	const char *text = "{\"status\": {\"code\": 200, \"t\\u0065xt\": \"OK\"}, \"items\": [1, [2, 3], {\"a\": 4.5}], \"skipped\": [1, 2,]}";
+	fdxx::JSONLazy doc(text, strlen(text));
+	fdxx::JSONLazy &items = doc["items"];
+	printfn("size = %zu, code = %d, text = %s", doc.Size(), doc["status"].GetValue<int>("code"), doc["status"].GetValue<const char*>("text"));
+	printfn("items = %zu, [1][0] = %d, [2].a = %g, type = %d", items.Size(), items[1].GetValue<int>(0ul), items[2].GetValue<double>("a"), (int)items[2]["a"].Type());
+	printfn("missing = %d, key = %s", doc["none"][3ul].IsValid(), doc.Key(1));
+	PrintJson(items.Get(), JSON_COMPACT);
+}
+
+void Test17(char **buffer)
+{
+	printfn("--- JSON Path Test ---");
+	fdxx::JSON *root = fdxx::JSON::FromString("{\"a/b\": {\"c\": [1, 2, 3]}, \"items\": [{\"n\": \"x\", \"price\": 5}, {\"n\": \"y\", \"price\": 12}]}");
+	printfn("pointer = %d, missing = %d", root->Find("/a~1b/c/2")->GetValue<int>(), root->Find("/a~1b/c/3") == nullptr);
+
+	fdxx::JSONPath last("$['a/b'].c[-1]"), cheap("$.items[?(@.price < 10)].n"), names("$.items[*].n");
+	printfn("last = %d", last.Get(root)->GetValue<int>());
+	cheap.Query(root, [](fdxx::JSON *value) { printfn("cheap = %s", value->GetValue<const char*>()); });
+
+	const fdxx::JSONPath *paths[] = {&names, &last};
+	fdxx::JSONPath::QueryBatch(root, paths, 2, [](size_t index, fdxx::JSON *value) {
+		char *str = value->ToString(JSON_ENCODE_ANY);
+		printfn("path %zu = %s", index, str);
+		free(str);
+		return true;
+	});
+	root->decref();
+}
+
+void Test18(char **buffer)
+{
+	printfn("--- JSON Hash Test ---");
+	fdxx::JSON *a = fdxx::JSON::FromString("{\"id\": 1, \"tags\": [\"x\", \"y\"]}");
+	fdxx::JSON *b = fdxx::JSON::FromString("{\"tags\": [\"x\", \"y\"], \"id\": 1}");
+	printfn("equal = %d, same hash = %d", a->Equal(b), a->Hash() == b->Hash());
+	(*b)["tags"].SetValue<const char*>(1ul, "z");
+	printfn("equal = %d, same hash = %d", a->Equal(b), a->Hash() == b->Hash());
+
+	fdxx::JSON *list = fdxx::JSON::FromString("[{\"tags\": [\"x\", \"y\"]}, {\"tags\": [\"x\", \"y\"]}, [\"x\", \"y\"]]");
+	fdxx::JSONHashSet pool;
+	fdxx::JSON *copy = pool.Dedup(list);
+	printfn("distinct = %zu, shared = %d", pool.Size(), &(*copy)[0ul]["tags"] == &(*copy)[2]);
+	PrintJson(copy, JSON_COMPACT);
+	copy->decref();
+	list->decref();
+	a->decref();
+	b->decref();
+}
+
+void Test19(char **buffer)
+{
+	printfn("--- Copy On Write Test ---");
+	fdxx::JSON *base = fdxx::JSON::FromString("{\"server\": {\"port\": 80, \"tls\": false}, \"routes\": [\"/a\", \"/b\"]}");
+	fdxx::JSON *config = base->Clone();
+	config->Mutable("server").SetValue("port", 8080);
+	config->FindMutable("/routes")->PushValue("/c");
+	printfn("shared = %d", &(*config)["server"]["tls"] == &(*base)["server"]["tls"]);
+	PrintJson(base, JSON_COMPACT);
+	PrintJson(config, JSON_COMPACT);
+	config->decref();
+	base->decref();
+}
+
+void Test20(char **buffer)
+{
+	printfn("--- JSON Patch Test ---");
+	fdxx::JSON *state = fdxx::JSON::FromString("{\"players\": [\"a\", \"b\"], \"round\": 1, \"map\": {\"name\": \"x\", \"size\": 64}}");
+	fdxx::JSON *next = state->Clone();
+	next->SetValue("round", 2);
+	next->Mutable("players").PushValue("c");
+	fdxx::JSON *diff = state->Diff(next);
+	fdxx::JSON *merge = state->MergeDiff(next);
+	PrintJson(diff, JSON_COMPACT);
+	PrintJson(merge, JSON_COMPACT);
+
+	fdxx::JSON *replica = state->DeepCopy();
+	bool patched = replica->Patch(diff);
+	printfn("patched = %d, equal = %d", patched, replica->Equal(next));
+	fdxx::JSON *bad = fdxx::JSON::FromString("[{\"op\": \"remove\", \"path\": \"/round\"}, {\"op\": \"remove\", \"path\": \"/none\"}]");
+	patched = replica->Patch(bad);
+	printfn("patched = %d, round = %d", patched, replica->GetValue<int>("round"));
+
+	// arena documents are changed in place, a failure restores a deep copy
+	fdxx::Arena arena;
+	std::string text;
+	state->ToString(text, JSON_COMPACT);
+	fdxx::JSON *pinned = fdxx::JSON::FromString(text.c_str(), 0, arena);
+	fdxx::JSON *nested = fdxx::JSON::FromString("[{\"op\": \"replace\", \"path\": \"/map/size\", \"value\": 32}, {\"op\": \"add\", \"path\": \"/players/-\", \"value\": \"d\"}, {\"op\": \"remove\", \"path\": \"/none\"}]");
+	patched = pinned->Patch(nested);
+	printfn("patched = %d, equal = %d", patched, pinned->Equal(state));
+	nested->decref();
+	fdxx::JSON *erase = fdxx::JSON::FromString("{\"map\": {\"size\": null}}");
+	replica->MergePatch(erase);
+	PrintJson(replica, JSON_COMPACT);
+
+	erase->decref();
+	bad->decref();
+	replica->decref();
+	merge->decref();
+	diff->decref();
+	next->decref();
+	state->decref();
+}
+
+void Test21(char **buffer)
+{
+	printfn("--- CBOR Test ---");
+	fdxx::JSON *root = fdxx::JSON::FromString("{\"id\": -70000, \"ratio\": 0.1, \"tags\": [\"a\", \"bb\"], \"ok\": true, \"none\": null}");
+	std::string cbor;
+	root->ToCBOR(cbor);
+	printfn("size = %d", (int)cbor.size());
+
+	fdxx::JSON *copy = fdxx::JSON::FromCBOR(cbor.data(), cbor.size());
+	printfn("equal = %d, ratio = %d", copy->Equal(root), copy->GetValue<double>("ratio") == 0.1);
+	PrintJson(copy, JSON_COMPACT);
+
+	size_t offset = 0;
+	fdxx::JSON *streamed = fdxx::JSON::LoadCBOR([&](void *data, size_t size) -> size_t
+	{
+		size_t n = std::min<size_t>(3, cbor.size() - offset);
+		memcpy(data, cbor.data() + offset, n);
+		offset += n;
+		return n;
+	});
+	printfn("streamed = %d", streamed->Equal(root));
+
+	fdxx::JSON *cut = fdxx::JSON::FromCBOR(cbor.data(), cbor.size() - 1);
+	printfn("cut = %d", cut == nullptr);
+
+	streamed->decref();
+	copy->decref();
+	root->decref();
+}
+
+void Test22(char **buffer)
+{
+	printfn("--- Struct Binding Test ---");
+	const char *text = "{\"name\": \"red\", \"id\": {\"skipped\": [1, 2]}, \"active\": true, \"players\": "
+		"[{\"name\": \"a\", \"score\": 10, \"items\": [1, 2]}, {\"name\": \"b\", \"score\": -3, \"ratio\": 0.5}]}";
+	Team team;
+	bool ok = fdxx::JSONStruct::Decode(text, strlen(text), team);
+	printfn("ok = %d, players = %d, ratio = %d", ok, (int)team.players.size(), team.players[1].ratio.value_or(0) == 0.5);
+
+	team.players[0].score++;
+	std::string out;
+	fdxx::JSONStruct::ToString(team, out);
+	printfn("%s", out.c_str());
+
+	Player player;
+	const char *wrong = "{\"name\": \"c\", \"score\": \"high\"}";
+	ok = fdxx::JSONStruct::Decode(wrong, strlen(wrong), player);
+	printfn("ok = %d", ok);
+}
+
+void Test23(char **buffer)
+{
+	printfn("--- Iteration Test ---");
+	fdxx::JSON *root = fdxx::JSON::FromString("{\"a\": 1, \"bc\": [true, {\"d\": null}], \"e\": [1.5, 2.5]}", 0);
+	root->Remove("a");
+
+	for (auto [key, value] : root->Items())
+		printfn("%s (%d) = %s", key.data(), (int)key.size(), json_is_array(value) ? "array" : "other");
+
+	size_t count = 0;
+	for (fdxx::JSON *element : root->Find("/bc")->Elements())
+		count += json_is_object(element);
+	double sum = 0;
+	for (fdxx::JSON *element : root->Find("/e")->Elements())
+		sum += element->GetValue<double>();
+	printfn("objects = %d, sum = %.1f", (int)count, sum);
+
+	root->Visit([](std::string_view key, size_t index, fdxx::JSON *value, size_t depth) {
+		printfn("%*s%s[%d] %d", (int)depth * 2, "", key.data() ? key.data() : "-", (int)index, json_typeof(value));
+		return key == "e" ? JSON_VISIT_SKIP : 0;
+	});
+
+	// deeper than any recursion would go
+	fdxx::JSON *deep = fdxx::JSON::CreateArray();
+	for (int i = 0; i < 100000; i++)
+	{
+		fdxx::JSON *outer = fdxx::JSON::CreateArray();
+		outer->Push(deep);
+		deep = outer;
+	}
+	size_t depth = 0;
+	deep->Visit([&](std::string_view, size_t, fdxx::JSON *, size_t d) { depth = d; return 0; }, JSON_ACYCLIC);
+	printfn("depth = %d", (int)depth);
+
+	root->decref();
+	deep->decref();
+}
+
+void Test24(char **buffer)
+{
+	printfn("--- Deep Nesting Test ---");
+	std::string text;
+	for (int i = 0; i < 1000; i++)
+		text += "[{\"k\":";
+	text += "1";
+	for (int i = 0; i < 1000; i++)
+		text += "}]";
+
+	fdxx::JSON *json = fdxx::JSON::FromString(text.c_str(), 0);
+	fdxx::JSON *copy = json->DeepCopy();
+	std::string out;
+	json->ToString(out, JSON_COMPACT);
+	printfn("equal = %d, same = %d", copy->Equal(json), out == text);
+	copy->decref();
+	json->decref();
+
+	// one level past the limit, with the scalar at the bottom
+	text.insert(0, JSON_PARSER_MAX_DEPTH - 2000, '[');
+	text.append(JSON_PARSER_MAX_DEPTH - 2000, ']');
+	printfn("too deep = %d", fdxx::JSON::FromString(text.c_str(), 0) == nullptr);
+}
+
+void Test25(char **buffer)
+{
+	printfn("--- Hash Invalidation Test ---");
+	fdxx::JSON *packed = fdxx::JSON::FromString("[1, 2]", JSON_DECODE_PACKED);
+	fdxx::JSON *other = fdxx::JSON::FromString("[99, 2]");
+	printfn("equal = %d, same hash = %d", packed->Equal(other), packed->Hash() == other->Hash());
+	json_integer_set(&(*packed)[0ul], 99);
+	printfn("equal = %d, same hash = %d", packed->Equal(other), packed->Hash() == other->Hash());
+	packed->decref();
+	other->decref();
+
+	// clones share their children, threads may hash them at the same time
+	fdxx::JSON *doc = fdxx::JSON::FromString("{\"a\": [1, 2, {\"b\": \"c\"}], \"d\": [true, null, 1.5]}");
+	fdxx::JSON *clones[2] = {doc->Clone(), doc->Clone()};
+	size_t hashes[2];
+	std::vector<std::thread> threads;
+	for (int i = 0; i < 2; i++)
+		threads.emplace_back([&, i]() { for (int j = 0; j < 100; j++) hashes[i] = clones[i]->Hash(); });
+	for (std::thread &thread : threads)
+		thread.join();
+	printfn("clones same hash = %d", hashes[0] == doc->Hash() && hashes[1] == doc->Hash());
+	clones[0]->Mutable("a").SetValue(0ul, 5);
+	printfn("changed clone same hash = %d, original same hash = %d", clones[0]->Hash() == doc->Hash(), clones[1]->Hash() == doc->Hash());
+	clones[0]->decref();
+	clones[1]->decref();
+	doc->decref();
+
+	// a container holding itself, and chains deeper than the parser allows
+	fdxx::JSON *cyclic = fdxx::JSON::CreateArray();
+	cyclic->Push(cyclic, true);
+	printfn("cyclic hash = %d", cyclic->Hash() != 0);
+	json_array_clear(cyclic);
+	cyclic->decref();
+
+	fdxx::JSON *deep[2];
+	for (int i = 0; i < 2; i++)
+	{
+		deep[i] = fdxx::JSON::CreateArray();
+		for (int j = 0; j < 100000; j++)
+		{
+			fdxx::JSON *parent = fdxx::JSON::CreateArray();
+			parent->Push(deep[i]);
+			deep[i] = parent;
+		}
+	}
+	printfn("deep same hash = %d", deep[0]->Hash() == deep[1]->Hash());
+	deep[0]->decref();
+	deep[1]->decref();
+}
+
+void Test26(char **buffer)
+{
+	printfn("--- Small Values Test ---");
+	// 15 bytes are stored with the node, 16 are not
+	fdxx::JSON *strings = fdxx::JSON::FromString("[\"123456789012345\", \"1234567890123456\"]");
+	fdxx::JSON *inlined = &(*strings)[0ul], *separate = &(*strings)[1];
+	printfn("lengths = %zu %zu", json_string_length(inlined), json_string_length(separate));
+	json_string_set(inlined, "a longer string than fits");
+	json_string_set(separate, "short");
+	printfn("%s, %s", inlined->GetValue<const char*>(), separate->GetValue<const char*>());
+	fdxx::JSON *created = fdxx::JSON::Create("1234567890123456");
+	json_string_set(&(*strings)[0ul], "1234567890123456");
+	printfn("equal = %d", created->Equal(&(*strings)[0ul]));
+	created->decref();
+	strings->decref();
+
+	// values in range come from static tables, the same in every document
+	const char *text = "[-129, -128, 1023, 1024, \"\", \"a\", \"ab\"]";
+	fdxx::JSON *a = fdxx::JSON::FromString(text, JSON_DECODE_SHARED);
+	fdxx::JSON *b = fdxx::JSON::FromString(text, JSON_DECODE_SHARED);
+	std::string shared;
+	for (size_t i = 0; i < a->ArrSize(); i++)
+		shared += &(*a)[i] == &(*b)[i] ? '1' : '0';
+	printfn("shared = %s", shared.c_str());
+
+	// and can't be changed
+	printfn("set = %d %d %d %d", json_integer_set(&(*a)[1], 5), json_string_set(&(*a)[5], "b"), json_integer_set(&(*a)[0ul], 5), json_string_set(&(*a)[6], "b"));
+	PrintJson(a, JSON_COMPACT);
+	PrintJson(b, JSON_COMPACT);
+	a->decref();
+	b->decref();
+}
+
+void Test27(char **buffer)
+{
+	printfn("--- Object Order Test ---");
+	// keys that share length, first and last byte in a table small enough to have no index
+	fdxx::JSON *small = fdxx::JSON::FromString("{\"axb\": 1, \"ayb\": 2, \"azb\": 3}");
+	small->Remove("ayb");
+	small->SetValue("ayb", 4);
+	small->SetValue("axb", 5);
+	printfn("axb = %d, ayb = %d, azb = %d", small->GetValue<int>("axb"), small->GetValue<int>("ayb"), small->GetValue<int>("azb"));
+	PrintJson(small, JSON_COMPACT);
+	small->decref();
+
+	// members stay in insertion order through growth, removals and compaction
+	fdxx::JSON *large = fdxx::JSON::CreateObject();
+	char key[16];
+	for (int i = 0; i < 1000; i++)
+	{
+		snprintf(key, sizeof(key), "k%d", i);
+		large->SetValue(key, i);
+	}
+	for (int i = 0; i < 1000; i++)
+	{
+		snprintf(key, sizeof(key), "k%d", i);
+		if (i % 3)
+			large->Remove(key);
+	}
+	large->SetValue("k1", -1);
+	large->SetValue("k0", -2);
+	for (int i = 1000; i < 1400; i++)
+	{
+		snprintf(key, sizeof(key), "k%d", i);
+		large->SetValue(key, i);
+	}
+
+	std::string order, expected;
+	for (auto [key, value] : large->Items())
+		order.append(key).append(",");
+	for (int i = 0; i < 1000; i += 3)
+		expected.append("k").append(std::to_string(i)).append(",");
+	expected += "k1,";
+	for (int i = 1000; i < 1400; i++)
+		expected.append("k").append(std::to_string(i)).append(",");
+	bool ordered = order == expected;
+	printfn("size = %zu, ordered = %d, k0 = %d, k1 = %d, k999 = %d, k1399 = %d, k2 = %d", large->ObjSize(), ordered,
+		large->GetValue<int>("k0"), large->GetValue<int>("k1"), large->GetValue<int>("k999"), large->GetValue<int>("k1399"), large->HasKey("k2"));
+	large->decref();
+}
+
 void PrintJson(fdxx::JSON *json, size_t flags)
 {
 	char *str = json->ToString(flags);
@@ -14,6 +14,7 @@ target("test")
 	add_includedirs("../jansson")
 	add_files("test.cpp")
 	add_defines("HAVE_CONFIG_H")
+	add_syslinks("pthread")
 	add_cxflags("-O3", "-g3", "-Wno-undefined-bool-conversion")
 
 